@@ -21,6 +21,8 @@
 #include "parse-options.h"
 #include "utf8.h"
 #include "userdiff.h"
+#include "notes-cache.h"
+#include "refs.h"
 
 static char blame_usage[] = "git blame [options] [rev-opts] [rev] [--] file";
 
@@ -40,6 +42,7 @@ static int show_root;
 static int reverse;
 static int blank_boundary;
 static int incremental;
+static int use_blame_cache;
 static int xdl_opts;
 static int abbrev = -1;
 
@@ -1167,7 +1170,7 @@ static void pass_whole_blame(struct scoreboard *sb,
 		origin->file.ptr = NULL;
 	}
 	for (e = sb->ent; e; e = e->next) {
-		if (!same_suspect(e->suspect, origin))
+		if (e->guilty || !same_suspect(e->suspect, origin))
 			continue;
 		origin_incref(porigin);
 		origin_decref(e->suspect);
@@ -1536,6 +1539,284 @@ static void found_guilty_entry(struct blame_entry *ent)
 	}
 }
 
+/*
+ * The blame cache ("refs/notes/blame-cache") remembers, for a path in
+ * a commit, the result of blaming the whole file, as a note attached
+ * to a name made from the commit, the diff options and the path.  When
+ * the lines of a later commit are traced back to a commit and path
+ * found there, they are blamed from the cache without digging any
+ * further, so that blaming a file again after a few more commits only
+ * has to look at those.
+ *
+ * Each note lists the blame entries in order, every one as
+ * "<lno> <num_lines> <s_lno> <commit> <previous commit or ->"
+ * followed by a space, the NUL-terminated path and the NUL-terminated
+ * previous path.
+ */
+static struct notes_cache *blame_cache;
+
+struct cached_blame {
+	int lno, num_lines, s_lno;
+	struct origin *suspect;
+};
+
+static int blame_cache_path_ok(struct scoreboard *sb, const char *path)
+{
+	struct userdiff_driver *driver;
+
+	/* what a textconv filter makes of the blob can change */
+	if (!DIFF_OPT_TST(&sb->revs->diffopt, ALLOW_TEXTCONV))
+		return 1;
+	driver = userdiff_find_by_path(path);
+	return !driver || !driver->textconv;
+}
+
+static void blame_cache_key(struct commit *commit, const char *path,
+			    unsigned char *sha1)
+{
+	struct strbuf key = STRBUF_INIT;
+
+	strbuf_addf(&key, "blame %s %d %s",
+		    sha1_to_hex(commit->object.sha1), xdl_opts, path);
+	hash_sha1_file(key.buf, key.len, "blob", sha1);
+	strbuf_release(&key);
+}
+
+static struct origin *cached_origin(struct scoreboard *sb,
+				    const char *hex, const char *path)
+{
+	unsigned char sha1[20];
+	struct commit *commit;
+
+	if (get_sha1_hex(hex, sha1))
+		return NULL;
+	commit = lookup_commit(sha1);
+	if (!commit || parse_commit(commit))
+		return NULL;
+	/* treat root commit as boundary, as assign_blame() does */
+	if (!commit->parents && !show_root)
+		commit->object.flags |= UNINTERESTING;
+	return get_origin(sb, commit, path);
+}
+
+static int parse_cached_blame(struct scoreboard *sb, const char *buf,
+			      size_t size, struct cached_blame **list_p)
+{
+	const char *end = buf + size;
+	struct cached_blame *list = NULL;
+	int nr = 0, alloc = 0, next_lno = 0;
+
+	while (buf < end) {
+		struct cached_blame *c;
+		const char *hex, *prev, *path, *prev_path, *next;
+		char *ep;
+
+		ALLOC_GROW(list, nr + 1, alloc);
+		c = &list[nr];
+		c->lno = strtol(buf, &ep, 10);
+		c->num_lines = strtol(ep, &ep, 10);
+		c->s_lno = strtol(ep, &ep, 10);
+		hex = ep + 1;
+		prev = hex + 41;
+		if (end - hex < 43 || c->lno != next_lno ||
+		    c->num_lines <= 0 || c->s_lno < 0 ||
+		    *ep != ' ' || hex[40] != ' ')
+			break;
+		path = *prev == '-' ? prev + 2 : prev + 41;
+		if (path >= end || path[-1] != ' ')
+			break;
+		prev_path = memchr(path, '\0', end - path);
+		if (!prev_path || prev_path + 1 >= end)
+			break;
+		prev_path++;
+		next = memchr(prev_path, '\0', end - prev_path);
+		if (!next)
+			break;
+
+		c->suspect = cached_origin(sb, hex, path);
+		if (!c->suspect)
+			break;
+		nr++;
+		if (*prev != '-' && !c->suspect->previous) {
+			c->suspect->previous = cached_origin(sb, prev, prev_path);
+			if (!c->suspect->previous)
+				break;
+		}
+		next_lno = c->lno + c->num_lines;
+		buf = next + 1;
+	}
+	*list_p = list;
+	if (buf < end) {
+		while (nr)
+			origin_decref(list[--nr].suspect);
+		return -1;
+	}
+	return nr;
+}
+
+/*
+ * Replace the entries "suspect" is suspected for with the parts of
+ * them blamed on the commits the cached entries "list" point at.
+ */
+static void split_from_cache(struct scoreboard *sb, struct origin *suspect,
+			     struct cached_blame *list, int nr)
+{
+	struct blame_entry *e, *next;
+	int i;
+
+	for (e = sb->ent; e; e = next) {
+		struct blame_entry orig, *last = NULL;
+
+		next = e->next;
+		if (e->guilty || !same_suspect(e->suspect, suspect))
+			continue;
+		orig = *e;
+		for (i = 0; i < nr; i++) {
+			struct cached_blame *c = &list[i];
+			struct blame_entry *n;
+			int from, to;
+
+			from = c->lno < orig.s_lno ? orig.s_lno : c->lno;
+			to = c->lno + c->num_lines;
+			if (orig.s_lno + orig.num_lines < to)
+				to = orig.s_lno + orig.num_lines;
+			if (to <= from)
+				continue;
+
+			if (!last) {
+				n = e;
+			} else {
+				n = xcalloc(1, sizeof(*n));
+				n->prev = last;
+				n->next = last->next;
+				last->next = n;
+				if (n->next)
+					n->next->prev = n;
+			}
+			n->lno = orig.lno + from - orig.s_lno;
+			n->num_lines = to - from;
+			n->s_lno = c->s_lno + from - c->lno;
+			n->suspect = origin_incref(c->suspect);
+			n->score = 0;
+			found_guilty_entry(n);
+			last = n;
+		}
+		if (last)
+			origin_decref(orig.suspect);
+	}
+}
+
+/*
+ * Blame what "suspect" is suspected for from the blame cache; returns
+ * 1 if that worked, 0 if the caller has to pass the blame itself.
+ */
+static int blame_from_cache(struct scoreboard *sb, struct origin *suspect)
+{
+	unsigned char key[20];
+	struct cached_blame *list;
+	struct blame_entry *e;
+	char *buf;
+	size_t size;
+	int nr, i, last_in_target = 0;
+
+	if (!blame_cache || is_null_sha1(suspect->commit->object.sha1) ||
+	    !blame_cache_path_ok(sb, suspect->path))
+		return 0;
+	blame_cache_key(suspect->commit, suspect->path, key);
+	buf = notes_cache_get(blame_cache, key, &size);
+	if (!buf)
+		return 0;
+	nr = parse_cached_blame(sb, buf, size, &list);
+	free(buf);
+
+	/* the cached entries must cover the lines we want */
+	for (e = sb->ent; e; e = e->next)
+		if (!e->guilty && same_suspect(e->suspect, suspect) &&
+		    last_in_target < e->s_lno + e->num_lines)
+			last_in_target = e->s_lno + e->num_lines;
+	if (nr <= 0 ||
+	    list[nr - 1].lno + list[nr - 1].num_lines < last_in_target) {
+		for (i = 0; i < nr; i++)
+			origin_decref(list[i].suspect);
+		free(list);
+		return 0;
+	}
+
+	split_from_cache(sb, suspect, list, nr);
+	for (i = 0; i < nr; i++)
+		origin_decref(list[i].suspect);
+	free(list);
+	return 1;
+}
+
+/*
+ * Remember the blame of the whole file in the final commit.
+ */
+static void cache_blame(struct scoreboard *sb)
+{
+	struct blame_entry *e;
+	struct origin *o;
+	unsigned char key[20];
+	struct strbuf buf = STRBUF_INIT;
+
+	if (!blame_cache || !blame_cache_path_ok(sb, sb->path))
+		return;
+	for (e = sb->ent; e; e = e->next) {
+		o = e->suspect;
+		strbuf_addf(&buf, "%d %d %d %s ", e->lno, e->num_lines,
+			    e->s_lno, sha1_to_hex(o->commit->object.sha1));
+		if (o->previous)
+			strbuf_addf(&buf, "%s ",
+				    sha1_to_hex(o->previous->commit->object.sha1));
+		else
+			strbuf_addstr(&buf, "- ");
+		strbuf_add(&buf, o->path, strlen(o->path) + 1);
+		if (o->previous)
+			strbuf_addstr(&buf, o->previous->path);
+		strbuf_addch(&buf, '\0');
+	}
+
+	blame_cache_key(sb->final, sb->path, key);
+	/* ignore errors, as we might be in a readonly repository */
+	notes_cache_put(blame_cache, key, buf.buf, buf.len);
+	notes_cache_write(blame_cache);
+	strbuf_release(&buf);
+}
+
+static int count_graft(const struct commit_graft *graft, void *cb_data)
+{
+	return 1;
+}
+
+static int count_replace_ref(const char *refname, const unsigned char *sha1,
+			     int flags, void *cb_data)
+{
+	return 1;
+}
+
+/*
+ * The cache only holds results of digging down to the roots with the
+ * history and the options every plain "git blame" sees.
+ */
+static void prepare_blame_cache(struct rev_info *revs, int opt)
+{
+	int i;
+
+	if (!use_blame_cache || reverse || opt || revs->max_age != -1)
+		return;
+	for (i = 0; i < revs->pending.nr; i++)
+		if (revs->pending.objects[i].item->flags & UNINTERESTING)
+			return;
+	prepare_commit_graft();
+	if (for_each_commit_graft(count_graft, NULL))
+		return;
+	if (read_replace_refs && for_each_replace_ref(count_replace_ref, NULL))
+		return;
+
+	blame_cache = xcalloc(1, sizeof(*blame_cache));
+	notes_cache_init(blame_cache, "blame-cache", "blame cache v1");
+}
+
 /*
  * The main loop -- while the scoreboard has lines whose true origin
  * is still unknown, pick one blame_entry, and allow its current
@@ -1567,9 +1848,10 @@ static void assign_blame(struct scoreboard *sb, int opt)
 			parse_commit(commit);
 		if (reverse ||
 		    (!(commit->object.flags & UNINTERESTING) &&
-		     !(revs->max_age != -1 && commit->date < revs->max_age)))
-			pass_blame(sb, suspect, opt);
-		else {
+		     !(revs->max_age != -1 && commit->date < revs->max_age))) {
+			if (!blame_from_cache(sb, suspect))
+				pass_blame(sb, suspect, opt);
+		} else {
 			commit->object.flags |= UNINTERESTING;
 			if (commit->object.parsed)
 				mark_parents_uninteresting(commit);
@@ -2043,6 +2325,10 @@ static int git_blame_config(const char *var, const char *value, void *cb)
 		blank_boundary = git_config_bool(var, value);
 		return 0;
 	}
+	if (!strcmp(var, "blame.cache")) {
+		use_blame_cache = git_config_bool(var, value);
+		return 0;
+	}
 	if (!strcmp(var, "blame.date")) {
 		if (!value)
 			return config_error_nonbool(var);
@@ -2483,6 +2769,8 @@ parse_done:
 	else if (contents_from)
 		die("Cannot use --contents with final commit object name");
 
+	prepare_blame_cache(&revs, opt);
+
 	/*
 	 * If we have bottom, this will mark the ancestors of the
 	 * bottom commits we would reach while traversing as
@@ -2551,6 +2839,11 @@ parse_done:
 
 	assign_blame(&sb, opt);
 
+	if (!bottom && top == lno && !is_null_sha1(sb.final->object.sha1)) {
+		coalesce(&sb);
+		cache_blame(&sb);
+	}
+
 	if (incremental)
 		return 0;
 
@@ -11,6 +11,7 @@
 #include "parse-options.h"
 #include "diff.h"
 #include "userdiff.h"
+#include "string-list.h"
 
 #define BATCH 1
 #define BATCH_CHECK 2
@@ -163,58 +164,110 @@ static int cat_one_file(int opt, const char *exp_type, const char *obj_name)
 	return 0;
 }
 
-static int batch_one_object(const char *obj_name, int print_contents)
+/*
+ * Objects are read in batches of the names that are available on the
+ * standard input without waiting, so that read_object_batch() can
+ * order the reads, while a caller feeding one name at a time still
+ * gets each answer before it has to send the next name.
+ */
+#define BATCH_MAX 1024
+
+struct batch_input {
+	struct strbuf buf;
+	int eof;
+};
+
+static int input_ready(int fd)
 {
-	unsigned char sha1[20];
-	enum object_type type = 0;
-	unsigned long size;
-	void *contents = contents;
+	struct pollfd pfd;
 
-	if (!obj_name)
-	   return 1;
+	pfd.fd = fd;
+	pfd.events = POLLIN;
+	return poll(&pfd, 1, 0) > 0;
+}
 
-	if (get_sha1(obj_name, sha1)) {
-		printf("%s missing\n", obj_name);
-		fflush(stdout);
-		return 0;
+static void read_batch_names(struct batch_input *in, struct string_list *names)
+{
+	while (!in->eof &&
+	       (!names->nr || (names->nr < BATCH_MAX && input_ready(0)))) {
+		char *line, *eol;
+		ssize_t n;
+
+		strbuf_grow(&in->buf, 8192);
+		n = xread(0, in->buf.buf + in->buf.len, 8192);
+		if (n < 0)
+			die_errno("unable to read from standard input");
+		if (!n) {
+			in->eof = 1;
+			if (in->buf.len)
+				string_list_append(names, in->buf.buf);
+			strbuf_reset(&in->buf);
+			break;
+		}
+		strbuf_setlen(&in->buf, in->buf.len + n);
+
+		line = in->buf.buf;
+		while ((eol = memchr(line, '\n', in->buf.buf + in->buf.len - line))) {
+			*eol = '\0';
+			string_list_append(names, line);
+			line = eol + 1;
+		}
+		strbuf_remove(&in->buf, 0, line - in->buf.buf);
 	}
+}
 
-	if (print_contents == BATCH)
-		contents = read_sha1_file(sha1, &type, &size);
-	else
-		type = sha1_object_info(sha1, &size);
+static void batch_object_names(struct string_list *names, int print_contents)
+{
+	struct object_read_request *req;
+	int i, nr = 0;
 
-	if (type <= 0) {
-		printf("%s missing\n", obj_name);
-		fflush(stdout);
-		if (print_contents == BATCH)
-			free(contents);
-		return 0;
+	req = xcalloc(names->nr, sizeof(*req));
+	for (i = 0; i < names->nr; i++) {
+		if (get_sha1(names->items[i].string, req[nr].sha1))
+			continue;
+		names->items[i].util = &req[nr++];
 	}
+	read_object_batch(req, nr, print_contents == BATCH);
 
-	printf("%s %s %lu\n", sha1_to_hex(sha1), typename(type), size);
-	fflush(stdout);
+	for (i = 0; i < names->nr; i++) {
+		struct object_read_request *r = names->items[i].util;
 
-	if (print_contents == BATCH) {
-		write_or_die(1, contents, size);
-		printf("\n");
-		fflush(stdout);
-		free(contents);
-	}
+		if (r && r->type > 0 && print_contents == BATCH && !r->buf) {
+			r->buf = read_sha1_file(r->sha1, &r->type, &r->size);
+			if (!r->buf)
+				r->type = OBJ_BAD;
+		}
+		if (!r || r->type <= 0) {
+			printf("%s missing\n", names->items[i].string);
+			continue;
+		}
 
-	return 0;
+		printf("%s %s %lu\n", sha1_to_hex(r->sha1), typename(r->type),
+		       r->size);
+		if (print_contents == BATCH) {
+			fwrite(r->buf, 1, r->size, stdout);
+			putchar('\n');
+			free(r->buf);
+		}
+	}
+	if (fflush(stdout))
+		die_errno("unable to write to standard output");
+	free(req);
 }
 
 static int batch_objects(int print_contents)
 {
-	struct strbuf buf = STRBUF_INIT;
+	struct batch_input in = { STRBUF_INIT, 0 };
+	struct string_list names = STRING_LIST_INIT_DUP;
 
-	while (strbuf_getline(&buf, stdin, '\n') != EOF) {
-		int error = batch_one_object(buf.buf, print_contents);
-		if (error)
-			return error;
+	for (;;) {
+		read_batch_names(&in, &names);
+		if (!names.nr)
+			break;
+		batch_object_names(&names, print_contents);
+		string_list_clear(&names, 0);
 	}
-
+	strbuf_release(&in.buf);
 	return 0;
 }
 
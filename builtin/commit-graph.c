@@ -0,0 +1,30 @@
+#include "builtin.h"
+#include "cache.h"
+#include "commit.h"
+#include "commit-graph.h"
+#include "parse-options.h"
+
+static const char * const commit_graph_usage[] = {
+	"git commit-graph write",
+	"git commit-graph verify",
+	NULL
+};
+
+int cmd_commit_graph(int argc, const char **argv, const char *prefix)
+{
+	const struct option options[] = {
+		OPT_END()
+	};
+
+	git_config(git_default_config, NULL);
+	argc = parse_options(argc, argv, prefix, options,
+			     commit_graph_usage, 0);
+	if (argc != 1)
+		usage_with_options(commit_graph_usage, options);
+
+	if (!strcmp(argv[0], "write"))
+		return !!write_commit_graph();
+	if (!strcmp(argv[0], "verify"))
+		return !!verify_commit_graph();
+	usage_with_options(commit_graph_usage, options);
+}
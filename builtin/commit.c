@@ -995,8 +995,10 @@ static const char *read_commit_message(const char *name)
 	 * This also handles the case where input and output
 	 * encodings are identical.
 	 */
-	if (out == NULL)
+	if (out == NULL) {
+		load_commit_buffer(commit);
 		out = xstrdup(commit->buffer);
+	}
 	return out;
 }
 
@@ -1225,13 +1227,15 @@ int cmd_status(int argc, const char **argv, const char *prefix)
 	refresh_index(&the_index, REFRESH_QUIET|REFRESH_UNMERGED, s.pathspec, NULL, NULL);
 
 	fd = hold_locked_index(&index_lock, 0);
-	if (0 <= fd)
-		update_index_if_able(&the_index, &index_lock);
 
 	s.is_initial = get_sha1(s.reference, sha1) ? 1 : 0;
 	s.ignore_submodule_arg = ignore_submodule_arg;
 	wt_status_collect(&s);
 
+	/* after collecting, so that an updated untracked cache is saved */
+	if (0 <= fd)
+		update_index_if_able(&the_index, &index_lock);
+
 	if (s.relative_paths)
 		s.prefix = prefix;
 
@@ -604,6 +604,8 @@ int cmd_fsck(int argc, const char **argv, const char *prefix)
 
 	errors_found = 0;
 	read_replace_refs = 0;
+	/* look at the commit objects themselves, not at the commit-graph */
+	core_commit_graph = 0;
 
 	argc = parse_options(argc, argv, prefix, fsck_opts, fsck_usage, 0);
 	if (write_lost_and_found) {
@@ -627,6 +629,7 @@ int cmd_fsck(int argc, const char **argv, const char *prefix)
 		struct packed_git *p;
 
 		prepare_packed_git();
+		reserve_object_hash(approximate_object_count());
 		for (p = packed_git; p; p = p->next)
 			/* verify gives error messages itself */
 			verify_pack(p);
@@ -0,0 +1,27 @@
+#include "builtin.h"
+#include "cache.h"
+#include "grep-index.h"
+#include "parse-options.h"
+
+static const char * const grep_index_usage[] = {
+	"git grep-index write [--full]",
+	NULL
+};
+
+int cmd_grep_index(int argc, const char **argv, const char *prefix)
+{
+	int full = 0;
+	const struct option options[] = {
+		OPT_BOOLEAN(0, "full", &full,
+			    "rewrite the index, dropping blobs that are gone"),
+		OPT_END()
+	};
+
+	git_config(git_default_config, NULL);
+	argc = parse_options(argc, argv, prefix, options,
+			     grep_index_usage, 0);
+	if (argc != 1 || strcmp(argv[0], "write"))
+		usage_with_options(grep_index_usage, options);
+
+	return !!write_grep_index(full);
+}
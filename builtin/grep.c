@@ -15,6 +15,7 @@
 #include "run-command.h"
 #include "userdiff.h"
 #include "grep.h"
+#include "grep-index.h"
 #include "quote.h"
 #include "dir.h"
 #include "thread-utils.h"
@@ -26,9 +27,14 @@ static char const * const grep_usage[] = {
 
 static int use_threads = 1;
 
+/* Skip blobs the grep index shows cannot match. */
+static int use_grep_index = 1;
+
+/* Number of consumer threads; 0 means one per online cpu. */
+static int num_threads;
+
 #ifndef NO_PTHREADS
-#define THREADS 8
-static pthread_t threads[THREADS];
+static pthread_t *threads;
 
 static void *load_sha1(const unsigned char *sha1, unsigned long *size,
 		       const char *name);
@@ -36,7 +42,7 @@ static void *load_file(const char *filename, size_t *sz);
 
 enum work_type {WORK_SHA1, WORK_FILE};
 
-/* We use one producer thread and THREADS consumer
+/* We use one producer thread and num_threads consumer
  * threads. The producer adds struct work_items to 'todo' and the
  * consumers pick work items from the same array.
  */
@@ -60,10 +66,16 @@ struct work_item {
  * The work_items in [todo_start, todo_end) are waiting to be picked
  * up by a consumer thread.
  *
- * The ranges are modulo TODO_SIZE.
+ * Items are written out in the order they were added, however long
+ * each takes, so there must be room in 'todo' for every thread to be
+ * busy while the output waits for a slow item; hence its size grows
+ * with the number of threads.
+ *
+ * The ranges are modulo todo_size.
  */
-#define TODO_SIZE 128
-static struct work_item todo[TODO_SIZE];
+#define TODO_PER_THREAD 16
+static struct work_item *todo;
+static int todo_size;
 static int todo_start;
 static int todo_end;
 static int todo_done;
@@ -74,7 +86,11 @@ static int all_work_added;
 /* This lock protects all the variables above. */
 static pthread_mutex_t grep_mutex;
 
-/* Used to serialize calls to read_sha1_file. */
+/*
+ * Used to serialize calls into the object store; only
+ * prepare_object_read() needs it, and the objects are inflated
+ * without it.
+ */
 static pthread_mutex_t read_sha1_mutex;
 
 #define grep_lock() pthread_mutex_lock(&grep_mutex)
@@ -99,7 +115,7 @@ static void add_work(enum work_type type, char *name, void *id)
 {
 	grep_lock();
 
-	while ((todo_end+1) % ARRAY_SIZE(todo) == todo_done) {
+	while ((todo_end+1) % todo_size == todo_done) {
 		pthread_cond_wait(&cond_write, &grep_mutex);
 	}
 
@@ -108,7 +124,7 @@ static void add_work(enum work_type type, char *name, void *id)
 	todo[todo_end].identifier = id;
 	todo[todo_end].done = 0;
 	strbuf_reset(&todo[todo_end].out);
-	todo_end = (todo_end + 1) % ARRAY_SIZE(todo);
+	todo_end = (todo_end + 1) % todo_size;
 
 	pthread_cond_signal(&cond_add);
 	grep_unlock();
@@ -127,7 +143,7 @@ static struct work_item *get_work(void)
 		ret = NULL;
 	} else {
 		ret = &todo[todo_start];
-		todo_start = (todo_start + 1) % ARRAY_SIZE(todo);
+		todo_start = (todo_start + 1) % todo_size;
 	}
 	grep_unlock();
 	return ret;
@@ -156,7 +172,7 @@ static void work_done(struct work_item *w)
 	w->done = 1;
 	old_done = todo_done;
 	for(; todo[todo_done].done && todo_done != todo_start;
-	    todo_done = (todo_done+1) % ARRAY_SIZE(todo)) {
+	    todo_done = (todo_done+1) % todo_size) {
 		w = &todo[todo_done];
 		if (w->out.len) {
 			const char *p = w->out.buf;
@@ -241,11 +257,16 @@ static void start_threads(struct grep_opt *opt)
 	pthread_cond_init(&cond_write, NULL);
 	pthread_cond_init(&cond_result, NULL);
 
-	for (i = 0; i < ARRAY_SIZE(todo); i++) {
+	todo_size = num_threads * TODO_PER_THREAD;
+	if (todo_size < 128)
+		todo_size = 128;
+	todo = xcalloc(todo_size, sizeof(*todo));
+	for (i = 0; i < todo_size; i++) {
 		strbuf_init(&todo[i].out, 0);
 	}
 
-	for (i = 0; i < ARRAY_SIZE(threads); i++) {
+	threads = xcalloc(num_threads, sizeof(*threads));
+	for (i = 0; i < num_threads; i++) {
 		int err;
 		struct grep_opt *o = grep_opt_dup(opt);
 		o->output = strbuf_out;
@@ -276,11 +297,15 @@ static int wait_all(void)
 	pthread_cond_broadcast(&cond_add);
 	grep_unlock();
 
-	for (i = 0; i < ARRAY_SIZE(threads); i++) {
+	for (i = 0; i < num_threads; i++) {
 		void *h;
 		pthread_join(threads[i], &h);
 		hit |= (int) (intptr_t) h;
 	}
+	free(threads);
+	for (i = 0; i < todo_size; i++)
+		strbuf_release(&todo[i].out);
+	free(todo);
 
 	pthread_mutex_destroy(&grep_mutex);
 	pthread_mutex_destroy(&read_sha1_mutex);
@@ -324,6 +349,19 @@ static int grep_config(const char *var, const char *value, void *cb)
 		return 0;
 	}
 
+	if (!strcmp(var, "grep.useindex")) {
+		use_grep_index = git_config_bool(var, value);
+		return 0;
+	}
+
+	if (!strcmp(var, "grep.threads")) {
+		num_threads = git_config_int(var, value);
+		if (num_threads < 0)
+			die(_("invalid number of threads specified (%d) for %s"),
+			    num_threads, var);
+		return 0;
+	}
+
 	if (!strcmp(var, "color.grep"))
 		opt->color = git_config_colorbool(var, value);
 	else if (!strcmp(var, "color.grep.context"))
@@ -368,7 +406,22 @@ static void *load_sha1(const unsigned char *sha1, unsigned long *size,
 		       const char *name)
 {
 	enum object_type type;
-	void *data = lock_and_read_sha1_file(sha1, &type, size);
+	void *data;
+
+	if (use_threads) {
+		struct prepared_object po;
+		int ret;
+
+		read_sha1_lock();
+		ret = prepare_object_read(sha1, &po);
+		read_sha1_unlock();
+		data = ret ? NULL : finish_object_read(&po, &type, size);
+		/* let read_sha1_file() diagnose a corrupt object */
+		if (!ret && !data)
+			data = lock_and_read_sha1_file(sha1, &type, size);
+	} else {
+		data = read_sha1_file(sha1, &type, size);
+	}
 
 	if (!data)
 		error(_("'%s': unable to read %s"), name, sha1_to_hex(sha1));
@@ -382,6 +435,9 @@ static int grep_sha1(struct grep_opt *opt, const unsigned char *sha1,
 	struct strbuf pathbuf = STRBUF_INIT;
 	char *name;
 
+	if (use_grep_index && !grep_index_may_match(sha1))
+		return 0;
+
 	if (opt->relative && opt->prefix_length) {
 		quote_path_relative(filename + tree_name_len, -1, &pathbuf,
 				    opt->prefix);
@@ -865,6 +921,8 @@ int cmd_grep(int argc, const char **argv, const char *prefix)
 		{ OPTION_STRING, 'O', "open-files-in-pager", &show_in_pager,
 			"pager", "show matching files in the pager",
 			PARSE_OPT_OPTARG, NULL, (intptr_t)default_pager },
+		OPT_INTEGER(0, "threads", &num_threads,
+			"use <n> worker threads"),
 		OPT_BOOLEAN(0, "ext-grep", &external_grep_allowed__ignored,
 			    "allow calling of grep(1) (ignored by this build)"),
 		{ OPTION_CALLBACK, 0, "help-all", &options, NULL, "show usage",
@@ -970,13 +1028,18 @@ int cmd_grep(int argc, const char **argv, const char *prefix)
 		use_threads = 0;
 	}
 
+	if (num_threads < 0)
+		die(_("invalid number of threads specified (%d)"), num_threads);
+
 	if (!opt.pattern_list)
 		die(_("no pattern given."));
 	if (!opt.fixed && opt.ignore_case)
 		opt.regflags |= REG_ICASE;
 
 #ifndef NO_PTHREADS
-	if (online_cpus() == 1 || !grep_threads_ok(&opt))
+	if (!num_threads)
+		num_threads = online_cpus();
+	if (num_threads == 1 || !grep_threads_ok(&opt))
 		use_threads = 0;
 
 	if (use_threads) {
@@ -1045,6 +1108,8 @@ int cmd_grep(int argc, const char **argv, const char *prefix)
 	if (!show_in_pager)
 		setup_pager();
 
+	if (use_grep_index)
+		use_grep_index = (cached || list.nr) && prepare_grep_index(&opt);
 
 	if (!use_index) {
 		if (cached)
@@ -9,9 +9,10 @@
 #include "progress.h"
 #include "fsck.h"
 #include "exec_cmd.h"
+#include "thread-utils.h"
 
 static const char index_pack_usage[] =
-"git index-pack [-v] [-o <index-file>] [--keep | --keep=<msg>] [--verify] [--strict] (<pack-file> | --stdin [--fix-thin] [<pack-file>])";
+"git index-pack [-v] [-o <index-file>] [--keep | --keep=<msg>] [--verify] [--strict] [--threads=<n>] (<pack-file> | --stdin [--fix-thin] [<pack-file>])";
 
 struct object_entry {
 	struct pack_idx_entry idx;
@@ -19,6 +20,7 @@ struct object_entry {
 	unsigned int hdr_size;
 	enum object_type type;
 	enum object_type real_type;
+	unsigned long real_size;
 	unsigned delta_depth;
 	int base_object_no;
 };
@@ -36,6 +38,19 @@ struct base_data {
 	unsigned long size;
 };
 
+/*
+ * Each thread resolving deltas keeps its own chain of base objects,
+ * and its own account of how much of delta_base_cache_limit that
+ * chain uses.
+ */
+struct thread_local {
+#ifndef NO_PTHREADS
+	pthread_t thread;
+#endif
+	struct base_data *base_cache;
+	size_t base_cache_used;
+};
+
 /*
  * Even if sizeof(union delta_base) == 24 on 64-bit archs, we really want
  * to memcmp() only the first 20 bytes.
@@ -52,15 +67,17 @@ struct delta_entry {
 
 static struct object_entry *objects;
 static struct delta_entry *deltas;
-static struct base_data *base_cache;
-static size_t base_cache_used;
+static struct thread_local nothread_data;
 static int nr_objects;
 static int nr_deltas;
 static int nr_resolved_deltas;
+static int nr_threads;
 
 static int from_stdin;
 static int strict;
 static int verbose;
+static int write_sizes;
+static int write_rev;
 
 static struct progress *progress;
 
@@ -73,6 +90,87 @@ static git_SHA_CTX input_ctx;
 static uint32_t input_crc32;
 static int input_fd, output_fd, pack_fd;
 
+#ifndef NO_PTHREADS
+
+static struct thread_local *thread_data;
+static int nr_dispatched;
+static int threads_active;
+
+static pthread_mutex_t read_mutex;
+#define read_lock()		lock_mutex(&read_mutex)
+#define read_unlock()		unlock_mutex(&read_mutex)
+
+static pthread_mutex_t counter_mutex;
+#define counter_lock()		lock_mutex(&counter_mutex)
+#define counter_unlock()	unlock_mutex(&counter_mutex)
+
+static pthread_mutex_t work_mutex;
+#define work_lock()		lock_mutex(&work_mutex)
+#define work_unlock()		unlock_mutex(&work_mutex)
+
+static pthread_key_t key;
+
+static inline void lock_mutex(pthread_mutex_t *mutex)
+{
+	if (threads_active)
+		pthread_mutex_lock(mutex);
+}
+
+static inline void unlock_mutex(pthread_mutex_t *mutex)
+{
+	if (threads_active)
+		pthread_mutex_unlock(mutex);
+}
+
+static void try_to_free_from_threads(size_t size)
+{
+	read_lock();
+	release_pack_memory(size, -1);
+	read_unlock();
+}
+
+static try_to_free_t old_try_to_free_routine;
+
+/*
+ * Mutex and conditional variable can't be statically-initialized on Windows.
+ */
+static void init_thread(void)
+{
+	init_recursive_mutex(&read_mutex);
+	pthread_mutex_init(&counter_mutex, NULL);
+	pthread_mutex_init(&work_mutex, NULL);
+	pthread_key_create(&key, NULL);
+	thread_data = xcalloc(nr_threads, sizeof(*thread_data));
+	old_try_to_free_routine = set_try_to_free_routine(try_to_free_from_threads);
+	threads_active = 1;
+}
+
+static void cleanup_thread(void)
+{
+	if (!threads_active)
+		return;
+	threads_active = 0;
+	set_try_to_free_routine(old_try_to_free_routine);
+	pthread_mutex_destroy(&read_mutex);
+	pthread_mutex_destroy(&counter_mutex);
+	pthread_mutex_destroy(&work_mutex);
+	pthread_key_delete(key);
+	free(thread_data);
+}
+
+#else
+
+#define read_lock()
+#define read_unlock()
+
+#define counter_lock()
+#define counter_unlock()
+
+#define work_lock()
+#define work_unlock()
+
+#endif
+
 static int mark_link(struct object *obj, int type, void *data)
 {
 	if (!obj)
@@ -204,6 +302,8 @@ static void parse_pack_header(void)
 			ntohl(hdr->hdr_version));
 
 	nr_objects = ntohl(hdr->hdr_entries);
+	if (strict)
+		reserve_object_hash(nr_objects);
 	use(sizeof(struct pack_header));
 }
 
@@ -221,20 +321,30 @@ static NORETURN void bad_object(unsigned long offset, const char *format, ...)
 	die("pack has bad object at offset %lu: %s", offset, buf);
 }
 
+static inline struct thread_local *get_thread_data(void)
+{
+#ifndef NO_PTHREADS
+	if (threads_active)
+		return pthread_getspecific(key);
+#endif
+	return &nothread_data;
+}
+
 static void free_base_data(struct base_data *c)
 {
 	if (c->data) {
 		free(c->data);
 		c->data = NULL;
-		base_cache_used -= c->size;
+		get_thread_data()->base_cache_used -= c->size;
 	}
 }
 
 static void prune_base_data(struct base_data *retain)
 {
+	struct thread_local *data = get_thread_data();
 	struct base_data *b;
-	for (b = base_cache;
-	     base_cache_used > delta_base_cache_limit && b;
+	for (b = data->base_cache;
+	     data->base_cache_used > delta_base_cache_limit && b;
 	     b = b->child) {
 		if (b->data && b != retain)
 			free_base_data(b);
@@ -246,12 +356,12 @@ static void link_base_data(struct base_data *base, struct base_data *c)
 	if (base)
 		base->child = c;
 	else
-		base_cache = c;
+		get_thread_data()->base_cache = c;
 
 	c->base = base;
 	c->child = NULL;
 	if (c->data)
-		base_cache_used += c->size;
+		get_thread_data()->base_cache_used += c->size;
 	prune_base_data(c);
 }
 
@@ -261,7 +371,7 @@ static void unlink_base_data(struct base_data *c)
 	if (base)
 		base->child = NULL;
 	else
-		base_cache = NULL;
+		get_thread_data()->base_cache = NULL;
 	free_base_data(c);
 }
 
@@ -450,19 +560,23 @@ static void sha1_object(const void *data, unsigned long size,
 			enum object_type type, unsigned char *sha1)
 {
 	hash_sha1_file(data, size, typename(type), sha1);
+	read_lock();
 	if (has_sha1_file(sha1)) {
 		void *has_data;
 		enum object_type has_type;
 		unsigned long has_size;
 		has_data = read_sha1_file(sha1, &has_type, &has_size);
+		read_unlock();
 		if (!has_data)
 			die("cannot read existing object %s", sha1_to_hex(sha1));
 		if (size != has_size || type != has_type ||
 		    memcmp(data, has_data, size) != 0)
 			die("SHA1 COLLISION FOUND WITH %s !", sha1_to_hex(sha1));
 		free(has_data);
-	}
+	} else
+		read_unlock();
 	if (strict) {
+		read_lock();
 		if (type == OBJ_BLOB) {
 			struct blob *blob = lookup_blob(sha1);
 			if (blob)
@@ -496,6 +610,7 @@ static void sha1_object(const void *data, unsigned long size,
 			}
 			obj->flags |= FLAG_CHECKED;
 		}
+		read_unlock();
 	}
 }
 
@@ -524,7 +639,7 @@ static void *get_base_data(struct base_data *c)
 			c->size = obj->size;
 		}
 
-		base_cache_used += c->size;
+		get_thread_data()->base_cache_used += c->size;
 		prune_base_data(c);
 	}
 	return c->data;
@@ -537,8 +652,10 @@ static void resolve_delta(struct object_entry *delta_obj,
 
 	delta_obj->real_type = base->obj->real_type;
 	delta_obj->delta_depth = base->obj->delta_depth + 1;
+	counter_lock();
 	if (deepest_delta < delta_obj->delta_depth)
 		deepest_delta = delta_obj->delta_depth;
+	counter_unlock();
 	delta_obj->base_object_no = base->obj - objects;
 	delta_data = get_data_from_pack(delta_obj);
 	base_data = get_base_data(base);
@@ -548,9 +665,12 @@ static void resolve_delta(struct object_entry *delta_obj,
 	free(delta_data);
 	if (!result->data)
 		bad_object(delta_obj->idx.offset, "failed to apply delta");
+	delta_obj->real_size = result->size;
 	sha1_object(result->data, result->size, delta_obj->real_type,
 		    delta_obj->idx.sha1);
+	counter_lock();
 	nr_resolved_deltas++;
+	counter_unlock();
 }
 
 static void find_unresolved_deltas(struct base_data *base,
@@ -607,6 +727,47 @@ static void find_unresolved_deltas(struct base_data *base,
 	unlink_base_data(base);
 }
 
+static void resolve_base(struct object_entry *obj)
+{
+	struct base_data base_obj;
+
+	base_obj.obj = obj;
+	base_obj.data = NULL;
+	find_unresolved_deltas(&base_obj, NULL);
+}
+
+#ifndef NO_PTHREADS
+/*
+ * Each non-delta object is the root of a tree of deltas that can be
+ * resolved independently of the others; hand them out to the threads
+ * one at a time.
+ */
+static void *threaded_second_pass(void *data)
+{
+	pthread_setspecific(key, data);
+	for (;;) {
+		int i;
+
+		work_lock();
+		counter_lock();
+		display_progress(progress, nr_resolved_deltas);
+		counter_unlock();
+		while (nr_dispatched < nr_objects &&
+		       is_delta_type(objects[nr_dispatched].type))
+			nr_dispatched++;
+		if (nr_dispatched >= nr_objects) {
+			work_unlock();
+			break;
+		}
+		i = nr_dispatched++;
+		work_unlock();
+
+		resolve_base(&objects[i]);
+	}
+	return NULL;
+}
+#endif
+
 static int compare_delta_entry(const void *a, const void *b)
 {
 	const struct delta_entry *delta_a = a;
@@ -682,15 +843,31 @@ static void parse_pack_objects(unsigned char *sha1)
 	 */
 	if (verbose)
 		progress = start_progress("Resolving deltas", nr_deltas);
+
+#ifndef NO_PTHREADS
+	if (nr_threads > 1) {
+		init_thread();
+		for (i = 0; i < nr_threads; i++) {
+			int ret = pthread_create(&thread_data[i].thread, NULL,
+						 threaded_second_pass,
+						 thread_data + i);
+			if (ret)
+				die("unable to create thread: %s", strerror(ret));
+		}
+		for (i = 0; i < nr_threads; i++)
+			pthread_join(thread_data[i].thread, NULL);
+		cleanup_thread();
+		display_progress(progress, nr_resolved_deltas);
+		return;
+	}
+#endif
+
 	for (i = 0; i < nr_objects; i++) {
 		struct object_entry *obj = &objects[i];
-		struct base_data base_obj;
 
 		if (is_delta_type(obj->type))
 			continue;
-		base_obj.obj = obj;
-		base_obj.data = NULL;
-		find_unresolved_deltas(&base_obj, NULL);
+		resolve_base(obj);
 		display_progress(progress, nr_resolved_deltas);
 	}
 }
@@ -802,8 +979,30 @@ static void fix_unresolved_deltas(struct sha1file *f, int nr_unresolved)
 	free(sorted_by_pos);
 }
 
+/*
+ * Move a file describing the pack, written to a temporary file, next
+ * to the final pack.
+ */
+static void move_pack_extension(const char *curr_name,
+				const char *final_pack_name,
+				const unsigned char *sha1, const char *ext)
+{
+	char name[PATH_MAX];
+
+	if (final_pack_name) {
+		int len = strlen(final_pack_name) - strlen(".pack");
+		snprintf(name, sizeof(name), "%.*s%s",
+			 len, final_pack_name, ext);
+	} else
+		snprintf(name, sizeof(name), "%s/pack/pack-%s%s",
+			 get_object_directory(), sha1_to_hex(sha1), ext);
+	if (move_temp_to_file(curr_name, name))
+		die("cannot store %s file", ext + 1);
+}
+
 static void final(const char *final_pack_name, const char *curr_pack_name,
 		  const char *final_index_name, const char *curr_index_name,
+		  const char *curr_sizes_name, const char *curr_rev_name,
 		  const char *keep_name, const char *keep_msg,
 		  unsigned char *sha1)
 {
@@ -844,6 +1043,13 @@ static void final(const char *final_pack_name, const char *curr_pack_name,
 		}
 	}
 
+	if (curr_sizes_name)
+		move_pack_extension(curr_sizes_name, final_pack_name,
+				    sha1, ".sizes");
+	if (curr_rev_name)
+		move_pack_extension(curr_rev_name, final_pack_name,
+				    sha1, ".rev");
+
 	if (final_pack_name != curr_pack_name) {
 		if (!final_pack_name) {
 			snprintf(name, sizeof(name), "%s/pack/pack-%s.pack",
@@ -898,6 +1104,26 @@ static int git_index_pack_config(const char *k, const char *v, void *cb)
 			die("bad pack.indexversion=%"PRIu32, opts->version);
 		return 0;
 	}
+	if (!strcmp(k, "pack.threads")) {
+		nr_threads = git_config_int(k, v);
+		if (nr_threads < 0)
+			die("invalid number of threads specified (%d)",
+			    nr_threads);
+#ifdef NO_PTHREADS
+		if (nr_threads != 1)
+			warning("no threads support, ignoring %s", k);
+		nr_threads = 1;
+#endif
+		return 0;
+	}
+	if (!strcmp(k, "pack.writesizes")) {
+		write_sizes = git_config_bool(k, v);
+		return 0;
+	}
+	if (!strcmp(k, "pack.writereverseindex")) {
+		write_rev = git_config_bool(k, v);
+		return 0;
+	}
 	return git_default_config(k, v, cb);
 }
 
@@ -972,6 +1198,26 @@ static void read_idx_option(struct pack_idx_option *opts, const char *pack_name)
 	free(p);
 }
 
+static const char *write_pack_sizes(const unsigned char *pack_sha1)
+{
+	struct pack_sizes_entry *entries;
+	const char *sizes_name;
+	int i;
+
+	entries = xmalloc(nr_objects * sizeof(*entries));
+	for (i = 0; i < nr_objects; i++) {
+		struct object_entry *obj = &objects[i];
+
+		hashcpy(entries[i].sha1, obj->idx.sha1);
+		entries[i].type = obj->real_type;
+		entries[i].size = is_delta_type(obj->type) ?
+				  obj->real_size : obj->size;
+	}
+	sizes_name = write_sizes_file(NULL, entries, nr_objects, pack_sha1);
+	free(entries);
+	return sizes_name;
+}
+
 static void show_pack_info(int stat_only)
 {
 	int i, baseobjects = nr_objects - nr_deltas;
@@ -1015,13 +1261,13 @@ static void show_pack_info(int stat_only)
 int cmd_index_pack(int argc, const char **argv, const char *prefix)
 {
 	int i, fix_thin_pack = 0, verify = 0, stat_only = 0, stat = 0;
-	const char *curr_pack, *curr_index;
+	const char *curr_pack, *curr_index, *curr_sizes = NULL, *curr_rev = NULL;
 	const char *index_name = NULL, *pack_name = NULL;
 	const char *keep_name = NULL, *keep_msg = NULL;
 	char *index_name_buf = NULL, *keep_name_buf = NULL;
 	struct pack_idx_entry **idx_objects;
 	struct pack_idx_option opts;
-	unsigned char pack_sha1[20];
+	unsigned char pack_sha1[20], pack_checksum[20];
 
 	if (argc == 2 && !strcmp(argv[1], "-h"))
 		usage(index_pack_usage);
@@ -1071,6 +1317,17 @@ int cmd_index_pack(int argc, const char **argv, const char *prefix)
 				input_len = sizeof(*hdr);
 			} else if (!strcmp(arg, "-v")) {
 				verbose = 1;
+			} else if (!prefixcmp(arg, "--threads=")) {
+				char *end;
+				nr_threads = strtoul(arg+10, &end, 0);
+				if (!arg[10] || *end || nr_threads < 0)
+					usage(index_pack_usage);
+#ifdef NO_PTHREADS
+				if (nr_threads != 1)
+					warning("no threads support, "
+						"ignoring %s", arg);
+				nr_threads = 1;
+#endif
 			} else if (!strcmp(arg, "-o")) {
 				if (index_name || (i+1) >= argc)
 					usage(index_pack_usage);
@@ -1125,6 +1382,15 @@ int cmd_index_pack(int argc, const char **argv, const char *prefix)
 		opts.flags |= WRITE_IDX_VERIFY;
 	}
 
+#ifndef NO_PTHREADS
+	if (!nr_threads)	/* --threads=0 means autodetect */
+		nr_threads = online_cpus();
+#ifdef NO_PREAD
+	/* the pread() emulation is not thread-safe */
+	nr_threads = 1;
+#endif
+#endif
+
 	curr_pack = open_pack_file(pack_name);
 	parse_pack_header();
 	objects = xcalloc(nr_objects + 1, sizeof(struct object_entry));
@@ -1171,15 +1437,22 @@ int cmd_index_pack(int argc, const char **argv, const char *prefix)
 	if (stat)
 		show_pack_info(stat_only);
 
+	if (write_sizes && !verify)
+		curr_sizes = write_pack_sizes(pack_sha1);
+
+	hashcpy(pack_checksum, pack_sha1);
 	idx_objects = xmalloc((nr_objects) * sizeof(struct pack_idx_entry *));
 	for (i = 0; i < nr_objects; i++)
 		idx_objects[i] = &objects[i].idx;
 	curr_index = write_idx_file(index_name, idx_objects, nr_objects, &opts, pack_sha1);
+	if (write_rev && !verify)
+		curr_rev = write_rev_file(NULL, idx_objects, nr_objects,
+					  pack_checksum);
 	free(idx_objects);
 
 	if (!verify)
 		final(pack_name, curr_pack,
-		      index_name, curr_index,
+		      index_name, curr_index, curr_sizes, curr_rev,
 		      keep_name, keep_msg,
 		      pack_sha1);
 	else
@@ -1191,6 +1464,8 @@ int cmd_index_pack(int argc, const char **argv, const char *prefix)
 		free((void *) curr_pack);
 	if (index_name == NULL)
 		free((void *) curr_index);
+	free((void *) curr_sizes);
+	free((void *) curr_rev);
 
 	return 0;
 }
@@ -0,0 +1,29 @@
+#include "builtin.h"
+#include "cache.h"
+#include "midx.h"
+#include "parse-options.h"
+
+static const char * const multi_pack_index_usage[] = {
+	"git multi-pack-index write",
+	"git multi-pack-index verify",
+	NULL
+};
+
+int cmd_multi_pack_index(int argc, const char **argv, const char *prefix)
+{
+	const struct option options[] = {
+		OPT_END()
+	};
+
+	git_config(git_default_config, NULL);
+	argc = parse_options(argc, argv, prefix, options,
+			     multi_pack_index_usage, 0);
+	if (argc != 1)
+		usage_with_options(multi_pack_index_usage, options);
+
+	if (!strcmp(argv[0], "write"))
+		return !!write_multi_pack_index(get_object_directory());
+	if (!strcmp(argv[0], "verify"))
+		return !!verify_multi_pack_index(get_object_directory());
+	usage_with_options(multi_pack_index_usage, options);
+}
@@ -9,6 +9,7 @@
 #include "delta.h"
 #include "pack.h"
 #include "pack-revindex.h"
+#include "pack-bitmap.h"
 #include "csum-file.h"
 #include "tree-walk.h"
 #include "diff.h"
@@ -17,6 +18,7 @@
 #include "progress.h"
 #include "refs.h"
 #include "thread-utils.h"
+#include "delta-islands.h"
 
 static const char pack_usage[] =
   "git pack-objects [ -q | --progress | --all-progress ]\n"
@@ -26,8 +28,10 @@ static const char pack_usage[] =
   "        [--no-reuse-delta] [--no-reuse-object] [--delta-base-offset]\n"
   "        [--threads=<n>] [--non-empty] [--revs [--unpacked | --all]]\n"
   "        [--reflog] [--stdout | base-name] [--include-tag]\n"
+  "        [--no-use-bitmap-index] [--write-bitmap-index]\n"
   "        [--keep-unreachable | --unpack-unreachable]\n"
-  "        [< ref-list | < object-list]";
+  "        [--stdin-packs [--unpacked]] [--delta-islands]\n"
+  "        [< ref-list | < object-list | < pack-list]";
 
 struct object_entry {
 	struct pack_idx_entry idx;
@@ -53,6 +57,7 @@ struct object_entry {
 	unsigned char no_try_delta;
 	unsigned char tagged; /* near the very tip of refs */
 	unsigned char filled; /* assigned write-order */
+	unsigned int tree_depth; /* of the first path a tree was seen at */
 };
 
 /*
@@ -70,6 +75,7 @@ static int reuse_delta = 1, reuse_object = 1;
 static int keep_unreachable, unpack_unreachable, include_tag;
 static int local;
 static int incremental;
+static int stdin_packs, rev_list_unpacked;
 static int ignore_packed_keep;
 static int allow_ofs_delta;
 static struct pack_idx_option pack_idx_opts;
@@ -91,6 +97,30 @@ static unsigned long cache_max_small_delta_size = 1000;
 
 static unsigned long window_memory_limit = 0;
 
+/*
+ * Reachability bitmaps: use an existing bitmap index to enumerate the
+ * objects to pack, or record the commits we walk so that a bitmap
+ * index can be written for the new pack.
+ */
+static int use_bitmap_index = 1;
+static int use_delta_islands;
+static int write_bitmap_index;
+static struct commit **indexed_commits;
+static unsigned int indexed_commits_nr, indexed_commits_alloc;
+
+/* Write a sizes file next to each pack (pack.writeSizes) */
+static int write_sizes;
+
+/* Write a reverse index next to each pack (pack.writeReverseIndex) */
+static int write_rev;
+
+/*
+ * When the bitmaps say that the objects to pack are exactly the ones
+ * at the start of the bitmapped pack, they are copied from it as they
+ * are, and never become entries of the objects array.
+ */
+static struct bitmap_reuse reuse_packfile;
+
 /*
  * The object names in objects array are hashed with this hashtable,
  * to help looking up the entry by object name.
@@ -340,8 +370,9 @@ static unsigned long write_object(struct sha1file *f,
 	else {
 		struct packed_git *p = entry->in_pack;
 		struct pack_window *w_curs = NULL;
-		struct revindex_entry *revidx;
+		uint32_t nr;
 		off_t offset;
+		int pos;
 
 		if (entry->delta)
 			type = (allow_ofs_delta && entry->delta->idx.offset) ?
@@ -349,10 +380,11 @@ static unsigned long write_object(struct sha1file *f,
 		hdrlen = encode_in_pack_object_header(type, entry->size, header);
 
 		offset = entry->in_pack_offset;
-		revidx = find_pack_revindex(p, offset);
-		datalen = revidx[1].offset - offset;
+		pos = find_pack_revindex(p, offset);
+		datalen = pack_pos_to_offset(p, pos + 1) - offset;
+		nr = pack_pos_to_index(p, pos);
 		if (!pack_to_stdout && p->index_version > 1 &&
-		    check_pack_crc(p, &w_curs, offset, datalen, revidx->nr)) {
+		    check_pack_crc(p, &w_curs, offset, datalen, nr)) {
 			error("bad packed object CRC for %s", sha1_to_hex(entry->idx.sha1));
 			unuse_pack(&w_curs);
 			goto no_reuse;
@@ -566,6 +598,106 @@ static struct object_entry **compute_write_order(void)
 	return wo;
 }
 
+/*
+ * The type of a reused delta is that of the base at the end of its
+ * chain.
+ */
+static enum object_type final_type(struct object_entry *entry)
+{
+	while (entry->type == OBJ_REF_DELTA || entry->type == OBJ_OFS_DELTA)
+		entry = entry->delta;
+	return entry->type;
+}
+
+static void write_bitmap_for_pack(int complete, const unsigned char *sha1)
+{
+	const char *bitmap_tmp_name;
+	char tmpname[PATH_MAX];
+	uint32_t *name_hashes;
+	unsigned char *types;
+	uint32_t j;
+
+	if (!complete) {
+		warning("not writing bitmap index: the pack was split");
+		return;
+	}
+	name_hashes = xmalloc(nr_written * sizeof(*name_hashes));
+	types = xmalloc(nr_written);
+	for (j = 0; j < nr_written; j++) {
+		struct object_entry *entry = (struct object_entry *)written_list[j];
+		name_hashes[j] = entry->hash;
+		types[j] = final_type(entry);
+	}
+	bitmap_tmp_name = write_bitmap_file(written_list, name_hashes, types,
+					    nr_written, sha1,
+					    indexed_commits,
+					    indexed_commits_nr);
+	free(name_hashes);
+	free(types);
+	if (!bitmap_tmp_name)
+		return;
+
+	snprintf(tmpname, sizeof(tmpname), "%s-%s.bitmap",
+		 base_name, sha1_to_hex(sha1));
+	if (adjust_shared_perm(bitmap_tmp_name))
+		die_errno("unable to make temporary bitmap file readable");
+	if (rename(bitmap_tmp_name, tmpname))
+		die_errno("unable to rename temporary bitmap file");
+	free((void *)bitmap_tmp_name);
+}
+
+/*
+ * A reused delta only knows the size of its delta data: the final
+ * size is recorded in the header of the delta.
+ */
+static void fill_sizes_entry(struct pack_sizes_entry *s,
+			     struct object_entry *entry)
+{
+	hashcpy(s->sha1, entry->idx.sha1);
+	s->type = final_type(entry);
+	if (entry->type != OBJ_REF_DELTA && entry->type != OBJ_OFS_DELTA) {
+		s->size = entry->size;
+		return;
+	}
+
+	if (packed_object_size(entry->in_pack, entry->idx.sha1, &s->size) < 0) {
+		struct pack_window *w_curs = NULL;
+
+		s->size = get_size_from_delta(entry->in_pack, &w_curs,
+				entry->in_pack_offset + entry->in_pack_header_size);
+		unuse_pack(&w_curs);
+	}
+}
+
+static const char *write_sizes_for_pack(const unsigned char *pack_sha1)
+{
+	struct pack_sizes_entry *entries;
+	const char *sizes_tmp_name;
+	uint32_t j;
+
+	entries = xmalloc(nr_written * sizeof(*entries));
+	for (j = 0; j < nr_written; j++)
+		fill_sizes_entry(&entries[j],
+				 (struct object_entry *)written_list[j]);
+	sizes_tmp_name = write_sizes_file(NULL, entries, nr_written, pack_sha1);
+	free(entries);
+	return sizes_tmp_name;
+}
+
+static void move_pack_extension(const char *tmp_name,
+				const unsigned char *sha1, const char *ext)
+{
+	char name[PATH_MAX];
+
+	snprintf(name, sizeof(name), "%s-%s.%s",
+		 base_name, sha1_to_hex(sha1), ext);
+	if (adjust_shared_perm(tmp_name))
+		die_errno("unable to make temporary %s file readable", ext);
+	if (rename(tmp_name, name))
+		die_errno("unable to rename temporary %s file", ext);
+	free((void *)tmp_name);
+}
+
 static void write_pack_file(void)
 {
 	uint32_t i = 0, j;
@@ -602,6 +734,19 @@ static void write_pack_file(void)
 		sha1write(f, &hdr, sizeof(hdr));
 		offset = sizeof(hdr);
 		nr_written = 0;
+		if (reuse_packfile.pack) {
+			struct pack_window *w_curs = NULL;
+
+			copy_pack_data(f, reuse_packfile.pack, &w_curs, offset,
+				       reuse_packfile.end - offset);
+			unuse_pack(&w_curs);
+			offset = reuse_packfile.end;
+			written += reuse_packfile.nr_objects;
+			written_delta += reuse_packfile.nr_deltas;
+			reused += reuse_packfile.nr_objects;
+			reused_delta += reuse_packfile.nr_deltas;
+			display_progress(progress_state, written);
+		}
 		for (; i < nr_objects; i++) {
 			struct object_entry *e = write_order[i];
 			if (!write_one(f, e, &offset))
@@ -626,11 +771,27 @@ static void write_pack_file(void)
 
 		if (!pack_to_stdout) {
 			struct stat st;
-			const char *idx_tmp_name;
+			const char *idx_tmp_name, *sizes_tmp_name = NULL;
+			const char *rev_tmp_name = NULL;
+			unsigned char pack_sha1[20];
 			char tmpname[PATH_MAX];
 
+			if (write_sizes)
+				sizes_tmp_name = write_sizes_for_pack(sha1);
+			hashcpy(pack_sha1, sha1);
 			idx_tmp_name = write_idx_file(NULL, written_list, nr_written,
 						      &pack_idx_opts, sha1);
+			if (write_rev)
+				rev_tmp_name = write_rev_file(NULL, written_list,
+							      nr_written,
+							      pack_sha1);
+			if (write_bitmap_index)
+				write_bitmap_for_pack(nr_written == nr_result,
+						      sha1);
+			if (sizes_tmp_name)
+				move_pack_extension(sizes_tmp_name, sha1, "sizes");
+			if (rev_tmp_name)
+				move_pack_extension(rev_tmp_name, sha1, "rev");
 
 			snprintf(tmpname, sizeof(tmpname), "%s-%s.pack",
 				 base_name, sha1_to_hex(sha1));
@@ -777,14 +938,32 @@ static int no_try_delta(const char *path)
 	return 0;
 }
 
-static int add_object_entry(const unsigned char *sha1, enum object_type type,
-			    const char *name, int exclude)
+static int in_reused_pack(const unsigned char *sha1)
+{
+	off_t offset;
+
+	if (!reuse_packfile.pack)
+		return 0;
+	offset = find_pack_entry_one(sha1, reuse_packfile.pack);
+	return offset && offset < reuse_packfile.end;
+}
+
+/*
+ * Add the object to the pack, and to the hash of the objects we have,
+ * unless it is there already or should not be packed.  The caller may
+ * know that "found_pack" has it at "found_offset"; the other packs are
+ * still asked, as having the object in one of them may mean it should
+ * not go into this pack.
+ */
+static int add_object_entry_1(const unsigned char *sha1,
+			      enum object_type type, unsigned hash,
+			      const char *name, int exclude,
+			      struct packed_git *found_pack,
+			      off_t found_offset)
 {
 	struct object_entry *entry;
-	struct packed_git *p, *found_pack = NULL;
-	off_t found_offset = 0;
+	struct packed_git *p;
 	int ix;
-	unsigned hash = name_hash(name);
 
 	ix = nr_objects ? locate_object_entry_hash(sha1) : -1;
 	if (ix >= 0) {
@@ -797,11 +976,19 @@ static int add_object_entry(const unsigned char *sha1, enum object_type type,
 		return 0;
 	}
 
+	if (in_reused_pack(sha1))
+		return 0;
+
 	if (!exclude && local && has_loose_object_nonlocal(sha1))
 		return 0;
 
 	for (p = packed_git; p; p = p->next) {
-		off_t offset = find_pack_entry_one(sha1, p);
+		off_t offset;
+
+		if (p == found_pack)
+			offset = found_offset;
+		else
+			offset = find_pack_entry_one(sha1, p);
 		if (offset) {
 			if (!found_pack) {
 				found_offset = offset;
@@ -851,6 +1038,13 @@ static int add_object_entry(const unsigned char *sha1, enum object_type type,
 	return 1;
 }
 
+static int add_object_entry(const unsigned char *sha1, enum object_type type,
+			    const char *name, int exclude)
+{
+	return add_object_entry_1(sha1, type, name_hash(name), name, exclude,
+				  NULL, 0);
+}
+
 struct pbase_tree_cache {
 	unsigned char sha1[20];
 	int ref;
@@ -1123,6 +1317,36 @@ static void cleanup_preferred_base(void)
 	done_pbase_paths_num = done_pbase_paths_alloc = 0;
 }
 
+#ifndef NO_PTHREADS
+
+static pthread_mutex_t read_mutex;
+#define read_lock()		pthread_mutex_lock(&read_mutex)
+#define read_unlock()		pthread_mutex_unlock(&read_mutex)
+
+static pthread_mutex_t cache_mutex;
+#define cache_lock()		pthread_mutex_lock(&cache_mutex)
+#define cache_unlock()		pthread_mutex_unlock(&cache_mutex)
+
+static pthread_mutex_t progress_mutex;
+#define progress_lock()		pthread_mutex_lock(&progress_mutex)
+#define progress_unlock()	pthread_mutex_unlock(&progress_mutex)
+
+#else
+
+#define read_lock()		(void)0
+#define read_unlock()		(void)0
+#define cache_lock()		(void)0
+#define cache_unlock()		(void)0
+#define progress_lock()		(void)0
+#define progress_unlock()	(void)0
+
+#endif
+
+/*
+ * This may run in several threads at once: the pack windows and the
+ * object store are only touched under read_lock(), and a reusable delta
+ * only records its base here, to be linked by get_object_details().
+ */
 static void check_object(struct object_entry *entry)
 {
 	if (entry->in_pack) {
@@ -1130,12 +1354,15 @@ static void check_object(struct object_entry *entry)
 		struct pack_window *w_curs = NULL;
 		const unsigned char *base_ref = NULL;
 		struct object_entry *base_entry;
-		unsigned long used, used_0;
+		unsigned long used, used_0, size;
 		unsigned long avail;
 		off_t ofs;
 		unsigned char *buf, c;
+		int type;
 
+		read_lock();
 		buf = use_pack(p, &w_curs, entry->in_pack_offset, &avail);
+		read_unlock();
 
 		/*
 		 * We want in_pack_type even if we do not reuse delta
@@ -1159,17 +1386,24 @@ static void check_object(struct object_entry *entry)
 			entry->in_pack_header_size = used;
 			if (entry->type < OBJ_COMMIT || entry->type > OBJ_BLOB)
 				goto give_up;
+			read_lock();
 			unuse_pack(&w_curs);
+			read_unlock();
 			return;
 		case OBJ_REF_DELTA:
-			if (reuse_delta && !entry->preferred_base)
+			if (reuse_delta && !entry->preferred_base) {
+				read_lock();
 				base_ref = use_pack(p, &w_curs,
 						entry->in_pack_offset + used, NULL);
+				read_unlock();
+			}
 			entry->in_pack_header_size = used + 20;
 			break;
 		case OBJ_OFS_DELTA:
+			read_lock();
 			buf = use_pack(p, &w_curs,
 				       entry->in_pack_offset + used, NULL);
+			read_unlock();
 			used_0 = 0;
 			c = buf[used_0++];
 			ofs = c & 127;
@@ -1190,17 +1424,19 @@ static void check_object(struct object_entry *entry)
 				goto give_up;
 			}
 			if (reuse_delta && !entry->preferred_base) {
-				struct revindex_entry *revidx;
-				revidx = find_pack_revindex(p, ofs);
-				if (!revidx)
+				int pos = find_pack_revindex(p, ofs);
+				if (pos < 0)
 					goto give_up;
-				base_ref = nth_packed_object_sha1(p, revidx->nr);
+				base_ref = nth_packed_object_sha1(p,
+						pack_pos_to_index(p, pos));
 			}
 			entry->in_pack_header_size = used + used_0;
 			break;
 		}
 
-		if (base_ref && (base_entry = locate_object_entry(base_ref))) {
+		if (base_ref && (base_entry = locate_object_entry(base_ref)) &&
+		    (!use_delta_islands ||
+		     in_same_island(entry->idx.sha1, base_entry->idx.sha1))) {
 			/*
 			 * If base_ref was set above that means we wish to
 			 * reuse delta data, and we even found that base
@@ -1214,11 +1450,26 @@ static void check_object(struct object_entry *entry)
 			entry->type = entry->in_pack_type;
 			entry->delta = base_entry;
 			entry->delta_size = entry->size;
-			entry->delta_sibling = base_entry->delta_child;
-			base_entry->delta_child = entry;
+			read_lock();
+			unuse_pack(&w_curs);
+			read_unlock();
+			return;
+		}
+
+		/*
+		 * A sizes file tells the final type and size of a delta
+		 * without looking at its delta chain.
+		 */
+		read_lock();
+		type = packed_object_size(p, entry->idx.sha1, &size);
+		if (type > 0) {
+			entry->type = type;
+			entry->size = size;
 			unuse_pack(&w_curs);
+			read_unlock();
 			return;
 		}
+		read_unlock();
 
 		if (entry->type) {
 			/*
@@ -1226,11 +1477,15 @@ static void check_object(struct object_entry *entry)
 			 * final object type is.  Let's extract the actual
 			 * object size from the delta header.
 			 */
+			read_lock();
 			entry->size = get_size_from_delta(p, &w_curs,
 					entry->in_pack_offset + entry->in_pack_header_size);
-			if (entry->size == 0)
+			if (entry->size == 0) {
+				read_unlock();
 				goto give_up;
+			}
 			unuse_pack(&w_curs);
+			read_unlock();
 			return;
 		}
 
@@ -1240,10 +1495,14 @@ static void check_object(struct object_entry *entry)
 		 * at this point...
 		 */
 		give_up:
+		read_lock();
 		unuse_pack(&w_curs);
+		read_unlock();
 	}
 
+	read_lock();
 	entry->type = sha1_object_info(entry->idx.sha1, &entry->size);
+	read_unlock();
 	/*
 	 * The error condition is checked in prepare_pack().  This is
 	 * to permit a missing preferred base object to be ignored
@@ -1269,26 +1528,6 @@ static int pack_offset_sort(const void *_a, const void *_b)
 			(a->in_pack_offset > b->in_pack_offset);
 }
 
-static void get_object_details(void)
-{
-	uint32_t i;
-	struct object_entry **sorted_by_offset;
-
-	sorted_by_offset = xcalloc(nr_objects, sizeof(struct object_entry *));
-	for (i = 0; i < nr_objects; i++)
-		sorted_by_offset[i] = objects + i;
-	qsort(sorted_by_offset, nr_objects, sizeof(*sorted_by_offset), pack_offset_sort);
-
-	for (i = 0; i < nr_objects; i++) {
-		struct object_entry *entry = sorted_by_offset[i];
-		check_object(entry);
-		if (big_file_threshold <= entry->size)
-			entry->no_try_delta = 1;
-	}
-
-	free(sorted_by_offset);
-}
-
 /*
  * We search for deltas in a list sorted by type, by filename hash, and then
  * by size, so that we see progressively smaller and smaller files.
@@ -1315,6 +1554,11 @@ static int type_size_sort(const void *_a, const void *_b)
 		return -1;
 	if (a->preferred_base < b->preferred_base)
 		return 1;
+	if (use_delta_islands) {
+		int cmp = island_delta_cmp(a->idx.sha1, b->idx.sha1);
+		if (cmp)
+			return cmp;
+	}
 	if (a->size > b->size)
 		return -1;
 	if (a->size < b->size)
@@ -1345,31 +1589,6 @@ static int delta_cacheable(unsigned long src_size, unsigned long trg_size,
 	return 0;
 }
 
-#ifndef NO_PTHREADS
-
-static pthread_mutex_t read_mutex;
-#define read_lock()		pthread_mutex_lock(&read_mutex)
-#define read_unlock()		pthread_mutex_unlock(&read_mutex)
-
-static pthread_mutex_t cache_mutex;
-#define cache_lock()		pthread_mutex_lock(&cache_mutex)
-#define cache_unlock()		pthread_mutex_unlock(&cache_mutex)
-
-static pthread_mutex_t progress_mutex;
-#define progress_lock()		pthread_mutex_lock(&progress_mutex)
-#define progress_unlock()	pthread_mutex_unlock(&progress_mutex)
-
-#else
-
-#define read_lock()		(void)0
-#define read_unlock()		(void)0
-#define cache_lock()		(void)0
-#define cache_unlock()		(void)0
-#define progress_lock()		(void)0
-#define progress_unlock()	(void)0
-
-#endif
-
 static int try_delta(struct unpacked *trg, struct unpacked *src,
 		     unsigned max_depth, unsigned long *mem_usage)
 {
@@ -1398,6 +1617,11 @@ static int try_delta(struct unpacked *trg, struct unpacked *src,
 	if (src->depth >= max_depth)
 		return 0;
 
+	/* Nor make a pack for one island need objects of another. */
+	if (use_delta_islands &&
+	    !in_same_island(trg_entry->idx.sha1, src_entry->idx.sha1))
+		return 0;
+
 	/* Now some size filtering heuristics. */
 	trg_size = trg_entry->size;
 	if (!trg_entry->delta) {
@@ -1894,6 +2118,120 @@ static void ll_find_deltas(struct object_entry **list, unsigned list_size,
 #define ll_find_deltas(l, s, w, d, p)	find_deltas(l, &s, w, d, p)
 #endif
 
+/* Below this many objects per thread, check_object() is not worth a thread */
+#define CHECK_OBJECT_PER_THREAD 1024
+
+#ifndef NO_PTHREADS
+
+struct check_thread_params {
+	pthread_t thread;
+	struct object_entry **list;
+	unsigned list_size;
+};
+
+static void *threaded_check_object(void *arg)
+{
+	struct check_thread_params *me = arg;
+	unsigned i;
+
+	for (i = 0; i < me->list_size; i++)
+		check_object(me->list[i]);
+	return NULL;
+}
+
+static void ll_check_objects(struct object_entry **list, unsigned list_size)
+{
+	struct check_thread_params *p;
+	struct packed_git *last = NULL;
+	int i, ret, nr_threads;
+	unsigned j;
+
+	init_threaded_search();
+
+	if (!delta_search_threads)	/* --threads=0 means autodetect */
+		delta_search_threads = online_cpus();
+	nr_threads = delta_search_threads;
+	if (nr_threads > list_size / CHECK_OBJECT_PER_THREAD)
+		nr_threads = list_size / CHECK_OBJECT_PER_THREAD;
+	if (nr_threads <= 1) {
+		for (j = 0; j < list_size; j++)
+			check_object(list[j]);
+		cleanup_threaded_search();
+		return;
+	}
+
+	/*
+	 * The reverse indices are built lazily, which is not safe to
+	 * race on; the list is sorted by pack, so this is cheap.
+	 */
+	for (j = 0; j < list_size; j++) {
+		if (!list[j]->in_pack || list[j]->in_pack == last)
+			continue;
+		last = list[j]->in_pack;
+		load_pack_revindex(last);
+	}
+
+	/* Each thread gets a run of the list, so it reads nearby data. */
+	p = xcalloc(nr_threads, sizeof(*p));
+	for (i = 0; i < nr_threads; i++) {
+		unsigned sub_size = list_size / (nr_threads - i);
+
+		p[i].list = list;
+		p[i].list_size = sub_size;
+		list += sub_size;
+		list_size -= sub_size;
+
+		ret = pthread_create(&p[i].thread, NULL,
+				     threaded_check_object, &p[i]);
+		if (ret)
+			die("unable to create thread: %s", strerror(ret));
+	}
+	for (i = 0; i < nr_threads; i++)
+		pthread_join(p[i].thread, NULL);
+	cleanup_threaded_search();
+	free(p);
+}
+
+#else
+static void ll_check_objects(struct object_entry **list, unsigned list_size)
+{
+	unsigned i;
+
+	for (i = 0; i < list_size; i++)
+		check_object(list[i]);
+}
+#endif
+
+static void get_object_details(void)
+{
+	uint32_t i;
+	struct object_entry **sorted_by_offset;
+
+	sorted_by_offset = xcalloc(nr_objects, sizeof(struct object_entry *));
+	for (i = 0; i < nr_objects; i++)
+		sorted_by_offset[i] = objects + i;
+	qsort(sorted_by_offset, nr_objects, sizeof(*sorted_by_offset), pack_offset_sort);
+
+	ll_check_objects(sorted_by_offset, nr_objects);
+
+	/*
+	 * Link the reused deltas to their bases in pack order, so that
+	 * the result does not depend on how the threads were scheduled.
+	 */
+	for (i = 0; i < nr_objects; i++) {
+		struct object_entry *entry = sorted_by_offset[i];
+		if (entry->delta) {
+			entry->delta_sibling = entry->delta->delta_child;
+			entry->delta->delta_child = entry;
+		}
+		if (big_file_threshold <= entry->size)
+			entry->no_try_delta = 1;
+	}
+
+	free(sorted_by_offset);
+}
+
+
 static int add_ref_tag(const char *path, const unsigned char *sha1, int flag, void *cb_data)
 {
 	unsigned char peeled[20];
@@ -1901,7 +2239,8 @@ static int add_ref_tag(const char *path, const unsigned char *sha1, int flag, vo
 	if (!prefixcmp(path, "refs/tags/") && /* is a tag? */
 	    !peel_ref(path, peeled)        && /* peelable? */
 	    !is_null_sha1(peeled)          && /* annotated tag? */
-	    locate_object_entry(peeled))      /* object packed? */
+	    (locate_object_entry(peeled) ||   /* object packed? */
+	     in_reused_pack(peeled)))
 		add_object_entry(sha1, OBJ_TAG, NULL, 0);
 	return 0;
 }
@@ -2031,6 +2370,18 @@ static int git_pack_config(const char *k, const char *v, void *cb)
 		pack_size_limit_cfg = git_config_ulong(k, v);
 		return 0;
 	}
+	if (!strcmp(k, "pack.usebitmaps")) {
+		use_bitmap_index = git_config_bool(k, v);
+		return 0;
+	}
+	if (!strcmp(k, "pack.writesizes")) {
+		write_sizes = git_config_bool(k, v);
+		return 0;
+	}
+	if (!strcmp(k, "pack.writereverseindex")) {
+		write_rev = git_config_bool(k, v);
+		return 0;
+	}
 	return git_default_config(k, v, cb);
 }
 
@@ -2071,6 +2422,15 @@ static void show_commit(struct commit *commit, void *data)
 {
 	add_object_entry(commit->object.sha1, OBJ_COMMIT, NULL, 0);
 	commit->object.flags |= OBJECT_ADDED;
+
+	if (use_delta_islands)
+		propagate_island_marks(commit);
+
+	if (write_bitmap_index) {
+		ALLOC_GROW(indexed_commits, indexed_commits_nr + 1,
+			   indexed_commits_alloc);
+		indexed_commits[indexed_commits_nr++] = commit;
+	}
 }
 
 static void show_object(struct object *obj, const struct name_path *path, const char *last)
@@ -2081,6 +2441,17 @@ static void show_object(struct object *obj, const struct name_path *path, const
 	add_object_entry(obj->sha1, obj->type, name, 0);
 	obj->flags |= OBJECT_ADDED;
 
+	if (use_delta_islands && obj->type == OBJ_TREE) {
+		struct object_entry *entry = locate_object_entry(obj->sha1);
+		unsigned depth = *name ? 1 : 0;	/* "" is a root tree */
+		const char *p;
+
+		for (p = strchr(name, '/'); p; p = strchr(p + 1, '/'))
+			depth++;
+		if (entry)
+			entry->tree_depth = depth;
+	}
+
 	/*
 	 * We will have generated the hash from the name,
 	 * but not saved a pointer to it - we can free it
@@ -2093,6 +2464,19 @@ static void show_edge(struct commit *commit)
 	add_preferred_base(commit->object.sha1);
 }
 
+/*
+ * The bitmap index keeps the name hash of every object, so that these
+ * objects are grouped for the delta search as a walk would have done.
+ * Only the "delta" attribute cannot be checked, as the path is gone.
+ */
+static void show_reachable(const unsigned char *sha1, enum object_type type,
+			   uint32_t name_hash,
+			   struct packed_git *found_pack, off_t found_offset)
+{
+	add_object_entry_1(sha1, type, name_hash, NULL, 0,
+			   found_pack, found_offset);
+}
+
 struct in_pack_object {
 	off_t offset;
 	struct object *object;
@@ -2169,6 +2553,209 @@ static void add_objects_in_unpacked_packs(struct rev_info *revs)
 	free(in_pack.array);
 }
 
+static int in_excluded_pack(const unsigned char *sha1,
+			    struct packed_git **excluded, int nr_excluded)
+{
+	int i;
+
+	for (i = 0; i < nr_excluded; i++)
+		if (find_pack_entry_one(sha1, excluded[i]))
+			return 1;
+	return 0;
+}
+
+/*
+ * Add an object of the packs read by --stdin-packs.  It has no name
+ * yet; the commits among them are kept, to name the objects by the
+ * paths in their trees once all are in.
+ */
+static void add_stdin_packs_object(const unsigned char *sha1,
+				   struct object_array *commits)
+{
+	enum object_type type = sha1_object_info(sha1, NULL);
+
+	if (type < 0)
+		die("unable to get type of object %s", sha1_to_hex(sha1));
+	add_object_entry(sha1, type, "", 0);
+	if (type == OBJ_COMMIT)
+		add_object_array(&lookup_commit(sha1)->object, NULL, commits);
+}
+
+static void add_loose_objects(struct packed_git **excluded, int nr_excluded,
+			      struct object_array *commits)
+{
+	struct strbuf path = STRBUF_INIT;
+	unsigned char sha1[20];
+	char hex[41];
+	size_t baselen;
+	int i;
+
+	strbuf_addstr(&path, get_object_directory());
+	baselen = path.len;
+	for (i = 0; i < 256; i++) {
+		DIR *dir;
+		struct dirent *de;
+
+		strbuf_setlen(&path, baselen);
+		strbuf_addf(&path, "/%02x", i);
+		dir = opendir(path.buf);
+		if (!dir)
+			continue;
+		while ((de = readdir(dir)) != NULL) {
+			struct object *o;
+
+			if (strlen(de->d_name) != 38)
+				continue;
+			sprintf(hex, "%02x%s", i, de->d_name);
+			if (get_sha1_hex(hex, sha1))
+				continue;
+			o = lookup_unknown_object(sha1);
+			if (o->flags & OBJECT_ADDED)
+				continue;
+			o->flags |= OBJECT_ADDED;
+			if (!in_excluded_pack(sha1, excluded, nr_excluded))
+				add_stdin_packs_object(sha1, commits);
+		}
+		closedir(dir);
+	}
+	strbuf_release(&path);
+}
+
+static struct packed_git *find_pack_by_basename(const char *name)
+{
+	struct packed_git *p;
+	int len = strlen(name);
+
+	if (len > 5 && !strcmp(name + len - 5, ".pack"))
+		len -= 5;
+	for (p = packed_git; p; p = p->next) {
+		const char *base = strrchr(p->pack_name, '/');
+		base = base ? base + 1 : p->pack_name;
+		if (!strncmp(base, name, len) && !strcmp(base + len, ".pack"))
+			return p;
+	}
+	return NULL;
+}
+
+static void show_commit_pack_hint(struct commit *commit, void *data)
+{
+}
+
+static void show_object_pack_hint(struct object *obj,
+				  const struct name_path *path,
+				  const char *last)
+{
+	struct object_entry *entry = locate_object_entry(obj->sha1);
+	char *name;
+
+	if (!entry || entry->hash)
+		return;
+	name = path_name(path, last);
+	entry->hash = name_hash(name);
+	if (no_try_delta(name))
+		entry->no_try_delta = 1;
+	free(name);
+}
+
+/*
+ * The delta search groups objects by the hash of their names, so give
+ * the objects of the packs the first path they are found at in the
+ * trees of the commits among them.  The history is not walked: an
+ * object only reachable from a commit in another pack stays nameless.
+ */
+static void name_stdin_packs_objects(struct object_array *commits)
+{
+	struct rev_info revs;
+	int i;
+
+	init_revisions(&revs, NULL);
+	save_commit_buffer = 0;
+	revs.tag_objects = revs.tree_objects = revs.blob_objects = 1;
+	revs.no_walk = 1;
+	for (i = 0; i < commits->nr; i++)
+		add_pending_object(&revs, commits->objects[i].item, "");
+	if (prepare_revision_walk(&revs))
+		die("revision walk setup failed");
+	traverse_commit_list(&revs, show_commit_pack_hint,
+			     show_object_pack_hint, NULL);
+}
+
+/*
+ * Read "pack-<sha1>.pack" names from stdin and pack every object in
+ * them, except those also found in a pack listed as "^pack-<sha1>.pack".
+ * The objects are mostly copied (and their deltas reused) from the
+ * packs they are already in, so the cost is that of the listed packs,
+ * not that of the whole repository.
+ */
+static void read_packs_list_from_stdin(void)
+{
+	struct strbuf line = STRBUF_INIT;
+	struct packed_git **included = NULL, **excluded = NULL;
+	struct object_array commits = OBJECT_ARRAY_INIT;
+	int nr_included = 0, alloc_included = 0;
+	int nr_excluded = 0, alloc_excluded = 0;
+	struct in_pack in_pack;
+	int i;
+
+	while (strbuf_getline(&line, stdin, '\n') != EOF) {
+		int exclude = line.buf[0] == '^';
+		const char *name = line.buf + exclude;
+		struct packed_git *p;
+
+		if (!*name)
+			continue;
+		p = find_pack_by_basename(name);
+		if (!p)
+			die("could not find pack '%s'", name);
+		if (open_pack_index(p))
+			die("cannot open pack index of '%s'", name);
+		if (exclude) {
+			ALLOC_GROW(excluded, nr_excluded + 1, alloc_excluded);
+			excluded[nr_excluded++] = p;
+		} else {
+			ALLOC_GROW(included, nr_included + 1, alloc_included);
+			included[nr_included++] = p;
+		}
+	}
+	strbuf_release(&line);
+
+	memset(&in_pack, 0, sizeof(in_pack));
+	for (i = 0; i < nr_included; i++) {
+		struct packed_git *p = included[i];
+		uint32_t j;
+
+		ALLOC_GROW(in_pack.array, in_pack.nr + p->num_objects,
+			   in_pack.alloc);
+		for (j = 0; j < p->num_objects; j++) {
+			const unsigned char *sha1 = nth_packed_object_sha1(p, j);
+			struct object *o = lookup_unknown_object(sha1);
+
+			if (o->flags & OBJECT_ADDED)
+				continue;
+			o->flags |= OBJECT_ADDED;
+			if (!in_excluded_pack(sha1, excluded, nr_excluded))
+				mark_in_pack_object(o, p, &in_pack);
+		}
+	}
+	if (in_pack.nr) {
+		qsort(in_pack.array, in_pack.nr, sizeof(in_pack.array[0]),
+		      ofscmp);
+		for (i = 0; i < in_pack.nr; i++)
+			add_stdin_packs_object(in_pack.array[i].object->sha1,
+					       &commits);
+	}
+	free(in_pack.array);
+
+	if (rev_list_unpacked)
+		add_loose_objects(excluded, nr_excluded, &commits);
+
+	name_stdin_packs_objects(&commits);
+	free(commits.objects);
+
+	free(included);
+	free(excluded);
+}
+
 static int has_sha1_pack_kept_or_nonlocal(const unsigned char *sha1)
 {
 	static struct packed_git *last_found = (void *)1;
@@ -2215,6 +2802,45 @@ static void loosen_unused_packed_objects(struct rev_info *revs)
 	}
 }
 
+static int tree_depth_sort(const void *_a, const void *_b)
+{
+	const struct object_entry *a = *(struct object_entry **)_a;
+	const struct object_entry *b = *(struct object_entry **)_b;
+
+	if (a->tree_depth != b->tree_depth)
+		return a->tree_depth < b->tree_depth ? -1 : 1;
+	return a < b ? -1 : (a > b);
+}
+
+/*
+ * Push the island marks of the trees down to what they contain.  The
+ * depth show_object() records is that of the first path a tree is
+ * found at, so going from the shallowest trees to the deepest gets
+ * most of them their final marks before they are pushed down.  A tree
+ * also found deeper under another one can still get more marks after
+ * that; resolve_tree_islands() pushes those down again, as an object
+ * missing a mark could take a base from an island it is not in.
+ */
+static void resolve_object_islands(void)
+{
+	struct object_entry **list;
+	struct object **trees;
+	uint32_t i, nr = 0;
+
+	list = xmalloc(nr_objects * sizeof(*list));
+	for (i = 0; i < nr_objects; i++)
+		if (objects[i].type == OBJ_TREE)
+			list[nr++] = &objects[i];
+	qsort(list, nr, sizeof(*list), tree_depth_sort);
+
+	trees = xmalloc(nr * sizeof(*trees));
+	for (i = 0; i < nr; i++)
+		trees[i] = lookup_object(list[i]->idx.sha1);
+	resolve_tree_islands(trees, nr);
+	free(trees);
+	free(list);
+}
+
 static void get_object_list(int ac, const char **av)
 {
 	struct rev_info revs;
@@ -2242,11 +2868,45 @@ static void get_object_list(int ac, const char **av)
 			die("bad revision '%s'", line);
 	}
 
+	/*
+	 * Objects can only be copied verbatim into a pack that goes out
+	 * as it is made, and when the caller did not ask for anything
+	 * else to be done with them, nor for any of them to be left out
+	 * as add_object_entry() would (--incremental, --local and
+	 * --honor-pack-keep).  Without delta reuse, every object goes
+	 * through the delta search, which finds better deltas when it
+	 * sees the objects in the order of a walk than in pack order.
+	 * A thin pack needs the walk, whose edges give the objects the
+	 * other side has as bases for the deltas.
+	 */
+	reuse_packfile.allow_ofs_delta = allow_ofs_delta;
+	if (use_bitmap_index && !write_bitmap_index && reuse_delta &&
+	    !revs.edge_hint &&
+	    !keep_unreachable && !unpack_unreachable && !use_delta_islands &&
+	    !traverse_bitmap_commit_list(&revs, show_reachable,
+					 pack_to_stdout && !incremental &&
+					 !local && !ignore_packed_keep ?
+					 &reuse_packfile : NULL)) {
+		nr_result += reuse_packfile.nr_objects;
+		display_progress(progress_state, nr_result);
+		return;
+	}
+
+	if (use_delta_islands) {
+		load_delta_islands();
+		/* the marks go from children to parents */
+		revs.topo_order = 1;
+		revs.limited = 1;
+	}
+
 	if (prepare_revision_walk(&revs))
 		die("revision walk setup failed");
 	mark_edges_uninteresting(revs.commits, &revs, show_edge);
 	traverse_commit_list(&revs, show_commit, show_object, NULL);
 
+	if (use_delta_islands)
+		resolve_object_islands();
+
 	if (keep_unreachable)
 		add_objects_in_unpacked_packs(&revs);
 	if (unpack_unreachable)
@@ -2255,7 +2915,7 @@ static void get_object_list(int ac, const char **av)
 
 int cmd_pack_objects(int argc, const char **argv, const char *prefix)
 {
-	int use_internal_rev_list = 0;
+	int use_internal_rev_list = 0, revs_given = 0;
 	int thin = 0;
 	int all_progress_implied = 0;
 	uint32_t i;
@@ -2382,6 +3042,7 @@ int cmd_pack_objects(int argc, const char **argv, const char *prefix)
 		}
 		if (!strcmp("--revs", arg)) {
 			use_internal_rev_list = 1;
+			revs_given = 1;
 			continue;
 		}
 		if (!strcmp("--keep-unreachable", arg)) {
@@ -2396,6 +3057,12 @@ int cmd_pack_objects(int argc, const char **argv, const char *prefix)
 			include_tag = 1;
 			continue;
 		}
+		if (!strcmp("--stdin-packs", arg)) {
+			stdin_packs = 1;
+			continue;
+		}
+		if (!strcmp("--unpacked", arg))
+			rev_list_unpacked = 1;
 		if (!strcmp("--unpacked", arg) ||
 		    !strcmp("--reflog", arg) ||
 		    !strcmp("--all", arg)) {
@@ -2429,6 +3096,22 @@ int cmd_pack_objects(int argc, const char **argv, const char *prefix)
 			grafts_replace_parents = 0;
 			continue;
 		}
+		if (!strcmp(arg, "--use-bitmap-index")) {
+			use_bitmap_index = 1;
+			continue;
+		}
+		if (!strcmp(arg, "--no-use-bitmap-index")) {
+			use_bitmap_index = 0;
+			continue;
+		}
+		if (!strcmp(arg, "--write-bitmap-index")) {
+			write_bitmap_index = 1;
+			continue;
+		}
+		if (!strcmp(arg, "--delta-islands")) {
+			use_delta_islands = 1;
+			continue;
+		}
 		usage(pack_usage);
 	}
 
@@ -2463,9 +3146,23 @@ int cmd_pack_objects(int argc, const char **argv, const char *prefix)
 	if (!pack_to_stdout && thin)
 		die("--thin cannot be used to build an indexable pack.");
 
+	if (write_bitmap_index && (pack_to_stdout || !use_internal_rev_list)) {
+		warning("--write-bitmap-index needs --revs and a pack on disk");
+		write_bitmap_index = 0;
+	}
+
 	if (keep_unreachable && unpack_unreachable)
 		die("--keep-unreachable and --unpack-unreachable are incompatible.");
 
+	if (stdin_packs) {
+		/* --unpacked is the only revision option that makes sense */
+		if (revs_given || thin || rp_ac != 2 + rev_list_unpacked)
+			die("--stdin-packs cannot be used with --revs, --all, "
+			    "--reflog or --thin; only --unpacked is allowed");
+		use_internal_rev_list = 0;
+		write_bitmap_index = 0;
+	}
+
 	if (progress && all_progress_implied)
 		progress = 2;
 
@@ -2473,7 +3170,9 @@ int cmd_pack_objects(int argc, const char **argv, const char *prefix)
 
 	if (progress)
 		progress_state = start_progress("Counting objects", 0);
-	if (!use_internal_rev_list)
+	if (stdin_packs)
+		read_packs_list_from_stdin();
+	else if (!use_internal_rev_list)
 		read_object_list_from_stdin();
 	else {
 		rp_av[rp_ac] = NULL;
@@ -0,0 +1,588 @@
+/*
+ * "git repack" builtin command
+ *
+ * Based on git-repack.sh, which is
+ *
+ * Copyright (c) 2005 Linus Torvalds
+ */
+
+#include "builtin.h"
+#include "cache.h"
+#include "dir.h"
+#include "parse-options.h"
+#include "run-command.h"
+#include "sigchain.h"
+#include "string-list.h"
+
+static int delta_base_offset = 1;
+static int write_bitmaps;
+static char *packdir, *packtmp;
+
+static const char * const git_repack_usage[] = {
+	"git repack [options]",
+	NULL
+};
+
+#define ALL_INTO_ONE 1
+#define LOOSEN_UNREACHABLE 2
+
+static int repack_config(const char *var, const char *value, void *cb)
+{
+	if (!strcmp(var, "repack.usedeltabaseoffset")) {
+		delta_base_offset = git_config_bool(var, value);
+		return 0;
+	}
+	if (!strcmp(var, "repack.writebitmaps")) {
+		write_bitmaps = git_config_bool(var, value);
+		return 0;
+	}
+	return git_default_config(var, value, cb);
+}
+
+/* Remove temporary "$packtmp-*" files left by pack-objects. */
+static void remove_temporary_files(void)
+{
+	struct strbuf buf = STRBUF_INIT;
+	size_t dirlen, prefixlen;
+	struct dirent *e;
+	DIR *dir;
+
+	if (!packtmp)
+		return;
+	dir = opendir(packdir);
+	if (!dir)
+		return;
+
+	strbuf_addf(&buf, "%s/", packdir);
+	dirlen = buf.len;
+	prefixlen = strlen(packtmp) - dirlen;
+	while ((e = readdir(dir)) != NULL) {
+		if (strncmp(e->d_name, packtmp + dirlen, prefixlen) ||
+		    e->d_name[prefixlen] != '-')
+			continue;
+		strbuf_setlen(&buf, dirlen);
+		strbuf_addstr(&buf, e->d_name);
+		unlink(buf.buf);
+	}
+	closedir(dir);
+	strbuf_release(&buf);
+}
+
+static void remove_pack_on_signal(int signo)
+{
+	remove_temporary_files();
+	sigchain_pop(signo);
+	raise(signo);
+}
+
+static void push_arg(const char ***argv, int *nr, int *alloc, const char *arg)
+{
+	ALLOC_GROW(*argv, *nr + 1, *alloc);
+	(*argv)[(*nr)++] = arg;
+}
+
+static void push_argf(const char ***argv, int *nr, int *alloc,
+		      const char *fmt, ...)
+{
+	struct strbuf buf = STRBUF_INIT;
+	va_list ap;
+
+	va_start(ap, fmt);
+	strbuf_vaddf(&buf, fmt, ap);
+	va_end(ap);
+	push_arg(argv, nr, alloc, strbuf_detach(&buf, NULL));
+}
+
+/*
+ * Collect the base names ("pack-<sha1>") of the packs in packdir that
+ * are not protected by a .keep file.
+ */
+static void get_non_kept_pack_filenames(struct string_list *fname_list)
+{
+	DIR *dir;
+	struct dirent *e;
+
+	dir = opendir(packdir);
+	if (!dir)
+		return;
+
+	while ((e = readdir(dir)) != NULL) {
+		size_t len = strlen(e->d_name);
+		char *fname;
+
+		if (len <= 5 || strcmp(e->d_name + len - 5, ".pack"))
+			continue;
+		fname = xmemdupz(e->d_name, len - 5);
+		if (!file_exists(mkpath("%s/%s.keep", packdir, fname)))
+			string_list_append(fname_list, fname);
+		free(fname);
+	}
+	closedir(dir);
+}
+
+static void remove_redundant_pack(const char *dir_name, const char *base_name)
+{
+	const char *exts[] = {".pack", ".idx", ".keep", ".bitmap", ".sizes", ".rev"};
+	struct strbuf buf = STRBUF_INIT;
+	size_t plen;
+	int i;
+
+	strbuf_addf(&buf, "%s/%s", dir_name, base_name);
+	plen = buf.len;
+	for (i = 0; i < ARRAY_SIZE(exts); i++) {
+		strbuf_setlen(&buf, plen);
+		strbuf_addstr(&buf, exts[i]);
+		unlink(buf.buf);
+	}
+	strbuf_release(&buf);
+}
+
+/*
+ * Geometric repacking keeps the local, non-kept packs in a geometric
+ * progression by object count: every pack has at least "factor" times
+ * as many objects as the next smaller one.  Only the smallest packs
+ * that break the progression are rewritten, so that the cost of each
+ * repack is proportional to the amount of new data rather than to the
+ * size of the repository.
+ */
+struct pack_geometry {
+	struct packed_git **pack;
+	int pack_nr, pack_alloc;
+	int split;
+};
+
+static uint32_t geometry_pack_weight(struct packed_git *p)
+{
+	if (open_pack_index(p))
+		die("cannot open index for %s", p->pack_name);
+	return p->num_objects;
+}
+
+static int geometry_cmp(const void *va, const void *vb)
+{
+	uint32_t aw = geometry_pack_weight(*(struct packed_git **)va),
+		 bw = geometry_pack_weight(*(struct packed_git **)vb);
+
+	if (aw < bw)
+		return -1;
+	if (aw > bw)
+		return 1;
+	return 0;
+}
+
+static void init_pack_geometry(struct pack_geometry *geometry)
+{
+	struct packed_git *p;
+
+	memset(geometry, 0, sizeof(*geometry));
+	prepare_packed_git();
+	for (p = packed_git; p; p = p->next) {
+		if (!p->pack_local || p->pack_keep)
+			continue;
+		ALLOC_GROW(geometry->pack, geometry->pack_nr + 1,
+			   geometry->pack_alloc);
+		geometry->pack[geometry->pack_nr++] = p;
+	}
+	qsort(geometry->pack, geometry->pack_nr, sizeof(*geometry->pack),
+	      geometry_cmp);
+}
+
+/* Loose objects are rolled up into the new pack, too. */
+static uint32_t count_loose_objects(void)
+{
+	struct strbuf path = STRBUF_INIT;
+	uint32_t count = 0;
+	size_t baselen;
+	int i;
+
+	strbuf_addstr(&path, get_object_directory());
+	baselen = path.len;
+	for (i = 0; i < 256; i++) {
+		struct dirent *de;
+		DIR *dir;
+
+		strbuf_setlen(&path, baselen);
+		strbuf_addf(&path, "/%02x", i);
+		dir = opendir(path.buf);
+		if (!dir)
+			continue;
+		while ((de = readdir(dir)) != NULL)
+			if (strlen(de->d_name) == 38)
+				count++;
+		closedir(dir);
+	}
+	strbuf_release(&path);
+	return count;
+}
+
+static void split_pack_geometry(struct pack_geometry *geometry, int factor)
+{
+	uint64_t total = count_loose_objects();
+	int i, split;
+
+	if (!geometry->pack_nr)
+		return;
+
+	/*
+	 * Find the largest pack that is not at least "factor" times
+	 * bigger than its smaller neighbour; it and everything smaller
+	 * need to be combined.
+	 */
+	for (i = geometry->pack_nr - 1; i > 0; i--) {
+		uint64_t ours = geometry_pack_weight(geometry->pack[i]);
+		uint64_t prev = geometry_pack_weight(geometry->pack[i - 1]);
+		if (ours < factor * prev)
+			break;
+	}
+	split = i ? i + 1 : 0;
+
+	/*
+	 * The combined pack, loose objects included, may itself be too
+	 * big to sit below the next pack, so keep absorbing larger packs
+	 * until it fits.
+	 */
+	for (i = 0; i < split; i++)
+		total += geometry_pack_weight(geometry->pack[i]);
+	for (i = split; i < geometry->pack_nr; i++) {
+		uint64_t ours = geometry_pack_weight(geometry->pack[i]);
+		if (ours >= factor * total)
+			break;
+		split++;
+		total += ours;
+	}
+	geometry->split = split;
+}
+
+static const char *pack_basename(struct packed_git *p)
+{
+	const char *base = strrchr(p->pack_name, '/');
+	return base ? base + 1 : p->pack_name;
+}
+
+int cmd_repack(int argc, const char **argv, const char *prefix)
+{
+	const char *exts[] = {".pack", ".idx", ".bitmap", ".sizes", ".rev"};
+	struct child_process cmd;
+	struct string_list_item *item;
+	struct string_list names = STRING_LIST_INIT_DUP;
+	struct string_list rollback = STRING_LIST_INIT_DUP;
+	struct string_list existing_packs = STRING_LIST_INIT_DUP;
+	struct strbuf line = STRBUF_INIT;
+	struct pack_geometry geometry;
+	const char **args = NULL;
+	int nr_args = 0, alloc_args = 0;
+	int i, ext, ret, failed;
+	FILE *out;
+
+	/* variables to be filled by option parsing */
+	int pack_everything = 0;
+	int delete_redundant = 0;
+	const char *window = NULL, *window_memory = NULL;
+	const char *depth = NULL;
+	const char *max_pack_size = NULL;
+	int no_reuse_delta = 0, no_reuse_object = 0;
+	int no_update_server_info = 0;
+	int quiet = 0;
+	int local = 0;
+	int delta_islands = 0;
+	int geometric_factor = 0;
+
+	struct option builtin_repack_options[] = {
+		OPT_BIT('a', NULL, &pack_everything,
+				"pack everything in a single pack", ALL_INTO_ONE),
+		OPT_BIT('A', NULL, &pack_everything,
+				"same as -a, and turn unreachable objects loose",
+				   LOOSEN_UNREACHABLE | ALL_INTO_ONE),
+		OPT_BOOLEAN('b', "write-bitmap-index", &write_bitmaps,
+				"write a bitmap index (requires -a or -A)"),
+		OPT_BOOLEAN('d', NULL, &delete_redundant,
+				"remove redundant packs, and run git-prune-packed"),
+		OPT_BOOLEAN('f', NULL, &no_reuse_delta,
+				"pass --no-reuse-delta to git-pack-objects"),
+		OPT_BOOLEAN('F', NULL, &no_reuse_object,
+				"pass --no-reuse-object to git-pack-objects"),
+		OPT_BOOLEAN('i', "delta-islands", &delta_islands,
+				"pass --delta-islands to git-pack-objects"),
+		OPT_BOOLEAN('n', NULL, &no_update_server_info,
+				"do not run git-update-server-info"),
+		OPT__QUIET(&quiet, "be quiet"),
+		OPT_BOOLEAN('l', "local", &local,
+				"pass --local to git-pack-objects"),
+		OPT_INTEGER('g', "geometric", &geometric_factor,
+				"only repack the smallest packs, keeping a geometric progression of pack sizes with this factor"),
+		OPT_GROUP("Packing constraints"),
+		OPT_STRING(0, "window", &window, "n",
+				"size of the window used for delta compression"),
+		OPT_STRING(0, "window-memory", &window_memory, "bytes",
+				"same as the above, but limit memory size instead of entries count"),
+		OPT_STRING(0, "depth", &depth, "n",
+				"limits the maximum delta depth"),
+		OPT_STRING(0, "max-pack-size", &max_pack_size, "bytes",
+				"maximum size of each packfile"),
+		OPT_END()
+	};
+
+	git_config(repack_config, NULL);
+
+	argc = parse_options(argc, argv, prefix, builtin_repack_options,
+				git_repack_usage, 0);
+	if (argc)
+		usage_with_options(git_repack_usage, builtin_repack_options);
+
+	if (geometric_factor) {
+		if (geometric_factor < 2)
+			die("--geometric factor must be at least 2");
+		if (pack_everything)
+			die("--geometric is incompatible with -a and -A");
+	}
+
+	packdir = xstrdup(mkpath("%s/pack", get_object_directory()));
+	packtmp = xstrdup(mkpath("%s/.tmp-%d-pack", packdir, (int)getpid()));
+
+	remove_temporary_files();
+	sigchain_push_common(remove_pack_on_signal);
+	atexit(remove_temporary_files);
+
+	push_arg(&args, &nr_args, &alloc_args, "pack-objects");
+	push_arg(&args, &nr_args, &alloc_args, "--keep-true-parents");
+	push_arg(&args, &nr_args, &alloc_args, "--honor-pack-keep");
+	push_arg(&args, &nr_args, &alloc_args, "--non-empty");
+	if (geometric_factor) {
+		init_pack_geometry(&geometry);
+		split_pack_geometry(&geometry, geometric_factor);
+		push_arg(&args, &nr_args, &alloc_args, "--stdin-packs");
+		push_arg(&args, &nr_args, &alloc_args, "--unpacked");
+		for (i = 0; i < geometry.split; i++) {
+			const char *base = pack_basename(geometry.pack[i]);
+			char *fname = xmemdupz(base, strlen(base) - 5);
+			string_list_append(&existing_packs, fname);
+			free(fname);
+		}
+	} else {
+		push_arg(&args, &nr_args, &alloc_args, "--all");
+		push_arg(&args, &nr_args, &alloc_args, "--reflog");
+	}
+	if (window)
+		push_argf(&args, &nr_args, &alloc_args, "--window=%s", window);
+	if (window_memory)
+		push_argf(&args, &nr_args, &alloc_args, "--window-memory=%s", window_memory);
+	if (depth)
+		push_argf(&args, &nr_args, &alloc_args, "--depth=%s", depth);
+	if (max_pack_size)
+		push_argf(&args, &nr_args, &alloc_args, "--max-pack-size=%s", max_pack_size);
+
+	if (geometric_factor)
+		; /* the packs to combine are fed on stdin below */
+	else if (!(pack_everything & ALL_INTO_ONE)) {
+		push_arg(&args, &nr_args, &alloc_args, "--unpacked");
+		push_arg(&args, &nr_args, &alloc_args, "--incremental");
+	} else {
+		get_non_kept_pack_filenames(&existing_packs);
+
+		if (existing_packs.nr && delete_redundant &&
+		    (pack_everything & LOOSEN_UNREACHABLE))
+			push_arg(&args, &nr_args, &alloc_args,
+				 "--unpack-unreachable");
+		if (write_bitmaps > 0)
+			push_arg(&args, &nr_args, &alloc_args,
+				 "--write-bitmap-index");
+	}
+
+	if (local)
+		push_arg(&args, &nr_args, &alloc_args, "--local");
+	if (quiet)
+		push_arg(&args, &nr_args, &alloc_args, "-q");
+	if (no_reuse_object)
+		push_arg(&args, &nr_args, &alloc_args, "--no-reuse-object");
+	else if (no_reuse_delta)
+		push_arg(&args, &nr_args, &alloc_args, "--no-reuse-delta");
+	if (delta_base_offset)
+		push_arg(&args, &nr_args, &alloc_args, "--delta-base-offset");
+	if (delta_islands)
+		push_arg(&args, &nr_args, &alloc_args, "--delta-islands");
+
+	if (safe_create_leading_directories_const(packtmp) < 0)
+		die_errno("unable to create '%s'", packdir);
+	push_arg(&args, &nr_args, &alloc_args, packtmp);
+	push_arg(&args, &nr_args, &alloc_args, NULL);
+
+	memset(&cmd, 0, sizeof(cmd));
+	cmd.argv = args;
+	cmd.git_cmd = 1;
+	cmd.out = -1;
+	if (geometric_factor)
+		cmd.in = -1;
+	else
+		cmd.no_stdin = 1;
+
+	ret = start_command(&cmd);
+	if (ret)
+		return ret;
+
+	if (geometric_factor) {
+		FILE *in = xfdopen(cmd.in, "w");
+		for (i = 0; i < geometry.pack_nr; i++)
+			fprintf(in, "%s%s\n", i < geometry.split ? "" : "^",
+				pack_basename(geometry.pack[i]));
+		fclose(in);
+	}
+
+	out = xfdopen(cmd.out, "r");
+	while (strbuf_getline(&line, out, '\n') != EOF) {
+		if (line.len != 40)
+			die("repack: Expecting 40 character sha1 lines only from pack-objects.");
+		string_list_append(&names, line.buf);
+	}
+	fclose(out);
+	ret = finish_command(&cmd);
+	if (ret)
+		return ret;
+	strbuf_release(&line);
+
+	if (!names.nr && !quiet)
+		printf("Nothing new to pack.\n");
+
+	/*
+	 * Ok we have prepared all new packfiles.
+	 * First see if there are packs of the same name and if so
+	 * if we can move them out of the way (this can happen if we
+	 * repacked immediately after packing fully.
+	 */
+	failed = 0;
+	for_each_string_list_item(item, &names) {
+		for (ext = 0; ext < ARRAY_SIZE(exts); ext++) {
+			char *fname, *fname_old;
+			fname = xstrdup(mkpath("%s/pack-%s%s", packdir,
+						item->string, exts[ext]));
+			if (!file_exists(fname)) {
+				free(fname);
+				continue;
+			}
+
+			fname_old = xstrdup(mkpath("%s/old-pack-%s%s", packdir,
+						   item->string, exts[ext]));
+			if ((file_exists(fname_old) && unlink(fname_old)) ||
+			    rename(fname, fname_old)) {
+				free(fname);
+				free(fname_old);
+				failed = 1;
+				break;
+			}
+			string_list_append(&rollback, fname_old);
+			free(fname);
+			free(fname_old);
+		}
+		if (failed)
+			break;
+	}
+	if (failed) {
+		struct string_list rollback_failure = STRING_LIST_INIT_DUP;
+		for_each_string_list_item(item, &rollback) {
+			char *fname, *fname_old;
+			fname_old = item->string;
+			fname = xstrdup(fname_old);
+			memmove(strrchr(fname, '/') + 1,
+				strrchr(fname, '/') + 5,
+				strlen(strrchr(fname, '/') + 5) + 1);
+			if (rename(fname_old, fname))
+				string_list_append(&rollback_failure, fname);
+			free(fname);
+		}
+
+		if (rollback_failure.nr) {
+			int i;
+			fprintf(stderr,
+				"WARNING: Some packs in use have been renamed by\n"
+				"WARNING: prefixing old- to their name, in order to\n"
+				"WARNING: replace them with the new version of the\n"
+				"WARNING: file.  But the operation failed, and the\n"
+				"WARNING: attempt to rename them back to their\n"
+				"WARNING: original names also failed.\n"
+				"WARNING: Please rename them in %s manually:\n", packdir);
+			for (i = 0; i < rollback_failure.nr; i++)
+				fprintf(stderr, "WARNING:   old-%s -> %s\n",
+					strrchr(rollback_failure.items[i].string, '/') + 1,
+					strrchr(rollback_failure.items[i].string, '/') + 1);
+		}
+		exit(1);
+	}
+
+	/* Now the ones with the same name are out of the way... */
+	for_each_string_list_item(item, &names) {
+		for (ext = 0; ext < ARRAY_SIZE(exts); ext++) {
+			char *fname, *fname_old;
+			struct stat statbuffer;
+			fname = xstrdup(mkpath("%s/pack-%s%s",
+					packdir, item->string, exts[ext]));
+			fname_old = xstrdup(mkpath("%s-%s%s",
+					packtmp, item->string, exts[ext]));
+			if (!stat(fname_old, &statbuffer)) {
+				statbuffer.st_mode &= ~(S_IWUSR | S_IWGRP | S_IWOTH);
+				chmod(fname_old, statbuffer.st_mode);
+				if (rename(fname_old, fname))
+					die_errno("renaming '%s' failed", fname_old);
+			} else if (ext < 2) {
+				/* the .pack and .idx must be there */
+				die_errno("missing '%s'", fname_old);
+			}
+			free(fname);
+			free(fname_old);
+		}
+	}
+
+	/* Remove the "old-" files */
+	for_each_string_list_item(item, &names) {
+		for (ext = 0; ext < ARRAY_SIZE(exts); ext++) {
+			char *fname;
+			fname = mkpath("%s/old-pack-%s%s",
+					packdir, item->string, exts[ext]);
+			if (file_exists(fname))
+				unlink_or_warn(fname);
+		}
+	}
+
+	/* End of pack replacement. */
+
+	if (delete_redundant) {
+		const char *argv_prune[] = {"prune-packed", NULL, NULL};
+
+		/* We know existing_packs are all redundant. */
+		sort_string_list(&names);
+		for_each_string_list_item(item, &existing_packs) {
+			char *sha1;
+			size_t len = strlen(item->string);
+			if (len < 40)
+				continue;
+			sha1 = item->string + len - 40;
+			if (!string_list_has_string(&names, sha1))
+				remove_redundant_pack(packdir, item->string);
+		}
+		if (quiet)
+			argv_prune[1] = "-q";
+		run_command_v_opt(argv_prune, RUN_GIT_CMD);
+	}
+
+	/* Keep an existing multi-pack-index covering the packs we now have. */
+	if (file_exists(mkpath("%s/multi-pack-index", packdir))) {
+		const char *argv_midx[] = {"multi-pack-index", "write", NULL};
+		if (run_command_v_opt(argv_midx, RUN_GIT_CMD))
+			return 1;
+	}
+
+	/* Add the blobs we just packed to an existing grep index. */
+	if (file_exists(git_path("objects/info/grep-index"))) {
+		const char *argv_gidx[] = {"grep-index", "write", NULL};
+		if (run_command_v_opt(argv_gidx, RUN_GIT_CMD))
+			return 1;
+	}
+
+	if (!no_update_server_info) {
+		const char *argv_update[] = {"update-server-info", NULL};
+		run_command_v_opt(argv_update, RUN_GIT_CMD);
+	}
+
+	string_list_clear(&names, 0);
+	string_list_clear(&rollback, 0);
+	string_list_clear(&existing_packs, 0);
+	return 0;
+}
@@ -97,6 +97,7 @@ static void print_new_head_line(struct commit *commit)
 
 	hex = find_unique_abbrev(commit->object.sha1, DEFAULT_ABBREV);
 	printf(_("HEAD is now at %s"), hex);
+	load_commit_buffer(commit);
 	body = strstr(commit->buffer, "\n\n");
 	if (body) {
 		const char *eol;
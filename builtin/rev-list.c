@@ -7,6 +7,7 @@
 #include "log-tree.h"
 #include "graph.h"
 #include "bisect.h"
+#include "pack-bitmap.h"
 
 static const char rev_list_usage[] =
 "git rev-list [OPTION] <commit-id>... [ -- paths... ]\n"
@@ -35,6 +36,7 @@ static const char rev_list_usage[] =
 "    --parents\n"
 "    --children\n"
 "    --objects | --objects-edge\n"
+"    --use-bitmap-index\n"
 "    --unpacked\n"
 "    --header | --pretty\n"
 "    --abbrev=<n> | --no-abbrev\n"
@@ -198,6 +200,13 @@ static void show_edge(struct commit *commit)
 	printf("-%s\n", sha1_to_hex(commit->object.sha1));
 }
 
+static void show_reachable(const unsigned char *sha1, enum object_type type,
+			   uint32_t name_hash,
+			   struct packed_git *found_pack, off_t found_offset)
+{
+	printf("%s\n", sha1_to_hex(sha1));
+}
+
 static inline int log2i(int n)
 {
 	int log2 = 0;
@@ -312,6 +321,22 @@ static int show_bisect_vars(struct rev_list_info *info, int reaches, int all)
 	return 0;
 }
 
+/*
+ * Listing all objects reachable from refs that are all wanted will
+ * create an object for most of what is in the repository.
+ */
+static int walks_all_objects(struct rev_info *revs)
+{
+	int i;
+
+	if (!revs->tree_objects || !revs->blob_objects || revs->max_count >= 0)
+		return 0;
+	for (i = 0; i < revs->pending.nr; i++)
+		if (revs->pending.objects[i].item->flags & UNINTERESTING)
+			return 0;
+	return 1;
+}
+
 int cmd_rev_list(int argc, const char **argv, const char *prefix)
 {
 	struct rev_info revs;
@@ -321,6 +346,7 @@ int cmd_rev_list(int argc, const char **argv, const char *prefix)
 	int bisect_show_vars = 0;
 	int bisect_find_all = 0;
 	int quiet = 0;
+	int use_bitmap_index = 0;
 
 	git_config(git_default_config, NULL);
 	init_revisions(&revs, prefix);
@@ -361,6 +387,10 @@ int cmd_rev_list(int argc, const char **argv, const char *prefix)
 			bisect_show_vars = 1;
 			continue;
 		}
+		if (!strcmp(arg, "--use-bitmap-index")) {
+			use_bitmap_index = 1;
+			continue;
+		}
 		usage(rev_list_usage);
 
 	}
@@ -388,6 +418,22 @@ int cmd_rev_list(int argc, const char **argv, const char *prefix)
 	if (bisect_list)
 		revs.limited = 1;
 
+	/*
+	 * The bitmaps only know which objects are reachable, so they
+	 * can only stand in for a plain "--objects" listing; the
+	 * objects are shown without their path names.
+	 */
+	if (use_bitmap_index && !bisect_list && !revs.count &&
+	    !revs.edge_hint && !revs.graph && !revs.print_parents &&
+	    !revs.left_right && !revs.boundary && !revs.verbose_header &&
+	    revs.commit_format == CMIT_FMT_UNSPECIFIED &&
+	    !info.show_timestamp && !quiet &&
+	    !traverse_bitmap_commit_list(&revs, show_reachable, NULL))
+		return 0;
+
+	if (walks_all_objects(&revs))
+		reserve_object_hash(approximate_object_count());
+
 	if (prepare_revision_walk(&revs))
 		die("revision walk setup failed");
 	if (revs.tree_objects)
@@ -51,7 +51,8 @@ static int in_commit_list(const struct commit_list *want, struct commit *c)
 }
 
 static int contains_recurse(struct commit *candidate,
-			    const struct commit_list *want)
+			    const struct commit_list *want,
+			    uint32_t cutoff)
 {
 	struct commit_list *p;
 
@@ -68,9 +69,16 @@ static int contains_recurse(struct commit *candidate,
 	if (parse_commit(candidate) < 0)
 		return 0;
 
+	/* too old to reach any of the want commits? */
+	if (candidate->generation != GENERATION_NUMBER_UNKNOWN &&
+	    candidate->generation < cutoff) {
+		candidate->object.flags |= UNINTERESTING;
+		return 0;
+	}
+
 	/* Otherwise recurse and mark ourselves for future traversals. */
 	for (p = candidate->parents; p; p = p->next) {
-		if (contains_recurse(p->item, want)) {
+		if (contains_recurse(p->item, want, cutoff)) {
 			candidate->object.flags |= TMP_MARK;
 			return 1;
 		}
@@ -79,9 +87,35 @@ static int contains_recurse(struct commit *candidate,
 	return 0;
 }
 
+/*
+ * The smallest generation number among the want commits; a commit
+ * with a lower generation cannot contain any of them.
+ */
+static uint32_t contains_cutoff(const struct commit_list *want)
+{
+	uint32_t cutoff = GENERATION_NUMBER_MAX;
+
+	for (; want; want = want->next) {
+		struct commit *c = want->item;
+		if (parse_commit(c) < 0 ||
+		    c->generation == GENERATION_NUMBER_UNKNOWN)
+			return GENERATION_NUMBER_UNKNOWN;
+		if (c->generation < cutoff)
+			cutoff = c->generation;
+	}
+	return cutoff;
+}
+
 static int contains(struct commit *candidate, const struct commit_list *want)
 {
-	return contains_recurse(candidate, want);
+	static int cutoff_computed;
+	static uint32_t cutoff;
+
+	if (!cutoff_computed) {
+		cutoff = contains_cutoff(want);
+		cutoff_computed = 1;
+	}
+	return contains_recurse(candidate, want, cutoff);
 }
 
 static int show_reference(const char *refname, const unsigned char *sha1,
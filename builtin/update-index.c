@@ -11,6 +11,8 @@
 #include "refs.h"
 #include "resolve-undo.h"
 #include "parse-options.h"
+#include "split-index.h"
+#include "dir.h"
 
 /*
  * Default to not allowing changes to the list of files. The
@@ -711,6 +713,9 @@ int cmd_update_index(int argc, const char **argv, const char *prefix)
 	char set_executable_bit = 0;
 	struct refresh_params refresh_args = {0, &has_errors};
 	int lock_error = 0;
+	int preferred_index_format = 0;
+	int split_index = -1;
+	int untracked_cache = -1;
 	struct lock_file *lock_file;
 	struct parse_opt_ctx_t ctx;
 	int parseopt_state = PARSE_OPT_UNKNOWN;
@@ -791,6 +796,12 @@ int cmd_update_index(int argc, const char **argv, const char *prefix)
 			"(for porcelains) forget saved unresolved conflicts",
 			PARSE_OPT_NOARG | PARSE_OPT_NONEG,
 			resolve_undo_clear_callback},
+		OPT_INTEGER(0, "index-version", &preferred_index_format,
+			"write index in this format"),
+		OPT_SET_INT(0, "split-index", &split_index,
+			"enable or disable split index", 1),
+		OPT_SET_INT(0, "untracked-cache", &untracked_cache,
+			"enable or disable the untracked cache", 1),
 		OPT_END()
 	};
 
@@ -852,6 +863,53 @@ int cmd_update_index(int argc, const char **argv, const char *prefix)
 	}
 	argc = parse_options_end(&ctx);
 
+	if (preferred_index_format) {
+		if (preferred_index_format < INDEX_FORMAT_LB ||
+		    INDEX_FORMAT_UB < preferred_index_format)
+			die("index-version %d not in range: %d..%d",
+			    preferred_index_format,
+			    INDEX_FORMAT_LB, INDEX_FORMAT_UB);
+
+		if (the_index.version != preferred_index_format)
+			active_cache_changed = 1;
+		the_index.version = preferred_index_format;
+	}
+
+	if (split_index > 0) {
+		if (!core_split_index)
+			warning("core.splitIndex is set to false; "
+				"remove or change it, if you really want to "
+				"enable split index");
+		init_split_index(&the_index);
+		active_cache_changed = 1;
+	} else if (!split_index && the_index.split_index) {
+		if (core_split_index > 0)
+			warning("core.splitIndex is set to true; "
+				"remove or change it, if you really want to "
+				"disable split index");
+		release_split_index(&the_index);
+		active_cache_changed = 1;
+	}
+
+	if (untracked_cache > 0) {
+		if (!core_untracked_cache)
+			warning("core.untrackedCache is set to false; "
+				"remove or change it, if you really want to "
+				"enable the untracked cache");
+		if (!the_index.untracked) {
+			the_index.untracked = new_untracked_cache();
+			active_cache_changed = 1;
+		}
+	} else if (!untracked_cache && the_index.untracked) {
+		if (core_untracked_cache > 0)
+			warning("core.untrackedCache is set to true; "
+				"remove or change it, if you really want to "
+				"disable the untracked cache");
+		free_untracked_cache(the_index.untracked);
+		the_index.untracked = NULL;
+		active_cache_changed = 1;
+	}
+
 	if (read_from_stdin) {
 		struct strbuf buf = STRBUF_INIT, nbuf = STRBUF_INIT;
 
@@ -104,6 +104,9 @@ struct cache_header {
 	unsigned int hdr_entries;
 };
 
+#define INDEX_FORMAT_LB 2
+#define INDEX_FORMAT_UB 4
+
 /*
  * The "cache_time" is just the low 32 bits of the
  * time. It doesn't matter if it overflows - we only
@@ -198,6 +201,7 @@ struct cache_entry {
 
 #define CE_UNPACKED          (1 << 24)
 #define CE_NEW_SKIP_WORKTREE (1 << 25)
+#define CE_FSMONITOR_VALID   (1 << 26)
 
 /*
  * Extended on-disk flags
@@ -311,13 +315,23 @@ static inline unsigned int canon_mode(unsigned int mode)
 
 struct index_state {
 	struct cache_entry **cache;
+	unsigned int version;
 	unsigned int cache_nr, cache_alloc, cache_changed;
 	struct string_list *resolve_undo;
 	struct cache_tree *cache_tree;
+	struct split_index *split_index;
+	struct untracked_cache *untracked;
 	struct cache_time timestamp;
+	unsigned char sha1[20];
 	void *alloc;
+	uint64_t fsmonitor_last_update;
+	/* positions from the fsmonitor extension, only while reading */
+	unsigned int *fsmonitor_dirty;
+	unsigned int fsmonitor_dirty_nr, fsmonitor_dirty_alloc;
 	unsigned name_hash_initialized : 1,
-		 initialized : 1;
+		 initialized : 1,
+		 fsmonitor_has_extension : 1,
+		 fsmonitor_has_run_once : 1;
 	struct hash_table name_hash;
 };
 
@@ -595,10 +609,16 @@ extern int core_compression_seen;
 extern size_t packed_git_window_size;
 extern size_t packed_git_limit;
 extern size_t delta_base_cache_limit;
+extern unsigned long delta_base_cache_entries;
 extern unsigned long big_file_threshold;
 extern int read_replace_refs;
 extern int fsync_object_files;
 extern int core_preload_index;
+extern int core_commit_graph;
+extern int core_multi_pack_index;
+extern int core_split_index;
+extern int core_untracked_cache;
+extern const char *core_fsmonitor;
 extern int core_apply_sparse_checkout;
 
 enum branch_track {
@@ -756,6 +776,7 @@ static inline void *read_sha1_file(const unsigned char *sha1, enum object_type *
 {
 	return read_sha1_file_extended(sha1, type, size, READ_SHA1_FILE_REPLACE);
 }
+
 extern const unsigned char *do_lookup_replace_object(const unsigned char *sha1);
 static inline const unsigned char *lookup_replace_object(const unsigned char *sha1)
 {
@@ -766,6 +787,49 @@ static inline const unsigned char *lookup_replace_object(const unsigned char *sh
 
 /* Read and unpack a sha1 file into memory, write memory to a sha1 file */
 extern int sha1_object_info(const unsigned char *, unsigned long *);
+
+/*
+ * Read many objects at once, in an order that suits the object store;
+ * the requests are filled in place.  "type" is negative for missing
+ * objects, and "buf" is left NULL, for the caller to read the object
+ * itself, for objects too big to be read with the rest of the batch.
+ * With "want_contents" unset, only "type" and "size" are filled, as
+ * with sha1_object_info().
+ */
+struct object_read_request {
+	unsigned char sha1[20];
+	enum object_type type;
+	unsigned long size;
+	void *buf;
+};
+extern void read_object_batch(struct object_read_request *, int nr, int want_contents);
+
+/*
+ * Read an object in two steps, for threaded callers that have to
+ * serialize their calls into the object store: prepare_object_read()
+ * must be called under the caller's lock, and does what needs global
+ * state (finding the object, and reading the base of a delta), but
+ * leaves the inflation of the object or its delta in "po";
+ * finish_object_read() does that, and may be called without the lock.
+ * prepare_object_read() returns -1 if the object is missing, and
+ * finish_object_read() returns NULL if it is corrupt, in which case
+ * read_sha1_file() can be called under the lock to report the error.
+ */
+struct prepared_object {
+	unsigned char sha1[20];
+	enum object_type type;
+	unsigned long size;
+	void *data;		/* read already */
+	void *map;		/* loose */
+	unsigned long mapsize;
+	unsigned char *zdata;	/* packed; compressed */
+	unsigned long zsize;
+	void *base;		/* the delta base, if zdata is a delta */
+	unsigned long base_size;
+};
+extern int prepare_object_read(const unsigned char *sha1, struct prepared_object *po);
+extern void *finish_object_read(struct prepared_object *po, enum object_type *type, unsigned long *size);
+
 extern int hash_sha1_file(const void *buf, unsigned long len, const char *type, unsigned char *sha1);
 extern int write_sha1_file(const void *buf, unsigned long len, const char *type, unsigned char *return_sha1);
 extern int pretend_sha1_file(void *, unsigned long, enum object_type, unsigned char *);
@@ -925,12 +989,20 @@ struct pack_window {
 	unsigned int inuse_cnt;
 };
 
+struct revindex_entry;
+
 extern struct packed_git {
 	struct packed_git *next;
 	struct pack_window *windows;
 	off_t pack_size;
 	const void *index_data;
 	size_t index_size;
+	const void *sizes_data;
+	size_t sizes_size;
+	struct revindex_entry *revindex;
+	const uint32_t *revindex_map;
+	const void *revindex_data;
+	size_t revindex_size;
 	uint32_t num_objects;
 	uint32_t num_bad_objects;
 	unsigned char *bad_object_sha1;
@@ -939,7 +1011,9 @@ extern struct packed_git {
 	int pack_fd;
 	unsigned pack_local:1,
 		 pack_keep:1,
-		 do_not_close:1;
+		 do_not_close:1,
+		 multi_pack_index:1,
+		 sizes_checked:1;
 	unsigned char sha1[20];
 	/* something like ".git/objects/pack/xxxxx.pack" */
 	char pack_name[FLEX_ARRAY]; /* more */
@@ -997,6 +1071,7 @@ extern struct packed_git *parse_pack_index(unsigned char *sha1, const char *idx_
 
 extern void prepare_packed_git(void);
 extern void reprepare_packed_git(void);
+extern unsigned long approximate_object_count(void);
 extern void install_packed_git(struct packed_git *pack);
 
 extern struct packed_git *find_sha1_pack(const unsigned char *sha1,
@@ -1017,6 +1092,7 @@ extern off_t find_pack_entry_one(const unsigned char *, struct packed_git *);
 extern void *unpack_entry(struct packed_git *, off_t, enum object_type *, unsigned long *);
 extern unsigned long unpack_object_header_buffer(const unsigned char *buf, unsigned long len, enum object_type *type, unsigned long *sizep);
 extern unsigned long get_size_from_delta(struct packed_git *, struct pack_window **, off_t);
+extern int packed_object_size(struct packed_git *, const unsigned char *, unsigned long *);
 extern int unpack_object_header(struct packed_git *, struct pack_window **, off_t *, unsigned long *);
 
 struct object_info {
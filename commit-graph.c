@@ -0,0 +1,521 @@
+#include "cache.h"
+#include "commit.h"
+#include "refs.h"
+#include "diff.h"
+#include "revision.h"
+#include "csum-file.h"
+#include "commit-graph.h"
+
+#define GRAPH_HEADER_SIZE 16
+#define GRAPH_FANOUT_SIZE (256 * 4)
+#define GRAPH_PARENT_CORRUPT 0x7fffffff
+
+struct commit_graph {
+	const unsigned char *map;
+	size_t size;
+	uint32_t nr;
+	uint32_t nr_extra;
+	const uint32_t *fanout;
+	const unsigned char *names;
+	const unsigned char *records;
+	const uint32_t *extra;
+};
+
+static struct commit_graph *graph;
+
+static char *commit_graph_path(void)
+{
+	return xstrdup(git_path("objects/info/commit-graph"));
+}
+
+static struct commit_graph *load_commit_graph(const char *path)
+{
+	struct commit_graph *g;
+	struct stat st;
+	const uint32_t *hdr;
+	size_t size, expect;
+	void *map;
+	int fd;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return NULL;
+	if (fstat(fd, &st)) {
+		close(fd);
+		return NULL;
+	}
+	size = xsize_t(st.st_size);
+	if (size < GRAPH_HEADER_SIZE + GRAPH_FANOUT_SIZE + 20) {
+		close(fd);
+		error("commit-graph file %s is too small", path);
+		return NULL;
+	}
+	map = xmmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	hdr = map;
+	if (ntohl(hdr[0]) != GRAPH_SIGNATURE) {
+		error("commit-graph file %s has a bad signature", path);
+		goto fail;
+	}
+	if (ntohl(hdr[1]) != GRAPH_VERSION) {
+		error("commit-graph file %s is version %"PRIu32
+		      " and we only understand version %d",
+		      path, ntohl(hdr[1]), GRAPH_VERSION);
+		goto fail;
+	}
+
+	g = xcalloc(1, sizeof(*g));
+	g->map = map;
+	g->size = size;
+	g->nr = ntohl(hdr[2]);
+	g->nr_extra = ntohl(hdr[3]);
+	g->fanout = (const uint32_t *)(g->map + GRAPH_HEADER_SIZE);
+	g->names = g->map + GRAPH_HEADER_SIZE + GRAPH_FANOUT_SIZE;
+	g->records = g->names + (size_t)g->nr * 20;
+	g->extra = (const uint32_t *)(g->records +
+				      (size_t)g->nr * GRAPH_RECORD_SIZE);
+
+	expect = GRAPH_HEADER_SIZE + GRAPH_FANOUT_SIZE +
+		(size_t)g->nr * (20 + GRAPH_RECORD_SIZE) +
+		(size_t)g->nr_extra * 4 + 20;
+	if (size != expect || ntohl(g->fanout[255]) != g->nr) {
+		error("commit-graph file %s is corrupt", path);
+		free(g);
+		goto fail;
+	}
+	return g;
+
+fail:
+	munmap(map, size);
+	return NULL;
+}
+
+static int count_replace_ref(const char *refname, const unsigned char *sha1,
+			     int flags, void *cb_data)
+{
+	return 1;
+}
+
+static int has_graft(const struct commit_graft *graft, void *cb_data)
+{
+	return 1;
+}
+
+/*
+ * The commit-graph records the parents found in the commit objects
+ * themselves; it cannot be used when grafts (including those of a
+ * shallow repository) or replace refs change them.
+ */
+static int prepare_commit_graph(void)
+{
+	static int prepared;
+
+	if (!prepared) {
+		prepared = 1;
+		prepare_commit_graft();
+		if (core_commit_graph &&
+		    !(read_replace_refs &&
+		      for_each_replace_ref(count_replace_ref, NULL))) {
+			char *path = commit_graph_path();
+			graph = load_commit_graph(path);
+			free(path);
+		}
+	}
+	if (!graph)
+		return 0;
+	/* shallow grafts can be registered at any time */
+	return !for_each_commit_graft(has_graft, NULL);
+}
+
+static int graph_position(struct commit_graph *g, const unsigned char *sha1,
+			  uint32_t *pos)
+{
+	uint32_t lo, hi;
+
+	lo = sha1[0] ? ntohl(g->fanout[sha1[0] - 1]) : 0;
+	hi = ntohl(g->fanout[sha1[0]]);
+	if (hi > g->nr || lo > hi)
+		return 0;
+	while (lo < hi) {
+		uint32_t mi = lo + (hi - lo) / 2;
+		int cmp = hashcmp(sha1, g->names + (size_t)mi * 20);
+		if (!cmp) {
+			*pos = mi;
+			return 1;
+		}
+		if (cmp < 0)
+			hi = mi;
+		else
+			lo = mi + 1;
+	}
+	return 0;
+}
+
+static const unsigned char *graph_record(struct commit_graph *g, uint32_t pos)
+{
+	return g->records + (size_t)pos * GRAPH_RECORD_SIZE;
+}
+
+/*
+ * Position of the n-th parent of a commit, GRAPH_PARENT_NONE past
+ * the last one, or something at least g->nr if the file is corrupt.
+ */
+static uint32_t graph_parent(struct commit_graph *g,
+			     const unsigned char *record, int n)
+{
+	uint32_t edge;
+
+	if (!n)
+		return ntohl(*(uint32_t *)(record + 20));
+	edge = ntohl(*(uint32_t *)(record + 24));
+	if (!(edge & GRAPH_OCTOPUS_EDGES))
+		return n == 1 ? edge : GRAPH_PARENT_NONE;
+	edge &= ~GRAPH_OCTOPUS_EDGES;
+	for (;;) {
+		uint32_t e;
+		if (edge >= g->nr_extra)
+			return GRAPH_PARENT_CORRUPT;
+		e = ntohl(g->extra[edge]);
+		if (n == 1)
+			return e & ~GRAPH_LAST_EDGE;
+		if (e & GRAPH_LAST_EDGE)
+			return GRAPH_PARENT_NONE;
+		n--;
+		edge++;
+	}
+}
+
+static unsigned long graph_date(const unsigned char *record)
+{
+	uint64_t hi = ntohl(*(uint32_t *)(record + 32));
+	uint64_t lo = ntohl(*(uint32_t *)(record + 36));
+	return (unsigned long)((hi << 32) | lo);
+}
+
+int parse_commit_in_graph(struct commit *item)
+{
+	const unsigned char *record;
+	struct commit_list **pptr;
+	uint32_t pos, parent;
+	int n;
+
+	if (!prepare_commit_graph() ||
+	    !graph_position(graph, item->object.sha1, &pos))
+		return 0;
+	record = graph_record(graph, pos);
+
+	for (n = 0; (parent = graph_parent(graph, record, n)) != GRAPH_PARENT_NONE; n++)
+		if (parent >= graph->nr) {
+			error("commit-graph has bad parents for %s",
+			      sha1_to_hex(item->object.sha1));
+			return 0;
+		}
+
+	item->object.parsed = 1;
+	item->tree = lookup_tree(record);
+	pptr = &item->parents;
+	for (n = 0; (parent = graph_parent(graph, record, n)) != GRAPH_PARENT_NONE; n++) {
+		struct commit *p = lookup_commit(graph->names + (size_t)parent * 20);
+		if (p)
+			pptr = &commit_list_insert(p, pptr)->next;
+	}
+	item->generation = ntohl(*(uint32_t *)(record + 28));
+	item->date = graph_date(record);
+	return 1;
+}
+
+struct graph_commits {
+	struct commit **list;
+	int nr, alloc;
+};
+
+static void add_graph_commit(struct graph_commits *commits, struct commit *c)
+{
+	if (c->object.flags & TMP_MARK)
+		return;
+	c->object.flags |= TMP_MARK;
+	ALLOC_GROW(commits->list, commits->nr + 1, commits->alloc);
+	commits->list[commits->nr++] = c;
+}
+
+static int add_ref_commit(const char *refname, const unsigned char *sha1,
+			  int flags, void *cb_data)
+{
+	struct commit *c = lookup_commit_reference_gently(sha1, 1);
+	if (c)
+		add_graph_commit(cb_data, c);
+	return 0;
+}
+
+static int commit_name_cmp(const void *a_, const void *b_)
+{
+	const struct commit *a = *(const struct commit **)a_;
+	const struct commit *b = *(const struct commit **)b_;
+	return hashcmp(a->object.sha1, b->object.sha1);
+}
+
+static uint32_t commit_pos(struct graph_commits *commits, struct commit *c)
+{
+	struct commit **found = bsearch(&c, commits->list, commits->nr,
+					sizeof(*commits->list),
+					commit_name_cmp);
+	if (!found)
+		die("BUG: commit %s missing from commit-graph",
+		    sha1_to_hex(c->object.sha1));
+	return found - commits->list;
+}
+
+static void compute_generations(struct graph_commits *commits, uint32_t *gen)
+{
+	uint32_t *stack = NULL;
+	int nr = 0, alloc = 0, i;
+
+	for (i = 0; i < commits->nr; i++) {
+		if (gen[i])
+			continue;
+		ALLOC_GROW(stack, nr + 1, alloc);
+		stack[nr++] = i;
+		while (nr) {
+			uint32_t pos = stack[nr - 1], max = 0;
+			struct commit_list *p;
+			int pending = 0;
+
+			if (gen[pos]) {
+				nr--;
+				continue;
+			}
+			for (p = commits->list[pos]->parents; p; p = p->next) {
+				uint32_t ppos = commit_pos(commits, p->item);
+				if (!gen[ppos]) {
+					ALLOC_GROW(stack, nr + 1, alloc);
+					stack[nr++] = ppos;
+					pending = 1;
+				} else if (max < gen[ppos]) {
+					max = gen[ppos];
+				}
+			}
+			if (pending)
+				continue;
+			gen[pos] = max < GENERATION_NUMBER_MAX ?
+				max + 1 : GENERATION_NUMBER_MAX;
+			nr--;
+		}
+	}
+	free(stack);
+}
+
+static void write_be32(struct sha1file *f, uint32_t v)
+{
+	v = htonl(v);
+	sha1write(f, &v, 4);
+}
+
+int write_commit_graph(void)
+{
+	static struct lock_file lock;
+	struct graph_commits commits = { NULL, 0, 0 };
+	uint32_t *gen, *extra;
+	uint32_t fanout[256];
+	int nr_extra = 0, i, j;
+	char *path;
+	struct sha1file *f;
+
+	prepare_commit_graft();
+	if (for_each_commit_graft(has_graft, NULL))
+		return error("cannot write a commit-graph with grafts in place");
+	if (read_replace_refs && for_each_replace_ref(count_replace_ref, NULL))
+		return error("cannot write a commit-graph with replace refs in place");
+
+	head_ref(add_ref_commit, &commits);
+	for_each_ref(add_ref_commit, &commits);
+	for (i = 0; i < commits.nr; i++) {
+		struct commit *c = commits.list[i];
+		struct commit_list *p;
+		if (parse_commit(c))
+			return error("unable to parse commit %s",
+				     sha1_to_hex(c->object.sha1));
+		for (p = c->parents; p; p = p->next)
+			add_graph_commit(&commits, p->item);
+	}
+	for (i = 0; i < commits.nr; i++)
+		commits.list[i]->object.flags &= ~TMP_MARK;
+
+	qsort(commits.list, commits.nr, sizeof(*commits.list), commit_name_cmp);
+	gen = xcalloc(commits.nr ? commits.nr : 1, sizeof(*gen));
+	compute_generations(&commits, gen);
+
+	for (i = 0; i < commits.nr; i++) {
+		int n = commit_list_count(commits.list[i]->parents);
+		if (n > 2)
+			nr_extra += n - 1;
+	}
+
+	extra = xcalloc(nr_extra ? nr_extra : 1, sizeof(*extra));
+
+	memset(fanout, 0, sizeof(fanout));
+	for (i = 0; i < commits.nr; i++)
+		fanout[commits.list[i]->object.sha1[0]]++;
+	for (i = 1; i < 256; i++)
+		fanout[i] += fanout[i - 1];
+
+	path = commit_graph_path();
+	if (safe_create_leading_directories(path))
+		die("unable to create leading directories of %s", path);
+	hold_lock_file_for_update(&lock, path, LOCK_DIE_ON_ERROR);
+	free(path);
+	f = sha1fd(lock.fd, lock.filename);
+
+	write_be32(f, GRAPH_SIGNATURE);
+	write_be32(f, GRAPH_VERSION);
+	write_be32(f, commits.nr);
+	write_be32(f, nr_extra);
+	for (i = 0; i < 256; i++)
+		write_be32(f, fanout[i]);
+	for (i = 0; i < commits.nr; i++)
+		sha1write(f, commits.list[i]->object.sha1, 20);
+
+	j = 0;
+	for (i = 0; i < commits.nr; i++) {
+		struct commit *c = commits.list[i];
+		struct commit_list *p = c->parents;
+		uint64_t date = c->date;
+
+		sha1write(f, c->tree->object.sha1, 20);
+		write_be32(f, p ? commit_pos(&commits, p->item) : GRAPH_PARENT_NONE);
+		if (!p || !p->next) {
+			write_be32(f, GRAPH_PARENT_NONE);
+		} else if (!p->next->next) {
+			write_be32(f, commit_pos(&commits, p->next->item));
+		} else {
+			write_be32(f, GRAPH_OCTOPUS_EDGES | j);
+			for (p = p->next; p; p = p->next) {
+				uint32_t edge = commit_pos(&commits, p->item);
+				if (!p->next)
+					edge |= GRAPH_LAST_EDGE;
+				extra[j++] = edge;
+			}
+		}
+		write_be32(f, gen[i]);
+		write_be32(f, (uint32_t)(date >> 32));
+		write_be32(f, (uint32_t)date);
+	}
+	for (j = 0; j < nr_extra; j++)
+		write_be32(f, extra[j]);
+
+	sha1close(f, NULL, CSUM_FSYNC);
+	lock.fd = -1; /* closed by sha1close() */
+	if (commit_lock_file(&lock))
+		die_errno("unable to write commit-graph");
+
+	free(extra);
+	free(gen);
+	free(commits.list);
+	return 0;
+}
+
+static unsigned long commit_buffer_date(const char *buf)
+{
+	const char *p = strstr(buf, "\ncommitter ");
+	if (!p)
+		return 0;
+	p = strchr(p, '>');
+	return p ? strtoul(p + 1, NULL, 10) : 0;
+}
+
+static int verify_one_commit(struct commit_graph *g, uint32_t pos)
+{
+	const unsigned char *name = g->names + (size_t)pos * 20;
+	const unsigned char *record = graph_record(g, pos);
+	unsigned char sha1[20];
+	enum object_type type;
+	unsigned long size;
+	uint32_t parent, max = 0, generation;
+	char *buf, *p;
+	int n, errors = 0;
+
+	buf = read_sha1_file(name, &type, &size);
+	if (!buf || type != OBJ_COMMIT) {
+		free(buf);
+		return error("commit-graph lists %s, which is not a commit",
+			     sha1_to_hex(name));
+	}
+
+	if (prefixcmp(buf, "tree ") || get_sha1_hex(buf + 5, sha1) ||
+	    hashcmp(sha1, record))
+		errors = error("commit-graph has the wrong tree for %s",
+			       sha1_to_hex(name));
+
+	p = strchr(buf, '\n');
+	for (n = 0; p && !prefixcmp(p + 1, "parent "); n++) {
+		parent = graph_parent(g, record, n);
+		if (parent >= g->nr ||
+		    get_sha1_hex(p + 8, sha1) ||
+		    hashcmp(sha1, g->names + (size_t)parent * 20)) {
+			errors = error("commit-graph has the wrong parents for %s",
+				       sha1_to_hex(name));
+			break;
+		}
+		generation = ntohl(*(uint32_t *)(graph_record(g, parent) + 28));
+		if (max < generation)
+			max = generation;
+		p = strchr(p + 1, '\n');
+	}
+	if (!errors && graph_parent(g, record, n) != GRAPH_PARENT_NONE)
+		errors = error("commit-graph has too many parents for %s",
+			       sha1_to_hex(name));
+
+	generation = ntohl(*(uint32_t *)(record + 28));
+	if (generation != (max < GENERATION_NUMBER_MAX ? max + 1 : max))
+		errors = error("commit-graph has generation %"PRIu32" for %s",
+			       generation, sha1_to_hex(name));
+	if (graph_date(record) != commit_buffer_date(buf))
+		errors = error("commit-graph has the wrong date for %s",
+			       sha1_to_hex(name));
+	free(buf);
+	return errors;
+}
+
+int verify_commit_graph(void)
+{
+	char *path = commit_graph_path();
+	struct commit_graph *g = load_commit_graph(path);
+	unsigned char sha1[20];
+	git_SHA_CTX ctx;
+	uint32_t i;
+	int errors = 0;
+
+	if (!g) {
+		/* no commit-graph is fine, an unreadable one is not */
+		errors = !access(path, F_OK);
+		free(path);
+		return errors;
+	}
+
+	git_SHA1_Init(&ctx);
+	git_SHA1_Update(&ctx, g->map, g->size - 20);
+	git_SHA1_Final(sha1, &ctx);
+	if (hashcmp(sha1, g->map + g->size - 20))
+		errors += !!error("commit-graph file %s has a bad checksum", path);
+
+	for (i = 0; i < g->nr; i++) {
+		if (i && hashcmp(g->names + (size_t)(i - 1) * 20,
+				 g->names + (size_t)i * 20) >= 0) {
+			errors += !!error("commit-graph names are out of order at %s",
+					  sha1_to_hex(g->names + (size_t)i * 20));
+			break;
+		}
+		if (ntohl(g->fanout[g->names[(size_t)i * 20]]) <= i) {
+			errors += !!error("commit-graph fan-out is wrong at %s",
+					  sha1_to_hex(g->names + (size_t)i * 20));
+			break;
+		}
+	}
+	for (i = 0; i < g->nr; i++)
+		errors += !!verify_one_commit(g, i);
+
+	munmap((void *)g->map, g->size);
+	free(g);
+	free(path);
+	return errors;
+}
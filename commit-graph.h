@@ -0,0 +1,64 @@
+#ifndef COMMIT_GRAPH_H
+#define COMMIT_GRAPH_H
+
+/*
+ * The commit-graph file ("objects/info/commit-graph") records, for
+ * every commit reachable from the refs when it was written, the
+ * information a history walk needs: the root tree, the parents, the
+ * commit date and the generation number.  parse_commit() reads it
+ * instead of inflating the commit object.
+ *
+ * The on-disk format is:
+ *
+ *   - a header: 4-byte signature "CGPH", 4-byte version, 4-byte
+ *     number of commits N and 4-byte number of extra edges E;
+ *
+ *   - a 256-entry fan-out table; entry K is the number of commits
+ *     whose name begins with a byte less than or equal to K;
+ *
+ *   - the N 20-byte commit names, sorted;
+ *
+ *   - N 40-byte records in the same order: the 20-byte tree name,
+ *     the 4-byte positions of the first and second parent, the
+ *     4-byte generation number and the 8-byte commit date.  A
+ *     missing parent is GRAPH_PARENT_NONE.  For a commit with more
+ *     than two parents, the second parent position has the
+ *     GRAPH_OCTOPUS_EDGES bit set and the rest of it indexes the
+ *     extra edge list, where the second and later parents are
+ *     listed and the last one has GRAPH_LAST_EDGE set;
+ *
+ *   - the E 4-byte entries of the extra edge list;
+ *
+ *   - a 20-byte SHA-1 checksum of all of the above.
+ *
+ * All integers are in network byte order.
+ */
+#define GRAPH_SIGNATURE 0x43475048	/* "CGPH" */
+#define GRAPH_VERSION 1
+#define GRAPH_RECORD_SIZE 40
+#define GRAPH_PARENT_NONE 0x70000000
+#define GRAPH_OCTOPUS_EDGES 0x80000000
+#define GRAPH_LAST_EDGE 0x80000000
+
+struct commit;
+
+/*
+ * Fill in "item" from the commit-graph.  Returns 1 if the commit was
+ * found there, 0 if it has to be parsed from the object database
+ * (no graph, commit not in it, or grafts and replace refs in use).
+ */
+extern int parse_commit_in_graph(struct commit *item);
+
+/*
+ * Write a commit-graph covering every commit reachable from the refs
+ * and HEAD.  Returns 0 on success, -1 on error.
+ */
+extern int write_commit_graph(void);
+
+/*
+ * Check the commit-graph against its checksum and against the commit
+ * objects it describes.  Returns the number of problems found.
+ */
+extern int verify_commit_graph(void);
+
+#endif
@@ -6,6 +6,7 @@
 #include "diff.h"
 #include "revision.h"
 #include "notes.h"
+#include "commit-graph.h"
 
 int save_commit_buffer = 1;
 
@@ -190,7 +191,7 @@ static int read_graft_file(const char *graft_file)
 	return 0;
 }
 
-static void prepare_commit_graft(void)
+void prepare_commit_graft(void)
 {
 	static int commit_graft_prepared;
 	char *graft_file;
@@ -301,6 +302,8 @@ int parse_commit(struct commit *item)
 		return -1;
 	if (item->object.parsed)
 		return 0;
+	if (parse_commit_in_graph(item))
+		return 0;
 	buffer = read_sha1_file(item->object.sha1, &type, &size);
 	if (!buffer)
 		return error("Could not read %s",
@@ -319,6 +322,27 @@ int parse_commit(struct commit *item)
 	return ret;
 }
 
+/*
+ * A commit parsed from the commit-graph has its tree, parents and
+ * date, but not its buffer; read the object for callers that want
+ * the message.
+ */
+void load_commit_buffer(struct commit *item)
+{
+	enum object_type type;
+	unsigned long size;
+	void *buffer;
+
+	if (item->buffer || !item->object.parsed)
+		return;
+	buffer = read_sha1_file(item->object.sha1, &type, &size);
+	if (!buffer)
+		die("Could not read %s", sha1_to_hex(item->object.sha1));
+	if (type != OBJ_COMMIT)
+		die("Object %s not a commit", sha1_to_hex(item->object.sha1));
+	item->buffer = buffer;
+}
+
 int find_commit_subject(const char *commit_buffer, const char **subject)
 {
 	const char *eol;
@@ -554,7 +578,15 @@ static struct commit *interesting(struct commit_list *list)
 	return NULL;
 }
 
-static struct commit_list *merge_bases_many(struct commit *one, int n, struct commit **twos)
+/*
+ * Paint down from "one" and "twos" to find their merge bases.  Commits
+ * whose generation number is known to be below "min_generation" cannot
+ * reach a commit of that generation, so the walk does not go past them;
+ * pass GENERATION_NUMBER_UNKNOWN to walk everything.
+ */
+static struct commit_list *merge_bases_many(struct commit *one, int n,
+					    struct commit **twos,
+					    uint32_t min_generation)
 {
 	struct commit_list *list = NULL;
 	struct commit_list *result = NULL;
@@ -611,6 +643,9 @@ static struct commit_list *merge_bases_many(struct commit *one, int n, struct co
 				continue;
 			if (parse_commit(p))
 				return NULL;
+			if (p->generation != GENERATION_NUMBER_UNKNOWN &&
+			    p->generation < min_generation)
+				continue;
 			p->object.flags |= flags;
 			commit_list_insert_by_date(p, &list);
 		}
@@ -656,6 +691,14 @@ struct commit_list *get_octopus_merge_bases(struct commit_list *in)
 	return ret;
 }
 
+static uint32_t min_known_generation(struct commit *a, struct commit *b)
+{
+	if (a->generation == GENERATION_NUMBER_UNKNOWN ||
+	    b->generation == GENERATION_NUMBER_UNKNOWN)
+		return GENERATION_NUMBER_UNKNOWN;
+	return a->generation < b->generation ? a->generation : b->generation;
+}
+
 struct commit_list *get_merge_bases_many(struct commit *one,
 					 int n,
 					 struct commit **twos,
@@ -666,7 +709,7 @@ struct commit_list *get_merge_bases_many(struct commit *one,
 	struct commit_list *result;
 	int cnt, i, j;
 
-	result = merge_bases_many(one, n, twos);
+	result = merge_bases_many(one, n, twos, GENERATION_NUMBER_UNKNOWN);
 	for (i = 0; i < n; i++) {
 		if (one == twos[i])
 			return result;
@@ -699,7 +742,9 @@ struct commit_list *get_merge_bases_many(struct commit *one,
 		for (j = i+1; j < cnt; j++) {
 			if (!rslt[i] || !rslt[j])
 				continue;
-			result = merge_bases_many(rslt[i], 1, &rslt[j]);
+			/* we only care whether one is an ancestor of the other */
+			result = merge_bases_many(rslt[i], 1, &rslt[j],
+				min_known_generation(rslt[i], rslt[j]));
 			clear_commit_marks(rslt[i], all_flags);
 			clear_commit_marks(rslt[j], all_flags);
 			for (list = result; list; list = list->next) {
@@ -742,22 +787,28 @@ int is_descendant_of(struct commit *commit, struct commit_list *with_commit)
 	return 0;
 }
 
+/*
+ * Is "commit" an ancestor of (or equal to) one of the "reference"
+ * commits?  Only commits whose generation is not below that of
+ * "commit" need to be painted to find out.
+ */
 int in_merge_bases(struct commit *commit, struct commit **reference, int num)
 {
-	struct commit_list *bases, *b;
-	int ret = 0;
+	struct commit_list *bases;
+	int i, ret = 0;
 
-	if (num == 1)
-		bases = get_merge_bases(commit, *reference, 1);
-	else
-		die("not yet");
-	for (b = bases; b; b = b->next) {
-		if (!hashcmp(commit->object.sha1, b->item->object.sha1)) {
-			ret = 1;
-			break;
-		}
-	}
+	for (i = 0; i < num; i++)
+		if (commit == reference[i])
+			return 1;
+	if (parse_commit(commit))
+		return 0;
 
+	bases = merge_bases_many(commit, num, reference, commit->generation);
+	if (commit->object.flags & PARENT2)
+		ret = 1;
+	clear_commit_marks(commit, all_flags);
+	for (i = 0; i < num; i++)
+		clear_commit_marks(reference[i], all_flags);
 	free_commit_list(bases);
 	return ret;
 }
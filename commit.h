@@ -19,8 +19,19 @@ struct commit {
 	struct commit_list *parents;
 	struct tree *tree;
 	char *buffer;
+	uint32_t generation;
 };
 
+/*
+ * The generation number of a commit found in the commit-graph is one
+ * more than the largest generation number among its parents (a root
+ * commit has generation 1).  Commits that were not parsed from the
+ * commit-graph have generation GENERATION_NUMBER_UNKNOWN; walks must
+ * not cut off at such commits.
+ */
+#define GENERATION_NUMBER_UNKNOWN 0
+#define GENERATION_NUMBER_MAX 0x3FFFFFFF
+
 extern int save_commit_buffer;
 extern const char *commit_type;
 
@@ -40,6 +51,7 @@ struct commit *lookup_commit_reference_by_name(const char *name);
 
 int parse_commit_buffer(struct commit *item, const void *buffer, unsigned long size);
 int parse_commit(struct commit *item);
+void load_commit_buffer(struct commit *item);
 
 /* Find beginning and length of commit subject. */
 int find_commit_subject(const char *commit_buffer, const char **subject);
@@ -147,6 +159,7 @@ typedef int (*each_commit_graft_fn)(const struct commit_graft *, void *);
 struct commit_graft *read_graft_line(char *buf, int len);
 int register_commit_graft(struct commit_graft *, int);
 struct commit_graft *lookup_commit_graft(const unsigned char *sha1);
+void prepare_commit_graft(void);
 
 extern struct commit_list *get_merge_bases(struct commit *rev1, struct commit *rev2, int cleanup);
 extern struct commit_list *get_merge_bases_many(struct commit *one, int n, struct commit **twos, int cleanup);
@@ -576,6 +576,11 @@ static int git_default_core_config(const char *var, const char *value)
 		return 0;
 	}
 
+	if (!strcmp(var, "core.deltabasecacheentries")) {
+		delta_base_cache_entries = git_config_ulong(var, value);
+		return 0;
+	}
+
 	if (!strcmp(var, "core.logpackaccess"))
 		return git_config_string(&log_pack_access, var, value);
 
@@ -647,6 +652,34 @@ static int git_default_core_config(const char *var, const char *value)
 		return 0;
 	}
 
+	if (!strcmp(var, "core.commitgraph")) {
+		core_commit_graph = git_config_bool(var, value);
+		return 0;
+	}
+
+	if (!strcmp(var, "core.multipackindex")) {
+		core_multi_pack_index = git_config_bool(var, value);
+		return 0;
+	}
+
+	if (!strcmp(var, "core.splitindex")) {
+		core_split_index = git_config_bool(var, value);
+		return 0;
+	}
+
+	if (!strcmp(var, "core.untrackedcache")) {
+		core_untracked_cache = git_config_bool(var, value);
+		return 0;
+	}
+
+	if (!strcmp(var, "core.fsmonitor")) {
+		if (git_config_string(&core_fsmonitor, var, value))
+			return -1;
+		if (!*core_fsmonitor)
+			core_fsmonitor = NULL;
+		return 0;
+	}
+
 	if (!strcmp(var, "core.createobject")) {
 		if (!strcmp(value, "rename"))
 			object_creation_mode = OBJECT_CREATION_USES_RENAMES;
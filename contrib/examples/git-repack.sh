@@ -9,6 +9,7 @@ git repack [options]
 --
 a               pack everything in a single pack
 A               same as -a, and turn unreachable objects loose
+b,write-bitmap-index write a bitmap index (requires -a or -A)
 d               remove redundant packs, and run git-prune-packed
 f               pass --no-reuse-delta to git-pack-objects
 F               pass --no-reuse-object to git-pack-objects
@@ -25,7 +26,7 @@ SUBDIRECTORY_OK='Yes'
 . git-sh-setup
 
 no_update_info= all_into_one= remove_redundant= unpack_unreachable=
-local= no_reuse= extra=
+local= no_reuse= extra= write_bitmap=
 while test $# != 0
 do
 	case "$1" in
@@ -33,6 +34,7 @@ do
 	-a)	all_into_one=t ;;
 	-A)	all_into_one=t
 		unpack_unreachable=--unpack-unreachable ;;
+	-b)	write_bitmap=t ;;
 	-d)	remove_redundant=t ;;
 	-q)	GIT_QUIET=t ;;
 	-f)	no_reuse=--no-reuse-delta ;;
@@ -51,6 +53,11 @@ true)
 	extra="$extra --delta-base-offset" ;;
 esac
 
+case "$write_bitmap" in
+'')
+	write_bitmap=`git config --bool repack.writebitmaps` ;;
+esac
+
 PACKDIR="$GIT_OBJECT_DIRECTORY/pack"
 PACKTMP="$PACKDIR/.tmp-$$-pack"
 rm -f "$PACKTMP"-*
@@ -79,6 +86,10 @@ case ",$all_into_one," in
 			args="$args $unpack_unreachable"
 		fi
 	fi
+	case "$write_bitmap" in
+	t|true)
+		args="$args --write-bitmap-index" ;;
+	esac
 	;;
 esac
 
@@ -100,7 +111,7 @@ rollback=
 failed=
 for name in $names
 do
-	for sfx in pack idx
+	for sfx in pack idx bitmap
 	do
 		file=pack-$name.$sfx
 		test -f "$PACKDIR/$file" || continue
@@ -151,6 +162,12 @@ do
 	mv -f "$PACKTMP-$name.pack" "$PACKDIR/pack-$name.pack" &&
 	mv -f "$PACKTMP-$name.idx"  "$PACKDIR/pack-$name.idx" ||
 	exit
+	if test -f "$PACKTMP-$name.bitmap"
+	then
+		chmod a-w "$PACKTMP-$name.bitmap"
+		mv -f "$PACKTMP-$name.bitmap" "$PACKDIR/pack-$name.bitmap" ||
+		exit
+	fi
 done
 
 # Remove the "old-" files
@@ -158,6 +175,7 @@ for name in $names
 do
 	rm -f "$PACKDIR/old-pack-$name.idx"
 	rm -f "$PACKDIR/old-pack-$name.pack"
+	rm -f "$PACKDIR/old-pack-$name.bitmap"
 done
 
 # End of pack replacement.
@@ -172,7 +190,7 @@ then
 		  do
 			case " $fullbases " in
 			*" $e "*) ;;
-			*)	rm -f "$e.pack" "$e.idx" "$e.keep" ;;
+			*)	rm -f "$e.pack" "$e.idx" "$e.keep" "$e.bitmap" ;;
 			esac
 		  done
 		)
@@ -180,6 +198,12 @@ then
 	git prune-packed ${GIT_QUIET:+-q}
 fi
 
+# Keep an existing multi-pack-index covering the packs we now have.
+if test -f "$PACKDIR/multi-pack-index"
+then
+	git multi-pack-index write || exit
+fi
+
 case "$no_update_info" in
 t) : ;;
 *) git update-server-info ;;
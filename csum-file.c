@@ -11,18 +11,35 @@
 #include "progress.h"
 #include "csum-file.h"
 
+/*
+ * Whole buffers of data given to sha1write() at once are summed and
+ * written straight from where they are, this much at a time: not so
+ * much that they are out of the CPU caches by the time they are
+ * written after being summed.
+ */
+#define SHA1WRITE_DIRECT_MAX (128 * 1024)
+
 static void flush(struct sha1file *f, void *buf, unsigned int count)
 {
 	if (0 <= f->check_fd && count)  {
 		unsigned char check_buffer[8192];
-		ssize_t ret = read_in_full(f->check_fd, check_buffer, count);
-
-		if (ret < 0)
-			die_errno("%s: sha1 file read error", f->name);
-		if (ret < count)
-			die("%s: sha1 file truncated", f->name);
-		if (memcmp(buf, check_buffer, count))
-			die("sha1 file '%s' validation error", f->name);
+		unsigned int done = 0;
+
+		while (done < count) {
+			unsigned int nr = count - done;
+			ssize_t ret;
+
+			if (nr > sizeof(check_buffer))
+				nr = sizeof(check_buffer);
+			ret = read_in_full(f->check_fd, check_buffer, nr);
+			if (ret < 0)
+				die_errno("%s: sha1 file read error", f->name);
+			if (ret < nr)
+				die("%s: sha1 file truncated", f->name);
+			if (memcmp((char *)buf + done, check_buffer, nr))
+				die("sha1 file '%s' validation error", f->name);
+			done += nr;
+		}
 	}
 
 	for (;;) {
@@ -94,11 +111,16 @@ int sha1write(struct sha1file *f, void *buf, unsigned int count)
 		unsigned nr = count > left ? left : count;
 		void *data;
 
+		if (!offset && count >= SHA1WRITE_DIRECT_MAX)
+			nr = left = SHA1WRITE_DIRECT_MAX;
+		else if (!offset && count >= sizeof(f->buffer))
+			nr = left = count - count % sizeof(f->buffer);
+
 		if (f->do_crc)
 			f->crc32 = crc32(f->crc32, buf, nr);
 
-		if (nr == sizeof(f->buffer)) {
-			/* process full buffer directly without copy */
+		if (nr >= sizeof(f->buffer)) {
+			/* process full buffers directly without copy */
 			data = buf;
 		} else {
 			memcpy(f->buffer + offset, buf, nr);
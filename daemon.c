@@ -24,6 +24,7 @@ static int reuseaddr;
 static const char daemon_usage[] =
 "git daemon [--verbose] [--syslog] [--export-all]\n"
 "           [--timeout=<n>] [--init-timeout=<n>] [--max-connections=<n>]\n"
+"           [--workers=<n>]\n"
 "           [--strict-paths] [--base-path=<path>] [--base-path-relaxed]\n"
 "           [--user-path | --user-path=<path>]\n"
 "           [--interpolated-path=<path>]\n"
@@ -520,18 +521,12 @@ static void parse_host_arg(char *extra_args, int buflen)
 }
 
 
-static int execute(void)
-{
-	static char line[1000];
-	int pktlen, len, i;
-	char *addr = getenv("REMOTE_ADDR"), *port = getenv("REMOTE_PORT");
-
-	if (addr)
-		loginfo("Connection from %s:%s", addr, port);
+/* The longest request line we accept, including its terminating NUL */
+#define MAX_REQUEST_LINE 1000
 
-	alarm(init_timeout ? init_timeout : timeout);
-	pktlen = packet_read_line(0, line, sizeof(line));
-	alarm(0);
+static int execute_request(char *line, int pktlen)
+{
+	int len, i;
 
 	len = strlen(line);
 	if (pktlen != len)
@@ -548,6 +543,7 @@ static int execute(void)
 	free(ip_address);
 	free(tcp_port);
 	hostname = canon_hostname = ip_address = tcp_port = NULL;
+	saw_extended_args = 0;
 
 	if (len != pktlen)
 		parse_host_arg(line + len + 1, pktlen - len - 1);
@@ -570,6 +566,22 @@ static int execute(void)
 	return -1;
 }
 
+static int execute(void)
+{
+	static char line[MAX_REQUEST_LINE];
+	int pktlen;
+	char *addr = getenv("REMOTE_ADDR"), *port = getenv("REMOTE_PORT");
+
+	if (addr)
+		loginfo("Connection from %s:%s", addr, port);
+
+	alarm(init_timeout ? init_timeout : timeout);
+	pktlen = packet_read_line(0, line, sizeof(line));
+	alarm(0);
+
+	return execute_request(line, pktlen);
+}
+
 static int addrcmp(const struct sockaddr_storage *s1,
     const struct sockaddr_storage *s2)
 {
@@ -593,6 +605,9 @@ static int addrcmp(const struct sockaddr_storage *s1,
 
 static int max_connections = 32;
 
+/* The size of the pool of workers; zero forks a new daemon per client */
+static int nr_workers;
+
 static unsigned int live_children;
 
 static struct child {
@@ -657,11 +672,39 @@ static void check_dead_children(void)
 			cradle = &blanket->next;
 }
 
+/*
+ * Format the address and port of a client the way they are given to
+ * the services in REMOTE_ADDR and REMOTE_PORT.
+ */
+static void remote_address(const struct sockaddr *addr,
+			   char *host, size_t hostlen,
+			   char *port, size_t portlen)
+{
+	*host = *port = '\0';
+	if (addr->sa_family == AF_INET) {
+		const struct sockaddr_in *sin_addr = (const void *) addr;
+		inet_ntop(addr->sa_family, &sin_addr->sin_addr, host, hostlen);
+		snprintf(port, portlen, "%d", ntohs(sin_addr->sin_port));
+#ifndef NO_IPV6
+	} else if (addr->sa_family == AF_INET6) {
+		const struct sockaddr_in6 *sin6_addr = (const void *) addr;
+
+		char *buf = host;
+		*buf++ = '['; *buf = '\0'; /* stpcpy() is cool */
+		inet_ntop(AF_INET6, &sin6_addr->sin6_addr, buf, hostlen - 2);
+		strcat(buf, "]");
+
+		snprintf(port, portlen, "%d", ntohs(sin6_addr->sin6_port));
+#endif
+	}
+}
+
 static char **cld_argv;
 static void handle(int incoming, struct sockaddr *addr, socklen_t addrlen)
 {
 	struct child_process cld = { NULL };
-	char addrbuf[300] = "REMOTE_ADDR=", portbuf[300];
+	char host[256], port[32];
+	char addrbuf[300], portbuf[300];
 	char *env[] = { addrbuf, portbuf, NULL };
 
 	if (max_connections && live_children >= max_connections) {
@@ -675,26 +718,9 @@ static void handle(int incoming, struct sockaddr *addr, socklen_t addrlen)
 		}
 	}
 
-	if (addr->sa_family == AF_INET) {
-		struct sockaddr_in *sin_addr = (void *) addr;
-		inet_ntop(addr->sa_family, &sin_addr->sin_addr, addrbuf + 12,
-		    sizeof(addrbuf) - 12);
-		snprintf(portbuf, sizeof(portbuf), "REMOTE_PORT=%d",
-		    ntohs(sin_addr->sin_port));
-#ifndef NO_IPV6
-	} else if (addr && addr->sa_family == AF_INET6) {
-		struct sockaddr_in6 *sin6_addr = (void *) addr;
-
-		char *buf = addrbuf + 12;
-		*buf++ = '['; *buf = '\0'; /* stpcpy() is cool */
-		inet_ntop(AF_INET6, &sin6_addr->sin6_addr, buf,
-		    sizeof(addrbuf) - 13);
-		strcat(buf, "]");
-
-		snprintf(portbuf, sizeof(portbuf), "REMOTE_PORT=%d",
-		    ntohs(sin6_addr->sin6_port));
-#endif
-	}
+	remote_address(addr, host, sizeof(host), port, sizeof(port));
+	snprintf(addrbuf, sizeof(addrbuf), "REMOTE_ADDR=%s", host);
+	snprintf(portbuf, sizeof(portbuf), "REMOTE_PORT=%s", port);
 
 	cld.env = (const char **)env;
 	cld.argv = (const char **)cld_argv;
@@ -1019,6 +1045,634 @@ static void daemonize(void)
 }
 #endif
 
+/*
+ * With --workers, a connection is not given a "git daemon --serve" of
+ * its own.  Instead, one loop reads the request line of every client
+ * as it comes in, queues the client behind the others asking for the
+ * same service and repository, and passes it over a socket to one of
+ * a pool of workers forked in advance, as soon as one is idle.  The
+ * queues take turns, so that a storm of requests for one repository
+ * does not hold up the others, and while --max-connections clients
+ * are being read, queued or served, no more are accepted: the kernel
+ * keeps them in the listen backlog until there is room.
+ */
+#ifdef NO_POSIX_GOODIES
+
+static void NORETURN worker_service_loop(struct socketlist *socklist)
+{
+	die("--workers not supported on this platform");
+}
+
+#else
+
+/* What a worker is sent together with the connection itself */
+struct worker_request {
+	char addr[256];
+	char port[32];
+	int pktlen;
+	char line[MAX_REQUEST_LINE];
+};
+
+struct connection {
+	struct connection *next;
+	int fd;
+	unsigned long since; /* ms; when accepted, then when queued */
+	int len; /* of the pkt-line read so far */
+	char hdr[4];
+	struct worker_request req;
+};
+
+struct repo_queue {
+	struct repo_queue *next;
+	char *name;
+	struct connection *first, **last;
+	unsigned nr;
+};
+
+struct worker {
+	pid_t pid;
+	int fd;
+	int busy;
+};
+
+static struct worker *workers;
+static unsigned nr_busy;
+
+/* Connections whose request line is not complete yet */
+static struct connection *reading;
+static unsigned nr_reading;
+
+/* The queues which have connections waiting, in the order they are served */
+static struct repo_queue *ready, **ready_last = &ready;
+
+static struct {
+	unsigned waiting, waiting_max;
+	unsigned long served, timed_out;
+	unsigned long wait_total, wait_max; /* ms */
+} queue_stats;
+
+static volatile sig_atomic_t stats_requested;
+
+static void stats_handler(int signo)
+{
+	stats_requested = 1;
+	signal(SIGUSR1, stats_handler);
+}
+
+static unsigned long now_ms(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec * 1000UL + tv.tv_usec / 1000;
+}
+
+static int receive_connection(int sock, struct worker_request *req)
+{
+	union {
+		struct cmsghdr cm;
+		char control[CMSG_SPACE(sizeof(int))];
+	} u;
+	struct msghdr msg;
+	struct iovec iov;
+	struct cmsghdr *cm;
+	ssize_t n;
+	int fd = -1;
+
+	memset(&msg, 0, sizeof(msg));
+	iov.iov_base = req;
+	iov.iov_len = sizeof(*req);
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = u.control;
+	msg.msg_controllen = sizeof(u.control);
+
+	do {
+		n = recvmsg(sock, &msg, 0);
+	} while (n < 0 && errno == EINTR);
+	if (n <= 0)
+		return -1;
+	cm = CMSG_FIRSTHDR(&msg);
+	if (cm && cm->cmsg_level == SOL_SOCKET && cm->cmsg_type == SCM_RIGHTS)
+		memcpy(&fd, CMSG_DATA(cm), sizeof(int));
+	if (n < sizeof(*req) &&
+	    read_in_full(sock, (char *)req + n, sizeof(*req) - n) != sizeof(*req) - n) {
+		if (0 <= fd)
+			close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+static int send_connection(int sock, struct connection *c)
+{
+	union {
+		struct cmsghdr cm;
+		char control[CMSG_SPACE(sizeof(int))];
+	} u;
+	struct msghdr msg;
+	struct iovec iov;
+	struct cmsghdr *cm;
+	ssize_t n;
+
+	memset(&msg, 0, sizeof(msg));
+	iov.iov_base = &c->req;
+	iov.iov_len = sizeof(c->req);
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = u.control;
+	msg.msg_controllen = sizeof(u.control);
+	cm = CMSG_FIRSTHDR(&msg);
+	cm->cmsg_level = SOL_SOCKET;
+	cm->cmsg_type = SCM_RIGHTS;
+	cm->cmsg_len = CMSG_LEN(sizeof(int));
+	memcpy(CMSG_DATA(cm), &c->fd, sizeof(int));
+
+	do {
+		n = sendmsg(sock, &msg, 0);
+	} while (n < 0 && errno == EINTR);
+	if (n < 0)
+		return -1;
+	if (n < sizeof(c->req) &&
+	    write_in_full(sock, (char *)&c->req + n, sizeof(c->req) - n) < 0)
+		return -1;
+	return 0;
+}
+
+static void NORETURN worker_loop(int sock)
+{
+	struct worker_request req;
+	int cwd, fd;
+
+	cwd = open(".", O_RDONLY);
+	if (cwd < 0)
+		die_errno("cannot open the current directory");
+	fcntl(cwd, F_SETFD, FD_CLOEXEC);
+	fcntl(sock, F_SETFD, FD_CLOEXEC);
+	signal(SIGUSR1, SIG_IGN);
+	signal(SIGPIPE, SIG_DFL);
+
+	while (0 <= (fd = receive_connection(sock, &req))) {
+		if (*req.addr) {
+			loginfo("Connection from %s:%s", req.addr, req.port);
+			setenv("REMOTE_ADDR", req.addr, 1);
+			setenv("REMOTE_PORT", req.port, 1);
+		} else {
+			unsetenv("REMOTE_ADDR");
+			unsetenv("REMOTE_PORT");
+		}
+		dup2(fd, 0);
+		dup2(fd, 1);
+		close(fd);
+
+		if (execute_request(req.line, req.pktlen))
+			loginfo("Disconnected (with error)");
+		else
+			loginfo("Disconnected");
+
+		/* Get ready for the next one, as if we were new */
+		close(0);
+		close(1);
+		sanitize_stdfds();
+		signal(SIGTERM, SIG_DFL);
+		if (fchdir(cwd))
+			die_errno("cannot go back to the original directory");
+		if (write_in_full(sock, "", 1) < 0)
+			break;
+	}
+	exit(0);
+}
+
+static void spawn_worker(struct worker *w, struct socketlist *socklist)
+{
+	struct connection *c;
+	struct repo_queue *q;
+	int sv[2], i;
+	pid_t pid;
+
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv)) {
+		logerror("socketpair failed: %s", strerror(errno));
+		return;
+	}
+	pid = fork();
+	if (pid < 0) {
+		logerror("unable to fork a worker: %s", strerror(errno));
+		close(sv[0]);
+		close(sv[1]);
+		return;
+	}
+	if (!pid) {
+		/* The worker needs none of the descriptors of the master */
+		for (i = 0; i < socklist->nr; i++)
+			close(socklist->list[i]);
+		for (i = 0; i < nr_workers; i++)
+			if (0 <= workers[i].fd)
+				close(workers[i].fd);
+		for (c = reading; c; c = c->next)
+			close(c->fd);
+		for (q = ready; q; q = q->next)
+			for (c = q->first; c; c = c->next)
+				close(c->fd);
+		close(sv[0]);
+		worker_loop(sv[1]);
+	}
+	close(sv[1]);
+	w->pid = pid;
+	w->fd = sv[0];
+	w->busy = 0;
+	loginfo("[%"PRIuMAX"] Worker started", (uintmax_t)pid);
+}
+
+static void reap_workers(void)
+{
+	int status, i;
+	pid_t pid;
+
+	while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+		for (i = 0; i < nr_workers; i++) {
+			struct worker *w = &workers[i];
+
+			if (w->pid != pid)
+				continue;
+			logerror("[%"PRIuMAX"] Worker exited%s",
+				 (uintmax_t)pid, status ? " (with error)" : "");
+			if (0 <= w->fd)
+				close(w->fd);
+			if (w->busy)
+				nr_busy--;
+			w->pid = 0;
+			w->fd = -1;
+			w->busy = 0;
+		}
+	}
+}
+
+static void enqueue(struct connection *c)
+{
+	struct repo_queue *q;
+
+	for (q = ready; q; q = q->next)
+		if (!strcmp(q->name, c->req.line))
+			break;
+	if (!q) {
+		q = xcalloc(1, sizeof(*q));
+		q->name = xstrdup(c->req.line);
+		q->last = &q->first;
+		*ready_last = q;
+		ready_last = &q->next;
+	}
+	c->next = NULL;
+	*q->last = c;
+	q->last = &c->next;
+	q->nr++;
+
+	c->since = now_ms();
+	if (++queue_stats.waiting > queue_stats.waiting_max)
+		queue_stats.waiting_max = queue_stats.waiting;
+}
+
+static struct connection *dequeue(void)
+{
+	struct repo_queue *q = ready;
+	struct connection *c;
+
+	if (!q)
+		return NULL;
+	c = q->first;
+	q->first = c->next;
+	q->nr--;
+
+	/* The queue of this repository goes to the back of the line */
+	ready = q->next;
+	if (!ready)
+		ready_last = &ready;
+	if (q->nr) {
+		q->next = NULL;
+		*ready_last = q;
+		ready_last = &q->next;
+	} else {
+		free(q->name);
+		free(q);
+	}
+	queue_stats.waiting--;
+	return c;
+}
+
+/*
+ * Put back a connection we could not pass to a worker, at the head of
+ * its queue and with its queue first in line.
+ */
+static void requeue(struct connection *c)
+{
+	struct repo_queue *q, **qp;
+
+	for (qp = &ready; (q = *qp); qp = &q->next)
+		if (!strcmp(q->name, c->req.line))
+			break;
+	if (q) {
+		*qp = q->next;
+		if (!*qp)
+			ready_last = qp;
+	} else {
+		q = xcalloc(1, sizeof(*q));
+		q->name = xstrdup(c->req.line);
+		q->last = &q->first;
+	}
+	c->next = q->first;
+	q->first = c;
+	if (!c->next)
+		q->last = &c->next;
+	q->nr++;
+
+	q->next = ready;
+	ready = q;
+	if (!q->next)
+		ready_last = &q->next;
+	queue_stats.waiting++;
+}
+
+static void dispatch_requests(void)
+{
+	int i;
+
+	for (i = 0; ready && i < nr_workers; i++) {
+		struct worker *w = &workers[i];
+		struct connection *c;
+		unsigned long waited;
+
+		if (w->busy || w->fd < 0)
+			continue;
+		c = dequeue();
+
+		/* Until it says it is done, or dies */
+		w->busy = 1;
+		nr_busy++;
+		if (send_connection(w->fd, c)) {
+			/*
+			 * The worker is dead or dying, and closes the
+			 * connection if it got it at all; the next idle
+			 * worker, or the one started in its place, gets
+			 * the client instead.
+			 */
+			logerror("unable to pass a connection to worker %"PRIuMAX": %s",
+				 (uintmax_t)w->pid, strerror(errno));
+			close(w->fd);
+			w->fd = -1;
+			requeue(c);
+			continue;
+		}
+
+		waited = now_ms() - c->since;
+		queue_stats.served++;
+		queue_stats.wait_total += waited;
+		if (queue_stats.wait_max < waited)
+			queue_stats.wait_max = waited;
+		loginfo("Passed '%s' to worker %"PRIuMAX" after %lu ms",
+			c->req.line, (uintmax_t)w->pid, waited);
+		close(c->fd);
+		free(c);
+	}
+}
+
+/*
+ * Read what the client has sent of its request line; returns 1 once
+ * all of it is there, 0 if there is more to come, and -1 if the client
+ * is to be dropped.
+ */
+static int read_request(struct connection *c)
+{
+	ssize_t n;
+
+	if (c->len < sizeof(c->hdr)) {
+		int i, len = 0;
+
+		n = xread(c->fd, c->hdr + c->len, sizeof(c->hdr) - c->len);
+		if (n <= 0)
+			return -1;
+		c->len += n;
+		if (c->len < sizeof(c->hdr))
+			return 0;
+		for (i = 0; i < sizeof(c->hdr); i++) {
+			unsigned int val = hexval(c->hdr[i]);
+			if (val & ~0xf) {
+				logerror("Protocol error: bad line length character: %.4s",
+					 c->hdr);
+				return -1;
+			}
+			len = (len << 4) | val;
+		}
+		len -= sizeof(c->hdr);
+		if (len < 0 || MAX_REQUEST_LINE <= len) {
+			logerror("Protocol error: bad line length %d", len);
+			return -1;
+		}
+		c->req.pktlen = len;
+	} else {
+		int got = c->len - sizeof(c->hdr);
+
+		n = xread(c->fd, c->req.line + got, c->req.pktlen - got);
+		if (n <= 0)
+			return -1;
+		c->len += n;
+	}
+	if (c->len - sizeof(c->hdr) < c->req.pktlen)
+		return 0;
+	c->req.line[c->req.pktlen] = '\0';
+	return 1;
+}
+
+static void accept_connection(int listener)
+{
+	struct sockaddr_storage ss;
+	socklen_t sslen = sizeof(ss);
+	struct connection *c;
+	int incoming;
+
+	incoming = accept(listener, (struct sockaddr *)&ss, &sslen);
+	if (incoming < 0) {
+		switch (errno) {
+		case EAGAIN:
+		case EINTR:
+		case ECONNABORTED:
+			return;
+		default:
+			die_errno("accept returned");
+		}
+	}
+	c = xcalloc(1, sizeof(*c));
+	c->fd = incoming;
+	c->since = now_ms();
+	remote_address((struct sockaddr *)&ss, c->req.addr, sizeof(c->req.addr),
+		       c->req.port, sizeof(c->req.port));
+	c->next = reading;
+	reading = c;
+	nr_reading++;
+}
+
+__attribute__((format (printf, 1, 2)))
+static void lognotice(const char *err, ...)
+{
+	va_list params;
+	va_start(params, err);
+	logreport(LOG_NOTICE, err, params);
+	va_end(params);
+}
+
+static void log_queue_stats(void)
+{
+	struct repo_queue *q;
+
+	lognotice("Queue: %u waiting (at most %u so far), %u reading, "
+		  "%u of %d workers busy",
+		  queue_stats.waiting, queue_stats.waiting_max,
+		  nr_reading, nr_busy, nr_workers);
+	lognotice("Queue: %lu served after %lu ms on average, %lu ms at most; "
+		  "%lu timed out",
+		  queue_stats.served,
+		  queue_stats.served ?
+		  queue_stats.wait_total / queue_stats.served : 0,
+		  queue_stats.wait_max, queue_stats.timed_out);
+	for (q = ready; q; q = q->next)
+		lognotice("Queue: %u waiting for '%s'", q->nr, q->name);
+}
+
+/*
+ * Look at what poll() found, with the descriptors in the order
+ * worker_service_loop() gave them: workers, clients, then listeners.
+ */
+static void handle_events(struct pollfd *pfd, struct socketlist *socklist,
+			  int accepting, unsigned long request_timeout)
+{
+	struct connection *c, **cp;
+	unsigned long now;
+	int i, nr = 0;
+
+	for (i = 0; i < nr_workers; i++) {
+		struct worker *w = &workers[i];
+		char done;
+
+		if (w->fd < 0)
+			continue;
+		if (!pfd[nr++].revents)
+			continue;
+		if (xread(w->fd, &done, 1) == 1) {
+			w->busy = 0;
+			nr_busy--;
+			continue;
+		}
+		/* It is going away; reap_workers() will see to it */
+		close(w->fd);
+		w->fd = -1;
+		if (!w->busy) {
+			w->busy = 1;
+			nr_busy++;
+		}
+	}
+
+	now = now_ms();
+	for (cp = &reading; (c = *cp); ) {
+		int ret = 0;
+
+		if (pfd[nr++].revents)
+			ret = read_request(c);
+		else if (request_timeout &&
+			 request_timeout * 1000 <= now - c->since) {
+			loginfo("Timed out waiting for a request");
+			queue_stats.timed_out++;
+			ret = -1;
+		}
+		if (!ret) {
+			cp = &c->next;
+			continue;
+		}
+		*cp = c->next;
+		nr_reading--;
+		if (ret < 0) {
+			close(c->fd);
+			free(c);
+		} else
+			enqueue(c);
+	}
+
+	if (accepting) {
+		for (i = 0; i < socklist->nr; i++)
+			if (pfd[nr++].revents & POLLIN)
+				accept_connection(socklist->list[i]);
+	}
+}
+
+static void NORETURN worker_service_loop(struct socketlist *socklist)
+{
+	unsigned long request_timeout = init_timeout ? init_timeout : timeout;
+	struct pollfd *pfd = NULL;
+	int pfd_alloc = 0;
+	int i;
+
+	workers = xcalloc(nr_workers, sizeof(*workers));
+	for (i = 0; i < nr_workers; i++)
+		workers[i].fd = -1;
+
+	signal(SIGCHLD, child_handler);
+	signal(SIGUSR1, stats_handler);
+	/* A worker may die with its connection in flight */
+	signal(SIGPIPE, SIG_IGN);
+
+	for (;;) {
+		struct connection *c;
+		int nr = 0, accepting, wait = -1;
+		unsigned long now;
+
+		reap_workers();
+		for (i = 0; i < nr_workers; i++)
+			if (!workers[i].pid)
+				spawn_worker(&workers[i], socklist);
+		if (stats_requested) {
+			stats_requested = 0;
+			log_queue_stats();
+		}
+		dispatch_requests();
+
+		/* In the order handle_events() expects them */
+		ALLOC_GROW(pfd, nr_workers + nr_reading + socklist->nr, pfd_alloc);
+		for (i = 0; i < nr_workers; i++) {
+			if (workers[i].fd < 0)
+				continue;
+			pfd[nr].fd = workers[i].fd;
+			pfd[nr++].events = POLLIN;
+		}
+		now = now_ms();
+		for (c = reading; c; c = c->next) {
+			pfd[nr].fd = c->fd;
+			pfd[nr++].events = POLLIN;
+			if (request_timeout) {
+				unsigned long end = c->since + request_timeout * 1000;
+				int left = end > now ? end - now : 0;
+				if (wait < 0 || left < wait)
+					wait = left;
+			}
+		}
+		accepting = !max_connections ||
+			nr_reading + queue_stats.waiting + nr_busy < max_connections;
+		if (accepting) {
+			for (i = 0; i < socklist->nr; i++) {
+				pfd[nr].fd = socklist->list[i];
+				pfd[nr++].events = POLLIN;
+			}
+		}
+
+		if (poll(pfd, nr, wait) < 0) {
+			if (errno != EINTR) {
+				logerror("Poll failed, resuming: %s",
+				      strerror(errno));
+				sleep(1);
+			}
+		} else
+			handle_events(pfd, socklist, accepting, request_timeout);
+	}
+}
+
+#endif
+
 static void store_pid(const char *path)
 {
 	FILE *f = fopen(path, "w");
@@ -1040,6 +1694,8 @@ static int serve(struct string_list *listen_addr, int listen_port,
 
 	drop_privileges(cred);
 
+	if (nr_workers)
+		worker_service_loop(&socklist);
 	return service_loop(&socklist);
 }
 
@@ -1106,6 +1762,12 @@ int main(int argc, char **argv)
 				max_connections = 0;	        /* unlimited */
 			continue;
 		}
+		if (!prefixcmp(arg, "--workers=")) {
+			nr_workers = atoi(arg+10);
+			if (nr_workers < 0)
+				nr_workers = 0;
+			continue;
+		}
 		if (!strcmp(arg, "--strict-paths")) {
 			strict_paths = 1;
 			continue;
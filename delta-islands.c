@@ -0,0 +1,302 @@
+#include "cache.h"
+#include "commit.h"
+#include "tag.h"
+#include "tree.h"
+#include "tree-walk.h"
+#include "refs.h"
+#include "decorate.h"
+#include "string-list.h"
+#include "delta-islands.h"
+
+/*
+ * The islands an object is in, one bit per island.  Most objects are
+ * in exactly the same islands as the commit or tree that leads to
+ * them, so a bitmap is shared by all of them until one of them needs
+ * a bit more, at which point that one gets its own copy.
+ */
+struct island_bitmap {
+	uint32_t refcount;
+	uint32_t bits[FLEX_ARRAY];
+};
+
+static unsigned island_bitmap_size; /* in 32-bit words */
+
+static struct decoration island_marks = { "island marks" };
+
+static regex_t *island_regexes;
+static int island_regexes_nr, island_regexes_alloc;
+
+static struct string_list island_names = STRING_LIST_INIT_DUP;
+
+static struct island_pending {
+	struct object *obj;
+	int island;
+} *island_pending;
+static int island_pending_nr, island_pending_alloc;
+
+static struct island_bitmap *island_bitmap_new(const struct island_bitmap *old)
+{
+	size_t size = sizeof(struct island_bitmap) +
+		island_bitmap_size * sizeof(uint32_t);
+	struct island_bitmap *b = xcalloc(1, size);
+
+	if (old)
+		memcpy(b->bits, old->bits, island_bitmap_size * sizeof(uint32_t));
+	b->refcount = 1;
+	return b;
+}
+
+static int island_bitmap_is_subset(const struct island_bitmap *self,
+				   const struct island_bitmap *super)
+{
+	unsigned i;
+
+	if (self == super)
+		return 1;
+	for (i = 0; i < island_bitmap_size; i++)
+		if ((self->bits[i] & super->bits[i]) != self->bits[i])
+			return 0;
+	return 1;
+}
+
+static struct island_bitmap *island_marks_of(const unsigned char *sha1)
+{
+	struct object *obj = lookup_object(sha1);
+
+	if (!obj)
+		return NULL;
+	return lookup_decoration(&island_marks, obj);
+}
+
+int in_same_island(const unsigned char *trg, const unsigned char *src)
+{
+	struct island_bitmap *trg_marks, *src_marks;
+
+	/* An object no island reaches may use any base. */
+	trg_marks = island_marks_of(trg);
+	if (!trg_marks)
+		return 1;
+	src_marks = island_marks_of(src);
+	if (!src_marks)
+		return 0;
+	return island_bitmap_is_subset(trg_marks, src_marks);
+}
+
+int island_delta_cmp(const unsigned char *a, const unsigned char *b)
+{
+	struct island_bitmap *a_marks = island_marks_of(a);
+	struct island_bitmap *b_marks = island_marks_of(b);
+	int a_in_b, b_in_a;
+
+	if (!a_marks || !b_marks)
+		return !a_marks - !b_marks;
+	a_in_b = island_bitmap_is_subset(a_marks, b_marks);
+	b_in_a = island_bitmap_is_subset(b_marks, a_marks);
+	if (a_in_b == b_in_a)
+		return 0;
+	return b_in_a ? -1 : 1;
+}
+
+/* Add marks to those of obj; returns 1 if that changed them. */
+static int set_island_marks(struct object *obj, struct island_bitmap *marks)
+{
+	struct island_bitmap *b = lookup_decoration(&island_marks, obj);
+	unsigned i;
+
+	if (!b) {
+		marks->refcount++;
+		add_decoration(&island_marks, obj, marks);
+		return 1;
+	}
+	if (island_bitmap_is_subset(marks, b))
+		return 0;
+
+	/* Others may be sharing these marks; only change ours. */
+	if (b->refcount > 1) {
+		b->refcount--;
+		b = island_bitmap_new(b);
+		add_decoration(&island_marks, obj, b);
+	}
+	for (i = 0; i < island_bitmap_size; i++)
+		b->bits[i] |= marks->bits[i];
+	return 1;
+}
+
+void propagate_island_marks(struct commit *commit)
+{
+	struct island_bitmap *marks;
+	struct commit_list *p;
+
+	marks = lookup_decoration(&island_marks, &commit->object);
+	if (!marks)
+		return;
+	if (commit->tree)
+		set_island_marks(&commit->tree->object, marks);
+	for (p = commit->parents; p; p = p->next)
+		set_island_marks(&p->item->object, marks);
+}
+
+/*
+ * Push the marks of tree down to its entries.  A tree among them that
+ * has already been done gets more marks only if it is reachable at
+ * more than one depth; it goes to redo, to push those down as well.
+ */
+static void resolve_one_tree(struct object *tree, struct decoration *done,
+			     struct object_array *redo)
+{
+	struct island_bitmap *marks;
+	struct tree_desc desc;
+	struct name_entry entry;
+	enum object_type type;
+	unsigned long size;
+	void *buf;
+
+	marks = lookup_decoration(&island_marks, tree);
+	if (!marks)
+		return;
+	buf = read_sha1_file(tree->sha1, &type, &size);
+	if (!buf || type != OBJ_TREE)
+		die("unable to read tree %s", sha1_to_hex(tree->sha1));
+
+	init_tree_desc(&desc, buf, size);
+	while (tree_entry(&desc, &entry)) {
+		struct object *obj;
+
+		if (S_ISGITLINK(entry.mode))
+			continue;
+		obj = lookup_object(entry.sha1);
+		if (!obj)
+			continue;
+		if (set_island_marks(obj, marks) &&
+		    obj->type == OBJ_TREE && lookup_decoration(done, obj))
+			add_object_array(obj, NULL, redo);
+	}
+	free(buf);
+}
+
+void resolve_tree_islands(struct object **trees, unsigned nr)
+{
+	struct decoration done = { "resolved trees" };
+	struct object_array redo = OBJECT_ARRAY_INIT;
+	unsigned i;
+
+	for (i = 0; i < nr; i++) {
+		add_decoration(&done, trees[i], trees[i]);
+		resolve_one_tree(trees[i], &done, &redo);
+	}
+
+	/* Marks only ever grow, so this stops once they all settle. */
+	while (redo.nr) {
+		struct object *tree = redo.objects[--redo.nr].item;
+		resolve_one_tree(tree, &done, &redo);
+	}
+	free(redo.objects);
+	free(done.hash);
+}
+
+static int island_config_callback(const char *k, const char *v, void *cb)
+{
+	if (!strcmp(k, "pack.island")) {
+		int ret;
+
+		if (!v)
+			return config_error_nonbool(k);
+		ALLOC_GROW(island_regexes, island_regexes_nr + 1,
+			   island_regexes_alloc);
+		ret = regcomp(&island_regexes[island_regexes_nr], v, REG_EXTENDED);
+		if (ret) {
+			char errbuf[1024];
+			regerror(ret, &island_regexes[island_regexes_nr],
+				 errbuf, sizeof(errbuf));
+			return error("invalid pack.island regex '%s': %s",
+				     v, errbuf);
+		}
+		island_regexes_nr++;
+	}
+	return 0;
+}
+
+static void add_pending_island_mark(struct object *obj, int island)
+{
+	ALLOC_GROW(island_pending, island_pending_nr + 1, island_pending_alloc);
+	island_pending[island_pending_nr].obj = obj;
+	island_pending[island_pending_nr].island = island;
+	island_pending_nr++;
+}
+
+/*
+ * The island of a ref is named after the parts of it captured by the
+ * last regex that matches it, joined with dashes; with no capture
+ * groups, all the refs a regex matches are one island.
+ */
+static int find_island_for_ref(const char *refname, const unsigned char *sha1,
+			       int flags, void *data)
+{
+	struct strbuf name = STRBUF_INIT;
+	struct string_list_item *item;
+	regmatch_t matches[16];
+	struct object *obj;
+	int i, m, island;
+
+	for (i = island_regexes_nr - 1; i >= 0; i--)
+		if (!regexec(&island_regexes[i], refname,
+			     ARRAY_SIZE(matches), matches, 0))
+			break;
+	if (i < 0)
+		return 0;
+
+	for (m = 1; m < ARRAY_SIZE(matches); m++) {
+		regmatch_t *match = &matches[m];
+
+		if (match->rm_so == -1)
+			continue;
+		if (name.len)
+			strbuf_addch(&name, '-');
+		strbuf_add(&name, refname + match->rm_so,
+			   match->rm_eo - match->rm_so);
+	}
+
+	item = string_list_insert(&island_names, name.buf);
+	if (!item->util)
+		item->util = (void *)(intptr_t)island_names.nr;
+	island = (intptr_t)item->util - 1;
+	strbuf_release(&name);
+
+	obj = parse_object(sha1);
+	while (obj) {
+		add_pending_island_mark(obj, island);
+		if (obj->type != OBJ_TAG)
+			break;
+		obj = ((struct tag *)obj)->tagged;
+		if (obj)
+			obj = parse_object(obj->sha1);
+	}
+	return 0;
+}
+
+void load_delta_islands(void)
+{
+	int i;
+
+	git_config(island_config_callback, NULL);
+	if (!island_regexes_nr)
+		return;
+	for_each_ref(find_island_for_ref, NULL);
+
+	island_bitmap_size = (island_names.nr + 31) / 32;
+	for (i = 0; i < island_pending_nr; i++) {
+		struct object *obj = island_pending[i].obj;
+		int island = island_pending[i].island;
+		struct island_bitmap *b;
+
+		b = lookup_decoration(&island_marks, obj);
+		if (!b) {
+			b = island_bitmap_new(NULL);
+			add_decoration(&island_marks, obj, b);
+		}
+		b->bits[island / 32] |= 1u << (island % 32);
+	}
+	free(island_pending);
+	island_pending = NULL;
+	island_pending_nr = island_pending_alloc = 0;
+}
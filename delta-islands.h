@@ -0,0 +1,36 @@
+#ifndef DELTA_ISLANDS_H
+#define DELTA_ISLANDS_H
+
+struct commit;
+struct object;
+
+/*
+ * Delta islands group the refs matching the "pack.island" regexes;
+ * every object is marked with the islands whose refs reach it, and an
+ * object may only be stored as a delta against a base that is in all
+ * the islands it is in.  That keeps a pack made for one island (say,
+ * one fork of a repository sharing its object store with others) free
+ * of deltas against objects only the other islands have.
+ *
+ * load_delta_islands() marks the tips; the marks are then pushed down
+ * to parents by propagate_island_marks() as the commits are walked
+ * (children first, so the walk must be in topological order), and to
+ * the contents of the trees by resolve_tree_islands().  That is given
+ * the trees sorted so that a tree usually comes before the trees it
+ * contains; a tree that turns out to get more marks after it was done
+ * is done again.
+ */
+extern void load_delta_islands(void);
+extern void propagate_island_marks(struct commit *commit);
+extern void resolve_tree_islands(struct object **trees, unsigned nr);
+
+/* Can trg be stored as a delta against src? */
+extern int in_same_island(const unsigned char *trg, const unsigned char *src);
+
+/*
+ * Order a before b (negative) when it is in a superset of the islands
+ * of b, so that the delta search considers it as a base first.
+ */
+extern int island_delta_cmp(const unsigned char *a, const unsigned char *b);
+
+#endif
@@ -176,6 +176,13 @@ int git_diff_basic_config(const char *var, const char *value, void *cb)
 		diff_rename_limit_default = git_config_int(var, value);
 		return 0;
 	}
+	if (!strcmp(var, "diff.renamesketch")) {
+		if (git_config_bool(var, value))
+			DIFF_OPT_SET(&default_diff_options, RENAME_SKETCH);
+		else
+			DIFF_OPT_CLR(&default_diff_options, RENAME_SKETCH);
+		return 0;
+	}
 
 	switch (userdiff_config(var, value)) {
 		case 0: break;
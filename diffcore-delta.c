@@ -163,6 +163,42 @@ static struct spanhash_top *hash_chars(struct diff_filespec *one)
 	return hash;
 }
 
+void diffcore_populate_count(struct diff_filespec *one)
+{
+	if (!one->cnt_data)
+		one->cnt_data = hash_chars(one);
+}
+
+/*
+ * A MinHash sketch of the set of spans in "one": for each of "nr"
+ * hash functions, the smallest value it gives to any span.  The
+ * fraction of places where the sketches of two files agree estimates
+ * the Jaccard similarity of their span sets, which is good enough to
+ * tell which pairs deserve a real diffcore_count_changes().  Returns
+ * the number of distinct spans; the sketch is meaningless if zero.
+ */
+int diffcore_sketch(struct diff_filespec *one, uint32_t *sketch, int nr)
+{
+	struct spanhash *s;
+	int i, spans = 0;
+
+	diffcore_populate_count(one);
+	for (i = 0; i < nr; i++)
+		sketch[i] = 0xffffffff;
+	for (s = ((struct spanhash_top *)one->cnt_data)->data; s->cnt; s++) {
+		for (i = 0; i < nr; i++) {
+			uint32_t h = (s->hashval ^ (i * 0x9e3779b9u)) * 0x85ebca6bu;
+			h ^= h >> 13;
+			h *= 0xc2b2ae35u;
+			h ^= h >> 16;
+			if (h < sketch[i])
+				sketch[i] = h;
+		}
+		spans++;
+	}
+	return spans;
+}
+
 int diffcore_count_changes(struct diff_filespec *src,
 			   struct diff_filespec *dst,
 			   void **src_count_p,
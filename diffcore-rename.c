@@ -6,6 +6,7 @@
 #include "diffcore.h"
 #include "hash.h"
 #include "progress.h"
+#include "thread-utils.h"
 
 /* Table of rename/copy destinations */
 
@@ -118,6 +119,15 @@ struct diff_score {
 	short name_score;
 };
 
+/* Would a pair of files of these sizes pass the size check below? */
+static int size_compatible(unsigned long a, unsigned long b, int minimum_score)
+{
+	unsigned long max_size = a > b ? a : b;
+	unsigned long delta_size = a > b ? a - b : b - a;
+
+	return max_size * (MAX_SCORE-minimum_score) >= delta_size * MAX_SCORE;
+}
+
 static int estimate_similarity(struct diff_filespec *src,
 			       struct diff_filespec *dst,
 			       int minimum_score)
@@ -147,17 +157,12 @@ static int estimate_similarity(struct diff_filespec *src,
 		return 0;
 
 	/*
-	 * Need to check that source and destination sizes are
-	 * filled in before comparing them.
-	 *
-	 * If we already have "cnt_data" filled in, we know it's
-	 * all good (avoid checking the size for zero, as that
-	 * is a possible size - we really should have a flag to
-	 * say whether the size is valid or not!)
+	 * The span counts of both sides have been computed by
+	 * prepare_rename_filespec() before we are called (possibly
+	 * from more than one thread), unless the file could not be
+	 * read or its size rules out every pair it could be part of.
 	 */
-	if (!src->cnt_data && diff_populate_filespec(src, 1))
-		return 0;
-	if (!dst->cnt_data && diff_populate_filespec(dst, 1))
+	if (!src->cnt_data || !dst->cnt_data)
 		return 0;
 
 	max_size = ((src->size > dst->size) ? src->size : dst->size);
@@ -175,11 +180,6 @@ static int estimate_similarity(struct diff_filespec *src,
 	if (max_size * (MAX_SCORE-minimum_score) < delta_size * MAX_SCORE)
 		return 0;
 
-	if (!src->cnt_data && diff_populate_filespec(src, 0))
-		return 0;
-	if (!dst->cnt_data && diff_populate_filespec(dst, 0))
-		return 0;
-
 	delta_limit = (unsigned long)
 		(base_size * (MAX_SCORE-minimum_score) / MAX_SCORE);
 	if (diffcore_count_changes(src, dst,
@@ -420,6 +420,15 @@ static void record_if_better(struct diff_score m[], struct diff_score *o)
 		m[worst] = *o;
 }
 
+static int effective_rename_limit(struct diff_options *options)
+{
+	int rename_limit = options->rename_limit;
+
+	if (rename_limit <= 0 || rename_limit > 32767)
+		rename_limit = 32767;
+	return rename_limit;
+}
+
 /*
  * Returns:
  * 0 if we are under the limit;
@@ -429,7 +438,7 @@ static void record_if_better(struct diff_score m[], struct diff_score *o)
 static int too_many_rename_candidates(int num_create,
 				      struct diff_options *options)
 {
-	int rename_limit = options->rename_limit;
+	int rename_limit = effective_rename_limit(options);
 	int num_src = rename_src_nr;
 	int i;
 
@@ -444,8 +453,6 @@ static int too_many_rename_candidates(int num_create,
 	 * but handles the potential overflow case specially (and we
 	 * assume at least 32-bit integers)
 	 */
-	if (rename_limit <= 0 || rename_limit > 32767)
-		rename_limit = 32767;
 	if ((num_create <= rename_limit || num_src <= rename_limit) &&
 	    (num_create * num_src <= rename_limit * rename_limit))
 		return 0;
@@ -469,6 +476,353 @@ static int too_many_rename_candidates(int num_create,
 	return 1;
 }
 
+/*
+ * Inexact rename detection scores each remaining destination (a "row"
+ * of the matrix mx) against its candidate sources.  The span counts of
+ * all the files involved are computed up front, so that the rows can
+ * then be scored by several threads.
+ *
+ * Normally every source is a candidate.  With diff.renameSketch, a
+ * matrix over the rename limit is not given up on; instead, the
+ * MinHash sketch of every file (see diffcore_sketch()) is cut into
+ * SKETCH_BANDS bands of SKETCH_ROWS values, and only the sources that
+ * agree with a destination on a whole band are its candidates.  A
+ * pair sharing a third of its spans becomes a candidate with a
+ * probability of about 97%, a pair sharing a tenth about 27%.  The
+ * rename limit then bounds the number of candidate pairs instead.
+ */
+#define SKETCH_BANDS 32
+#define SKETCH_ROWS 2
+
+struct sketch_band {
+	uint32_t hash;
+	int src;
+};
+
+struct rename_scoring {
+	struct diff_score *mx;
+	int *rows;		/* index in rename_dst of each row */
+	int nr_rows;
+	int minimum_score;
+	int skip_unmodified;
+
+	/* only with sketches */
+	struct sketch_band *bands;	/* of the sources, sorted */
+	int nr_bands;
+	uint32_t *row_bands;		/* SKETCH_BANDS per row */
+	char *row_sketched;
+
+	unsigned long nr_pairs;
+	int next_row;
+	unsigned long done;
+	struct progress *progress;
+#ifndef NO_PTHREADS
+	pthread_mutex_t mutex;
+#endif
+};
+
+#ifndef NO_PTHREADS
+#define scoring_lock(s)		pthread_mutex_lock(&(s)->mutex)
+#define scoring_unlock(s)	pthread_mutex_unlock(&(s)->mutex)
+#else
+#define scoring_lock(s)		(void)0
+#define scoring_unlock(s)	(void)0
+#endif
+
+static void prepare_rename_filespec(struct diff_filespec *one)
+{
+	if (!one->cnt_data && !diff_populate_filespec(one, 0))
+		diffcore_populate_count(one);
+	diff_free_filespec_blob(one);
+}
+
+static int sketch_bands(struct diff_filespec *one, uint32_t *bands)
+{
+	uint32_t sketch[SKETCH_BANDS * SKETCH_ROWS];
+	int i, j;
+
+	if (!one->cnt_data ||
+	    !diffcore_sketch(one, sketch, SKETCH_BANDS * SKETCH_ROWS))
+		return 0;
+	for (i = 0; i < SKETCH_BANDS; i++) {
+		uint32_t h = i;
+		for (j = 0; j < SKETCH_ROWS; j++) {
+			h = (h ^ sketch[i * SKETCH_ROWS + j]) * 0x9e3779b1u;
+			h ^= h >> 16;
+		}
+		bands[i] = h;
+	}
+	return 1;
+}
+
+static int sketch_band_cmp(const void *a_, const void *b_)
+{
+	const struct sketch_band *a = a_, *b = b_;
+
+	if (a->hash != b->hash)
+		return a->hash < b->hash ? -1 : 1;
+	return a->src - b->src;
+}
+
+static int int_cmp(const void *a_, const void *b_)
+{
+	return *(const int *)a_ - *(const int *)b_;
+}
+
+static int ulong_cmp(const void *a_, const void *b_)
+{
+	unsigned long a = *(const unsigned long *)a_;
+	unsigned long b = *(const unsigned long *)b_;
+	return a < b ? -1 : a != b;
+}
+
+static int usable_rename_src(struct rename_scoring *s, int j)
+{
+	return !s->skip_unmodified || !diff_unmodified_pair(rename_src[j].p);
+}
+
+/*
+ * Is there a file with a size in sizes[0..nr), which is sorted, that
+ * one of "size" could be paired with?
+ */
+static int has_compatible_size(unsigned long size, unsigned long *sizes,
+			       int nr, int minimum_score)
+{
+	int lo = 0, hi = nr;
+
+	while (lo < hi) {
+		int mi = (lo + hi) / 2;
+		if (sizes[mi] < size)
+			lo = mi + 1;
+		else
+			hi = mi;
+	}
+	/* the sizes that are compatible with "size" form a range around it */
+	return (lo < nr && size_compatible(size, sizes[lo], minimum_score)) ||
+	       (lo && size_compatible(size, sizes[lo - 1], minimum_score));
+}
+
+/*
+ * Compute the span counts of the files that can be part of at least
+ * one pair that passes the size check in estimate_similarity().
+ */
+static void prepare_full_matrix(struct rename_scoring *s)
+{
+	unsigned long *src_sizes, *dst_sizes;
+	int i, nr_src = 0, nr_dst = 0;
+
+	src_sizes = xmalloc(rename_src_nr * sizeof(*src_sizes));
+	for (i = 0; i < rename_src_nr; i++) {
+		struct diff_filespec *one = rename_src[i].p->one;
+		if (!usable_rename_src(s, i))
+			continue;
+		s->nr_pairs += s->nr_rows;
+		if (S_ISREG(one->mode) &&
+		    (one->cnt_data || !diff_populate_filespec(one, 1)))
+			src_sizes[nr_src++] = one->size;
+	}
+	dst_sizes = xmalloc(s->nr_rows * sizeof(*dst_sizes));
+	for (i = 0; i < s->nr_rows; i++) {
+		struct diff_filespec *two = rename_dst[s->rows[i]].two;
+		if (S_ISREG(two->mode) &&
+		    (two->cnt_data || !diff_populate_filespec(two, 1)))
+			dst_sizes[nr_dst++] = two->size;
+	}
+	qsort(src_sizes, nr_src, sizeof(*src_sizes), ulong_cmp);
+	qsort(dst_sizes, nr_dst, sizeof(*dst_sizes), ulong_cmp);
+
+	for (i = 0; i < rename_src_nr; i++) {
+		struct diff_filespec *one = rename_src[i].p->one;
+		if (usable_rename_src(s, i) && S_ISREG(one->mode) &&
+		    has_compatible_size(one->size, dst_sizes, nr_dst,
+					s->minimum_score))
+			prepare_rename_filespec(one);
+	}
+	for (i = 0; i < s->nr_rows; i++) {
+		struct diff_filespec *two = rename_dst[s->rows[i]].two;
+		if (S_ISREG(two->mode) &&
+		    has_compatible_size(two->size, src_sizes, nr_src,
+					s->minimum_score))
+			prepare_rename_filespec(two);
+	}
+	free(src_sizes);
+	free(dst_sizes);
+}
+
+/*
+ * Collect the candidate sources for "row" in cand[], in the order of
+ * rename_src, and return how many there are.  "seen" is scratch space
+ * of rename_src_nr entries, zeroed before the first call.
+ */
+static int row_candidates(struct rename_scoring *s, int row,
+			  int *cand, int *seen)
+{
+	int i, j, nr = 0;
+
+	if (!s->bands) {
+		for (j = 0; j < rename_src_nr; j++)
+			if (usable_rename_src(s, j))
+				cand[nr++] = j;
+		return nr;
+	}
+
+	if (!s->row_sketched[row])
+		return 0;
+	for (i = 0; i < SKETCH_BANDS; i++) {
+		uint32_t h = s->row_bands[row * SKETCH_BANDS + i];
+		int lo = 0, hi = s->nr_bands;
+
+		while (lo < hi) {
+			int mi = (lo + hi) / 2;
+			if (s->bands[mi].hash < h)
+				lo = mi + 1;
+			else
+				hi = mi;
+		}
+		for (; lo < s->nr_bands && s->bands[lo].hash == h; lo++) {
+			j = s->bands[lo].src;
+			if (seen[j] == row + 1)
+				continue;
+			seen[j] = row + 1;
+			cand[nr++] = j;
+		}
+	}
+	qsort(cand, nr, sizeof(*cand), int_cmp);
+	return nr;
+}
+
+/*
+ * Sketch all the files, and count the candidate pairs.  Returns -1
+ * if there are more of them than the rename limit allows.
+ */
+static int prepare_sketches(struct rename_scoring *s, int rename_limit)
+{
+	uint32_t bands[SKETCH_BANDS];
+	int *cand, *seen;
+	int i, j;
+
+	s->bands = xmalloc(rename_src_nr * SKETCH_BANDS * sizeof(*s->bands));
+	for (i = 0; i < rename_src_nr; i++) {
+		struct diff_filespec *one = rename_src[i].p->one;
+		if (!S_ISREG(one->mode))
+			continue;
+		prepare_rename_filespec(one);
+		if (!sketch_bands(one, bands))
+			continue;
+		for (j = 0; j < SKETCH_BANDS; j++) {
+			s->bands[s->nr_bands].hash = bands[j];
+			s->bands[s->nr_bands].src = i;
+			s->nr_bands++;
+		}
+	}
+	qsort(s->bands, s->nr_bands, sizeof(*s->bands), sketch_band_cmp);
+
+	s->row_bands = xmalloc(s->nr_rows * SKETCH_BANDS * sizeof(*s->row_bands));
+	s->row_sketched = xcalloc(s->nr_rows, 1);
+	for (i = 0; i < s->nr_rows; i++) {
+		struct diff_filespec *two = rename_dst[s->rows[i]].two;
+		if (!S_ISREG(two->mode))
+			continue;
+		prepare_rename_filespec(two);
+		s->row_sketched[i] =
+			sketch_bands(two, s->row_bands + i * SKETCH_BANDS);
+	}
+
+	cand = xmalloc(rename_src_nr * sizeof(*cand));
+	seen = xcalloc(rename_src_nr, sizeof(*seen));
+	for (i = 0; i < s->nr_rows; i++)
+		s->nr_pairs += row_candidates(s, i, cand, seen);
+	free(cand);
+	free(seen);
+	return s->nr_pairs > (unsigned long)rename_limit * rename_limit ? -1 : 0;
+}
+
+static int score_row(struct rename_scoring *s, int row, int *cand, int *seen)
+{
+	int i = s->rows[row];
+	struct diff_filespec *two = rename_dst[i].two;
+	struct diff_score *m = &s->mx[row * NUM_CANDIDATE_PER_DST];
+	int j, nr;
+
+	for (j = 0; j < NUM_CANDIDATE_PER_DST; j++)
+		m[j].dst = -1;
+
+	nr = row_candidates(s, row, cand, seen);
+	for (j = 0; j < nr; j++) {
+		struct diff_filespec *one = rename_src[cand[j]].p->one;
+		struct diff_score this_src;
+
+		this_src.score = estimate_similarity(one, two,
+						     s->minimum_score);
+		this_src.name_score = basename_same(one, two);
+		this_src.dst = i;
+		this_src.src = cand[j];
+		record_if_better(m, &this_src);
+	}
+	return nr;
+}
+
+static void *score_rows(void *data)
+{
+	struct rename_scoring *s = data;
+	int *cand = xmalloc(rename_src_nr * sizeof(*cand));
+	int *seen = xcalloc(rename_src_nr, sizeof(*seen));
+
+	for (;;) {
+		int row, nr;
+
+		scoring_lock(s);
+		row = s->next_row++;
+		scoring_unlock(s);
+		if (s->nr_rows <= row)
+			break;
+
+		nr = score_row(s, row, cand, seen);
+
+		scoring_lock(s);
+		s->done += nr;
+		display_progress(s->progress, s->done);
+		scoring_unlock(s);
+	}
+	free(cand);
+	free(seen);
+	return NULL;
+}
+
+/*
+ * A pair takes around a microsecond to score, so a thread is only
+ * worth starting for a good few hundred of them; with fewer pairs
+ * than this in all, they are scored without threads.
+ */
+#define MIN_PAIRS_PER_THREAD 512
+
+static void score_all_rows(struct rename_scoring *s)
+{
+#ifndef NO_PTHREADS
+	int i, nr_threads = online_cpus();
+	pthread_t *threads;
+
+	if (nr_threads > s->nr_pairs / MIN_PAIRS_PER_THREAD)
+		nr_threads = s->nr_pairs / MIN_PAIRS_PER_THREAD;
+	if (nr_threads > s->nr_rows)
+		nr_threads = s->nr_rows;
+	pthread_mutex_init(&s->mutex, NULL);
+	if (nr_threads > 1) {
+		threads = xmalloc(nr_threads * sizeof(*threads));
+		for (i = 0; i < nr_threads; i++)
+			if (pthread_create(&threads[i], NULL, score_rows, s))
+				die("unable to create thread");
+		for (i = 0; i < nr_threads; i++)
+			pthread_join(threads[i], NULL);
+		free(threads);
+	} else
+		score_rows(s);
+	pthread_mutex_destroy(&s->mutex);
+#else
+	score_rows(s);
+#endif
+}
+
 static int find_renames(struct diff_score *mx, int dst_cnt, int minimum_score, int copies)
 {
 	int count = 0, i;
@@ -497,7 +851,8 @@ void diffcore_rename(struct diff_options *options)
 	struct diff_queue_struct *q = &diff_queued_diff;
 	struct diff_queue_struct outq;
 	struct diff_score *mx;
-	int i, j, rename_count, skip_unmodified = 0;
+	struct rename_scoring scoring;
+	int i, rename_count, use_sketches = 0;
 	int num_create, dst_cnt;
 	struct progress *progress = NULL;
 
@@ -559,59 +914,47 @@ void diffcore_rename(struct diff_options *options)
 	if (!num_create)
 		goto cleanup;
 
+	memset(&scoring, 0, sizeof(scoring));
+	scoring.minimum_score = minimum_score;
+
 	switch (too_many_rename_candidates(num_create, options)) {
 	case 1:
-		goto cleanup;
+		if (!DIFF_OPT_TST(options, RENAME_SKETCH))
+			goto cleanup;
+		use_sketches = 1;
+		break;
 	case 2:
 		options->degraded_cc_to_c = 1;
-		skip_unmodified = 1;
+		scoring.skip_unmodified = 1;
 		break;
 	default:
 		break;
 	}
 
+	scoring.rows = xmalloc(num_create * sizeof(*scoring.rows));
+	for (i = 0; i < rename_dst_nr; i++)
+		if (!rename_dst[i].pair) /* not dealt with as an exact match */
+			scoring.rows[scoring.nr_rows++] = i;
+
+	if (use_sketches) {
+		if (prepare_sketches(&scoring, effective_rename_limit(options)))
+			goto free_scoring;
+		/* we could look at them after all */
+		options->needed_rename_limit = 0;
+	} else
+		prepare_full_matrix(&scoring);
+
 	if (options->show_rename_progress) {
 		progress = start_progress_delay(
 				"Performing inexact rename detection",
-				rename_dst_nr * rename_src_nr, 50, 1);
+				scoring.nr_pairs, 50, 1);
 	}
 
-	mx = xcalloc(num_create * NUM_CANDIDATE_PER_DST, sizeof(*mx));
-	for (dst_cnt = i = 0; i < rename_dst_nr; i++) {
-		struct diff_filespec *two = rename_dst[i].two;
-		struct diff_score *m;
-
-		if (rename_dst[i].pair)
-			continue; /* dealt with exact match already. */
-
-		m = &mx[dst_cnt * NUM_CANDIDATE_PER_DST];
-		for (j = 0; j < NUM_CANDIDATE_PER_DST; j++)
-			m[j].dst = -1;
-
-		for (j = 0; j < rename_src_nr; j++) {
-			struct diff_filespec *one = rename_src[j].p->one;
-			struct diff_score this_src;
-
-			if (skip_unmodified &&
-			    diff_unmodified_pair(rename_src[j].p))
-				continue;
-
-			this_src.score = estimate_similarity(one, two,
-							     minimum_score);
-			this_src.name_score = basename_same(one, two);
-			this_src.dst = i;
-			this_src.src = j;
-			record_if_better(m, &this_src);
-			/*
-			 * Once we run estimate_similarity,
-			 * We do not need the text anymore.
-			 */
-			diff_free_filespec_blob(one);
-			diff_free_filespec_blob(two);
-		}
-		dst_cnt++;
-		display_progress(progress, (i+1)*rename_src_nr);
-	}
+	dst_cnt = scoring.nr_rows;
+	mx = xcalloc(dst_cnt * NUM_CANDIDATE_PER_DST, sizeof(*mx));
+	scoring.mx = mx;
+	scoring.progress = progress;
+	score_all_rows(&scoring);
 	stop_progress(&progress);
 
 	/* cost matrix sorted by most to least similar pair */
@@ -622,6 +965,12 @@ void diffcore_rename(struct diff_options *options)
 		rename_count += find_renames(mx, dst_cnt, minimum_score, 1);
 	free(mx);
 
+ free_scoring:
+	free(scoring.rows);
+	free(scoring.bands);
+	free(scoring.row_bands);
+	free(scoring.row_sketched);
+
  cleanup:
 	/* At this point, we have found some renames and copies and they
 	 * are recorded in rename_dst.  The original list is still in *q.
@@ -128,5 +128,7 @@ extern int diffcore_count_changes(struct diff_filespec *src,
 				  unsigned long delta_limit,
 				  unsigned long *src_copied,
 				  unsigned long *literal_added);
+extern void diffcore_populate_count(struct diff_filespec *);
+extern int diffcore_sketch(struct diff_filespec *, uint32_t *sketch, int nr);
 
 #endif
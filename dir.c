@@ -8,6 +8,8 @@
 #include "cache.h"
 #include "dir.h"
 #include "refs.h"
+#include "varint.h"
+#include "fsmonitor.h"
 
 struct path_simplify {
 	int len;
@@ -15,7 +17,8 @@ struct path_simplify {
 };
 
 static int read_directory_recursive(struct dir_struct *dir, const char *path, int len,
-	int check_only, const struct path_simplify *simplify);
+	int check_only, const struct path_simplify *simplify,
+	struct untracked_cache_dir *untracked);
 static int get_dtype(struct dirent *de, const char *path, int len);
 
 /* helper string functions with support for the ignore_case flag */
@@ -602,6 +605,135 @@ struct dir_entry *dir_add_ignored(struct dir_struct *dir, const char *pathname,
 	return dir->ignored[dir->ignored_nr++] = dir_entry_new(pathname, len);
 }
 
+static int untracked_name_cmp(const char *a, const char *name, int len)
+{
+	int cmp = strncmp(a, name, len);
+	if (cmp)
+		return cmp;
+	return a[len] ? 1 : 0;
+}
+
+static struct untracked_cache_dir *new_untracked_dir(const char *name, int len)
+{
+	struct untracked_cache_dir *d = xcalloc(1, sizeof(*d) + len + 1);
+	memcpy(d->name, name, len);
+	return d;
+}
+
+static void free_untracked_names(struct untracked_cache_dir *d)
+{
+	unsigned int i;
+
+	for (i = 0; i < d->untracked_nr; i++)
+		free(d->untracked[i]);
+	d->untracked_nr = 0;
+}
+
+static void free_untracked_dir(struct untracked_cache_dir *d)
+{
+	unsigned int i;
+
+	if (!d)
+		return;
+	for (i = 0; i < d->dirs_nr; i++)
+		free_untracked_dir(d->dirs[i]);
+	free_untracked_names(d);
+	free(d->untracked);
+	free(d->dirs);
+	free(d);
+}
+
+/*
+ * Binary search the subdirectories of "parent"; returns the position
+ * of "name", or -1 - the position it would be inserted at.
+ */
+static int untracked_dir_pos(struct untracked_cache_dir *parent,
+			     const char *name, int len)
+{
+	int lo = 0, hi = parent->dirs_nr;
+
+	while (lo < hi) {
+		int mi = lo + (hi - lo) / 2;
+		int cmp = untracked_name_cmp(parent->dirs[mi]->name, name, len);
+		if (!cmp)
+			return mi;
+		if (cmp < 0)
+			lo = mi + 1;
+		else
+			hi = mi;
+	}
+	return -lo - 1;
+}
+
+/*
+ * Find the node for the subdirectory "name" of "parent", creating it
+ * if this is the first time we walk into it.
+ */
+static struct untracked_cache_dir *lookup_untracked(struct untracked_cache *uc,
+						    struct untracked_cache_dir *parent,
+						    const char *name, int len)
+{
+	int pos = untracked_dir_pos(parent, name, len);
+	struct untracked_cache_dir *d;
+
+	if (pos >= 0) {
+		parent->dirs[pos]->seen = 1;
+		return parent->dirs[pos];
+	}
+	pos = -pos - 1;
+	uc->dir_created++;
+	uc->changed = 1;
+	d = new_untracked_dir(name, len);
+	d->seen = 1;
+	ALLOC_GROW(parent->dirs, parent->dirs_nr + 1, parent->dirs_alloc);
+	memmove(parent->dirs + pos + 1, parent->dirs + pos,
+		(parent->dirs_nr - pos) * sizeof(*parent->dirs));
+	parent->dirs_nr++;
+	parent->dirs[pos] = d;
+	return d;
+}
+
+/* "path" names a directory and ends with a slash */
+static struct untracked_cache_dir *lookup_untracked_path(struct dir_struct *dir,
+							 struct untracked_cache_dir *parent,
+							 const char *path, int len)
+{
+	const char *name;
+
+	if (!parent)
+		return NULL;
+	len--;
+	name = path + len;
+	while (name > path && name[-1] != '/')
+		name--;
+	return lookup_untracked(dir->untracked, parent, name, path + len - name);
+}
+
+/*
+ * Remember a name that survived the exclude checks while "untracked"
+ * is being read from the filesystem.  Files that are tracked at this
+ * point are left out, as they can only become interesting again by
+ * being removed from the index, which invalidates the directory.
+ */
+static void add_untracked(struct untracked_cache_dir *untracked,
+			  const char *path, int len, int dtype)
+{
+	const char *name = strrchr(path, '/');
+	struct strbuf sb = STRBUF_INIT;
+
+	if (dtype != DT_DIR && dtype != DT_REG && dtype != DT_LNK)
+		return;
+	if (dtype != DT_DIR && cache_name_exists(path, len, ignore_case))
+		return;
+	name = name ? name + 1 : path;
+	strbuf_add(&sb, name, path + len - name);
+	if (dtype == DT_DIR)
+		strbuf_addch(&sb, '/');
+	ALLOC_GROW(untracked->untracked, untracked->untracked_nr + 1,
+		   untracked->untracked_alloc);
+	untracked->untracked[untracked->untracked_nr++] = strbuf_detach(&sb, NULL);
+}
+
 enum exist_status {
 	index_nonexistent = 0,
 	index_directory,
@@ -716,7 +848,8 @@ enum directory_treatment {
 
 static enum directory_treatment treat_directory(struct dir_struct *dir,
 	const char *dirname, int len,
-	const struct path_simplify *simplify)
+	const struct path_simplify *simplify,
+	struct untracked_cache_dir *untracked)
 {
 	/* The "len-1" is to strip the final '/' */
 	switch (directory_exists_in_index(dirname, len-1)) {
@@ -742,7 +875,8 @@ static enum directory_treatment treat_directory(struct dir_struct *dir,
 	/* This is the "show_other_directories" case */
 	if (!(dir->flags & DIR_HIDE_EMPTY_DIRECTORIES))
 		return show_directory;
-	if (!read_directory_recursive(dir, dirname, len, 1, simplify))
+	if (!read_directory_recursive(dir, dirname, len, 1, simplify,
+				      lookup_untracked_path(dir, untracked, dirname, len)))
 		return ignore_directory;
 	return show_directory;
 }
@@ -865,10 +999,42 @@ enum path_treatment {
 	path_recurse
 };
 
+static enum path_treatment treat_candidate(struct dir_struct *dir,
+					   char *path, int *len,
+					   const struct path_simplify *simplify,
+					   int dtype, int exclude,
+					   struct untracked_cache_dir *untracked)
+{
+	switch (dtype) {
+	default:
+		return path_ignored;
+	case DT_DIR:
+		memcpy(path + *len, "/", 2);
+		(*len)++;
+		switch (treat_directory(dir, path, *len, simplify, untracked)) {
+		case show_directory:
+			if (exclude != !!(dir->flags
+					  & DIR_SHOW_IGNORED))
+				return path_ignored;
+			break;
+		case recurse_into_directory:
+			return path_recurse;
+		case ignore_directory:
+			return path_ignored;
+		}
+		break;
+	case DT_REG:
+	case DT_LNK:
+		break;
+	}
+	return path_handled;
+}
+
 static enum path_treatment treat_one_path(struct dir_struct *dir,
 					  char *path, int *len,
 					  const struct path_simplify *simplify,
-					  int dtype, struct dirent *de)
+					  int dtype, struct dirent *de,
+					  struct untracked_cache_dir *untracked)
 {
 	int exclude = excluded(dir, path, &dtype);
 	if (exclude && (dir->flags & DIR_COLLECT_IGNORED)
@@ -896,29 +1062,10 @@ static enum path_treatment treat_one_path(struct dir_struct *dir,
 			return path_ignored;
 	}
 
-	switch (dtype) {
-	default:
-		return path_ignored;
-	case DT_DIR:
-		memcpy(path + *len, "/", 2);
-		(*len)++;
-		switch (treat_directory(dir, path, *len, simplify)) {
-		case show_directory:
-			if (exclude != !!(dir->flags
-					  & DIR_SHOW_IGNORED))
-				return path_ignored;
-			break;
-		case recurse_into_directory:
-			return path_recurse;
-		case ignore_directory:
-			return path_ignored;
-		}
-		break;
-	case DT_REG:
-	case DT_LNK:
-		break;
-	}
-	return path_handled;
+	if (untracked)
+		add_untracked(untracked, path, *len, dtype);
+	return treat_candidate(dir, path, len, simplify, dtype, exclude,
+			       untracked);
 }
 
 static enum path_treatment treat_path(struct dir_struct *dir,
@@ -926,7 +1073,8 @@ static enum path_treatment treat_path(struct dir_struct *dir,
 				      char *path, int path_max,
 				      int baselen,
 				      const struct path_simplify *simplify,
-				      int *len)
+				      int *len,
+				      struct untracked_cache_dir *untracked)
 {
 	int dtype;
 
@@ -942,7 +1090,182 @@ static enum path_treatment treat_path(struct dir_struct *dir,
 		return path_ignored;
 
 	dtype = DTYPE(de);
-	return treat_one_path(dir, path, len, simplify, dtype, de);
+	return treat_one_path(dir, path, len, simplify, dtype, de, untracked);
+}
+
+static void fill_untracked_stat(struct untracked_stat_data *sd, struct stat *st)
+{
+	memset(sd, 0, sizeof(*sd));
+	if (trust_ctime) {
+		sd->ctime.sec = (unsigned int)st->st_ctime;
+		sd->ctime.nsec = ST_CTIME_NSEC(*st);
+	}
+	sd->mtime.sec = (unsigned int)st->st_mtime;
+	sd->mtime.nsec = ST_MTIME_NSEC(*st);
+	sd->dev = st->st_dev;
+	sd->ino = st->st_ino;
+	sd->size = st->st_size;
+}
+
+/*
+ * A directory modified in the same second we started looking at it
+ * could change again without its mtime moving; do not trust it.
+ */
+static int untracked_stat_is_racy(struct untracked_cache *uc,
+				  struct untracked_stat_data *sd)
+{
+	return uc->start_time <= (time_t)sd->mtime.sec;
+}
+
+static void invalidate_untracked_dir(struct untracked_cache_dir *d)
+{
+	unsigned int i;
+
+	d->valid = 0;
+	for (i = 0; i < d->dirs_nr; i++)
+		invalidate_untracked_dir(d->dirs[i]);
+}
+
+/*
+ * Decide whether the cached listing of "base" can be used.  Returns
+ * 1 if it can be replayed, 0 if the directory has to be read and the
+ * result recorded, and -1 if the directory cannot be cached at all.
+ */
+static int valid_cached_dir(struct dir_struct *dir,
+			    struct untracked_cache_dir *untracked,
+			    const char *base, int baselen, int check_only)
+{
+	struct untracked_cache *uc = dir->untracked;
+	struct untracked_stat_data sd, exclude_sd;
+	char path[PATH_MAX];
+	struct stat st;
+	int has_exclude;
+
+	/* nothing was reported below here, so nothing has changed */
+	if (uc->use_fsmonitor && untracked->valid &&
+	    (check_only || !untracked->check_only))
+		return 1;
+
+	if (lstat(*base ? base : ".", &st) ||
+	    baselen + strlen(uc->exclude_per_dir) >= PATH_MAX) {
+		untracked->valid = 0;
+		return -1;
+	}
+	fill_untracked_stat(&sd, &st);
+
+	memcpy(path, base, baselen);
+	strcpy(path + baselen, uc->exclude_per_dir);
+	has_exclude = !lstat(path, &st);
+	if (has_exclude)
+		fill_untracked_stat(&exclude_sd, &st);
+	else if (cache_name_exists(path, strlen(path), ignore_case)) {
+		/* the patterns come from the index; we cannot stat them */
+		untracked->valid = 0;
+		return -1;
+	} else
+		memset(&exclude_sd, 0, sizeof(exclude_sd));
+
+	/* new patterns here may hide or reveal anything below */
+	if (untracked->has_exclude != has_exclude ||
+	    memcmp(&untracked->exclude_stat, &exclude_sd, sizeof(exclude_sd))) {
+		invalidate_untracked_dir(untracked);
+		untracked->has_exclude = has_exclude;
+		untracked->exclude_stat = exclude_sd;
+		if (untracked_stat_is_racy(uc, &exclude_sd))
+			memset(&untracked->exclude_stat, 0, sizeof(exclude_sd));
+		uc->gitignore_invalidated++;
+		uc->changed = 1;
+	}
+
+	if (untracked->valid &&
+	    !memcmp(&untracked->stat_data, &sd, sizeof(sd)) &&
+	    (check_only || !untracked->check_only))
+		return 1;
+	if (untracked->valid)
+		uc->dir_invalidated++;
+	untracked->valid = 0;
+	untracked->stat_data = sd;
+	return 0;
+}
+
+static void start_recording(struct untracked_cache_dir *untracked)
+{
+	unsigned int i;
+
+	free_untracked_names(untracked);
+	for (i = 0; i < untracked->dirs_nr; i++)
+		untracked->dirs[i]->seen = 0;
+}
+
+static void finish_recording(struct untracked_cache *uc,
+			     struct untracked_cache_dir *untracked,
+			     int check_only)
+{
+	unsigned int i, j;
+
+	/* drop the subdirectories this read did not walk into */
+	for (i = j = 0; i < untracked->dirs_nr; i++) {
+		if (untracked->dirs[i]->seen)
+			untracked->dirs[j++] = untracked->dirs[i];
+		else
+			free_untracked_dir(untracked->dirs[i]);
+	}
+	untracked->dirs_nr = j;
+	untracked->check_only = !!check_only;
+	untracked->valid = !untracked_stat_is_racy(uc, &untracked->stat_data);
+	uc->changed = 1;
+}
+
+/*
+ * Replay a cached listing through the same decisions that reading the
+ * directory would have made; only the exclude checks are skipped.
+ */
+static int read_cached_dir(struct dir_struct *dir,
+			   const char *base, int baselen,
+			   int check_only,
+			   const struct path_simplify *simplify,
+			   struct untracked_cache_dir *untracked)
+{
+	char path[PATH_MAX + 1];
+	unsigned int i;
+	int contents = 0;
+
+	memcpy(path, base, baselen);
+	for (i = 0; i < untracked->untracked_nr; i++) {
+		const char *name = untracked->untracked[i];
+		int len = strlen(name);
+		int dtype = DT_REG;
+
+		if (len && name[len - 1] == '/') {
+			dtype = DT_DIR;
+			len--;
+		}
+		if (len + baselen + 8 > sizeof(path))
+			continue;
+		memcpy(path + baselen, name, len);
+		path[baselen + len] = '\0';
+		len += baselen;
+		if (simplify_away(path, len, simplify))
+			continue;
+		switch (treat_candidate(dir, path, &len, simplify, dtype, 0,
+					untracked)) {
+		case path_recurse:
+			contents += read_directory_recursive
+				(dir, path, len, 0, simplify,
+				 lookup_untracked_path(dir, untracked, path, len));
+			continue;
+		case path_ignored:
+			continue;
+		case path_handled:
+			break;
+		}
+		contents++;
+		if (check_only)
+			break;
+		else
+			dir_add_name(dir, path, len);
+	}
+	return contents;
 }
 
 /*
@@ -957,23 +1280,43 @@ static enum path_treatment treat_path(struct dir_struct *dir,
 static int read_directory_recursive(struct dir_struct *dir,
 				    const char *base, int baselen,
 				    int check_only,
-				    const struct path_simplify *simplify)
+				    const struct path_simplify *simplify,
+				    struct untracked_cache_dir *untracked)
 {
-	DIR *fdir = opendir(*base ? base : ".");
-	int contents = 0;
+	DIR *fdir;
+	int contents = 0, partial = 0;
+
+	if (untracked) {
+		switch (valid_cached_dir(dir, untracked, base, baselen,
+					 check_only)) {
+		case 1:
+			return read_cached_dir(dir, base, baselen, check_only,
+					       simplify, untracked);
+		case -1:
+			untracked = NULL;
+			break;
+		}
+	}
 
+	fdir = opendir(*base ? base : ".");
 	if (fdir) {
 		struct dirent *de;
 		char path[PATH_MAX + 1];
 		memcpy(path, base, baselen);
 
+		if (untracked) {
+			dir->untracked->dir_opened++;
+			start_recording(untracked);
+		}
 		while ((de = readdir(fdir)) != NULL) {
 			int len;
 			switch (treat_path(dir, de, path, sizeof(path),
-					   baselen, simplify, &len)) {
+					   baselen, simplify, &len, untracked)) {
 			case path_recurse:
 				contents += read_directory_recursive
-					(dir, path, len, 0, simplify);
+					(dir, path, len, 0, simplify,
+					 lookup_untracked_path(dir, untracked,
+							       path, len));
 				continue;
 			case path_ignored:
 				continue;
@@ -981,13 +1324,16 @@ static int read_directory_recursive(struct dir_struct *dir,
 				break;
 			}
 			contents++;
-			if (check_only)
+			if (check_only) {
+				partial = 1;
 				goto exit_early;
-			else
+			} else
 				dir_add_name(dir, path, len);
 		}
 exit_early:
 		closedir(fdir);
+		if (untracked)
+			finish_recording(dir->untracked, untracked, partial);
 	}
 
 	return contents;
@@ -1075,24 +1421,111 @@ static int treat_leading_path(struct dir_struct *dir,
 			return 0;
 		blen = baselen;
 		if (treat_one_path(dir, pathbuf, &blen, simplify,
-				   DT_DIR, NULL) == path_ignored)
+				   DT_DIR, NULL, NULL) == path_ignored)
 			return 0; /* do not recurse into it */
 		if (len <= baselen)
 			return 1; /* finished checking */
 	}
 }
 
+static void hash_exclude_list(git_SHA_CTX *c, struct exclude_list *el)
+{
+	int i;
+
+	for (i = 0; i < el->nr; i++) {
+		struct exclude *x = el->excludes[i];
+		unsigned char flags[2];
+
+		flags[0] = x->flags;
+		flags[1] = x->to_exclude;
+		git_SHA1_Update(c, x->pattern, x->patternlen);
+		git_SHA1_Update(c, flags, sizeof(flags));
+		git_SHA1_Update(c, x->base, x->baselen + 1);
+	}
+}
+
+/*
+ * The cache only describes a plain walk of the whole work tree with
+ * the standard exclude files.  Start over if the global exclude
+ * patterns or the work tree have changed since it was recorded.
+ */
+static struct untracked_cache_dir *validate_untracked_cache(struct dir_struct *dir,
+							    int len,
+							    const char **pathspec)
+{
+	struct untracked_cache *uc = dir->untracked;
+	const char *ident = get_git_work_tree();
+	unsigned char sha1[20];
+	git_SHA_CTX c;
+
+	if (!uc || !ident || len || pathspec)
+		return NULL;
+	if (dir->flags & (DIR_SHOW_IGNORED | DIR_COLLECT_IGNORED))
+		return NULL;
+	if (!dir->exclude_per_dir || dir->exclude_list[EXC_CMDL].nr)
+		return NULL;
+	if (uc == the_index.untracked)
+		refresh_fsmonitor(&the_index);
+
+	git_SHA1_Init(&c);
+	hash_exclude_list(&c, &dir->exclude_list[EXC_FILE]);
+	git_SHA1_Final(sha1, &c);
+
+	if (!uc->root || strcmp(uc->ident, ident) ||
+	    strcmp(uc->exclude_per_dir, dir->exclude_per_dir) ||
+	    hashcmp(uc->excludes_sha1, sha1)) {
+		free_untracked_dir(uc->root);
+		uc->root = new_untracked_dir("", 0);
+		free(uc->ident);
+		uc->ident = xstrdup(ident);
+		free(uc->exclude_per_dir);
+		uc->exclude_per_dir = xstrdup(dir->exclude_per_dir);
+		hashcpy(uc->excludes_sha1, sha1);
+		uc->changed = 1;
+	}
+	uc->start_time = time(NULL);
+	uc->dir_created = 0;
+	uc->dir_invalidated = 0;
+	uc->gitignore_invalidated = 0;
+	uc->dir_opened = 0;
+	return uc->root;
+}
+
+__attribute__((format (printf, 1, 2)))
+static void trace_untracked_stats(const char *fmt, ...)
+{
+	va_list ap;
+
+	va_start(ap, fmt);
+	trace_vprintf("GIT_TRACE_UNTRACKED_STATS", fmt, ap);
+	va_end(ap);
+}
+
 int read_directory(struct dir_struct *dir, const char *path, int len, const char **pathspec)
 {
 	struct path_simplify *simplify;
+	struct untracked_cache_dir *untracked;
 
 	if (has_symlink_leading_path(path, len))
 		return dir->nr;
 
+	untracked = validate_untracked_cache(dir, len, pathspec);
 	simplify = create_simplify(pathspec);
 	if (!len || treat_leading_path(dir, path, len, simplify))
-		read_directory_recursive(dir, path, len, 0, simplify);
+		read_directory_recursive(dir, path, len, 0, simplify, untracked);
 	free_simplify(simplify);
+	if (untracked) {
+		struct untracked_cache *uc = dir->untracked;
+		trace_untracked_stats("node creation: %d\n"
+				      "gitignore invalidation: %d\n"
+				      "directory invalidation: %d\n"
+				      "opendir: %d\n",
+				      uc->dir_created, uc->gitignore_invalidated,
+				      uc->dir_invalidated, uc->dir_opened);
+		if (uc->changed)
+			the_index.cache_changed = 1;
+		uc->changed = 0;
+	}
 	qsort(dir->entries, dir->nr, sizeof(struct dir_entry *), cmp_name);
 	qsort(dir->ignored, dir->ignored_nr, sizeof(struct dir_entry *), cmp_name);
 	return dir->nr;
@@ -1290,3 +1723,281 @@ void free_pathspec(struct pathspec *pathspec)
 	free(pathspec->items);
 	pathspec->items = NULL;
 }
+
+struct untracked_cache *new_untracked_cache(void)
+{
+	struct untracked_cache *uc = xcalloc(1, sizeof(*uc));
+	uc->ident = xstrdup("");
+	uc->exclude_per_dir = xstrdup(".gitignore");
+	return uc;
+}
+
+void free_untracked_cache(struct untracked_cache *uc)
+{
+	if (!uc)
+		return;
+	free_untracked_dir(uc->root);
+	free(uc->ident);
+	free(uc->exclude_per_dir);
+	free(uc);
+}
+
+/* Add or drop the untracked cache as core.untrackedCache says */
+void tweak_untracked_cache(struct index_state *istate)
+{
+	if (core_untracked_cache > 0 && !istate->untracked) {
+		istate->untracked = new_untracked_cache();
+		istate->cache_changed = 1;
+	} else if (!core_untracked_cache && istate->untracked) {
+		free_untracked_cache(istate->untracked);
+		istate->untracked = NULL;
+		istate->cache_changed = 1;
+	}
+}
+
+#define UNTRACKED_VALID       01
+#define UNTRACKED_HAS_EXCLUDE 02
+#define UNTRACKED_CHECK_ONLY  04
+
+static void write_untracked_stat(struct strbuf *out,
+				 const struct untracked_stat_data *sd)
+{
+	uint32_t data[7];
+
+	data[0] = htonl(sd->ctime.sec);
+	data[1] = htonl(sd->ctime.nsec);
+	data[2] = htonl(sd->mtime.sec);
+	data[3] = htonl(sd->mtime.nsec);
+	data[4] = htonl(sd->dev);
+	data[5] = htonl(sd->ino);
+	data[6] = htonl(sd->size);
+	strbuf_add(out, data, sizeof(data));
+}
+
+static void write_varint(struct strbuf *out, uintmax_t value)
+{
+	unsigned char buf[16];
+	strbuf_add(out, buf, encode_varint(value, buf));
+}
+
+static void write_untracked_dir(struct strbuf *out, struct untracked_cache_dir *d)
+{
+	unsigned int i;
+
+	write_varint(out, d->untracked_nr);
+	write_varint(out, d->dirs_nr);
+	strbuf_addch(out, (d->valid ? UNTRACKED_VALID : 0) |
+		     (d->has_exclude ? UNTRACKED_HAS_EXCLUDE : 0) |
+		     (d->check_only ? UNTRACKED_CHECK_ONLY : 0));
+	if (d->valid)
+		write_untracked_stat(out, &d->stat_data);
+	if (d->has_exclude)
+		write_untracked_stat(out, &d->exclude_stat);
+	strbuf_add(out, d->name, strlen(d->name) + 1);
+	for (i = 0; i < d->untracked_nr; i++)
+		strbuf_add(out, d->untracked[i], strlen(d->untracked[i]) + 1);
+	for (i = 0; i < d->dirs_nr; i++)
+		write_untracked_dir(out, d->dirs[i]);
+}
+
+/*
+ * The extension holds the work tree path, the name of the per-directory
+ * exclude file and a hash of the global exclude patterns, followed by
+ * the directory tree in pre-order, if one has been recorded.
+ */
+void write_untracked_extension(struct strbuf *out, struct untracked_cache *uc)
+{
+	strbuf_add(out, uc->ident, strlen(uc->ident) + 1);
+	strbuf_add(out, uc->exclude_per_dir, strlen(uc->exclude_per_dir) + 1);
+	strbuf_add(out, uc->excludes_sha1, 20);
+	if (uc->root)
+		write_untracked_dir(out, uc->root);
+}
+
+struct untracked_reader {
+	const unsigned char *data;
+	const unsigned char *end;
+};
+
+static int read_untracked_stat(struct untracked_reader *rd,
+			       struct untracked_stat_data *sd)
+{
+	uint32_t data[7];
+
+	if (rd->end - rd->data < sizeof(data))
+		return -1;
+	memcpy(data, rd->data, sizeof(data));
+	rd->data += sizeof(data);
+	sd->ctime.sec = ntohl(data[0]);
+	sd->ctime.nsec = ntohl(data[1]);
+	sd->mtime.sec = ntohl(data[2]);
+	sd->mtime.nsec = ntohl(data[3]);
+	sd->dev = ntohl(data[4]);
+	sd->ino = ntohl(data[5]);
+	sd->size = ntohl(data[6]);
+	return 0;
+}
+
+static const char *read_untracked_string(struct untracked_reader *rd)
+{
+	const char *str = (const char *)rd->data;
+	const unsigned char *nul = memchr(rd->data, '\0', rd->end - rd->data);
+
+	if (!nul)
+		return NULL;
+	rd->data = nul + 1;
+	return str;
+}
+
+static int read_untracked_varint(struct untracked_reader *rd, unsigned int *value)
+{
+	const unsigned char *p = rd->data;
+	uintmax_t v;
+
+	if (p >= rd->end)
+		return -1;
+	v = decode_varint(&p);
+	if (p == rd->data || p > rd->end || v > INT_MAX)
+		return -1;
+	rd->data = p;
+	*value = v;
+	return 0;
+}
+
+static struct untracked_cache_dir *read_untracked_dir(struct untracked_reader *rd)
+{
+	struct untracked_cache_dir *d;
+	unsigned int untracked_nr, dirs_nr, i;
+	int flags;
+	struct untracked_stat_data sd, exclude_sd;
+	const char *name;
+
+	if (read_untracked_varint(rd, &untracked_nr) ||
+	    read_untracked_varint(rd, &dirs_nr) ||
+	    rd->data >= rd->end)
+		return NULL;
+	flags = *rd->data++;
+	memset(&sd, 0, sizeof(sd));
+	memset(&exclude_sd, 0, sizeof(exclude_sd));
+	if (((flags & UNTRACKED_VALID) && read_untracked_stat(rd, &sd)) ||
+	    ((flags & UNTRACKED_HAS_EXCLUDE) && read_untracked_stat(rd, &exclude_sd)))
+		return NULL;
+	name = read_untracked_string(rd);
+	if (!name)
+		return NULL;
+
+	d = new_untracked_dir(name, strlen(name));
+	d->valid = !!(flags & UNTRACKED_VALID);
+	d->has_exclude = !!(flags & UNTRACKED_HAS_EXCLUDE);
+	d->check_only = !!(flags & UNTRACKED_CHECK_ONLY);
+	d->stat_data = sd;
+	d->exclude_stat = exclude_sd;
+	for (i = 0; i < untracked_nr; i++) {
+		name = read_untracked_string(rd);
+		if (!name)
+			goto bad;
+		ALLOC_GROW(d->untracked, d->untracked_nr + 1, d->untracked_alloc);
+		d->untracked[d->untracked_nr++] = xstrdup(name);
+	}
+	for (i = 0; i < dirs_nr; i++) {
+		struct untracked_cache_dir *sub = read_untracked_dir(rd);
+		if (!sub)
+			goto bad;
+		ALLOC_GROW(d->dirs, d->dirs_nr + 1, d->dirs_alloc);
+		d->dirs[d->dirs_nr++] = sub;
+		if (i && strcmp(d->dirs[i - 1]->name, sub->name) >= 0)
+			goto bad;
+	}
+	return d;
+
+bad:
+	free_untracked_dir(d);
+	return NULL;
+}
+
+/* Returns NULL if the extension cannot be parsed */
+struct untracked_cache *read_untracked_extension(const void *data, unsigned long sz)
+{
+	struct untracked_reader rd;
+	struct untracked_cache *uc;
+	const char *ident, *exclude_per_dir;
+
+	rd.data = data;
+	rd.end = rd.data + sz;
+	ident = read_untracked_string(&rd);
+	exclude_per_dir = ident ? read_untracked_string(&rd) : NULL;
+	if (!exclude_per_dir || rd.end - rd.data < 20)
+		return NULL;
+
+	uc = xcalloc(1, sizeof(*uc));
+	uc->ident = xstrdup(ident);
+	uc->exclude_per_dir = xstrdup(exclude_per_dir);
+	hashcpy(uc->excludes_sha1, rd.data);
+	rd.data += 20;
+	if (rd.data < rd.end) {
+		uc->root = read_untracked_dir(&rd);
+		if (!uc->root || rd.data != rd.end) {
+			free_untracked_cache(uc);
+			return NULL;
+		}
+	}
+	return uc;
+}
+
+/*
+ * Something happened to "path": it left the index, so the directory
+ * holding it may now have an untracked file its cached listing left
+ * out, or the file system monitor saw it change.  Invalidate the
+ * directory holding it, or the closest one we have a node for, and
+ * the node for "path" itself if it is a directory.
+ */
+void untracked_cache_invalidate_path(struct index_state *istate, const char *path)
+{
+	struct untracked_cache_dir *d;
+	const char *slash;
+
+	if (!istate->untracked || !istate->untracked->root)
+		return;
+	d = istate->untracked->root;
+	while ((slash = strchr(path, '/')) != NULL) {
+		int pos = untracked_dir_pos(d, path, slash - path);
+		if (pos < 0)
+			break;
+		d = d->dirs[pos];
+		path = slash + 1;
+	}
+	d->valid = 0;
+	if (!slash) {
+		int pos = untracked_dir_pos(d, path, strlen(path));
+		if (pos >= 0)
+			d->dirs[pos]->valid = 0;
+	}
+}
+
+/*
+ * Hand the untracked cache of "src" over to "dst", which is about to
+ * replace it, invalidating the directories of paths "dst" dropped.
+ */
+void move_untracked_cache(struct index_state *src, struct index_state *dst)
+{
+	unsigned int i = 0, j = 0;
+
+	if (!src->untracked)
+		return;
+	dst->untracked = src->untracked;
+	src->untracked = NULL;
+	while (i < src->cache_nr) {
+		const char *name = src->cache[i]->name;
+		int cmp = j < dst->cache_nr ? strcmp(name, dst->cache[j]->name) : -1;
+
+		if (cmp < 0) {
+			untracked_cache_invalidate_path(dst, name);
+			i++;
+		} else if (cmp > 0)
+			j++;
+		else {
+			i++;
+			j++;
+		}
+	}
+}
@@ -31,6 +31,51 @@ struct exclude_stack {
 	int exclude_ix;
 };
 
+/*
+ * The untracked cache remembers, for each directory, what
+ * read_directory() found there the last time it was read, together
+ * with enough stat data to tell when that answer has gone stale.
+ * Only the names that survive the exclude checks are kept; whether
+ * they are tracked, and what to do with subdirectories, is decided
+ * again against the index every time the cache is replayed.
+ */
+struct untracked_stat_data {
+	struct cache_time ctime;
+	struct cache_time mtime;
+	unsigned int dev;
+	unsigned int ino;
+	unsigned int size;
+};
+
+struct untracked_cache_dir {
+	struct untracked_cache_dir **dirs;
+	char **untracked;
+	struct untracked_stat_data stat_data;
+	struct untracked_stat_data exclude_stat;
+	unsigned int untracked_nr, untracked_alloc;
+	unsigned int dirs_nr, dirs_alloc;
+	unsigned valid : 1;	/* the lists above can be replayed */
+	unsigned has_exclude : 1; /* exclude_per_dir file present */
+	unsigned check_only : 1; /* listing stops at the first untracked file */
+	unsigned seen : 1;	/* looked up since the parent was reread */
+	char name[FLEX_ARRAY];
+};
+
+struct untracked_cache {
+	char *ident;
+	unsigned char excludes_sha1[20];
+	char *exclude_per_dir;
+	struct untracked_cache_dir *root;
+	/* The rest is per-process state and not written out */
+	int use_fsmonitor;
+	time_t start_time;
+	int changed;
+	int dir_created;
+	int dir_invalidated;
+	int gitignore_invalidated;
+	int dir_opened;
+};
+
 struct dir_struct {
 	int nr, alloc;
 	int ignored_nr, ignored_alloc;
@@ -59,6 +104,9 @@ struct dir_struct {
 
 	struct exclude_stack *exclude_stack;
 	char basebuf[PATH_MAX];
+
+	/* Consulted and updated by read_directory() when non-NULL */
+	struct untracked_cache *untracked;
 };
 
 #define MATCHED_RECURSIVELY 1
@@ -106,6 +154,14 @@ extern int remove_dir_recursively(struct strbuf *path, int flag);
 /* tries to remove the path with empty directories along it, ignores ENOENT */
 extern int remove_path(const char *path);
 
+extern struct untracked_cache *new_untracked_cache(void);
+extern void free_untracked_cache(struct untracked_cache *uc);
+extern struct untracked_cache *read_untracked_extension(const void *data, unsigned long sz);
+extern void write_untracked_extension(struct strbuf *out, struct untracked_cache *uc);
+extern void untracked_cache_invalidate_path(struct index_state *istate, const char *path);
+extern void move_untracked_cache(struct index_state *src, struct index_state *dst);
+extern void tweak_untracked_cache(struct index_state *istate);
+
 extern int strcmp_icase(const char *a, const char *b);
 extern int strncmp_icase(const char *a, const char *b, size_t count);
 extern int fnmatch_icase(const char *pattern, const char *string, int flags);
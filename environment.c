@@ -36,6 +36,7 @@ int fsync_object_files;
 size_t packed_git_window_size = DEFAULT_PACKED_GIT_WINDOW_SIZE;
 size_t packed_git_limit = DEFAULT_PACKED_GIT_LIMIT;
 size_t delta_base_cache_limit = 16 * 1024 * 1024;
+unsigned long delta_base_cache_entries;
 unsigned long big_file_threshold = 512 * 1024 * 1024;
 const char *log_pack_access;
 const char *pager_program;
@@ -63,6 +64,21 @@ struct startup_info *startup_info;
 /* Parallel index stat data preload? */
 int core_preload_index = 0;
 
+/* Read commit parents from objects/info/commit-graph when present? */
+int core_commit_graph = 1;
+
+/* Look up packed objects in objects/pack/multi-pack-index when present? */
+int core_multi_pack_index = 1;
+
+/* Keep the index split into a shared base and a delta? -1 means as it is */
+int core_split_index = -1;
+
+/* Cache untracked files in the index? -1 means as it is */
+int core_untracked_cache = -1;
+
+/* Command to ask which paths changed in the work tree, if any */
+const char *core_fsmonitor;
+
 /* This is set by setup_git_dir_gently() and/or git_default_config() */
 char *git_work_tree_cfg;
 static char *work_tree;
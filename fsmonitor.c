@@ -0,0 +1,215 @@
+#include "cache.h"
+#include "dir.h"
+#include "fsmonitor.h"
+#include "run-command.h"
+#include "varint.h"
+
+#define HOOK_INTERFACE_VERSION 1
+#define FSMONITOR_EXT_VERSION 1
+
+/*
+ * The "FSMN" extension is a 32-bit version, the 64-bit time of the
+ * last query, and the positions of the entries that were not known
+ * to be clean then: a count followed by the differences between
+ * successive positions, in the variable width encoding of index v4.
+ */
+int read_fsmonitor_extension(struct index_state *istate,
+			     const void *data, unsigned long sz)
+{
+	const unsigned char *p = data, *end = p + sz;
+	uint32_t hdr[3];
+	unsigned int nr, i, pos = 0;
+
+	if (sz < sizeof(hdr))
+		return error("corrupt fsmonitor extension (too short)");
+	memcpy(hdr, p, sizeof(hdr));
+	p += sizeof(hdr);
+	if (ntohl(hdr[0]) != FSMONITOR_EXT_VERSION)
+		return error("unsupported fsmonitor extension version %u",
+			     ntohl(hdr[0]));
+	istate->fsmonitor_last_update =
+		((uint64_t)ntohl(hdr[1]) << 32) | ntohl(hdr[2]);
+
+	nr = decode_varint(&p);
+	if (p > end)
+		return error("corrupt fsmonitor extension");
+	istate->fsmonitor_dirty_nr = 0;
+	for (i = 0; i < nr; i++) {
+		if (p >= end)
+			return error("corrupt fsmonitor extension");
+		pos += decode_varint(&p);
+		ALLOC_GROW(istate->fsmonitor_dirty, istate->fsmonitor_dirty_nr + 1,
+			   istate->fsmonitor_dirty_alloc);
+		istate->fsmonitor_dirty[istate->fsmonitor_dirty_nr++] = pos;
+	}
+	if (p != end)
+		return error("corrupt fsmonitor extension");
+	istate->fsmonitor_has_extension = 1;
+	return 0;
+}
+
+void write_fsmonitor_extension(struct strbuf *sb, struct index_state *istate)
+{
+	unsigned char buf[16];
+	uint32_t hdr[3];
+	unsigned int i, nr = 0, last = 0;
+
+	hdr[0] = htonl(FSMONITOR_EXT_VERSION);
+	hdr[1] = htonl((uint32_t)(istate->fsmonitor_last_update >> 32));
+	hdr[2] = htonl((uint32_t)istate->fsmonitor_last_update);
+	strbuf_add(sb, hdr, sizeof(hdr));
+
+	for (i = 0; i < istate->cache_nr; i++)
+		if (!(istate->cache[i]->ce_flags & CE_FSMONITOR_VALID))
+			nr++;
+	strbuf_add(sb, buf, encode_varint(nr, buf));
+	for (i = 0; i < istate->cache_nr; i++) {
+		if (istate->cache[i]->ce_flags & CE_FSMONITOR_VALID)
+			continue;
+		strbuf_add(sb, buf, encode_varint(i - last, buf));
+		last = i;
+	}
+}
+
+void tweak_fsmonitor(struct index_state *istate)
+{
+	unsigned int i;
+
+	if (istate->fsmonitor_has_extension) {
+		for (i = 0; i < istate->fsmonitor_dirty_nr; i++)
+			if (istate->fsmonitor_dirty[i] >= istate->cache_nr)
+				break;
+		/* an extension that does not fit is as good as none */
+		if (i < istate->fsmonitor_dirty_nr)
+			istate->fsmonitor_last_update = 0;
+		else {
+			for (i = 0; i < istate->cache_nr; i++) {
+				struct cache_entry *ce = istate->cache[i];
+				if (!S_ISGITLINK(ce->ce_mode))
+					ce->ce_flags |= CE_FSMONITOR_VALID;
+			}
+			for (i = 0; i < istate->fsmonitor_dirty_nr; i++) {
+				struct cache_entry *ce =
+					istate->cache[istate->fsmonitor_dirty[i]];
+				ce->ce_flags &= ~CE_FSMONITOR_VALID;
+			}
+		}
+	} else
+		istate->fsmonitor_last_update = 0;
+
+	free(istate->fsmonitor_dirty);
+	istate->fsmonitor_dirty = NULL;
+	istate->fsmonitor_dirty_nr = 0;
+	istate->fsmonitor_dirty_alloc = 0;
+	istate->fsmonitor_has_extension = 0;
+}
+
+static uint64_t getnanotime(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return (uint64_t)tv.tv_sec * 1000000000 + tv.tv_usec * 1000;
+}
+
+static int query_fsmonitor(uint64_t last_update, struct strbuf *result)
+{
+	struct child_process cp;
+	const char *argv[4];
+	char version[16], since[32];
+	int ret = 0;
+
+	snprintf(version, sizeof(version), "%d", HOOK_INTERFACE_VERSION);
+	snprintf(since, sizeof(since), "%"PRIuMAX, (uintmax_t)last_update);
+	argv[0] = core_fsmonitor;
+	argv[1] = version;
+	argv[2] = since;
+	argv[3] = NULL;
+
+	memset(&cp, 0, sizeof(cp));
+	cp.argv = argv;
+	cp.use_shell = 1;
+	cp.no_stdin = 1;
+	cp.out = -1;
+	if (start_command(&cp))
+		return -1;
+	if (strbuf_read(result, cp.out, 1024) < 0)
+		ret = -1;
+	close(cp.out);
+	if (finish_command(&cp))
+		ret = -1;
+	return ret;
+}
+
+static void fsmonitor_refresh_path(struct index_state *istate, char *name)
+{
+	int len = strlen(name);
+	int pos;
+
+	while (len && name[len - 1] == '/')
+		name[--len] = '\0';
+	if (!len)
+		return;
+
+	/* the path itself, and everything below it if it is a directory */
+	pos = index_name_pos(istate, name, len);
+	if (pos < 0)
+		pos = -pos - 1;
+	for (; pos < istate->cache_nr; pos++) {
+		struct cache_entry *ce = istate->cache[pos];
+
+		if (strncmp(ce->name, name, len))
+			break;
+		if (ce->name[len] == '\0' || ce->name[len] == '/')
+			ce->ce_flags &= ~CE_FSMONITOR_VALID;
+	}
+	untracked_cache_invalidate_path(istate, name);
+}
+
+void refresh_fsmonitor(struct index_state *istate)
+{
+	struct strbuf result = STRBUF_INIT;
+	uint64_t last_update;
+	int query_ok = 0;
+	unsigned int i;
+
+	if (istate->fsmonitor_has_run_once)
+		return;
+	istate->fsmonitor_has_run_once = 1;
+
+	if (!core_fsmonitor) {
+		/* the extension is dropped when the index is written */
+		for (i = 0; i < istate->cache_nr; i++)
+			istate->cache[i]->ce_flags &= ~CE_FSMONITOR_VALID;
+		istate->fsmonitor_last_update = 0;
+		return;
+	}
+
+	/* anything that changes from now on is reported next time */
+	last_update = getnanotime();
+	if (istate->fsmonitor_last_update)
+		query_ok = !query_fsmonitor(istate->fsmonitor_last_update, &result);
+
+	if (query_ok) {
+		char *p = result.buf, *end = result.buf + result.len;
+
+		while (p < end) {
+			/* a strbuf is always NUL-terminated past its end */
+			char *nul = memchr(p, '\0', end - p);
+			if (!nul)
+				nul = end;
+			fsmonitor_refresh_path(istate, p);
+			p = nul + 1;
+		}
+		if (result.len)
+			istate->cache_changed = 1;
+	} else {
+		for (i = 0; i < istate->cache_nr; i++)
+			istate->cache[i]->ce_flags &= ~CE_FSMONITOR_VALID;
+		istate->cache_changed = 1;
+	}
+	if (istate->untracked)
+		istate->untracked->use_fsmonitor = query_ok;
+	istate->fsmonitor_last_update = last_update;
+	strbuf_release(&result);
+}
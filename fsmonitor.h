@@ -0,0 +1,43 @@
+#ifndef FSMONITOR_H
+#define FSMONITOR_H
+
+/*
+ * With core.fsmonitor set to a command, git asks that command which
+ * paths changed since the time saved in the "FSMN" index extension,
+ * and trusts every other entry (and cached untracked directory) to be
+ * as it was when last checked, without calling lstat() on it.
+ *
+ * The command is run with the version of this protocol (1) and the
+ * saved time, in nanoseconds since the epoch, as arguments.  It prints
+ * the changed paths relative to the top of the work tree, each
+ * terminated by a NUL; a directory stands for everything below it.  A
+ * command that cannot tell must exit with a non-zero status, and then
+ * every path is checked.
+ */
+
+extern int read_fsmonitor_extension(struct index_state *istate,
+				    const void *data, unsigned long sz);
+extern void write_fsmonitor_extension(struct strbuf *sb, struct index_state *istate);
+
+/*
+ * Apply what the extension said, once the whole index has been read.
+ * This happens before the configuration may have been read, so the
+ * entries are not to be trusted before refresh_fsmonitor().
+ */
+extern void tweak_fsmonitor(struct index_state *istate);
+
+/*
+ * Ask the command what changed, the first time this is called for
+ * "istate", and clear CE_FSMONITOR_VALID from the entries it names,
+ * or from all of them if core.fsmonitor is not set.
+ */
+extern void refresh_fsmonitor(struct index_state *istate);
+
+/* "ce" was just found to match the work tree */
+static inline void mark_fsmonitor_valid(struct cache_entry *ce)
+{
+	if (core_fsmonitor && !S_ISGITLINK(ce->ce_mode))
+		ce->ce_flags |= CE_FSMONITOR_VALID;
+}
+
+#endif
@@ -0,0 +1,695 @@
+#include "cache.h"
+#include "csum-file.h"
+#include "grep.h"
+#include "hash.h"
+#include "varint.h"
+#include "grep-index.h"
+
+#define GREP_INDEX_HEADER_SIZE 16
+#define GREP_INDEX_RECORD_SIZE 12
+
+/* Past this many, the trigrams of a literal hardly narrow it down. */
+#define MAX_QUERY_TRIGRAMS 64
+
+/* Objects whose type and size are asked together, then read. */
+#define WRITE_BATCH 256
+
+struct grep_index {
+	const unsigned char *map;
+	size_t size;
+	uint32_t nr;
+	uint32_t nr_trigrams;
+	const unsigned char *names;
+	const uint32_t *lookup;
+	const unsigned char *records;
+	const unsigned char *postings;
+	uint64_t postings_size;
+};
+
+static struct grep_index *gidx;
+
+/* One bit per blob id, set for the blobs that may match. */
+static unsigned char *candidates;
+static int gidx_corrupt;
+
+static char *grep_index_path(void)
+{
+	return xstrdup(git_path("objects/info/grep-index"));
+}
+
+static inline uint32_t fold_trigram(uint32_t t, unsigned char c)
+{
+	return ((t << 8) | tolower(c)) & 0xffffff;
+}
+
+static uint64_t record_end(const unsigned char *record)
+{
+	uint64_t hi = ntohl(*(uint32_t *)(record + 4));
+	uint64_t lo = ntohl(*(uint32_t *)(record + 8));
+	return (hi << 32) | lo;
+}
+
+static struct grep_index *load_grep_index(const char *path)
+{
+	struct grep_index *g;
+	struct stat st;
+	const uint32_t *hdr;
+	size_t size, expect;
+	void *map;
+	int fd;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return NULL;
+	if (fstat(fd, &st)) {
+		close(fd);
+		return NULL;
+	}
+	size = xsize_t(st.st_size);
+	if (size < GREP_INDEX_HEADER_SIZE + 20) {
+		close(fd);
+		error("grep index %s is too small", path);
+		return NULL;
+	}
+	map = xmmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	hdr = map;
+	if (ntohl(hdr[0]) != GREP_INDEX_SIGNATURE) {
+		error("grep index %s has a bad signature", path);
+		goto fail;
+	}
+	if (ntohl(hdr[1]) != GREP_INDEX_VERSION) {
+		error("grep index %s is version %"PRIu32
+		      " and we only understand version %d",
+		      path, ntohl(hdr[1]), GREP_INDEX_VERSION);
+		goto fail;
+	}
+
+	g = xcalloc(1, sizeof(*g));
+	g->map = map;
+	g->size = size;
+	g->nr = ntohl(hdr[2]);
+	g->nr_trigrams = ntohl(hdr[3]);
+	g->names = g->map + GREP_INDEX_HEADER_SIZE;
+	g->lookup = (const uint32_t *)(g->names + (size_t)g->nr * 20);
+	g->records = (const unsigned char *)(g->lookup + g->nr);
+	g->postings = g->records +
+		(size_t)g->nr_trigrams * GREP_INDEX_RECORD_SIZE;
+
+	expect = GREP_INDEX_HEADER_SIZE + (size_t)g->nr * 24 +
+		(size_t)g->nr_trigrams * GREP_INDEX_RECORD_SIZE + 20;
+	if (size < expect) {
+		error("grep index %s is corrupt", path);
+		free(g);
+		goto fail;
+	}
+	g->postings_size = g->nr_trigrams ?
+		record_end(g->postings - GREP_INDEX_RECORD_SIZE) : 0;
+	if (g->postings_size != size - expect) {
+		error("grep index %s is corrupt", path);
+		free(g);
+		goto fail;
+	}
+	return g;
+
+fail:
+	munmap(map, size);
+	return NULL;
+}
+
+static void free_grep_index(struct grep_index *g)
+{
+	if (!g)
+		return;
+	munmap((void *)g->map, g->size);
+	free(g);
+}
+
+static int blob_id(struct grep_index *g, const unsigned char *sha1, uint32_t *id)
+{
+	uint32_t lo = 0, hi = g->nr;
+
+	while (lo < hi) {
+		uint32_t mi = lo + (hi - lo) / 2;
+		uint32_t n = ntohl(g->lookup[mi]);
+		int cmp;
+
+		if (n >= g->nr)
+			return 0;
+		cmp = hashcmp(sha1, g->names + (size_t)n * 20);
+		if (!cmp) {
+			*id = n;
+			return 1;
+		}
+		if (cmp < 0)
+			hi = mi;
+		else
+			lo = mi + 1;
+	}
+	return 0;
+}
+
+/*
+ * Find the posting list of trigram "t" in [*start, *end) of the
+ * posting lists; returns 0 if no blob has it, -1 if the index is
+ * corrupt.
+ */
+static int find_posting(struct grep_index *g, uint32_t t,
+			uint64_t *start, uint64_t *end)
+{
+	uint32_t lo = 0, hi = g->nr_trigrams;
+
+	while (lo < hi) {
+		uint32_t mi = lo + (hi - lo) / 2;
+		const unsigned char *r = g->records +
+			(size_t)mi * GREP_INDEX_RECORD_SIZE;
+		uint32_t cur = ntohl(*(uint32_t *)r);
+
+		if (cur == t) {
+			*start = mi ? record_end(r - GREP_INDEX_RECORD_SIZE) : 0;
+			*end = record_end(r);
+			if (*start > *end || *end > g->postings_size)
+				return -1;
+			return 1;
+		}
+		if (t < cur)
+			hi = mi;
+		else
+			lo = mi + 1;
+	}
+	return 0;
+}
+
+/*
+ * Call "fn" on each blob id in the posting list at [start, end);
+ * returns one more than the last id, or -1 if the list is corrupt.
+ */
+static int64_t walk_posting(struct grep_index *g, uint64_t start, uint64_t end,
+			    void (*fn)(uint32_t, void *), void *data)
+{
+	const unsigned char *p = g->postings + start;
+	const unsigned char *e = g->postings + end;
+	uint64_t next = 0;
+
+	while (p < e) {
+		const unsigned char *q = p;
+		uintmax_t delta = decode_varint(&p);
+
+		if (p == q || p > e || delta >= g->nr - next)
+			return -1;
+		next += delta;
+		if (fn)
+			fn(next, data);
+		next++;
+	}
+	return next;
+}
+
+static void set_bit(uint32_t id, void *bits)
+{
+	((unsigned char *)bits)[id / 8] |= 1 << (id % 8);
+}
+
+static size_t bitmap_size(void)
+{
+	return gidx->nr / 8 + 1;
+}
+
+/* The blobs that contain all the trigrams of "s"; NULL for all. */
+static unsigned char *literal_candidates(const char *s, size_t len, int icase)
+{
+	const unsigned char *c = (const unsigned char *)s;
+	unsigned char *bits = NULL, *tmp = NULL;
+	size_t i, j, nr = 0;
+	uint32_t t = 0;
+
+	for (i = 0; i < len && nr < MAX_QUERY_TRIGRAMS; i++) {
+		uint64_t start, end;
+		unsigned char *dst;
+		int found;
+
+		t = fold_trigram(t, c[i]);
+		if (i < 2)
+			continue;
+		/* case folding of other bytes depends on the locale */
+		if (icase && (c[i - 2] | c[i - 1] | c[i]) & 0x80)
+			continue;
+		nr++;
+
+		if (!bits) {
+			bits = xcalloc(bitmap_size(), 1);
+			dst = bits;
+		} else {
+			if (!tmp)
+				tmp = xmalloc(bitmap_size());
+			memset(tmp, 0, bitmap_size());
+			dst = tmp;
+		}
+		found = find_posting(gidx, t, &start, &end);
+		if (found < 0 ||
+		    (found && walk_posting(gidx, start, end, set_bit, dst) < 0)) {
+			gidx_corrupt = 1;
+			break;
+		}
+		if (dst == tmp)
+			for (j = 0; j < bitmap_size(); j++)
+				bits[j] &= tmp[j];
+	}
+	free(tmp);
+	return bits;
+}
+
+static unsigned char *pattern_candidates(struct grep_pat *p, int icase)
+{
+	if (p->fixed)
+		return literal_candidates(p->pattern, p->patternlen, icase);
+	if (p->literal)
+		return literal_candidates(p->literal, p->literal_len, icase);
+	return NULL;
+}
+
+static unsigned char *and_candidates(unsigned char *a, unsigned char *b)
+{
+	size_t i;
+
+	if (!a)
+		return b;
+	if (!b)
+		return a;
+	for (i = 0; i < bitmap_size(); i++)
+		a[i] &= b[i];
+	free(b);
+	return a;
+}
+
+static unsigned char *or_candidates(unsigned char *a, unsigned char *b)
+{
+	size_t i;
+
+	if (!a || !b) {
+		free(a);
+		free(b);
+		return NULL;
+	}
+	for (i = 0; i < bitmap_size(); i++)
+		a[i] |= b[i];
+	free(b);
+	return a;
+}
+
+static unsigned char *expr_candidates(struct grep_expr *x, int icase)
+{
+	switch (x->node) {
+	case GREP_NODE_ATOM:
+		return pattern_candidates(x->u.atom, icase);
+	case GREP_NODE_AND:
+		return and_candidates(expr_candidates(x->u.binary.left, icase),
+				      expr_candidates(x->u.binary.right, icase));
+	case GREP_NODE_OR:
+		return or_candidates(expr_candidates(x->u.binary.left, icase),
+				     expr_candidates(x->u.binary.right, icase));
+	default:
+		/* anything can fail to match a pattern */
+		return NULL;
+	}
+}
+
+int prepare_grep_index(struct grep_opt *opt)
+{
+	struct grep_pat *p;
+	char *path;
+
+	/* files without a match are shown too */
+	if (opt->invert || opt->unmatch_name_only)
+		return 0;
+
+	path = grep_index_path();
+	gidx = load_grep_index(path);
+	if (!gidx) {
+		free(path);
+		return 0;
+	}
+
+	if (opt->extended) {
+		candidates = expr_candidates(opt->pattern_expression,
+					     opt->ignore_case);
+	} else {
+		candidates = pattern_candidates(opt->pattern_list,
+						opt->ignore_case);
+		for (p = opt->pattern_list->next; p && candidates; p = p->next)
+			candidates = or_candidates(candidates,
+				pattern_candidates(p, opt->ignore_case));
+	}
+
+	if (gidx_corrupt) {
+		error("grep index %s is corrupt", path);
+		free(candidates);
+		candidates = NULL;
+	}
+	free(path);
+	if (!candidates) {
+		free_grep_index(gidx);
+		gidx = NULL;
+	}
+	return !!candidates;
+}
+
+int grep_index_may_match(const unsigned char *sha1)
+{
+	uint32_t id;
+
+	if (!candidates ||
+	    !blob_id(gidx, lookup_replace_object(sha1), &id))
+		return 1;
+	return candidates[id / 8] & (1 << (id % 8));
+}
+
+struct posting {
+	uint32_t trigram;
+	uint32_t next_id;
+	unsigned char *buf;
+	size_t len, alloc;
+};
+
+struct grep_index_writer {
+	struct hash_table postings;
+	unsigned char *names;
+	uint32_t nr;
+	size_t names_alloc;
+
+	/* the trigrams of the blob being indexed */
+	unsigned char *seen;
+	uint32_t *found;
+	int found_nr, found_alloc;
+};
+
+static struct posting *get_posting(struct grep_index_writer *w, uint32_t t)
+{
+	struct posting *p = lookup_hash(t, &w->postings);
+
+	if (!p) {
+		p = xcalloc(1, sizeof(*p));
+		p->trigram = t;
+		insert_hash(t, p, &w->postings);
+	}
+	return p;
+}
+
+static void add_posting(struct grep_index_writer *w, uint32_t t, uint32_t id)
+{
+	struct posting *p = get_posting(w, t);
+	unsigned char varint[16];
+	int len = encode_varint(id - p->next_id, varint);
+
+	ALLOC_GROW(p->buf, p->len + len, p->alloc);
+	memcpy(p->buf + p->len, varint, len);
+	p->len += len;
+	p->next_id = id + 1;
+}
+
+static int free_posting(void *ptr, void *data)
+{
+	struct posting *p = ptr;
+	free(p->buf);
+	free(p);
+	return 0;
+}
+
+static uint32_t add_blob_name(struct grep_index_writer *w,
+			      const unsigned char *sha1)
+{
+	ALLOC_GROW(w->names, ((size_t)w->nr + 1) * 20, w->names_alloc);
+	hashcpy(w->names + (size_t)w->nr * 20, sha1);
+	return w->nr++;
+}
+
+static void index_blob(struct grep_index_writer *w, uint32_t id,
+		       const unsigned char *buf, unsigned long size)
+{
+	uint32_t t = 0;
+	unsigned long i;
+	int j;
+
+	for (i = 0; i < size; i++) {
+		t = fold_trigram(t, buf[i]);
+		if (i < 2 || (w->seen[t / 8] & (1 << (t % 8))))
+			continue;
+		w->seen[t / 8] |= 1 << (t % 8);
+		ALLOC_GROW(w->found, w->found_nr + 1, w->found_alloc);
+		w->found[w->found_nr++] = t;
+	}
+	for (j = 0; j < w->found_nr; j++) {
+		t = w->found[j];
+		add_posting(w, t, id);
+		w->seen[t / 8] &= ~(1 << (t % 8));
+	}
+	w->found_nr = 0;
+}
+
+/* Take over the blobs and posting lists of an existing index. */
+static int add_old_index(struct grep_index_writer *w, struct grep_index *g)
+{
+	uint64_t start = 0;
+	uint32_t i;
+
+	for (i = 0; i < g->nr; i++)
+		add_blob_name(w, g->names + (size_t)i * 20);
+	for (i = 0; i < g->nr_trigrams; i++) {
+		const unsigned char *r = g->records +
+			(size_t)i * GREP_INDEX_RECORD_SIZE;
+		uint64_t end = record_end(r);
+		struct posting *p;
+		int64_t next;
+
+		if (start > end || end > g->postings_size)
+			return -1;
+		next = walk_posting(g, start, end, NULL, NULL);
+		if (next < 0)
+			return -1;
+		p = get_posting(w, ntohl(*(uint32_t *)r));
+		p->len = end - start;
+		ALLOC_GROW(p->buf, p->len, p->alloc);
+		memcpy(p->buf, g->postings + start, p->len);
+		p->next_id = next;
+		start = end;
+	}
+	return 0;
+}
+
+struct packed_blob {
+	unsigned char sha1[20];
+	int pack_nr;
+	off_t offset;
+};
+
+static int packed_blob_name_cmp(const void *a_, const void *b_)
+{
+	const struct packed_blob *a = a_, *b = b_;
+	return hashcmp(a->sha1, b->sha1);
+}
+
+static int packed_blob_offset_cmp(const void *a_, const void *b_)
+{
+	const struct packed_blob *a = a_, *b = b_;
+	if (a->pack_nr != b->pack_nr)
+		return a->pack_nr - b->pack_nr;
+	if (a->offset != b->offset)
+		return a->offset < b->offset ? -1 : 1;
+	return 0;
+}
+
+/*
+ * The packed objects that are not in "old", in pack order, so that
+ * delta bases are still cached when their deltas are read.
+ */
+static struct packed_blob *new_packed_objects(struct grep_index *old, int *nr_p)
+{
+	struct packed_blob *list = NULL;
+	struct packed_git *p;
+	int nr = 0, alloc = 0, pack_nr = 0, i, j;
+
+	prepare_packed_git();
+	for (p = packed_git; p; p = p->next, pack_nr++) {
+		uint32_t n;
+		if (open_pack_index(p))
+			continue;
+		for (n = 0; n < p->num_objects; n++) {
+			const unsigned char *sha1 = nth_packed_object_sha1(p, n);
+			uint32_t id;
+			if (old && blob_id(old, sha1, &id))
+				continue;
+			ALLOC_GROW(list, nr + 1, alloc);
+			hashcpy(list[nr].sha1, sha1);
+			list[nr].pack_nr = pack_nr;
+			list[nr].offset = nth_packed_object_offset(p, n);
+			nr++;
+		}
+	}
+
+	/* an object may be in more than one pack */
+	qsort(list, nr, sizeof(*list), packed_blob_name_cmp);
+	for (i = j = 0; i < nr; i++)
+		if (!j || hashcmp(list[j - 1].sha1, list[i].sha1))
+			list[j++] = list[i];
+	nr = j;
+	qsort(list, nr, sizeof(*list), packed_blob_offset_cmp);
+
+	*nr_p = nr;
+	return list;
+}
+
+static void index_new_blobs(struct grep_index_writer *w,
+			    struct packed_blob *list, int nr)
+{
+	struct object_read_request req[WRITE_BATCH];
+	int i, j, n, blobs;
+
+	for (i = 0; i < nr; i += n) {
+		n = nr - i < WRITE_BATCH ? nr - i : WRITE_BATCH;
+		for (j = 0; j < n; j++)
+			hashcpy(req[j].sha1, list[i + j].sha1);
+		read_object_batch(req, n, 0);
+
+		/* big blobs are left for grep to read */
+		for (j = blobs = 0; j < n; j++)
+			if (req[j].type == OBJ_BLOB &&
+			    req[j].size <= big_file_threshold)
+				req[blobs++] = req[j];
+		read_object_batch(req, blobs, 1);
+
+		for (j = 0; j < blobs; j++) {
+			enum object_type type;
+			unsigned long size;
+			void *buf = req[j].buf;
+
+			if (!buf)
+				buf = read_sha1_file(req[j].sha1, &type, &size);
+			else
+				size = req[j].size;
+			if (!buf) {
+				warning("unable to read blob %s",
+					sha1_to_hex(req[j].sha1));
+				continue;
+			}
+			index_blob(w, add_blob_name(w, req[j].sha1), buf, size);
+			free(buf);
+		}
+	}
+}
+
+static int collect_posting(void *ptr, void *data)
+{
+	struct posting ***list = data;
+	*(*list)++ = ptr;
+	return 0;
+}
+
+static int posting_cmp(const void *a_, const void *b_)
+{
+	const struct posting *a = *(const struct posting **)a_;
+	const struct posting *b = *(const struct posting **)b_;
+	if (a->trigram != b->trigram)
+		return a->trigram < b->trigram ? -1 : 1;
+	return 0;
+}
+
+static const unsigned char *sort_names;
+
+static int blob_id_cmp(const void *a_, const void *b_)
+{
+	uint32_t a = *(const uint32_t *)a_, b = *(const uint32_t *)b_;
+	return hashcmp(sort_names + (size_t)a * 20, sort_names + (size_t)b * 20);
+}
+
+static void write_be32(struct sha1file *f, uint32_t v)
+{
+	v = htonl(v);
+	sha1write(f, &v, 4);
+}
+
+int write_grep_index(int full)
+{
+	static struct lock_file lock;
+	struct grep_index_writer w;
+	struct grep_index *old = NULL;
+	struct packed_blob *list;
+	struct posting **postings, **pp;
+	uint32_t *order, i;
+	uint64_t end;
+	int nr;
+	char *path;
+	struct sha1file *f;
+
+	/* index what each blob really holds */
+	read_replace_refs = 0;
+
+	memset(&w, 0, sizeof(w));
+	init_hash(&w.postings);
+	path = grep_index_path();
+	if (!full)
+		old = load_grep_index(path);
+	if (old && add_old_index(&w, old)) {
+		warning("grep index %s is corrupt, rewriting it", path);
+		free_grep_index(old);
+		old = NULL;
+		for_each_hash(&w.postings, free_posting, NULL);
+		free_hash(&w.postings);
+		init_hash(&w.postings);
+		w.nr = 0;
+	}
+
+	list = new_packed_objects(old, &nr);
+	free_grep_index(old);
+	w.seen = xcalloc(1 << 21, 1);
+	index_new_blobs(&w, list, nr);
+	free(list);
+	free(w.seen);
+	free(w.found);
+
+	postings = xmalloc((w.postings.nr + 1) * sizeof(*postings));
+	pp = postings;
+	for_each_hash(&w.postings, collect_posting, &pp);
+	qsort(postings, w.postings.nr, sizeof(*postings), posting_cmp);
+
+	order = xmalloc(((size_t)w.nr + 1) * sizeof(*order));
+	for (i = 0; i < w.nr; i++)
+		order[i] = i;
+	sort_names = w.names;
+	qsort(order, w.nr, sizeof(*order), blob_id_cmp);
+
+	if (safe_create_leading_directories(path))
+		die("unable to create leading directories of %s", path);
+	hold_lock_file_for_update(&lock, path, LOCK_DIE_ON_ERROR);
+	free(path);
+	f = sha1fd(lock.fd, lock.filename);
+
+	write_be32(f, GREP_INDEX_SIGNATURE);
+	write_be32(f, GREP_INDEX_VERSION);
+	write_be32(f, w.nr);
+	write_be32(f, w.postings.nr);
+	sha1write(f, w.names, (size_t)w.nr * 20);
+	for (i = 0; i < w.nr; i++)
+		write_be32(f, order[i]);
+	end = 0;
+	for (i = 0; i < w.postings.nr; i++) {
+		end += postings[i]->len;
+		write_be32(f, postings[i]->trigram);
+		write_be32(f, (uint32_t)(end >> 32));
+		write_be32(f, (uint32_t)end);
+	}
+	for (i = 0; i < w.postings.nr; i++)
+		sha1write(f, postings[i]->buf, postings[i]->len);
+
+	sha1close(f, NULL, CSUM_FSYNC);
+	lock.fd = -1; /* closed by sha1close() */
+	if (commit_lock_file(&lock))
+		die_errno("unable to write grep index");
+
+	free(postings);
+	free(order);
+	for_each_hash(&w.postings, free_posting, NULL);
+	free_hash(&w.postings);
+	free(w.names);
+	return 0;
+}
@@ -0,0 +1,64 @@
+#ifndef GREP_INDEX_H
+#define GREP_INDEX_H
+
+/*
+ * The grep index ("objects/info/grep-index") records, for packed
+ * blobs, which trigrams (runs of three bytes, with ASCII letters
+ * folded to lowercase) occur in them.  A blob that lacks one of the
+ * trigrams of a string a pattern requires cannot match it, and 'git
+ * grep' skips it without reading it.  Blobs that are not in the
+ * index are searched as usual, so a stale index is never wrong.
+ *
+ * Blobs are numbered in the order they were added, and an update
+ * only appends the blobs packed since, so the posting lists of the
+ * existing trigrams are extended rather than rebuilt.
+ *
+ * The on-disk format is:
+ *
+ *   - a header: 4-byte signature "GIDX", 4-byte version, 4-byte
+ *     number of blobs N and 4-byte number of trigrams T;
+ *
+ *   - the N 20-byte blob names, in the order they were indexed; the
+ *     position of a blob in this table is its id;
+ *
+ *   - N 4-byte blob ids, sorted by the names of the blobs;
+ *
+ *   - T 12-byte records sorted by trigram: the 4-byte trigram (the
+ *     three bytes, first byte most significant) and the 8-byte offset
+ *     in the posting lists where its list ends; it starts where the
+ *     list of the previous trigram ends;
+ *
+ *   - the posting lists: for each trigram, the increasing ids of the
+ *     blobs that contain it, each as a varint of its difference from
+ *     one more than the previous id (from zero for the first one);
+ *
+ *   - a 20-byte SHA-1 checksum of all of the above.
+ *
+ * All integers are in network byte order.
+ */
+#define GREP_INDEX_SIGNATURE 0x47494458	/* "GIDX" */
+#define GREP_INDEX_VERSION 1
+
+struct grep_opt;
+
+/*
+ * Work out from the grep index which blobs can match the (compiled)
+ * patterns of "opt".  Returns 1 if grep_index_may_match() can rule
+ * some out, 0 if there is no index or the patterns cannot use it.
+ */
+extern int prepare_grep_index(struct grep_opt *opt);
+
+/*
+ * Returns 0 if the index shows blob "sha1" cannot match the patterns
+ * given to prepare_grep_index(), 1 if it has to be searched.
+ */
+extern int grep_index_may_match(const unsigned char *sha1);
+
+/*
+ * Add the packed blobs that are not yet in the grep index to it, or
+ * with "full", write it from scratch, dropping blobs that are gone.
+ * Returns 0 on success, -1 on error.
+ */
+extern int write_grep_index(int full);
+
+#endif
@@ -155,6 +155,173 @@ static int is_fixed(const char *s, size_t len)
 	return 1;
 }
 
+/*
+ * Skip the bracket expression starting at "s", returning where it ends,
+ * or NULL if it does not.
+ */
+static const char *skip_bracket(const char *s, const char *end)
+{
+	s++;
+	if (s < end && *s == '^')
+		s++;
+	if (s < end && *s == ']')
+		s++;
+	while (s < end && *s != ']') {
+		if (*s == '[' && s + 1 < end &&
+		    (s[1] == ':' || s[1] == '.' || s[1] == '=')) {
+			char kind = s[1];
+			for (s += 2; s + 1 < end; s++)
+				if (s[0] == kind && s[1] == ']')
+					break;
+			if (s + 1 >= end)
+				return NULL;
+			s++;
+		}
+		s++;
+	}
+	return s < end ? s + 1 : NULL;
+}
+
+/*
+ * Skip the group whose opening parenthesis ends right before "s",
+ * returning where it ends, or NULL if it does not.
+ */
+static const char *skip_group(const char *s, const char *end, int extended)
+{
+	int depth = 1;
+
+	while (s < end) {
+		if (*s == '[') {
+			s = skip_bracket(s, end);
+			if (!s)
+				return NULL;
+			continue;
+		}
+		if (*s == '\\' && s + 1 < end) {
+			if (!extended && s[1] == '(')
+				depth++;
+			else if (!extended && s[1] == ')' && !--depth)
+				return s + 2;
+			s += 2;
+			continue;
+		}
+		if (extended && *s == '(')
+			depth++;
+		else if (extended && *s == ')' && !--depth)
+			return s + 1;
+		s++;
+	}
+	return NULL;
+}
+
+/*
+ * Find the longest run of ordinary characters that any match of a
+ * regexp must contain, so that a buffer can be searched for it with
+ * memmem() before running the regexp on the few lines that have it.
+ * This errs on the side of not finding one: everything inside a
+ * bracket expression or a group is skipped, a quantifier takes the
+ * character before it out of the run, and an alternation outside of
+ * a group means there is no such string at all.
+ */
+static void compile_literal(struct grep_pat *p, struct grep_opt *opt)
+{
+	int extended = !!(opt->regflags & REG_EXTENDED);
+	int icase = (opt->regflags & REG_ICASE) || p->ignore_case;
+	const char *s = p->pattern, *end = p->pattern + p->patternlen;
+	struct strbuf run = STRBUF_INIT, best = STRBUF_INIT;
+
+	while (s < end) {
+		int ch = (unsigned char)*s++;
+		int literal = 0, quantifier = 0;
+
+		if (ch == '\\' && s < end) {
+			int next = (unsigned char)*s++;
+			if (!extended && next == '(') {
+				s = skip_group(s, end, extended);
+			} else if (!extended && next == '{') {
+				quantifier = 1;
+				while (s < end && *s != '}')
+					s++;
+				s++;
+			} else if (!extended && (next == '+' || next == '?')) {
+				quantifier = 1;
+			} else if (next == '|') {
+				if (!extended)
+					goto none;
+				literal = 1;
+			} else if (!isalnum(next) && next < 0x80 &&
+				   !strchr("<>`'", next)) {
+				literal = 1;
+			}
+			ch = next;
+		} else if (ch == '[') {
+			s = skip_bracket(s - 1, end);
+		} else if (ch == '*') {
+			quantifier = 1;
+		} else if (extended && (ch == '+' || ch == '?')) {
+			quantifier = 1;
+		} else if (extended && ch == '{') {
+			quantifier = 1;
+			while (s < end && *s != '}')
+				s++;
+			s++;
+		} else if (extended && ch == '(') {
+			s = skip_group(s, end, extended);
+		} else if (extended && ch == '|') {
+			goto none;
+		} else if (ch != '.' && ch != '^' && ch != '$' &&
+			   !(extended && ch == ')')) {
+			literal = 1;
+		}
+		/* case-folding is left to the regexp beyond ASCII */
+		if (literal && ch == '\n')
+			literal = 0;
+		if (literal && icase && 0x80 <= ch)
+			literal = 0;
+
+		if (literal) {
+			strbuf_addch(&run, ch);
+			continue;
+		}
+		if (quantifier) {
+			/* take out the whole quantified (multibyte) character */
+			while (run.len && 0x80 <= (unsigned char)run.buf[run.len - 1])
+				strbuf_setlen(&run, run.len - 1);
+			if (run.len)
+				strbuf_setlen(&run, run.len - 1);
+		}
+		if (best.len < run.len)
+			strbuf_swap(&best, &run);
+		strbuf_reset(&run);
+		if (!s || end < s)
+			goto none; /* unbalanced; let regcomp() complain */
+	}
+	if (best.len < run.len)
+		strbuf_swap(&best, &run);
+	strbuf_release(&run);
+	if (!best.len) {
+		strbuf_release(&best);
+		return;
+	}
+
+	p->literal_len = best.len;
+	p->literal = strbuf_detach(&best, NULL);
+	if (icase) {
+		static char trans[256];
+		int i;
+		for (i = 0; i < 256; i++)
+			trans[i] = tolower(i);
+		p->literal_kws = kwsalloc(trans);
+		kwsincr(p->literal_kws, p->literal, p->literal_len);
+		kwsprep(p->literal_kws);
+	}
+	return;
+
+none:
+	strbuf_release(&run);
+	strbuf_release(&best);
+}
+
 static void compile_regexp(struct grep_pat *p, struct grep_opt *opt)
 {
 	int err;
@@ -168,17 +335,16 @@ static void compile_regexp(struct grep_pat *p, struct grep_opt *opt)
 		p->fixed = 0;
 
 	if (p->fixed) {
+		/* without case-folding, fixmatch() uses memmem() */
 		if (opt->regflags & REG_ICASE || p->ignore_case) {
 			static char trans[256];
 			int i;
 			for (i = 0; i < 256; i++)
 				trans[i] = tolower(i);
 			p->kws = kwsalloc(trans);
-		} else {
-			p->kws = kwsalloc(NULL);
+			kwsincr(p->kws, p->pattern, p->patternlen);
+			kwsprep(p->kws);
 		}
-		kwsincr(p->kws, p->pattern, p->patternlen);
-		kwsprep(p->kws);
 		return;
 	}
 
@@ -194,6 +360,7 @@ static void compile_regexp(struct grep_pat *p, struct grep_opt *opt)
 		regfree(&p->regexp);
 		compile_regexp_failed(p, errbuf);
 	}
+	compile_literal(p, opt);
 }
 
 static struct grep_expr *compile_pattern_or(struct grep_pat **);
@@ -429,12 +596,16 @@ void free_grep_patterns(struct grep_opt *opt)
 		case GREP_PATTERN: /* atom */
 		case GREP_PATTERN_HEAD:
 		case GREP_PATTERN_BODY:
-			if (p->kws)
-				kwsfree(p->kws);
-			else if (p->pcre_regexp)
+			if (p->fixed) {
+				if (p->kws)
+					kwsfree(p->kws);
+			} else if (p->pcre_regexp)
 				free_pcre_regexp(p);
 			else
 				regfree(&p->regexp);
+			if (p->literal_kws)
+				kwsfree(p->literal_kws);
+			free(p->literal);
 			break;
 		default:
 			break;
@@ -492,7 +663,14 @@ static int fixmatch(struct grep_pat *p, char *line, char *eol,
 		    regmatch_t *match)
 {
 	struct kwsmatch kwsm;
-	size_t offset = kwsexec(p->kws, line, eol - line, &kwsm);
+	size_t offset;
+
+	if (!p->kws) {
+		char *hit = memmem(line, eol - line, p->pattern, p->patternlen);
+		offset = hit ? hit - line : -1;
+		kwsm.size[0] = p->patternlen;
+	} else
+		offset = kwsexec(p->kws, line, eol - line, &kwsm);
 	if (offset == -1) {
 		match->rm_so = match->rm_eo = -1;
 		return REG_NOMATCH;
@@ -514,11 +692,28 @@ static int regmatch(const regex_t *preg, char *line, char *eol,
 	return regexec(preg, line, 1, match, eflags);
 }
 
+/* Where does the required literal of "p" first occur in line..eol? */
+static char *find_literal(struct grep_pat *p, char *line, char *eol)
+{
+	struct kwsmatch kwsm;
+	size_t offset;
+
+	if (!p->literal_kws)
+		return memmem(line, eol - line, p->literal, p->literal_len);
+	offset = kwsexec(p->literal_kws, line, eol - line, &kwsm);
+	return offset == -1 ? NULL : line + offset;
+}
+
 static int patmatch(struct grep_pat *p, char *line, char *eol,
 		    regmatch_t *match, int eflags)
 {
 	int hit;
 
+	if (p->literal && !find_literal(p, line, eol)) {
+		match->rm_so = match->rm_eo = -1;
+		return 0;
+	}
+
 	if (p->fixed)
 		hit = !fixmatch(p, line, eol, match);
 	else if (p->pcre_regexp)
@@ -901,6 +1096,44 @@ static int should_lookahead(struct grep_opt *opt)
 	return 1;
 }
 
+/*
+ * Find the first line in buf..end that "p" matches, by looking for
+ * its required literal in the whole buffer, and running the regexp
+ * only on the lines that have it.
+ */
+static int literal_look_ahead(struct grep_pat *p, char *buf, char *end,
+			      regmatch_t *m)
+{
+	char *sp = buf;
+
+	while (sp < end) {
+		char *hit = find_literal(p, sp, end);
+		char *bol, *eol, ch;
+		int matched;
+
+		if (!hit)
+			break;
+		for (bol = hit; buf < bol && bol[-1] != '\n'; bol--)
+			; /* find the beginning of the line */
+		eol = memchr(hit, '\n', end - hit);
+		if (!eol)
+			eol = end;
+
+		ch = *eol;
+		*eol = '\0';
+		matched = patmatch(p, bol, eol, m, 0);
+		*eol = ch;
+		if (matched && 0 <= m->rm_so) {
+			m->rm_so += bol - buf;
+			m->rm_eo += bol - buf;
+			return 1;
+		}
+		sp = eol + 1;
+	}
+	m->rm_so = m->rm_eo = -1;
+	return 0;
+}
+
 static int look_ahead(struct grep_opt *opt,
 		      unsigned long *left_p,
 		      unsigned *lno_p,
@@ -916,7 +1149,10 @@ static int look_ahead(struct grep_opt *opt,
 		int hit;
 		regmatch_t m;
 
-		hit = patmatch(p, bol, bol + *left_p, &m, 0);
+		if (p->literal)
+			hit = literal_look_ahead(p, bol, bol + *left_p, &m);
+		else
+			hit = patmatch(p, bol, bol + *left_p, &m, 0);
 		if (!hit || m.rm_so < 0 || m.rm_eo < 0)
 			continue;
 		if (earliest < 0 || m.rm_so < earliest)
@@ -43,6 +43,10 @@ struct grep_pat {
 	pcre *pcre_regexp;
 	pcre_extra *pcre_extra_info;
 	kwset_t kws;
+	/* a string any match of a regexp must contain, or NULL */
+	char *literal;
+	size_t literal_len;
+	kwset_t literal_kws;
 	unsigned fixed:1;
 	unsigned ignore_case:1;
 	unsigned word_regexp:1;
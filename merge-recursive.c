@@ -191,7 +191,9 @@ static void output_commit_title(struct merge_options *o, struct commit *commit)
 			printf("(bad commit)\n");
 		else {
 			const char *title;
-			int len = find_commit_subject(commit->buffer, &title);
+			int len;
+			load_commit_buffer(commit);
+			len = find_commit_subject(commit->buffer, &title);
 			if (len)
 				printf("%.*s\n", len, title);
 		}
@@ -490,6 +492,8 @@ static struct string_list *get_renames(struct merge_options *o,
 	opts.rename_limit = o->merge_rename_limit >= 0 ? o->merge_rename_limit :
 			    o->diff_rename_limit >= 0 ? o->diff_rename_limit :
 			    1000;
+	if (o->rename_sketch)
+		DIFF_OPT_SET(&opts, RENAME_SKETCH);
 	opts.rename_score = o->rename_score;
 	opts.show_rename_progress = o->show_rename_progress;
 	opts.output_format = DIFF_FORMAT_NO_OUTPUT;
@@ -2028,6 +2032,10 @@ static int merge_recursive_config(const char *var, const char *value, void *cb)
 		o->merge_rename_limit = git_config_int(var, value);
 		return 0;
 	}
+	if (!strcmp(var, "diff.renamesketch")) {
+		o->rename_sketch = git_config_bool(var, value);
+		return 0;
+	}
 	return git_xmerge_config(var, value, cb);
 }
 
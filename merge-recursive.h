@@ -19,6 +19,7 @@ struct merge_options {
 	int verbosity;
 	int diff_rename_limit;
 	int merge_rename_limit;
+	int rename_sketch;
 	int rename_score;
 	int needed_rename_limit;
 	int show_rename_progress;
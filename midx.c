@@ -0,0 +1,493 @@
+#include "cache.h"
+#include "csum-file.h"
+#include "midx.h"
+
+#define MIDX_HEADER_SIZE 24
+#define MIDX_FANOUT_SIZE (256 * 4)
+
+struct multi_pack_index *multi_pack_index;
+
+static struct multi_pack_index *load_multi_pack_index(const char *objdir)
+{
+	struct multi_pack_index *m;
+	struct strbuf path = STRBUF_INIT;
+	struct stat st;
+	const uint32_t *hdr;
+	const char *name, *end;
+	size_t size, names_len, expect;
+	void *map;
+	uint32_t i;
+	int fd;
+
+	strbuf_addf(&path, "%s/pack/multi-pack-index", objdir);
+	fd = open(path.buf, O_RDONLY);
+	if (fd < 0 || fstat(fd, &st)) {
+		if (fd >= 0)
+			close(fd);
+		strbuf_release(&path);
+		return NULL;
+	}
+	size = xsize_t(st.st_size);
+	if (size < MIDX_HEADER_SIZE + MIDX_FANOUT_SIZE + 20) {
+		close(fd);
+		error("multi-pack-index file %s is too small", path.buf);
+		strbuf_release(&path);
+		return NULL;
+	}
+	map = xmmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	hdr = map;
+	if (ntohl(hdr[0]) != MIDX_SIGNATURE ||
+	    ntohl(hdr[1]) != MIDX_VERSION) {
+		error("multi-pack-index file %s has unknown signature or version",
+		      path.buf);
+		goto fail;
+	}
+
+	m = xcalloc(1, sizeof(*m));
+	m->data = map;
+	m->data_len = size;
+	m->num_packs = ntohl(hdr[2]);
+	m->num_objects = ntohl(hdr[3]);
+	m->num_large_offsets = ntohl(hdr[4]);
+	names_len = ntohl(hdr[5]);
+
+	expect = MIDX_HEADER_SIZE + names_len + MIDX_FANOUT_SIZE +
+		(size_t)m->num_objects * (20 + 8) +
+		(size_t)m->num_large_offsets * 8 + 20;
+	if (names_len % 4 || size != expect) {
+		error("multi-pack-index file %s is corrupt", path.buf);
+		free(m);
+		goto fail;
+	}
+
+	name = (const char *)m->data + MIDX_HEADER_SIZE;
+	end = name + names_len;
+	m->pack_names = xcalloc(m->num_packs, sizeof(*m->pack_names));
+	for (i = 0; i < m->num_packs; i++) {
+		const char *nul = memchr(name, '\0', end - name);
+		if (!nul || nul == name) {
+			error("multi-pack-index file %s has bad pack names",
+			      path.buf);
+			free(m->pack_names);
+			free(m);
+			goto fail;
+		}
+		m->pack_names[i] = name;
+		name = nul + 1;
+	}
+
+	m->fanout = (const uint32_t *)end;
+	m->oids = (const unsigned char *)end + MIDX_FANOUT_SIZE;
+	m->entries = (const uint32_t *)(m->oids + (size_t)m->num_objects * 20);
+	m->large_offsets = m->entries + (size_t)m->num_objects * 2;
+	if (ntohl(m->fanout[255]) != m->num_objects) {
+		error("multi-pack-index file %s is corrupt", path.buf);
+		free(m->pack_names);
+		free(m);
+		goto fail;
+	}
+	strbuf_release(&path);
+	return m;
+
+fail:
+	munmap(map, size);
+	strbuf_release(&path);
+	return NULL;
+}
+
+static void free_multi_pack_index(struct multi_pack_index *m)
+{
+	munmap((void *)m->data, m->data_len);
+	free(m->pack_names);
+	free(m->packs);
+	free(m);
+}
+
+static struct packed_git *add_midx_pack(const char *objdir, const char *name)
+{
+	struct strbuf path = STRBUF_INIT;
+	struct packed_git *p;
+
+	strbuf_addf(&path, "%s/pack/%s", objdir, name);
+	p = add_packed_git(path.buf, path.len, 1);
+	strbuf_release(&path);
+	return p;
+}
+
+/* The installed pack with the .idx "name" in "objdir", if any. */
+static struct packed_git *installed_midx_pack(const char *objdir,
+					      const char *name)
+{
+	struct strbuf path = STRBUF_INIT;
+	struct packed_git *p;
+
+	strbuf_addf(&path, "%s/pack/%s", objdir, name);
+	for (p = packed_git; p; p = p->next)
+		if (strlen(p->pack_name) == path.len + 1 &&
+		    !memcmp(path.buf, p->pack_name, path.len - 4))
+			break;
+	strbuf_release(&path);
+	return p;
+}
+
+/*
+ * This runs whenever the packs are (re)prepared, so that a process
+ * that had to reprepare_packed_git() sees a multi-pack-index that was
+ * written or rewritten since it started.  One that is unchanged, as
+ * told by its trailing checksum, is kept.
+ */
+void prepare_multi_pack_index(const char *objdir)
+{
+	struct multi_pack_index *m;
+	unsigned char *installed;
+	uint32_t i;
+
+	if (!core_multi_pack_index)
+		return;
+
+	m = load_multi_pack_index(objdir);
+	if (!m) {
+		close_multi_pack_index();
+		return;
+	}
+	if (multi_pack_index &&
+	    multi_pack_index->data_len == m->data_len &&
+	    !hashcmp(multi_pack_index->data + m->data_len - 20,
+		     m->data + m->data_len - 20)) {
+		free_multi_pack_index(m);
+		return;
+	}
+
+	m->packs = xcalloc(m->num_packs, sizeof(*m->packs));
+	installed = xcalloc(m->num_packs, 1);
+	for (i = 0; i < m->num_packs; i++) {
+		m->packs[i] = installed_midx_pack(objdir, m->pack_names[i]);
+		installed[i] = !!m->packs[i];
+		if (!m->packs[i])
+			m->packs[i] = add_midx_pack(objdir, m->pack_names[i]);
+		if (!m->packs[i])
+			break;
+	}
+	if (i < m->num_packs) {
+		/* a pack went away since the index was written; ignore it */
+		while (i--)
+			if (!installed[i])
+				free(m->packs[i]);
+		free(installed);
+		free_multi_pack_index(m);
+		close_multi_pack_index();
+		return;
+	}
+
+	close_multi_pack_index();
+	for (i = 0; i < m->num_packs; i++) {
+		m->packs[i]->multi_pack_index = 1;
+		if (!installed[i])
+			install_packed_git(m->packs[i]);
+	}
+	free(installed);
+	multi_pack_index = m;
+}
+
+void close_multi_pack_index(void)
+{
+	struct multi_pack_index *m = multi_pack_index;
+	uint32_t i;
+
+	if (!m)
+		return;
+	for (i = 0; i < m->num_packs; i++)
+		if (m->packs[i])
+			m->packs[i]->multi_pack_index = 0;
+	multi_pack_index = NULL;
+	free_multi_pack_index(m);
+}
+
+static int midx_pos(struct multi_pack_index *m, const unsigned char *sha1,
+		    uint32_t *pos)
+{
+	uint32_t lo, hi;
+
+	lo = sha1[0] ? ntohl(m->fanout[sha1[0] - 1]) : 0;
+	hi = ntohl(m->fanout[sha1[0]]);
+	while (lo < hi) {
+		uint32_t mi = lo + (hi - lo) / 2;
+		int cmp = hashcmp(sha1, m->oids + (size_t)mi * 20);
+		if (!cmp) {
+			*pos = mi;
+			return 1;
+		}
+		if (cmp < 0)
+			hi = mi;
+		else
+			lo = mi + 1;
+	}
+	*pos = lo;
+	return 0;
+}
+
+static off_t nth_midx_offset(struct multi_pack_index *m, uint32_t n)
+{
+	uint32_t off = ntohl(m->entries[2 * n + 1]);
+
+	if (off & MIDX_LARGE_OFFSET) {
+		const uint32_t *large;
+		off &= ~MIDX_LARGE_OFFSET;
+		if (off >= m->num_large_offsets)
+			die("multi-pack-index has a bad large offset");
+		large = m->large_offsets + 2 * off;
+		return (((off_t)ntohl(large[0])) << 32) | ntohl(large[1]);
+	}
+	return off;
+}
+
+int find_multi_pack_index_entry(const unsigned char *sha1,
+				struct packed_git **pack, off_t *offset)
+{
+	struct multi_pack_index *m = multi_pack_index;
+	uint32_t pos, pack_int_id;
+
+	if (!m || !midx_pos(m, sha1, &pos))
+		return 0;
+	pack_int_id = ntohl(m->entries[2 * pos]);
+	if (pack_int_id >= m->num_packs || !m->packs[pack_int_id])
+		return 0;
+	*pack = m->packs[pack_int_id];
+	*offset = nth_midx_offset(m, pos);
+	return 1;
+}
+
+const unsigned char *nth_multi_pack_index_sha1(struct multi_pack_index *m,
+					       uint32_t n)
+{
+	if (n >= m->num_objects)
+		return NULL;
+	return m->oids + (size_t)n * 20;
+}
+
+struct midx_pack {
+	struct packed_git *p;
+	char *name;
+};
+
+struct midx_entry {
+	unsigned char sha1[20];
+	uint32_t pack_int_id;
+	time_t mtime;
+	off_t offset;
+};
+
+static int midx_pack_cmp(const void *a_, const void *b_)
+{
+	const struct midx_pack *a = a_, *b = b_;
+	return strcmp(a->name, b->name);
+}
+
+static int midx_entry_cmp(const void *a_, const void *b_)
+{
+	const struct midx_entry *a = a_, *b = b_;
+	int cmp = hashcmp(a->sha1, b->sha1);
+
+	if (cmp)
+		return cmp;
+	/* prefer the younger pack, like rearrange_packed_git() does */
+	if (a->mtime != b->mtime)
+		return a->mtime < b->mtime ? 1 : -1;
+	return a->pack_int_id < b->pack_int_id ? -1 :
+		a->pack_int_id > b->pack_int_id;
+}
+
+static void write_be32(struct sha1file *f, uint32_t v)
+{
+	v = htonl(v);
+	sha1write(f, &v, 4);
+}
+
+int write_multi_pack_index(const char *objdir)
+{
+	static struct lock_file lock;
+	struct midx_pack *packs = NULL;
+	struct midx_entry *entries = NULL;
+	struct packed_git *p;
+	struct strbuf path = STRBUF_INIT;
+	struct sha1file *f;
+	uint32_t fanout[256], nr_large = 0;
+	int nr_packs = 0, alloc_packs = 0, nr = 0, alloc = 0;
+	int i, j, names_len = 0;
+
+	prepare_packed_git();
+	for (p = packed_git; p; p = p->next) {
+		const char *slash;
+		if (!p->pack_local)
+			continue;
+		if (open_pack_index(p)) {
+			warning("unable to open index of %s; not covering it",
+				p->pack_name);
+			continue;
+		}
+		slash = strrchr(p->pack_name, '/');
+		ALLOC_GROW(packs, nr_packs + 1, alloc_packs);
+		packs[nr_packs].p = p;
+		packs[nr_packs].name = xstrdup(slash ? slash + 1 : p->pack_name);
+		strcpy(packs[nr_packs].name +
+		       strlen(packs[nr_packs].name) - 5, ".idx");
+		names_len += strlen(packs[nr_packs].name) + 1;
+		nr_packs++;
+	}
+	if (nr_packs)
+		qsort(packs, nr_packs, sizeof(*packs), midx_pack_cmp);
+	names_len = (names_len + 3) & ~3;
+
+	for (i = 0; i < nr_packs; i++) {
+		uint32_t n;
+		p = packs[i].p;
+		ALLOC_GROW(entries, nr + p->num_objects, alloc);
+		for (n = 0; n < p->num_objects; n++) {
+			struct midx_entry *e = &entries[nr++];
+			hashcpy(e->sha1, nth_packed_object_sha1(p, n));
+			e->pack_int_id = i;
+			e->mtime = p->mtime;
+			e->offset = nth_packed_object_offset(p, n);
+		}
+	}
+	if (nr)
+		qsort(entries, nr, sizeof(*entries), midx_entry_cmp);
+
+	/* keep the first (preferred) copy of each object */
+	for (i = j = 0; i < nr; i++) {
+		if (j && !hashcmp(entries[j - 1].sha1, entries[i].sha1))
+			continue;
+		entries[j++] = entries[i];
+	}
+	nr = j;
+
+	memset(fanout, 0, sizeof(fanout));
+	for (i = 0; i < nr; i++) {
+		fanout[entries[i].sha1[0]]++;
+		if (entries[i].offset > 0x7fffffff)
+			nr_large++;
+	}
+	for (i = 1; i < 256; i++)
+		fanout[i] += fanout[i - 1];
+
+	strbuf_addf(&path, "%s/pack/multi-pack-index", objdir);
+	hold_lock_file_for_update(&lock, path.buf, LOCK_DIE_ON_ERROR);
+	strbuf_release(&path);
+	f = sha1fd(lock.fd, lock.filename);
+
+	write_be32(f, MIDX_SIGNATURE);
+	write_be32(f, MIDX_VERSION);
+	write_be32(f, nr_packs);
+	write_be32(f, nr);
+	write_be32(f, nr_large);
+	write_be32(f, names_len);
+	for (i = 0; i < nr_packs; i++) {
+		int len = strlen(packs[i].name) + 1;
+		sha1write(f, packs[i].name, len);
+		names_len -= len;
+	}
+	while (names_len-- > 0)
+		sha1write(f, "", 1);
+	for (i = 0; i < 256; i++)
+		write_be32(f, fanout[i]);
+	for (i = 0; i < nr; i++)
+		sha1write(f, entries[i].sha1, 20);
+	for (i = 0, j = 0; i < nr; i++) {
+		write_be32(f, entries[i].pack_int_id);
+		if (entries[i].offset > 0x7fffffff)
+			write_be32(f, MIDX_LARGE_OFFSET | j++);
+		else
+			write_be32(f, entries[i].offset);
+	}
+	for (i = 0; i < nr; i++) {
+		uint64_t offset = entries[i].offset;
+		if (offset <= 0x7fffffff)
+			continue;
+		write_be32(f, (uint32_t)(offset >> 32));
+		write_be32(f, (uint32_t)offset);
+	}
+
+	sha1close(f, NULL, CSUM_FSYNC);
+	lock.fd = -1; /* closed by sha1close() */
+	if (commit_lock_file(&lock))
+		die_errno("unable to write multi-pack-index");
+
+	for (i = 0; i < nr_packs; i++)
+		free(packs[i].name);
+	free(packs);
+	free(entries);
+	return 0;
+}
+
+int verify_multi_pack_index(const char *objdir)
+{
+	struct multi_pack_index *m = load_multi_pack_index(objdir);
+	unsigned char sha1[20];
+	git_SHA_CTX ctx;
+	uint32_t i;
+	int errors = 0;
+
+	if (!m) {
+		struct strbuf path = STRBUF_INIT;
+		/* no multi-pack-index is fine, an unreadable one is not */
+		strbuf_addf(&path, "%s/pack/multi-pack-index", objdir);
+		errors = !access(path.buf, F_OK);
+		strbuf_release(&path);
+		return errors;
+	}
+
+	git_SHA1_Init(&ctx);
+	git_SHA1_Update(&ctx, m->data, m->data_len - 20);
+	git_SHA1_Final(sha1, &ctx);
+	if (hashcmp(sha1, m->data + m->data_len - 20))
+		errors += !!error("multi-pack-index has a bad checksum");
+
+	m->packs = xcalloc(m->num_packs, sizeof(*m->packs));
+	for (i = 0; i < m->num_packs; i++) {
+		if (i && strcmp(m->pack_names[i - 1], m->pack_names[i]) >= 0)
+			errors += !!error("multi-pack-index pack names are out of order");
+		m->packs[i] = add_midx_pack(objdir, m->pack_names[i]);
+		if (!m->packs[i] || open_pack_index(m->packs[i]))
+			errors += !!error("multi-pack-index covers missing pack %s",
+					  m->pack_names[i]);
+	}
+
+	for (i = 0; i < m->num_objects; i++) {
+		const unsigned char *oid = m->oids + (size_t)i * 20;
+		uint32_t pack_int_id = ntohl(m->entries[2 * i]);
+		struct packed_git *p;
+
+		if (i && hashcmp(oid - 20, oid) >= 0) {
+			errors += !!error("multi-pack-index object names are out of order at %s",
+					  sha1_to_hex(oid));
+			break;
+		}
+		if (ntohl(m->fanout[oid[0]]) <= i ||
+		    (oid[0] && ntohl(m->fanout[oid[0] - 1]) > i)) {
+			errors += !!error("multi-pack-index fan-out is wrong at %s",
+					  sha1_to_hex(oid));
+			break;
+		}
+		if (pack_int_id >= m->num_packs) {
+			errors += !!error("multi-pack-index has a bad pack for %s",
+					  sha1_to_hex(oid));
+			continue;
+		}
+		p = m->packs[pack_int_id];
+		if (p && p->index_data &&
+		    find_pack_entry_one(oid, p) != nth_midx_offset(m, i))
+			errors += !!error("multi-pack-index has the wrong offset for %s",
+					  sha1_to_hex(oid));
+	}
+
+	for (i = 0; i < m->num_packs; i++) {
+		if (!m->packs[i])
+			continue;
+		close_pack_index(m->packs[i]);
+		free(m->packs[i]);
+	}
+	free_multi_pack_index(m);
+	return errors;
+}
@@ -0,0 +1,89 @@
+#ifndef MIDX_H
+#define MIDX_H
+
+/*
+ * A multi-pack-index ("objects/pack/multi-pack-index") lists every
+ * object of a set of packs in one sorted table, so that an object can
+ * be found with a single binary search instead of one per pack.
+ *
+ * The on-disk format is:
+ *
+ *   - a header: 4-byte signature "MIDX", 4-byte version, 4-byte
+ *     number of packs P, 4-byte number of objects N, 4-byte number
+ *     of large offsets L and 4-byte length of the pack name block;
+ *
+ *   - the pack name block: the P names of the ".idx" files covered,
+ *     relative to the pack directory, sorted and NUL-terminated, and
+ *     padded with NULs to a multiple of four bytes;
+ *
+ *   - a 256-entry fan-out table; entry K is the number of objects
+ *     whose name begins with a byte less than or equal to K;
+ *
+ *   - the N 20-byte object names, sorted;
+ *
+ *   - N 8-byte entries in the same order: the 4-byte position of the
+ *     pack in the name block and the 4-byte offset of the object in
+ *     that pack.  If MIDX_LARGE_OFFSET is set in the offset, the rest
+ *     of it indexes the large offset table instead;
+ *
+ *   - the L 8-byte large offsets;
+ *
+ *   - a 20-byte SHA-1 checksum of all of the above.
+ *
+ * All integers are in network byte order.  An object found in more
+ * than one pack is listed once, for the most recently modified pack.
+ */
+#define MIDX_SIGNATURE 0x4d494458	/* "MIDX" */
+#define MIDX_VERSION 1
+#define MIDX_LARGE_OFFSET 0x80000000
+
+struct multi_pack_index {
+	const unsigned char *data;
+	size_t data_len;
+	uint32_t num_packs;
+	uint32_t num_objects;
+	uint32_t num_large_offsets;
+	const uint32_t *fanout;
+	const unsigned char *oids;
+	const uint32_t *entries;
+	const uint32_t *large_offsets;
+	const char **pack_names;
+	struct packed_git **packs;
+};
+
+/* The multi-pack-index of the repository's own pack directory, if any. */
+extern struct multi_pack_index *multi_pack_index;
+
+/*
+ * Load the multi-pack-index of "objdir" and install all of the packs
+ * it covers, marking them with "multi_pack_index".  The index is not
+ * used if any of those packs is missing.  Called again, as it is by
+ * reprepare_packed_git(), it replaces the index in use if the file
+ * has changed.
+ */
+extern void prepare_multi_pack_index(const char *objdir);
+
+/* Stop using the multi-pack-index, e.g. because one of its packs went away. */
+extern void close_multi_pack_index(void);
+
+/*
+ * Look up "sha1" in the multi-pack-index.  Returns 1 and fills in the
+ * pack and offset if it is there, 0 otherwise.
+ */
+extern int find_multi_pack_index_entry(const unsigned char *sha1,
+				       struct packed_git **pack, off_t *offset);
+
+/* Name of the n-th object in the multi-pack-index, or NULL. */
+extern const unsigned char *nth_multi_pack_index_sha1(struct multi_pack_index *m,
+						      uint32_t n);
+
+/*
+ * Write a multi-pack-index covering every pack in "objdir".
+ * Returns 0 on success.
+ */
+extern int write_multi_pack_index(const char *objdir);
+
+/* Returns the number of problems found in the multi-pack-index of "objdir". */
+extern int verify_multi_pack_index(const char *objdir);
+
+#endif
@@ -682,7 +682,10 @@ int notes_merge_commit(struct notes_merge_options *o,
 	struct dir_struct dir;
 	const char *path = git_path(NOTES_MERGE_WORKTREE "/");
 	int path_len = strlen(path), i;
-	const char *msg = strstr(partial_commit->buffer, "\n\n");
+	const char *msg;
+
+	load_commit_buffer(partial_commit);
+	msg = strstr(partial_commit->buffer, "\n\n");
 
 	OUTPUT(o, 3, "Committing notes in notes merge worktree at %.*s",
 	       path_len - 1, path);
@@ -5,8 +5,16 @@
 #include "commit.h"
 #include "tag.h"
 
+/*
+ * The objects are kept in an open-addressing hash table whose size is
+ * a power of two.  Next to each slot, obj_hash_tag holds 32 bits of
+ * the object name other than the ones that pick the slot, or 0 for an
+ * empty slot, so that probing rarely has to look at an object that is
+ * not the one we are after.
+ */
 static struct object **obj_hash;
-static int nr_objs, obj_hash_size;
+static uint32_t *obj_hash_tag;
+static unsigned int nr_objs, obj_hash_size;
 
 unsigned int get_max_object_index(void)
 {
@@ -43,69 +51,92 @@ int type_from_string(const char *str)
 	die("invalid object type \"%s\"", str);
 }
 
-static unsigned int hash_obj(struct object *obj, unsigned int n)
+static inline unsigned int hash_sha1(const unsigned char *sha1)
 {
 	unsigned int hash;
-	memcpy(&hash, obj->sha1, sizeof(unsigned int));
-	return hash % n;
+	memcpy(&hash, sha1, sizeof(unsigned int));
+	return hash;
 }
 
-static void insert_obj_hash(struct object *obj, struct object **hash, unsigned int size)
+static inline uint32_t tag_sha1(const unsigned char *sha1)
 {
-	unsigned int j = hash_obj(obj, size);
-
-	while (hash[j]) {
-		j++;
-		if (j >= size)
-			j = 0;
-	}
-	hash[j] = obj;
+	uint32_t tag;
+	memcpy(&tag, sha1 + 4, sizeof(tag));
+	return tag ? tag : 1;
 }
 
-static unsigned int hashtable_index(const unsigned char *sha1)
+static void insert_obj_hash(struct object *obj, struct object **hash,
+			    uint32_t *tags, unsigned int size)
 {
-	unsigned int i;
-	memcpy(&i, sha1, sizeof(unsigned int));
-	return i % obj_hash_size;
+	unsigned int j = hash_sha1(obj->sha1) & (size - 1);
+
+	while (tags[j])
+		j = (j + 1) & (size - 1);
+	hash[j] = obj;
+	tags[j] = tag_sha1(obj->sha1);
 }
 
 struct object *lookup_object(const unsigned char *sha1)
 {
-	unsigned int i;
-	struct object *obj;
+	unsigned int i, mask;
+	uint32_t tag;
 
 	if (!obj_hash)
 		return NULL;
 
-	i = hashtable_index(sha1);
-	while ((obj = obj_hash[i]) != NULL) {
-		if (!hashcmp(sha1, obj->sha1))
-			break;
-		i++;
-		if (i == obj_hash_size)
-			i = 0;
-	}
-	return obj;
+	mask = obj_hash_size - 1;
+	tag = tag_sha1(sha1);
+	for (i = hash_sha1(sha1) & mask; obj_hash_tag[i]; i = (i + 1) & mask)
+		if (obj_hash_tag[i] == tag && !hashcmp(sha1, obj_hash[i]->sha1))
+			return obj_hash[i];
+	return NULL;
 }
 
-static void grow_object_hash(void)
+static void resize_object_hash(unsigned int new_hash_size)
 {
-	int i;
-	int new_hash_size = obj_hash_size < 32 ? 32 : 2 * obj_hash_size;
+	unsigned int i;
 	struct object **new_hash;
+	uint32_t *new_tag;
 
 	new_hash = xcalloc(new_hash_size, sizeof(struct object *));
+	new_tag = xcalloc(new_hash_size, sizeof(uint32_t));
 	for (i = 0; i < obj_hash_size; i++) {
 		struct object *obj = obj_hash[i];
 		if (!obj)
 			continue;
-		insert_obj_hash(obj, new_hash, new_hash_size);
+		insert_obj_hash(obj, new_hash, new_tag, new_hash_size);
 	}
 	free(obj_hash);
+	free(obj_hash_tag);
 	obj_hash = new_hash;
+	obj_hash_tag = new_tag;
 	obj_hash_size = new_hash_size;
 }
 
+/* Keep the table at most half full */
+static unsigned int object_hash_size_for(unsigned int nr)
+{
+	unsigned int size = obj_hash_size < 32 ? 32 : obj_hash_size;
+
+	while (size - 1 <= nr * 2) {
+		if (size > UINT_MAX / 2)
+			die("object hash table too large for %u objects", nr);
+		size *= 2;
+	}
+	return size;
+}
+
+void reserve_object_hash(unsigned int nr)
+{
+	unsigned int size;
+
+	if (nr > UINT_MAX / 2 - nr_objs)
+		return;
+	size = object_hash_size_for(nr_objs + nr);
+	if (size != obj_hash_size)
+		resize_object_hash(size);
+}
+
 void *create_object(const unsigned char *sha1, int type, void *o)
 {
 	struct object *obj = o;
@@ -116,10 +147,10 @@ void *create_object(const unsigned char *sha1, int type, void *o)
 	obj->flags = 0;
 	hashcpy(obj->sha1, sha1);
 
-	if (obj_hash_size - 1 <= nr_objs * 2)
-		grow_object_hash();
+	if (!obj_hash_size || obj_hash_size - 1 <= nr_objs * 2)
+		resize_object_hash(object_hash_size_for(nr_objs + 1));
 
-	insert_obj_hash(obj, obj_hash, obj_hash_size);
+	insert_obj_hash(obj, obj_hash, obj_hash_tag, obj_hash_size);
 	nr_objs++;
 	return obj;
 }
@@ -54,6 +54,12 @@ struct object *lookup_object(const unsigned char *sha1);
 
 extern void *create_object(const unsigned char *sha1, int type, void *obj);
 
+/*
+ * Make room for "nr" more objects, to spare the rehashing as they are
+ * created when their number is known in advance.
+ */
+extern void reserve_object_hash(unsigned int nr);
+
 /** Returns the object, having parsed it to find out what it is. **/
 struct object *parse_object(const unsigned char *sha1);
 
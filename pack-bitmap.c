@@ -0,0 +1,644 @@
+#include "cache.h"
+#include "commit.h"
+#include "tag.h"
+#include "tree.h"
+#include "blob.h"
+#include "tree-walk.h"
+#include "diff.h"
+#include "revision.h"
+#include "decorate.h"
+#include "pack.h"
+#include "pack-revindex.h"
+#include "pack-bitmap.h"
+#include "csum-file.h"
+
+/*
+ * Pick a bitmap for every BITMAP_COMMIT_INTERVAL-th commit of the
+ * walk in addition to the tips, so that a walk from any commit in the
+ * pack reaches a bitmapped commit quickly.
+ */
+#define BITMAP_COMMIT_INTERVAL 100
+
+struct stored_bitmap {
+	struct commit *commit;
+	const unsigned char *data;	/* deflated */
+	unsigned long len;
+};
+
+struct bitmap_index {
+	/* reading: the pack the bitmaps describe */
+	struct packed_git *pack;
+	unsigned char *map;
+	size_t map_size;
+	const unsigned char *name_hashes, *types;	/* in pack order */
+
+	/* writing: the objects of the new pack, sorted by name */
+	struct pack_idx_entry **index;
+	uint32_t *positions;
+
+	uint32_t nr_objects;
+	unsigned long bitmap_size;	/* in bytes */
+	unsigned char *scratch;
+
+	struct decoration stored;
+	struct stored_bitmap **entries;
+	int nr_entries, alloc_entries;
+};
+
+static struct bitmap_index bitmap_git;
+static int bitmap_git_prepared;
+
+static inline int bitmap_get(const unsigned char *bits, uint32_t pos)
+{
+	return bits[pos >> 3] & (1 << (pos & 7));
+}
+
+static inline void bitmap_set(unsigned char *bits, uint32_t pos)
+{
+	bits[pos >> 3] |= (1 << (pos & 7));
+}
+
+static int sha1_pos(const void *index_, const unsigned char *sha1,
+		    uint32_t nr)
+{
+	struct pack_idx_entry **index = (struct pack_idx_entry **)index_;
+	uint32_t lo = 0, hi = nr;
+
+	while (lo < hi) {
+		uint32_t mi = lo + (hi - lo) / 2;
+		int cmp = hashcmp(sha1, index[mi]->sha1);
+		if (!cmp)
+			return mi;
+		if (cmp < 0)
+			hi = mi;
+		else
+			lo = mi + 1;
+	}
+	return -1;
+}
+
+/*
+ * Return the pack order position of the object, or -1 if the
+ * object is not in the pack the bitmaps describe.
+ */
+static int bitmap_position(struct bitmap_index *bi, const unsigned char *sha1)
+{
+	off_t offset;
+	int ix;
+
+	if (bi->index) {
+		ix = sha1_pos(bi->index, sha1, bi->nr_objects);
+		return ix < 0 ? -1 : bi->positions[ix];
+	}
+	offset = find_pack_entry_one(sha1, bi->pack);
+	if (!offset)
+		return -1;
+	return find_revindex_position(bi->pack, offset);
+}
+
+static int or_stored_bitmap(struct bitmap_index *bi, unsigned char *bits,
+			    struct stored_bitmap *st)
+{
+	git_zstream stream;
+	unsigned long i;
+	int status;
+
+	memset(&stream, 0, sizeof(stream));
+	stream.next_in = (unsigned char *)st->data;
+	stream.avail_in = st->len;
+	stream.next_out = bi->scratch;
+	stream.avail_out = bi->bitmap_size;
+	git_inflate_init(&stream);
+	status = git_inflate(&stream, Z_FINISH);
+	git_inflate_end(&stream);
+	if (status != Z_STREAM_END || stream.total_out != bi->bitmap_size)
+		return error("corrupt bitmap for commit %s",
+			     sha1_to_hex(st->commit->object.sha1));
+
+	for (i = 0; i < bi->bitmap_size; i++)
+		bits[i] |= bi->scratch[i];
+	return 0;
+}
+
+static void push_object(struct object ***stack, int *nr, int *alloc,
+			struct object *obj)
+{
+	ALLOC_GROW(*stack, *nr + 1, *alloc);
+	(*stack)[(*nr)++] = obj;
+}
+
+/*
+ * Set the bits of all objects reachable from "root" in "bits".  An
+ * object whose bit is already set is assumed to have had everything
+ * it reaches marked already, which holds both for the objects we walk
+ * here and for the contents of stored bitmaps.
+ */
+static int fill_bitmap(struct bitmap_index *bi, unsigned char *bits,
+		       struct object *root)
+{
+	struct object **stack = NULL;
+	int nr = 0, alloc = 0, ret = 0;
+
+	push_object(&stack, &nr, &alloc, root);
+	while (nr) {
+		struct object *obj = stack[--nr];
+		int pos;
+
+		if (obj->type == OBJ_NONE && !parse_object(obj->sha1)) {
+			ret = -1;
+			break;
+		}
+		pos = bitmap_position(bi, obj->sha1);
+		if (pos < 0) {
+			ret = -1;
+			break;
+		}
+		if (bitmap_get(bits, pos))
+			continue;
+
+		if (obj->type == OBJ_COMMIT) {
+			struct stored_bitmap *st;
+			st = lookup_decoration(&bi->stored, obj);
+			if (st) {
+				if (or_stored_bitmap(bi, bits, st)) {
+					ret = -1;
+					break;
+				}
+				continue;
+			}
+		}
+		bitmap_set(bits, pos);
+
+		switch (obj->type) {
+		case OBJ_COMMIT: {
+			struct commit *commit = (struct commit *)obj;
+			struct commit_list *parents;
+
+			if (parse_commit(commit)) {
+				ret = -1;
+				goto out;
+			}
+			/* parents are popped first; they may have bitmaps */
+			push_object(&stack, &nr, &alloc, &commit->tree->object);
+			for (parents = commit->parents; parents; parents = parents->next)
+				push_object(&stack, &nr, &alloc,
+					    &parents->item->object);
+			break;
+		}
+		case OBJ_TREE: {
+			struct tree_desc desc;
+			struct name_entry entry;
+			enum object_type type;
+			unsigned long size;
+			void *buf;
+
+			/*
+			 * Do not go through parse_tree(); the revision walk
+			 * may have left the tree marked parsed with its
+			 * buffer already freed.
+			 */
+			buf = read_sha1_file(obj->sha1, &type, &size);
+			if (!buf || type != OBJ_TREE) {
+				free(buf);
+				ret = -1;
+				goto out;
+			}
+			init_tree_desc(&desc, buf, size);
+			while (tree_entry(&desc, &entry)) {
+				if (S_ISGITLINK(entry.mode))
+					continue;
+				if (S_ISDIR(entry.mode))
+					push_object(&stack, &nr, &alloc,
+						    &lookup_tree(entry.sha1)->object);
+				else
+					push_object(&stack, &nr, &alloc,
+						    &lookup_blob(entry.sha1)->object);
+			}
+			free(buf);
+			break;
+		}
+		case OBJ_TAG: {
+			struct tag *tag = (struct tag *)obj;
+			if (parse_tag(tag) || !tag->tagged) {
+				ret = -1;
+				goto out;
+			}
+			push_object(&stack, &nr, &alloc, tag->tagged);
+			break;
+		}
+		case OBJ_BLOB:
+			break;
+		default:
+			ret = -1;
+			goto out;
+		}
+	}
+out:
+	free(stack);
+	return ret;
+}
+
+static void add_stored_bitmap(struct bitmap_index *bi, struct commit *commit,
+			      const unsigned char *data, unsigned long len)
+{
+	struct stored_bitmap *st = xmalloc(sizeof(*st));
+
+	st->commit = commit;
+	st->data = data;
+	st->len = len;
+	ALLOC_GROW(bi->entries, bi->nr_entries + 1, bi->alloc_entries);
+	bi->entries[bi->nr_entries++] = st;
+	add_decoration(&bi->stored, &commit->object, st);
+}
+
+static int load_bitmap_file(struct bitmap_index *bi, struct packed_git *p)
+{
+	struct bitmap_disk_header *hdr;
+	unsigned char sha1[20];
+	git_SHA_CTX ctx;
+	char *path;
+	struct stat st;
+	unsigned char *ptr, *end;
+	uint32_t i, nr;
+	int fd;
+
+	path = xstrdup(p->pack_name);
+	strcpy(path + strlen(path) - strlen(".pack"), ".bitmap");
+	fd = open(path, O_RDONLY);
+	free(path);
+	if (fd < 0)
+		return -1;
+	if (fstat(fd, &st) ||
+	    st.st_size < sizeof(*hdr) + 20) {
+		close(fd);
+		return -1;
+	}
+	if (load_pack_revindex(p)) {
+		close(fd);
+		return -1;
+	}
+
+	bi->map_size = xsize_t(st.st_size);
+	bi->map = xmmap(NULL, bi->map_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	hdr = (struct bitmap_disk_header *)bi->map;
+	if (ntohl(hdr->signature) != BITMAP_SIGNATURE ||
+	    ntohl(hdr->version) != BITMAP_VERSION) {
+		warning("ignoring bitmap index of unknown format for %s",
+			p->pack_name);
+		goto fail;
+	}
+	if (hashcmp(hdr->checksum, p->sha1)) {
+		warning("ignoring stale bitmap index for %s", p->pack_name);
+		goto fail;
+	}
+	git_SHA1_Init(&ctx);
+	git_SHA1_Update(&ctx, bi->map, bi->map_size - 20);
+	git_SHA1_Final(sha1, &ctx);
+	if (hashcmp(sha1, bi->map + bi->map_size - 20))
+		goto corrupt;
+
+	bi->pack = p;
+	bi->nr_objects = p->num_objects;
+	bi->bitmap_size = (p->num_objects + 7) / 8;
+
+	nr = ntohl(hdr->entry_count);
+	ptr = bi->map + sizeof(*hdr);
+	end = bi->map + bi->map_size - 20;
+	for (i = 0; i < nr; i++) {
+		struct commit *commit;
+		uint32_t len;
+
+		if (end - ptr < 24)
+			goto corrupt;
+		memcpy(&len, ptr + 20, 4);
+		len = ntohl(len);
+		if (end - ptr - 24 < len)
+			goto corrupt;
+		commit = lookup_commit(ptr);
+		if (commit)
+			add_stored_bitmap(bi, commit, ptr + 24, len);
+		ptr += 24 + len;
+	}
+	if ((size_t)(end - ptr) != (size_t)bi->nr_objects * 5)
+		goto corrupt;
+	bi->name_hashes = ptr;
+	bi->types = ptr + bi->nr_objects * 4;
+	for (i = 0; i < bi->nr_objects; i++)
+		if (bi->types[i] < OBJ_COMMIT || bi->types[i] > OBJ_TAG)
+			goto corrupt;
+	bi->scratch = xmalloc(bi->bitmap_size);
+	return 0;
+
+corrupt:
+	warning("corrupt bitmap index for %s", p->pack_name);
+fail:
+	munmap(bi->map, bi->map_size);
+	for (i = 0; i < bi->nr_entries; i++)
+		free(bi->entries[i]);
+	free(bi->entries);
+	free(bi->stored.hash);
+	memset(bi, 0, sizeof(*bi));
+	return -1;
+}
+
+int prepare_bitmap_git(void)
+{
+	struct packed_git *p;
+
+	if (bitmap_git_prepared)
+		return bitmap_git.pack ? 0 : -1;
+	bitmap_git_prepared = 1;
+
+	prepare_packed_git();
+	for (p = packed_git; p; p = p->next) {
+		if (!p->pack_local)
+			continue;
+		if (!load_bitmap_file(&bitmap_git, p))
+			return 0;
+	}
+	return -1;
+}
+
+static int can_use_bitmaps(struct rev_info *revs)
+{
+	return (revs->tag_objects && revs->tree_objects && revs->blob_objects &&
+		!revs->prune_data.nr && !revs->reflog_info &&
+		!revs->unpacked && !revs->no_walk &&
+		revs->max_count < 0 && revs->skip_count <= 0 &&
+		revs->max_age == -1 && revs->min_age == -1 &&
+		!revs->min_parents && revs->max_parents < 0 &&
+		!revs->left_only && !revs->right_only &&
+		!revs->grep_filter.pattern_list &&
+		!revs->grep_filter.header_list);
+}
+
+/*
+ * How many of the objects at the start of the pack are wanted, if
+ * they are all the objects of the pack that are wanted, and could go
+ * out as they are; see struct bitmap_reuse.
+ */
+static uint32_t reusable_objects(struct bitmap_index *bi,
+				 const unsigned char *wants,
+				 const unsigned char *haves,
+				 struct bitmap_reuse *reuse)
+{
+	struct pack_window *w_curs = NULL;
+	uint32_t i, nr, nr_deltas = 0;
+
+	for (nr = 0; nr < bi->nr_objects; nr++)
+		if (!bitmap_get(wants, nr) || bitmap_get(haves, nr))
+			break;
+	if (!nr)
+		return 0;
+	for (i = nr; i < bi->nr_objects; i++)
+		if (bitmap_get(wants, i) && !bitmap_get(haves, i))
+			return 0;
+
+	for (i = 0; i < nr; i++) {
+		off_t offset = pack_pos_to_offset(bi->pack, i);
+		unsigned long size;
+		int base;
+
+		switch (unpack_object_header(bi->pack, &w_curs, &offset, &size)) {
+		case OBJ_OFS_DELTA:
+			/* The base comes earlier in the pack, so it is sent */
+			if (!reuse->allow_ofs_delta)
+				nr = 0;
+			nr_deltas++;
+			break;
+		case OBJ_REF_DELTA:
+			base = bitmap_position(bi, use_pack(bi->pack, &w_curs,
+							    offset, NULL));
+			if (base < 0 || nr <= base)
+				nr = 0;
+			nr_deltas++;
+			break;
+		}
+	}
+	unuse_pack(&w_curs);
+
+	if (nr) {
+		reuse->pack = bi->pack;
+		reuse->nr_objects = nr;
+		reuse->nr_deltas = nr_deltas;
+		reuse->end = pack_pos_to_offset(bi->pack, nr);
+	}
+	return nr;
+}
+
+int traverse_bitmap_commit_list(struct rev_info *revs, show_reachable_fn show,
+				struct bitmap_reuse *reuse)
+{
+	struct bitmap_index *bi = &bitmap_git;
+	unsigned char *wants, *haves;
+	uint32_t i;
+	int ret = -1;
+
+	if (!can_use_bitmaps(revs) || prepare_bitmap_git())
+		return -1;
+
+	wants = xcalloc(1, bi->bitmap_size);
+	haves = xcalloc(1, bi->bitmap_size);
+	for (i = 0; i < revs->pending.nr; i++) {
+		struct object *obj = revs->pending.objects[i].item;
+		unsigned char *bits;
+
+		bits = (obj->flags & UNINTERESTING) ? haves : wants;
+		if (fill_bitmap(bi, bits, obj))
+			goto out;
+	}
+
+	i = reuse ? reusable_objects(bi, wants, haves, reuse) : 0;
+	for (; i < bi->nr_objects; i++) {
+		const unsigned char *sha1;
+		uint32_t name_hash;
+
+		if (!bitmap_get(wants, i) || bitmap_get(haves, i))
+			continue;
+		sha1 = nth_packed_object_sha1(bi->pack,
+					      pack_pos_to_index(bi->pack, i));
+		memcpy(&name_hash, bi->name_hashes + i * 4, 4);
+		show(sha1, bi->types[i], ntohl(name_hash),
+		     bi->pack, pack_pos_to_offset(bi->pack, i));
+	}
+	ret = 0;
+out:
+	free(wants);
+	free(haves);
+	return ret;
+}
+
+static int offset_cmp(const void *a_, const void *b_)
+{
+	const struct pack_idx_entry *a = *(const struct pack_idx_entry **)a_;
+	const struct pack_idx_entry *b = *(const struct pack_idx_entry **)b_;
+
+	return a->offset < b->offset ? -1 : a->offset > b->offset;
+}
+
+static int stored_bitmap_cmp(const void *a_, const void *b_)
+{
+	const struct stored_bitmap *a = *(const struct stored_bitmap **)a_;
+	const struct stored_bitmap *b = *(const struct stored_bitmap **)b_;
+
+	return hashcmp(a->commit->object.sha1, b->commit->object.sha1);
+}
+
+static unsigned char *deflate_bitmap(unsigned char *bits, unsigned long size,
+				     unsigned long *len)
+{
+	git_zstream stream;
+	unsigned long maxsize;
+	unsigned char *out;
+
+	memset(&stream, 0, sizeof(stream));
+	git_deflate_init(&stream, Z_BEST_SPEED);
+	maxsize = git_deflate_bound(&stream, size);
+	out = xmalloc(maxsize);
+	stream.next_in = bits;
+	stream.avail_in = size;
+	stream.next_out = out;
+	stream.avail_out = maxsize;
+	while (git_deflate(&stream, Z_FINISH) == Z_OK)
+		; /* nothing */
+	git_deflate_end(&stream);
+	*len = stream.total_out;
+	return xrealloc(out, *len);
+}
+
+static void compute_positions(struct bitmap_index *bi)
+{
+	struct pack_idx_entry **by_offset;
+	uint32_t i;
+
+	by_offset = xmalloc(bi->nr_objects * sizeof(*by_offset));
+	memcpy(by_offset, bi->index, bi->nr_objects * sizeof(*by_offset));
+	qsort(by_offset, bi->nr_objects, sizeof(*by_offset), offset_cmp);
+
+	bi->positions = xmalloc(bi->nr_objects * sizeof(*bi->positions));
+	for (i = 0; i < bi->nr_objects; i++) {
+		int ix = sha1_pos(bi->index, by_offset[i]->sha1, bi->nr_objects);
+		bi->positions[ix] = i;
+	}
+	free(by_offset);
+}
+
+static void free_bitmap_writer(struct bitmap_index *bi)
+{
+	int i;
+
+	for (i = 0; i < bi->nr_entries; i++) {
+		free((void *)bi->entries[i]->data);
+		free(bi->entries[i]);
+	}
+	free(bi->entries);
+	free(bi->positions);
+	free(bi->scratch);
+	free(bi->stored.hash);
+}
+
+static void mark_parents(struct commit **commits, unsigned int nr, int set)
+{
+	unsigned int i;
+
+	for (i = 0; i < nr; i++) {
+		struct commit_list *p;
+		for (p = commits[i]->parents; p; p = p->next) {
+			if (set)
+				p->item->object.flags |= TMP_MARK;
+			else
+				p->item->object.flags &= ~TMP_MARK;
+		}
+	}
+}
+
+const char *write_bitmap_file(struct pack_idx_entry **index,
+			      const uint32_t *name_hashes,
+			      const unsigned char *types,
+			      uint32_t nr_objects,
+			      const unsigned char *pack_sha1,
+			      struct commit **commits,
+			      unsigned int nr_commits)
+{
+	struct bitmap_index bi;
+	struct bitmap_disk_header hdr;
+	struct sha1file *f;
+	unsigned char *bits, *pack_types;
+	uint32_t *pack_hashes;
+	char tmpname[PATH_MAX];
+	unsigned int i;
+	int fd;
+
+	memset(&bi, 0, sizeof(bi));
+	bi.index = index;
+	bi.nr_objects = nr_objects;
+	bi.bitmap_size = (nr_objects + 7) / 8;
+	bi.scratch = xmalloc(bi.bitmap_size);
+	compute_positions(&bi);
+
+	/* Tips of the history are the commits nobody names as a parent */
+	mark_parents(commits, nr_commits, 1);
+
+	/*
+	 * Older commits come later in the walk; compute their bitmaps
+	 * first so that younger ones can build on them.
+	 */
+	bits = xmalloc(bi.bitmap_size);
+	for (i = nr_commits; i-- > 0; ) {
+		struct commit *commit = commits[i];
+		unsigned char *data;
+		unsigned long len;
+
+		if ((commit->object.flags & TMP_MARK) &&
+		    i % BITMAP_COMMIT_INTERVAL)
+			continue;
+		memset(bits, 0, bi.bitmap_size);
+		if (fill_bitmap(&bi, bits, &commit->object)) {
+			warning("not writing bitmap index: %s reaches objects "
+				"outside of the pack",
+				sha1_to_hex(commit->object.sha1));
+			free(bits);
+			mark_parents(commits, nr_commits, 0);
+			free_bitmap_writer(&bi);
+			return NULL;
+		}
+		data = deflate_bitmap(bits, bi.bitmap_size, &len);
+		add_stored_bitmap(&bi, commit, data, len);
+	}
+	free(bits);
+	mark_parents(commits, nr_commits, 0);
+
+	qsort(bi.entries, bi.nr_entries, sizeof(*bi.entries), stored_bitmap_cmp);
+
+	fd = odb_mkstemp(tmpname, sizeof(tmpname), "pack/tmp_bitmap_XXXXXX");
+	f = sha1fd(fd, tmpname);
+	hdr.signature = htonl(BITMAP_SIGNATURE);
+	hdr.version = htonl(BITMAP_VERSION);
+	hdr.entry_count = htonl(bi.nr_entries);
+	hashcpy(hdr.checksum, pack_sha1);
+	sha1write(f, &hdr, sizeof(hdr));
+	for (i = 0; i < bi.nr_entries; i++) {
+		struct stored_bitmap *st = bi.entries[i];
+		uint32_t len = htonl(st->len);
+		sha1write(f, st->commit->object.sha1, 20);
+		sha1write(f, &len, 4);
+		sha1write(f, (void *)st->data, st->len);
+	}
+
+	pack_hashes = xmalloc(nr_objects * sizeof(*pack_hashes));
+	pack_types = xmalloc(nr_objects);
+	for (i = 0; i < nr_objects; i++) {
+		pack_hashes[bi.positions[i]] = htonl(name_hashes[i]);
+		pack_types[bi.positions[i]] = types[i];
+	}
+	sha1write(f, pack_hashes, nr_objects * sizeof(*pack_hashes));
+	sha1write(f, pack_types, nr_objects);
+	free(pack_hashes);
+	free(pack_types);
+	sha1close(f, NULL, CSUM_FSYNC);
+
+	free_bitmap_writer(&bi);
+	return xstrdup(tmpname);
+}
@@ -0,0 +1,108 @@
+#ifndef PACK_BITMAP_H
+#define PACK_BITMAP_H
+
+/*
+ * A reachability bitmap index ("pack-*.bitmap") accompanies a pack and
+ * records, for a selection of the commits in the pack, the set of
+ * objects reachable from each of them.  Bit N of a bitmap stands for
+ * the N-th object of the pack in pack (offset) order.
+ *
+ * The on-disk format is:
+ *
+ *   - a header: 4-byte signature "BITM", 4-byte version, 4-byte
+ *     number of entries, and the 20-byte SHA-1 of the pack the
+ *     bitmaps describe;
+ *
+ *   - for each entry, sorted by commit name: the 20-byte commit
+ *     name, the 4-byte length of the compressed bitmap, and the
+ *     bitmap itself, deflated with zlib;
+ *
+ *   - for each object in pack order, the 4-byte hash of the path it
+ *     was packed under (the name hash pack-objects sorts delta
+ *     candidates by), or 0 if it had none;
+ *
+ *   - for each object in pack order, a byte holding its type;
+ *
+ *   - a 20-byte SHA-1 checksum of all of the above.
+ *
+ * All integers are in network byte order.
+ */
+#define BITMAP_SIGNATURE 0x4249544d	/* "BITM" */
+#define BITMAP_VERSION 2
+
+struct bitmap_disk_header {
+	uint32_t signature;
+	uint32_t version;
+	uint32_t entry_count;
+	unsigned char checksum[20];
+};
+
+struct rev_info;
+struct commit;
+struct pack_idx_entry;
+
+typedef void (*show_reachable_fn)(const unsigned char *sha1,
+				  enum object_type type,
+				  uint32_t name_hash,
+				  struct packed_git *found_pack,
+				  off_t found_offset);
+
+/*
+ * Load the bitmap index of the first local pack that has one.
+ * Returns 0 on success, -1 if no usable bitmap index exists.
+ */
+extern int prepare_bitmap_git(void);
+
+/*
+ * When all the objects a traversal wants from the bitmapped pack are
+ * the ones at its start, from the first up to some offset, they can be
+ * copied into a new pack as they are, right after its header: the
+ * offsets of OFS_DELTA bases are the same there.  That is only done if
+ * the base of each REF_DELTA among them is among them too, and if
+ * "allow_ofs_delta" is set when any of them is an OFS_DELTA.
+ */
+struct bitmap_reuse {
+	int allow_ofs_delta;
+
+	/* set when the objects can be reused */
+	struct packed_git *pack;
+	uint32_t nr_objects, nr_deltas;
+	off_t end;
+};
+
+/*
+ * Enumerate the objects reachable from the interesting pending
+ * objects of "revs" but not from the uninteresting ones, using the
+ * bitmap index instead of a revision walk, and feed them to "show"
+ * in pack order, along with their types, name hashes and places in
+ * the bitmapped pack.  Returns -1 without calling "show" if the request
+ * cannot be answered from the bitmaps; the caller is expected to
+ * fall back to traverse_commit_list() in that case.
+ *
+ * If "reuse" is given and the objects wanted from the start of the
+ * pack can be reused as described above, they are not fed to "show"
+ * but reported in "reuse".
+ */
+extern int traverse_bitmap_commit_list(struct rev_info *revs,
+				       show_reachable_fn show,
+				       struct bitmap_reuse *reuse);
+
+/*
+ * Write a bitmap index for the pack whose objects are described by
+ * "index" (sorted by object name, with offsets in the new pack), whose
+ * name hashes and types are in "name_hashes" and "types" in the same
+ * order, selecting bitmap commits among "commits" (in revision walk
+ * order).
+ * Returns the name of a temporary file the caller should rename next
+ * to the pack, or NULL if some object reachable from a selected
+ * commit is not in the pack.
+ */
+extern const char *write_bitmap_file(struct pack_idx_entry **index,
+				     const uint32_t *name_hashes,
+				     const unsigned char *types,
+				     uint32_t nr_objects,
+				     const unsigned char *pack_sha1,
+				     struct commit **commits,
+				     unsigned int nr_commits);
+
+#endif
@@ -1,4 +1,5 @@
 #include "cache.h"
+#include "pack.h"
 #include "pack-revindex.h"
 
 /*
@@ -8,57 +9,19 @@
  * size is easily available by examining the pack entry header).  It is
  * also rather expensive to find the sha1 for an object given its offset.
  *
- * We build a hashtable of existing packs (pack_revindex), and keep reverse
- * index here -- pack index file is sorted by object name mapping to offset;
- * this pack_revindex[].revindex array is a list of offset/index_nr pairs
- * ordered by offset, so if you know the offset of an object, next offset
- * is where its packed representation ends and the index_nr can be used to
- * get the object sha1 from the main index.
+ * The reverse index of a pack lists its objects ordered by offset, so if
+ * you know the offset of an object, next offset is where its packed
+ * representation ends and its index_nr can be used to get the object
+ * sha1 from the main index.  It is read from the "pack-*.rev" file next
+ * to the pack when there is one, and otherwise built in core from the
+ * offsets in the main index, as a list of offset/index_nr pairs.
  */
 
-struct pack_revindex {
-	struct packed_git *p;
-	struct revindex_entry *revindex;
+struct revindex_entry {
+	off_t offset;
+	unsigned int nr;
 };
 
-static struct pack_revindex *pack_revindex;
-static int pack_revindex_hashsz;
-
-static int pack_revindex_ix(struct packed_git *p)
-{
-	unsigned long ui = (unsigned long)p;
-	int i;
-
-	ui = ui ^ (ui >> 16); /* defeat structure alignment */
-	i = (int)(ui % pack_revindex_hashsz);
-	while (pack_revindex[i].p) {
-		if (pack_revindex[i].p == p)
-			return i;
-		if (++i == pack_revindex_hashsz)
-			i = 0;
-	}
-	return -1 - i;
-}
-
-static void init_pack_revindex(void)
-{
-	int num;
-	struct packed_git *p;
-
-	for (num = 0, p = packed_git; p; p = p->next)
-		num++;
-	if (!num)
-		return;
-	pack_revindex_hashsz = num * 11;
-	pack_revindex = xcalloc(sizeof(*pack_revindex), pack_revindex_hashsz);
-	for (p = packed_git; p; p = p->next) {
-		num = pack_revindex_ix(p);
-		num = - 1 - num;
-		pack_revindex[num].p = p;
-	}
-	/* revindex elements are lazily initialized */
-}
-
 static int cmp_offset(const void *a_, const void *b_)
 {
 	const struct revindex_entry *a = a_;
@@ -69,14 +32,13 @@ static int cmp_offset(const void *a_, const void *b_)
 /*
  * Ordered list of offsets of objects in the pack.
  */
-static void create_pack_revindex(struct pack_revindex *rix)
+static void create_pack_revindex(struct packed_git *p)
 {
-	struct packed_git *p = rix->p;
 	int num_ent = p->num_objects;
 	int i;
 	const char *index = p->index_data;
 
-	rix->revindex = xmalloc(sizeof(*rix->revindex) * (num_ent + 1));
+	p->revindex = xmalloc(sizeof(*p->revindex) * (num_ent + 1));
 	index += 4 * 256;
 
 	if (p->index_version > 1) {
@@ -86,71 +48,147 @@ static void create_pack_revindex(struct pack_revindex *rix)
 		for (i = 0; i < num_ent; i++) {
 			uint32_t off = ntohl(*off_32++);
 			if (!(off & 0x80000000)) {
-				rix->revindex[i].offset = off;
+				p->revindex[i].offset = off;
 			} else {
-				rix->revindex[i].offset =
+				p->revindex[i].offset =
 					((uint64_t)ntohl(*off_64++)) << 32;
-				rix->revindex[i].offset |=
+				p->revindex[i].offset |=
 					ntohl(*off_64++);
 			}
-			rix->revindex[i].nr = i;
+			p->revindex[i].nr = i;
 		}
 	} else {
 		for (i = 0; i < num_ent; i++) {
 			uint32_t hl = *((uint32_t *)(index + 24 * i));
-			rix->revindex[i].offset = ntohl(hl);
-			rix->revindex[i].nr = i;
+			p->revindex[i].offset = ntohl(hl);
+			p->revindex[i].nr = i;
 		}
 	}
 
 	/* This knows the pack format -- the 20-byte trailer
 	 * follows immediately after the last object data.
 	 */
-	rix->revindex[num_ent].offset = p->pack_size - 20;
-	rix->revindex[num_ent].nr = -1;
-	qsort(rix->revindex, num_ent, sizeof(*rix->revindex), cmp_offset);
+	p->revindex[num_ent].offset = p->pack_size - 20;
+	p->revindex[num_ent].nr = -1;
+	qsort(p->revindex, num_ent, sizeof(*p->revindex), cmp_offset);
 }
 
-struct revindex_entry *find_pack_revindex(struct packed_git *p, off_t ofs)
+static int open_pack_rev_file(struct packed_git *p)
 {
-	int num;
-	int lo, hi;
-	struct pack_revindex *rix;
-	struct revindex_entry *revindex;
+	const struct pack_rev_header *hdr;
+	char *rev_name;
+	struct stat st;
+	size_t size;
+	void *map;
+	int fd;
+
+	rev_name = xstrdup(p->pack_name);
+	strcpy(rev_name + strlen(rev_name) - strlen(".pack"), ".rev");
+	fd = open(rev_name, O_RDONLY);
+	free(rev_name);
+	if (fd < 0)
+		return -1;
+	if (fstat(fd, &st)) {
+		close(fd);
+		return -1;
+	}
+	size = xsize_t(st.st_size);
+	if (size != sizeof(*hdr) + (size_t)p->num_objects * 4 + 40) {
+		close(fd);
+		warning("ignoring reverse index of the wrong size for %s",
+			p->pack_name);
+		return -1;
+	}
+	map = xmmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	hdr = map;
+	if (ntohl(hdr->signature) != PACK_REV_SIGNATURE ||
+	    ntohl(hdr->version) != PACK_REV_VERSION) {
+		warning("ignoring reverse index of unknown format for %s",
+			p->pack_name);
+		goto fail;
+	}
+	if (hashcmp((const unsigned char *)map + size - 40,
+		    (const unsigned char *)p->index_data + p->index_size - 40)) {
+		warning("ignoring stale reverse index for %s", p->pack_name);
+		goto fail;
+	}
+	p->revindex_data = map;
+	p->revindex_size = size;
+	p->revindex_map = (const uint32_t *)(hdr + 1);
+	return 0;
+
+fail:
+	munmap(map, size);
+	return -1;
+}
+
+int load_pack_revindex(struct packed_git *p)
+{
+	if (p->revindex || p->revindex_map)
+		return 0;
+	if (open_pack_index(p))
+		return -1;
+	if (open_pack_rev_file(p))
+		create_pack_revindex(p);
+	return 0;
+}
+
+uint32_t pack_pos_to_index(struct packed_git *p, uint32_t pos)
+{
+	if (p->revindex_map)
+		return ntohl(p->revindex_map[pos]);
+	return p->revindex[pos].nr;
+}
+
+off_t pack_pos_to_offset(struct packed_git *p, uint32_t pos)
+{
+	if (!p->revindex_map)
+		return p->revindex[pos].offset;
+	if (pos == p->num_objects)
+		return p->pack_size - 20;
+	return nth_packed_object_offset(p, ntohl(p->revindex_map[pos]));
+}
 
-	if (!pack_revindex_hashsz)
-		init_pack_revindex();
-	num = pack_revindex_ix(p);
-	if (num < 0)
-		die("internal error: pack revindex fubar");
+int find_revindex_position(struct packed_git *p, off_t ofs)
+{
+	int lo, hi;
 
-	rix = &pack_revindex[num];
-	if (!rix->revindex)
-		create_pack_revindex(rix);
-	revindex = rix->revindex;
+	if (load_pack_revindex(p))
+		return -1;
 
 	lo = 0;
 	hi = p->num_objects + 1;
 	do {
 		int mi = (lo + hi) / 2;
-		if (revindex[mi].offset == ofs) {
-			return revindex + mi;
-		} else if (ofs < revindex[mi].offset)
+		off_t mi_ofs = pack_pos_to_offset(p, mi);
+		if (mi_ofs == ofs) {
+			return mi;
+		} else if (ofs < mi_ofs)
 			hi = mi;
 		else
 			lo = mi + 1;
 	} while (lo < hi);
-	error("bad offset for revindex");
-	return NULL;
+	return -1;
+}
+
+int find_pack_revindex(struct packed_git *p, off_t ofs)
+{
+	int pos = find_revindex_position(p, ofs);
+
+	if (pos < 0)
+		error("bad offset for revindex");
+	return pos;
 }
 
-void discard_revindex(void)
+void free_pack_revindex(struct packed_git *p)
 {
-	if (pack_revindex_hashsz) {
-		int i;
-		for (i = 0; i < pack_revindex_hashsz; i++)
-			free(pack_revindex[i].revindex);
-		free(pack_revindex);
-		pack_revindex_hashsz = 0;
+	free(p->revindex);
+	p->revindex = NULL;
+	if (p->revindex_data) {
+		munmap((void *)p->revindex_data, p->revindex_size);
+		p->revindex_data = NULL;
+		p->revindex_map = NULL;
 	}
 }
@@ -1,12 +1,28 @@
 #ifndef PACK_REVINDEX_H
 #define PACK_REVINDEX_H
 
-struct revindex_entry {
-	off_t offset;
-	unsigned int nr;
-};
+/*
+ * The reverse index of a pack orders its p->num_objects objects by
+ * offset; the position of an object in that order is its "pack order"
+ * position.  Position p->num_objects stands for the pack trailer.
+ *
+ * load_pack_revindex() prepares it and returns -1 if the index of the
+ * pack cannot be opened; the other functions load it as needed, except
+ * pack_pos_to_index() and pack_pos_to_offset(), which expect it to be
+ * loaded already.
+ */
+int load_pack_revindex(struct packed_git *p);
+uint32_t pack_pos_to_index(struct packed_git *p, uint32_t pos);
+off_t pack_pos_to_offset(struct packed_git *p, uint32_t pos);
 
-struct revindex_entry *find_pack_revindex(struct packed_git *p, off_t ofs);
-void discard_revindex(void);
+/*
+ * Return the pack order position of the object at "ofs", or -1 if no
+ * object starts there; find_pack_revindex() also reports an error in
+ * that case.
+ */
+int find_revindex_position(struct packed_git *p, off_t ofs);
+int find_pack_revindex(struct packed_git *p, off_t ofs);
+
+void free_pack_revindex(struct packed_git *p);
 
 #endif
@@ -178,6 +178,133 @@ const char *write_idx_file(const char *index_name, struct pack_idx_entry **objec
 	return index_name;
 }
 
+static const struct pack_idx_entry **rev_objects;
+
+static int rev_position_cmp(const void *a_, const void *b_)
+{
+	off_t a = rev_objects[*(const uint32_t *)a_]->offset;
+	off_t b = rev_objects[*(const uint32_t *)b_]->offset;
+
+	return (a < b) ? -1 : (a != b);
+}
+
+const char *write_rev_file(const char *rev_name,
+			   struct pack_idx_entry **objects,
+			   uint32_t nr_objects,
+			   const unsigned char *pack_sha1)
+{
+	struct pack_rev_header hdr;
+	struct sha1file *f;
+	uint32_t *pack_order, i;
+	int fd;
+
+	pack_order = xmalloc(nr_objects * sizeof(*pack_order));
+	for (i = 0; i < nr_objects; i++)
+		pack_order[i] = i;
+	rev_objects = (const struct pack_idx_entry **)objects;
+	qsort(pack_order, nr_objects, sizeof(*pack_order), rev_position_cmp);
+	rev_objects = NULL;
+
+	if (!rev_name) {
+		static char tmpfile[PATH_MAX];
+		fd = odb_mkstemp(tmpfile, sizeof(tmpfile), "pack/tmp_rev_XXXXXX");
+		rev_name = xstrdup(tmpfile);
+	} else {
+		unlink(rev_name);
+		fd = open(rev_name, O_CREAT|O_EXCL|O_WRONLY, 0600);
+	}
+	if (fd < 0)
+		die_errno("unable to create '%s'", rev_name);
+	f = sha1fd(fd, rev_name);
+
+	hdr.signature = htonl(PACK_REV_SIGNATURE);
+	hdr.version = htonl(PACK_REV_VERSION);
+	sha1write(f, &hdr, sizeof(hdr));
+	for (i = 0; i < nr_objects; i++) {
+		uint32_t nr = htonl(pack_order[i]);
+		sha1write(f, &nr, 4);
+	}
+	sha1write(f, (void *)pack_sha1, 20);
+	sha1close(f, NULL, CSUM_FSYNC);
+
+	free(pack_order);
+	return rev_name;
+}
+
+static int sizes_entry_cmp(const void *a_, const void *b_)
+{
+	const struct pack_sizes_entry *a = a_;
+	const struct pack_sizes_entry *b = b_;
+
+	return hashcmp(a->sha1, b->sha1);
+}
+
+const char *write_sizes_file(const char *sizes_name,
+			     struct pack_sizes_entry *objects,
+			     uint32_t nr_objects,
+			     const unsigned char *pack_sha1)
+{
+	struct pack_sizes_header hdr;
+	struct sha1file *f;
+	uint32_t i, nr_large = 0;
+	int fd;
+
+	qsort(objects, nr_objects, sizeof(*objects), sizes_entry_cmp);
+
+	if (!sizes_name) {
+		static char tmpfile[PATH_MAX];
+		fd = odb_mkstemp(tmpfile, sizeof(tmpfile), "pack/tmp_sizes_XXXXXX");
+		sizes_name = xstrdup(tmpfile);
+	} else {
+		unlink(sizes_name);
+		fd = open(sizes_name, O_CREAT|O_EXCL|O_WRONLY, 0600);
+	}
+	if (fd < 0)
+		die_errno("unable to create '%s'", sizes_name);
+	f = sha1fd(fd, sizes_name);
+
+	for (i = 0; i < nr_objects; i++)
+		if (objects[i].size & ~(unsigned long)0x7fffffff)
+			nr_large++;
+
+	hdr.signature = htonl(PACK_SIZES_SIGNATURE);
+	hdr.version = htonl(PACK_SIZES_VERSION);
+	hdr.nr_objects = htonl(nr_objects);
+	hdr.nr_large = htonl(nr_large);
+	hashcpy(hdr.checksum, pack_sha1);
+	sha1write(f, &hdr, sizeof(hdr));
+
+	nr_large = 0;
+	for (i = 0; i < nr_objects; i++) {
+		uint32_t size = objects[i].size;
+
+		if (objects[i].size & ~(unsigned long)0x7fffffff)
+			size = 0x80000000 | nr_large++;
+		size = htonl(size);
+		sha1write(f, &size, 4);
+	}
+
+	for (i = 0; nr_large; i++) {
+		uint64_t size = objects[i].size;
+		uint32_t split[2];
+
+		if (!(size & ~(uint64_t)0x7fffffff))
+			continue;
+		split[0] = htonl(size >> 32);
+		split[1] = htonl(size & 0xffffffff);
+		sha1write(f, split, 8);
+		nr_large--;
+	}
+
+	for (i = 0; i < nr_objects; i++) {
+		unsigned char type = objects[i].type;
+		sha1write(f, &type, 1);
+	}
+
+	sha1close(f, NULL, CSUM_FSYNC);
+	return sizes_name;
+}
+
 /*
  * Update pack header with object_count and compute new SHA1 for pack data
  * associated to pack_fd, and write that SHA1 at the end.  That new SHA1
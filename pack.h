@@ -71,6 +71,90 @@ struct pack_idx_entry {
 };
 
 extern const char *write_idx_file(const char *index_name, struct pack_idx_entry **objects, int nr_objects, const struct pack_idx_option *, unsigned char *sha1);
+
+/*
+ * A pack sizes file ("pack-*.sizes") records the type and the size of
+ * each object of a pack once the deltas are resolved, so that they
+ * can be looked up without walking the delta chains.
+ *
+ * The on-disk format is:
+ *
+ *   - a header: 4-byte signature "PSIZ", 4-byte version, 4-byte
+ *     number of objects, 4-byte number of large sizes, and the
+ *     20-byte SHA-1 checksum of the pack the file describes;
+ *
+ *   - for each object in the order of the pack index (sorted by
+ *     object name), its 4-byte size, or, when the size does not fit
+ *     in 31 bits, the index of its entry in the large size table with
+ *     the most significant bit set;
+ *
+ *   - the large size table, 8 bytes per entry;
+ *
+ *   - for each object in pack index order, a byte holding its type;
+ *
+ *   - a 20-byte SHA-1 checksum of all of the above.
+ *
+ * All integers are in network byte order.
+ */
+#define PACK_SIZES_SIGNATURE 0x5053495a	/* "PSIZ" */
+#define PACK_SIZES_VERSION 1
+
+struct pack_sizes_header {
+	uint32_t signature;
+	uint32_t version;
+	uint32_t nr_objects;
+	uint32_t nr_large;
+	unsigned char checksum[20];
+};
+
+struct pack_sizes_entry {
+	unsigned char sha1[20];
+	unsigned long size;
+	enum object_type type;
+};
+
+/*
+ * A reverse index file ("pack-*.rev") lists the objects of a pack in
+ * pack (offset) order, so that the reverse index does not have to be
+ * computed by sorting the offsets of the .idx each time the pack is
+ * used.
+ *
+ * The on-disk format is:
+ *
+ *   - a header: 4-byte signature "RIDX" and 4-byte version;
+ *
+ *   - for each object in pack order, the 4-byte position of its
+ *     entry in the .idx;
+ *
+ *   - the 20-byte SHA-1 checksum of the pack the file describes;
+ *
+ *   - a 20-byte SHA-1 checksum of all of the above.
+ *
+ * All integers are in network byte order.
+ */
+#define PACK_REV_SIGNATURE 0x52494458	/* "RIDX" */
+#define PACK_REV_VERSION 1
+
+struct pack_rev_header {
+	uint32_t signature;
+	uint32_t version;
+};
+
+/*
+ * Write the reverse index file of the pack whose checksum is
+ * "pack_sha1" and whose objects are listed, sorted by name, in
+ * "objects", as write_idx_file() leaves them.  Returns the name of the
+ * file written, a temporary one if "rev_name" is NULL.
+ */
+extern const char *write_rev_file(const char *rev_name, struct pack_idx_entry **objects, uint32_t nr_objects, const unsigned char *pack_sha1);
+
+/*
+ * Write the sizes file of the pack whose checksum is "pack_sha1".
+ * The entries are sorted by object name, the order of the pack index,
+ * on exit.  Returns the name of the file written, a temporary one if
+ * "sizes_name" is NULL.
+ */
+extern const char *write_sizes_file(const char *sizes_name, struct pack_sizes_entry *objects, uint32_t nr_objects, const unsigned char *pack_sha1);
 extern int check_pack_crc(struct packed_git *p, struct pack_window **w_curs, off_t offset, off_t len, unsigned int nr);
 extern int verify_pack_index(struct packed_git *);
 extern int verify_pack(struct packed_git *);
@@ -2,6 +2,7 @@
  * Copyright (C) 2008 Linus Torvalds
  */
 #include "cache.h"
+#include "fsmonitor.h"
 
 #ifdef NO_PTHREADS
 static void preload_index(struct index_state *index, const char **pathspec)
@@ -53,6 +54,10 @@ static void *preload_thread(void *_data)
 			continue;
 		if (ce_uptodate(ce))
 			continue;
+		if (ce->ce_flags & CE_FSMONITOR_VALID) {
+			ce_mark_uptodate(ce);
+			continue;
+		}
 		if (!ce_path_match(ce, &pathspec))
 			continue;
 		if (threaded_has_symlink_leading_path(&cache, ce->name, ce_namelen(ce)))
@@ -62,6 +67,7 @@ static void *preload_thread(void *_data)
 		if (ie_match_stat(index, ce, &st, CE_MATCH_RACY_IS_DIRTY))
 			continue;
 		ce_mark_uptodate(ce);
+		mark_fsmonitor_valid(ce);
 	} while (--nr > 0);
 	free_pathspec(&pathspec);
 	return NULL;
@@ -74,6 +80,7 @@ static void preload_index(struct index_state *index, const char **pathspec)
 
 	if (!core_preload_index)
 		return;
+	refresh_fsmonitor(index);
 
 	threads = index->cache_nr / THREAD_COST;
 	if (threads < 2)
@@ -498,6 +498,7 @@ char *logmsg_reencode(const struct commit *commit,
 
 	if (!*output_encoding)
 		return NULL;
+	load_commit_buffer((struct commit *)commit);
 	encoding = get_header(commit, "encoding");
 	use_encoding = encoding ? encoding : utf8;
 	if (!strcmp(use_encoding, output_encoding))
@@ -1097,6 +1098,7 @@ void format_commit_message(const struct commit *commit,
 	const char *enc;
 	const char *output_enc = pretty_ctx->output_encoding;
 
+	load_commit_buffer((struct commit *)commit);
 	memset(&context, 0, sizeof(context));
 	context.commit = commit;
 	context.pretty_ctx = pretty_ctx;
@@ -1262,7 +1264,7 @@ void pretty_print_commit(const struct pretty_print_context *pp,
 {
 	unsigned long beginning_of_body;
 	int indent = 4;
-	const char *msg = commit->buffer;
+	const char *msg;
 	char *reencoded;
 	const char *encoding;
 	int need_8bit_cte = pp->need_8bit_cte;
@@ -1272,6 +1274,10 @@ void pretty_print_commit(const struct pretty_print_context *pp,
 		return;
 	}
 
+	/* a commit parsed from the commit-graph has no buffer yet */
+	load_commit_buffer((struct commit *)commit);
+	msg = commit->buffer;
+
 	reencoded = reencode_commit_message(commit, &encoding);
 	if (reencoded) {
 		msg = reencoded;
@@ -12,6 +12,9 @@
 #include "commit.h"
 #include "blob.h"
 #include "resolve-undo.h"
+#include "varint.h"
+#include "split-index.h"
+#include "fsmonitor.h"
 
 static struct cache_entry *refresh_cache_entry(struct cache_entry *ce, int really);
 
@@ -27,6 +30,9 @@ static struct cache_entry *refresh_cache_entry(struct cache_entry *ce, int reall
 #define CACHE_EXT(s) ( (s[0]<<24)|(s[1]<<16)|(s[2]<<8)|(s[3]) )
 #define CACHE_EXT_TREE 0x54524545	/* "TREE" */
 #define CACHE_EXT_RESOLVE_UNDO 0x52455543 /* "REUC" */
+#define CACHE_EXT_LINK 0x6c696e6b	/* "link" */
+#define CACHE_EXT_UNTRACKED 0x554E5452	/* "UNTR" */
+#define CACHE_EXT_FSMONITOR 0x46534D4E	/* "FSMN" */
 
 struct index_state the_index;
 
@@ -457,6 +463,7 @@ int remove_index_entry_at(struct index_state *istate, int pos)
 
 	record_resolve_undo(istate, ce);
 	remove_name_hash(ce);
+	untracked_cache_invalidate_path(istate, ce->name);
 	istate->cache_changed = 1;
 	istate->cache_nr--;
 	if (pos >= istate->cache_nr)
@@ -478,9 +485,10 @@ void remove_marked_cache_entries(struct index_state *istate)
 	unsigned int i, j;
 
 	for (i = j = 0; i < istate->cache_nr; i++) {
-		if (ce_array[i]->ce_flags & CE_REMOVE)
+		if (ce_array[i]->ce_flags & CE_REMOVE) {
 			remove_name_hash(ce_array[i]);
-		else
+			untracked_cache_invalidate_path(istate, ce_array[i]->name);
+		} else
 			ce_array[j++] = ce_array[i];
 	}
 	istate->cache_changed = 1;
@@ -1025,6 +1033,11 @@ static struct cache_entry *refresh_cache_ent(struct index_state *istate,
 		ce_mark_uptodate(ce);
 		return ce;
 	}
+	refresh_fsmonitor(istate);
+	if (!ignore_valid && (ce->ce_flags & CE_FSMONITOR_VALID)) {
+		ce_mark_uptodate(ce);
+		return ce;
+	}
 
 	if (lstat(ce->name, &st) < 0) {
 		if (err)
@@ -1052,6 +1065,7 @@ static struct cache_entry *refresh_cache_ent(struct index_state *istate,
 			 */
 			if (!S_ISGITLINK(ce->ce_mode))
 				ce_mark_uptodate(ce);
+			mark_fsmonitor_valid(ce);
 			return ce;
 		}
 	}
@@ -1075,6 +1089,7 @@ static struct cache_entry *refresh_cache_ent(struct index_state *istate,
 	if (!ignore_valid && assume_unchanged &&
 	    !(ce->ce_flags & CE_VALID))
 		updated->ce_flags &= ~CE_VALID;
+	mark_fsmonitor_valid(updated);
 
 	return updated;
 }
@@ -1107,6 +1122,7 @@ int refresh_index(struct index_state *istate, unsigned int flags, const char **p
 
 	needs_update_fmt = (in_porcelain ? "M\t%s\n" : "%s: needs update\n");
 	needs_merge_fmt = (in_porcelain ? "U\t%s\n" : "%s: needs merge\n");
+	refresh_fsmonitor(istate);
 	for (i = 0; i < istate->cache_nr; i++) {
 		struct cache_entry *ce, *new;
 		int cache_errno = 0;
@@ -1164,11 +1180,13 @@ static int verify_hdr(struct cache_header *hdr, unsigned long size)
 {
 	git_SHA_CTX c;
 	unsigned char sha1[20];
+	int hdr_version;
 
 	if (hdr->hdr_signature != htonl(CACHE_SIGNATURE))
 		return error("bad signature");
-	if (hdr->hdr_version != htonl(2) && hdr->hdr_version != htonl(3))
-		return error("bad index version");
+	hdr_version = ntohl(hdr->hdr_version);
+	if (hdr_version < INDEX_FORMAT_LB || INDEX_FORMAT_UB < hdr_version)
+		return error("bad index version %d", hdr_version);
 	git_SHA1_Init(&c);
 	git_SHA1_Update(&c, hdr, size - 20);
 	git_SHA1_Final(sha1, &c);
@@ -1187,6 +1205,17 @@ static int read_index_extension(struct index_state *istate,
 	case CACHE_EXT_RESOLVE_UNDO:
 		istate->resolve_undo = resolve_undo_read(data, sz);
 		break;
+	case CACHE_EXT_LINK:
+		if (read_link_extension(istate, data, sz))
+			return -1;
+		break;
+	case CACHE_EXT_UNTRACKED:
+		istate->untracked = read_untracked_extension(data, sz);
+		break;
+	case CACHE_EXT_FSMONITOR:
+		/* an unusable one only means every path gets checked */
+		read_fsmonitor_extension(istate, data, sz);
+		break;
 	default:
 		if (*ext < 'A' || 'Z' < *ext)
 			return error("index uses %.4s extension, which we do not understand",
@@ -1202,10 +1231,48 @@ int read_index(struct index_state *istate)
 	return read_index_from(istate, get_index_file());
 }
 
-static void convert_from_disk(struct ondisk_cache_entry *ondisk, struct cache_entry *ce)
+static const char *ondisk_ce_name(struct ondisk_cache_entry *ondisk)
+{
+	if (ntohs(ondisk->flags) & CE_EXTENDED)
+		return ((struct ondisk_cache_entry_extended *)ondisk)->name;
+	return ondisk->name;
+}
+
+/*
+ * In version 4 each name is stored as the number of bytes to remove
+ * from the end of the previous name, followed by the NUL-terminated
+ * bytes to append to what is left.  Update "name" accordingly and
+ * return the number of bytes this took on disk.
+ */
+static unsigned long expand_name_field(struct strbuf *name, const char *cp_,
+				       const char *end)
+{
+	const unsigned char *ep, *cp = (const unsigned char *)cp_;
+	size_t len = decode_varint(&cp);
+
+	if (name->len < len)
+		die("malformed name field in the index");
+	ep = memchr(cp, '\0', end - (const char *)cp);
+	if (!ep)
+		die("malformed name field in the index");
+	strbuf_setlen(name, name->len - len);
+	strbuf_add(name, cp, ep - cp);
+	return (const char *)ep + 1 - cp_;
+}
+
+/*
+ * Convert the entry at "ondisk" into "ce" and return the number of
+ * bytes it took on disk.  "previous_name" is NULL unless the index is
+ * in version 4, in which case it holds the name of the previous entry.
+ */
+static unsigned long convert_from_disk(struct ondisk_cache_entry *ondisk,
+				       struct cache_entry *ce,
+				       struct strbuf *previous_name,
+				       const char *end)
 {
 	size_t len;
 	const char *name;
+	unsigned long consumed;
 
 	ce->ce_ctime.sec = ntohl(ondisk->ctime.sec);
 	ce->ce_mtime.sec = ntohl(ondisk->mtime.sec);
@@ -1238,6 +1305,15 @@ static void convert_from_disk(struct ondisk_cache_entry *ondisk, struct cache_en
 	else
 		name = ondisk->name;
 
+	if (previous_name) {
+		consumed = expand_name_field(previous_name, name, end);
+		len = previous_name->len;
+		ce->ce_flags = (ce->ce_flags & ~CE_NAMEMASK) |
+			(len < CE_NAMEMASK ? len : CE_NAMEMASK);
+		memcpy(ce->name, previous_name->buf, len + 1);
+		return (name - (const char *)ondisk) + consumed;
+	}
+
 	if (len == CE_NAMEMASK)
 		len = strlen(name);
 	/*
@@ -1245,6 +1321,7 @@ static void convert_from_disk(struct ondisk_cache_entry *ondisk, struct cache_en
 	 * go unchecked.
 	 */
 	memcpy(ce->name, name, len + 1);
+	return ondisk_ce_size(ce);
 }
 
 static inline size_t estimate_cache_size(size_t ondisk_size, unsigned int entries)
@@ -1261,6 +1338,40 @@ static inline size_t estimate_cache_size(size_t ondisk_size, unsigned int entrie
 	return ondisk_size + entries*per_entry;
 }
 
+/*
+ * Without the padding of the older versions, and with most of each
+ * name shared with the previous entry, the on-disk size of a version
+ * 4 index says little about how much memory its entries need; walk
+ * the names to find out.
+ */
+static size_t cache_size_v4(const char *mmap, size_t mmap_size, unsigned int entries)
+{
+	struct strbuf name = STRBUF_INIT;
+	const char *src = mmap + sizeof(struct cache_header);
+	const char *end = mmap + mmap_size - 20;
+	size_t size = 0;
+	unsigned int i;
+
+	for (i = 0; i < entries; i++) {
+		const char *cp = ondisk_ce_name((struct ondisk_cache_entry *)src);
+
+		src = cp + expand_name_field(&name, cp, end);
+		size += cache_entry_size(name.len);
+	}
+	strbuf_release(&name);
+	return size;
+}
+
+/*
+ * Shared indexes nobody touched for a while are removed when another
+ * one is written, so touch the one an index depends on whenever that
+ * index is read or written.
+ */
+static void freshen_shared_index(const unsigned char *sha1)
+{
+	utime(git_path("sharedindex.%s", sha1_to_hex(sha1)), NULL);
+}
+
 /* remember to discard_cache() before reading a different cache! */
 int read_index_from(struct index_state *istate, const char *path)
 {
@@ -1270,6 +1381,7 @@ int read_index_from(struct index_state *istate, const char *path)
 	struct cache_header *hdr;
 	void *mmap;
 	size_t mmap_size;
+	struct strbuf previous_name_buf = STRBUF_INIT, *previous_name;
 
 	errno = EBUSY;
 	if (istate->initialized)
@@ -1302,6 +1414,8 @@ int read_index_from(struct index_state *istate, const char *path)
 	if (verify_hdr(hdr, mmap_size) < 0)
 		goto unmap;
 
+	hashcpy(istate->sha1, (unsigned char *)hdr + mmap_size - 20);
+	istate->version = ntohl(hdr->hdr_version);
 	istate->cache_nr = ntohl(hdr->hdr_entries);
 	istate->cache_alloc = alloc_nr(istate->cache_nr);
 	istate->cache = xcalloc(istate->cache_alloc, sizeof(struct cache_entry *));
@@ -1312,7 +1426,15 @@ int read_index_from(struct index_state *istate, const char *path)
 	 * has room for a few  more flags, we can allocate using the same
 	 * index size
 	 */
-	istate->alloc = xmalloc(estimate_cache_size(mmap_size, istate->cache_nr));
+	if (istate->version == 4) {
+		istate->alloc = xmalloc(cache_size_v4(mmap, mmap_size,
+						      istate->cache_nr));
+		previous_name = &previous_name_buf;
+	} else {
+		istate->alloc = xmalloc(estimate_cache_size(mmap_size,
+							    istate->cache_nr));
+		previous_name = NULL;
+	}
 	istate->initialized = 1;
 
 	src_offset = sizeof(*hdr);
@@ -1323,12 +1445,13 @@ int read_index_from(struct index_state *istate, const char *path)
 
 		disk_ce = (struct ondisk_cache_entry *)((char *)mmap + src_offset);
 		ce = (struct cache_entry *)((char *)istate->alloc + dst_offset);
-		convert_from_disk(disk_ce, ce);
+		src_offset += convert_from_disk(disk_ce, ce, previous_name,
+						(char *)mmap + mmap_size - 20);
 		set_index_entry(istate, i, ce);
 
-		src_offset += ondisk_ce_size(ce);
 		dst_offset += ce_size(ce);
 	}
+	strbuf_release(&previous_name_buf);
 	istate->timestamp.sec = st.st_mtime;
 	istate->timestamp.nsec = ST_MTIME_NSEC(st);
 
@@ -1351,6 +1474,11 @@ int read_index_from(struct index_state *istate, const char *path)
 		src_offset += extsize;
 	}
 	munmap(mmap, mmap_size);
+	if (istate->split_index) {
+		merge_base_index(istate);
+		freshen_shared_index(istate->split_index->base_sha1);
+	}
+	tweak_fsmonitor(istate);
 	return istate->cache_nr;
 
 unmap:
@@ -1367,6 +1495,11 @@ int is_index_unborn(struct index_state *istate)
 int discard_index(struct index_state *istate)
 {
 	resolve_undo_clear_index(istate);
+	release_split_index(istate);
+	free_untracked_cache(istate->untracked);
+	istate->untracked = NULL;
+	istate->fsmonitor_last_update = 0;
+	istate->fsmonitor_has_run_once = 0;
 	istate->cache_nr = 0;
 	istate->cache_changed = 0;
 	istate->timestamp.sec = 0;
@@ -1439,7 +1572,7 @@ static int write_index_ext_header(git_SHA_CTX *context, int fd,
 		(ce_write(context, fd, &sz, 4) < 0)) ? -1 : 0;
 }
 
-static int ce_flush(git_SHA_CTX *context, int fd)
+static int ce_flush(git_SHA_CTX *context, int fd, unsigned char *sha1)
 {
 	unsigned int left = write_buffer_len;
 
@@ -1457,6 +1590,7 @@ static int ce_flush(git_SHA_CTX *context, int fd)
 
 	/* Append the SHA1 signature at the end */
 	git_SHA1_Final(write_buffer + left, context);
+	hashcpy(sha1, write_buffer + left);
 	left += 20;
 	return (write_in_full(fd, write_buffer, left) != left) ? -1 : 0;
 }
@@ -1510,12 +1644,38 @@ static void ce_smudge_racily_clean_entry(struct cache_entry *ce)
 	}
 }
 
-static int ce_write_entry(git_SHA_CTX *c, int fd, struct cache_entry *ce)
+/*
+ * Write "ce" out.  "previous_name" is NULL unless the index is written
+ * in version 4, in which case it holds the name of the previous entry
+ * and is updated to this one.
+ */
+static int ce_write_entry(git_SHA_CTX *c, int fd, struct cache_entry *ce,
+			  struct strbuf *previous_name)
 {
-	int size = ondisk_ce_size(ce);
-	struct ondisk_cache_entry *ondisk = xcalloc(1, size);
+	int size;
+	struct ondisk_cache_entry *ondisk;
 	char *name;
 	int result;
+	size_t namelen = ce_namelen(ce), common = 0, to_remove = 0;
+	unsigned char to_remove_vi[16];
+	int prefix_size = 0;
+
+	if (!previous_name) {
+		size = ondisk_ce_size(ce);
+	} else {
+		while (common < namelen && common < previous_name->len &&
+		       ce->name[common] == previous_name->buf[common])
+			common++;
+		to_remove = previous_name->len - common;
+		prefix_size = encode_varint(to_remove, to_remove_vi);
+
+		if (ce->ce_flags & CE_EXTENDED)
+			size = offsetof(struct ondisk_cache_entry_extended, name);
+		else
+			size = offsetof(struct ondisk_cache_entry, name);
+		size += prefix_size + (namelen - common) + 1;
+	}
+	ondisk = xcalloc(1, size);
 
 	ondisk->ctime.sec = htonl(ce->ce_ctime.sec);
 	ondisk->mtime.sec = htonl(ce->ce_mtime.sec);
@@ -1537,7 +1697,15 @@ static int ce_write_entry(git_SHA_CTX *c, int fd, struct cache_entry *ce)
 	}
 	else
 		name = ondisk->name;
-	memcpy(name, ce->name, ce_namelen(ce));
+
+	if (!previous_name) {
+		memcpy(name, ce->name, namelen);
+	} else {
+		memcpy(name, to_remove_vi, prefix_size);
+		memcpy(name + prefix_size, ce->name + common, namelen - common);
+		strbuf_splice(previous_name, common, to_remove,
+			      ce->name + common, namelen - common);
+	}
 
 	result = ce_write(c, fd, ondisk, size);
 	free(ondisk);
@@ -1569,14 +1737,45 @@ void update_index_if_able(struct index_state *istate, struct lock_file *lockfile
 		rollback_lock_file(lockfile);
 }
 
-int write_index(struct index_state *istate, int newfd)
+#define INDEX_FORMAT_DEFAULT 3
+
+static int index_format_config(const char *var, const char *value, void *cb)
+{
+	if (!strcmp(var, "index.version")) {
+		*(int *)cb = git_config_int(var, value);
+		return 0;
+	}
+	return 0;
+}
+
+static unsigned int get_index_format_default(void)
+{
+	int version = INDEX_FORMAT_DEFAULT;
+
+	git_config(index_format_config, &version);
+	if (version < INDEX_FORMAT_LB || INDEX_FORMAT_UB < version) {
+		warning("index.version set, but the value is invalid.\n"
+			"Using version %i", INDEX_FORMAT_DEFAULT);
+		return INDEX_FORMAT_DEFAULT;
+	}
+	return version;
+}
+
+/*
+ * Write out "entries" entries from "cache", which is either all of
+ * "istate" or, for a split index, just the ones that differ from the
+ * shared index.  The shared index itself is written without any
+ * extensions.
+ */
+static int do_write_index(struct index_state *istate, int newfd,
+			  struct cache_entry **cache, int entries,
+			  int strip_extensions)
 {
 	git_SHA_CTX c;
 	struct cache_header hdr;
 	int i, err, removed, extended;
-	struct cache_entry **cache = istate->cache;
-	int entries = istate->cache_nr;
 	struct stat st;
+	struct strbuf previous_name_buf = STRBUF_INIT, *previous_name;
 
 	for (i = removed = extended = 0; i < entries; i++) {
 		if (cache[i]->ce_flags & CE_REMOVE)
@@ -1590,27 +1789,48 @@ int write_index(struct index_state *istate, int newfd)
 		}
 	}
 
+	/*
+	 * Versions 2 and 3 differ only in allowing extended flags; use the
+	 * extended format only when needed, so older git won't try to read
+	 * it.  Version 4 is kept as asked for.
+	 */
+	if (istate->version == 2 || istate->version == 3)
+		istate->version = extended ? 3 : 2;
+
 	hdr.hdr_signature = htonl(CACHE_SIGNATURE);
-	/* for extended format, increase version so older git won't try to read it */
-	hdr.hdr_version = htonl(extended ? 3 : 2);
+	hdr.hdr_version = htonl(istate->version);
 	hdr.hdr_entries = htonl(entries - removed);
 
 	git_SHA1_Init(&c);
 	if (ce_write(&c, newfd, &hdr, sizeof(hdr)) < 0)
 		return -1;
 
+	previous_name = (istate->version == 4) ? &previous_name_buf : NULL;
 	for (i = 0; i < entries; i++) {
 		struct cache_entry *ce = cache[i];
 		if (ce->ce_flags & CE_REMOVE)
 			continue;
 		if (!ce_uptodate(ce) && is_racy_timestamp(istate, ce))
 			ce_smudge_racily_clean_entry(ce);
-		if (ce_write_entry(&c, newfd, ce) < 0)
+		if (ce_write_entry(&c, newfd, ce, previous_name) < 0) {
+			strbuf_release(&previous_name_buf);
 			return -1;
+		}
 	}
+	strbuf_release(&previous_name_buf);
 
 	/* Write extension data here */
-	if (istate->cache_tree) {
+	if (!strip_extensions && istate->split_index) {
+		struct strbuf sb = STRBUF_INIT;
+
+		write_link_extension(&sb, istate);
+		err = write_index_ext_header(&c, newfd, CACHE_EXT_LINK, sb.len) < 0
+			|| ce_write(&c, newfd, sb.buf, sb.len) < 0;
+		strbuf_release(&sb);
+		if (err)
+			return -1;
+	}
+	if (!strip_extensions && istate->cache_tree) {
 		struct strbuf sb = STRBUF_INIT;
 
 		cache_tree_write(&sb, istate->cache_tree);
@@ -1620,7 +1840,7 @@ int write_index(struct index_state *istate, int newfd)
 		if (err)
 			return -1;
 	}
-	if (istate->resolve_undo) {
+	if (!strip_extensions && istate->resolve_undo) {
 		struct strbuf sb = STRBUF_INIT;
 
 		resolve_undo_write(&sb, istate->resolve_undo);
@@ -1631,14 +1851,157 @@ int write_index(struct index_state *istate, int newfd)
 		if (err)
 			return -1;
 	}
+	if (!strip_extensions && istate->untracked) {
+		struct strbuf sb = STRBUF_INIT;
+
+		write_untracked_extension(&sb, istate->untracked);
+		err = write_index_ext_header(&c, newfd, CACHE_EXT_UNTRACKED,
+					     sb.len) < 0
+			|| ce_write(&c, newfd, sb.buf, sb.len) < 0;
+		strbuf_release(&sb);
+		if (err)
+			return -1;
+	}
+	if (!strip_extensions && core_fsmonitor &&
+	    istate->fsmonitor_last_update) {
+		struct strbuf sb = STRBUF_INIT;
+
+		write_fsmonitor_extension(&sb, istate);
+		err = write_index_ext_header(&c, newfd, CACHE_EXT_FSMONITOR,
+					     sb.len) < 0
+			|| ce_write(&c, newfd, sb.buf, sb.len) < 0;
+		strbuf_release(&sb);
+		if (err)
+			return -1;
+	}
 
-	if (ce_flush(&c, newfd) || fstat(newfd, &st))
+	if (ce_flush(&c, newfd, istate->sha1) || fstat(newfd, &st))
 		return -1;
 	istate->timestamp.sec = (unsigned int)st.st_mtime;
 	istate->timestamp.nsec = ST_MTIME_NSEC(st);
 	return 0;
 }
 
+/*
+ * Write a new shared index when more than this percentage of the
+ * entries differ from the current one.
+ */
+#define SPLIT_INDEX_MAX_PERCENT_CHANGE 20
+
+/* Shared indexes not used by any write for this long are removed. */
+#define SHARED_INDEX_EXPIRE (14 * 24 * 60 * 60)
+
+static struct lock_file shared_index_lock;
+
+static void clean_shared_index_files(const char *current)
+{
+	DIR *dir = opendir(get_git_dir());
+	struct dirent *de;
+	time_t expire = time(NULL) - SHARED_INDEX_EXPIRE;
+
+	if (!dir)
+		return;
+	while ((de = readdir(dir)) != NULL) {
+		const char *path;
+		struct stat st;
+
+		if (prefixcmp(de->d_name, "sharedindex.") ||
+		    !strcmp(de->d_name, current))
+			continue;
+		path = git_path("%s", de->d_name);
+		if (!stat(path, &st) && st.st_mtime < expire)
+			unlink_or_warn(path);
+	}
+	closedir(dir);
+}
+
+static int write_shared_index(struct index_state *istate)
+{
+	char *path;
+	int fd;
+
+	fd = hold_lock_file_for_update(&shared_index_lock,
+				       git_path("sharedindex"), 0);
+	if (fd < 0)
+		return -1;
+	if (do_write_index(istate, fd, istate->cache, istate->cache_nr, 1) ||
+	    close_lock_file(&shared_index_lock)) {
+		rollback_lock_file(&shared_index_lock);
+		return -1;
+	}
+	path = xstrdup(git_path("sharedindex.%s", sha1_to_hex(istate->sha1)));
+	if (rename(shared_index_lock.filename, path)) {
+		rollback_lock_file(&shared_index_lock);
+		free(path);
+		return -1;
+	}
+	shared_index_lock.filename[0] = 0;
+	set_split_index_base(istate, istate->sha1);
+	clean_shared_index_files(strrchr(path, '/') ?
+				 strrchr(path, '/') + 1 : path);
+	free(path);
+	return 0;
+}
+
+static void smudge_racily_clean_entries(struct index_state *istate)
+{
+	int i;
+
+	for (i = 0; i < istate->cache_nr; i++) {
+		struct cache_entry *ce = istate->cache[i];
+		if (ce->ce_flags & CE_REMOVE)
+			continue;
+		if (!ce_uptodate(ce) && is_racy_timestamp(istate, ce))
+			ce_smudge_racily_clean_entry(ce);
+	}
+}
+
+int write_index(struct index_state *istate, int newfd)
+{
+	struct split_index *si;
+
+	if (!istate->version)
+		istate->version = get_index_format_default();
+
+	tweak_untracked_cache(istate);
+	if (core_split_index > 0)
+		init_split_index(istate);
+	else if (!core_split_index)
+		release_split_index(istate);
+	si = istate->split_index;
+	if (!si)
+		return do_write_index(istate, newfd,
+				      istate->cache, istate->cache_nr, 0);
+
+	/*
+	 * Entries that are about to be smudged no longer match the
+	 * shared index, so do that before comparing.
+	 */
+	smudge_racily_clean_entries(istate);
+	if (si->base) {
+		struct cache_entry **changed;
+		unsigned int nr = prepare_split_index(istate, &changed);
+		int ret;
+
+		if ((nr + si->delete_nr) * 100 <=
+		    istate->cache_nr * SPLIT_INDEX_MAX_PERCENT_CHANGE) {
+			freshen_shared_index(si->base_sha1);
+			ret = do_write_index(istate, newfd, changed, nr, 0);
+			free(changed);
+			return ret;
+		}
+		free(changed);
+	}
+
+	if (write_shared_index(istate)) {
+		warning("could not write a shared index, writing the whole index");
+		release_split_index(istate);
+		return do_write_index(istate, newfd,
+				      istate->cache, istate->cache_nr, 0);
+	}
+	return do_write_index(istate, newfd, NULL, 0, 0);
+}
+
 /*
  * Read the index file that is potentially unmerged into given
  * index_state, dropping any unmerged entries.  Returns true if
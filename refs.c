@@ -7,186 +7,287 @@
 /* ISSYMREF=01 and ISPACKED=02 are public interfaces */
 #define REF_KNOWS_PEELED 04
 #define REF_BROKEN 010
+/* The entry is a directory of refs, not a ref */
+#define REF_DIR 020
+/* A loose ref directory that has not been read from disk yet */
+#define REF_INCOMPLETE 040
 
-struct ref_list {
-	struct ref_list *next;
-	unsigned char flag; /* ISSYMREF? ISPACKED? */
+struct ref_entry;
+struct ref_cache;
+
+/*
+ * The refs in one directory, e.g. "refs/heads/", as an array of
+ * entries sorted by name.  The first "sorted" entries are known to be
+ * in order; entries appended after them are sorted (and duplicates
+ * removed) the next time the directory is searched.
+ */
+struct ref_dir {
+	int nr, alloc;
+	int sorted;
+	struct ref_cache *ref_cache;
+	struct ref_entry **entries;
+};
+
+struct ref_value {
 	unsigned char sha1[20];
 	unsigned char peeled[20];
+};
+
+/*
+ * A ref, or (if REF_DIR is set) a directory of refs.  The name is the
+ * full refname; the name of a directory ends with "/", and the name
+ * of the top-level directory is "".  Loose ref directories are only
+ * read from disk when they are first looked into, so that looking at
+ * "refs/heads/" does not read "refs/pull/".
+ */
+struct ref_entry {
+	unsigned char flag; /* ISSYMREF? ISPACKED? */
+	union {
+		struct ref_value value;
+		struct ref_dir subdir;
+	} u;
 	char name[FLEX_ARRAY];
 };
 
-static const char *parse_ref_line(char *line, unsigned char *sha1)
-{
-	/*
-	 * 42: the answer to everything.
-	 *
-	 * In this case, it happens to be the answer to
-	 *  40 (length of sha1 hex representation)
-	 *  +1 (space in between hex and name)
-	 *  +1 (newline at the end of the line)
-	 */
-	int len = strlen(line) - 42;
+/*
+ * Future: need to be in "struct repository"
+ * when doing a full libification.
+ */
+static struct ref_cache {
+	struct ref_entry *loose;
+	struct ref_entry *packed;
+	char *submodule;
+} cached_refs, submodule_refs;
+static struct ref_entry *current_ref;
 
-	if (len <= 0)
-		return NULL;
-	if (get_sha1_hex(line, sha1) < 0)
-		return NULL;
-	if (!isspace(line[40]))
-		return NULL;
-	line += 41;
-	if (isspace(*line))
-		return NULL;
-	if (line[len] != '\n')
-		return NULL;
-	line[len] = 0;
+/* Not sorted: the same name (e.g. ".have") may be added many times */
+static struct ref_dir extra_refs;
 
-	return line;
-}
+static void read_loose_refs(const char *dirname, struct ref_dir *dir);
 
-static struct ref_list *add_ref(const char *name, const unsigned char *sha1,
-				int flag, struct ref_list *list,
-				struct ref_list **new_entry)
+static struct ref_entry *create_ref_entry(const char *name,
+					  const unsigned char *sha1, int flag)
 {
-	int len;
-	struct ref_list *entry;
+	int len = strlen(name) + 1;
+	struct ref_entry *entry;
 
-	/* Allocate it and add it in.. */
-	len = strlen(name) + 1;
-	entry = xmalloc(sizeof(struct ref_list) + len);
-	hashcpy(entry->sha1, sha1);
-	hashclr(entry->peeled);
+	entry = xcalloc(1, sizeof(struct ref_entry) + len);
+	hashcpy(entry->u.value.sha1, sha1);
 	memcpy(entry->name, name, len);
 	entry->flag = flag;
-	entry->next = list;
-	if (new_entry)
-		*new_entry = entry;
 	return entry;
 }
 
-/* merge sort the ref list */
-static struct ref_list *sort_ref_list(struct ref_list *list)
+static struct ref_entry *create_dir_entry(struct ref_cache *ref_cache,
+					  const char *dirname, int len,
+					  int incomplete)
 {
-	int psize, qsize, last_merge_count, cmp;
-	struct ref_list *p, *q, *l, *e;
-	struct ref_list *new_list = list;
-	int k = 1;
-	int merge_count = 0;
+	struct ref_entry *entry;
 
-	if (!list)
-		return list;
+	entry = xcalloc(1, sizeof(struct ref_entry) + len + 1);
+	memcpy(entry->name, dirname, len);
+	entry->u.subdir.ref_cache = ref_cache;
+	entry->flag = REF_DIR | (incomplete ? REF_INCOMPLETE : 0);
+	return entry;
+}
+
+static void clear_ref_dir(struct ref_dir *dir);
 
-	do {
-		last_merge_count = merge_count;
-		merge_count = 0;
+static void free_ref_entry(struct ref_entry *entry)
+{
+	if (!entry)
+		return;
+	if (entry->flag & REF_DIR)
+		clear_ref_dir(&entry->u.subdir);
+	free(entry);
+}
 
-		psize = 0;
+static void clear_ref_dir(struct ref_dir *dir)
+{
+	int i;
 
-		p = new_list;
-		q = new_list;
-		new_list = NULL;
-		l = NULL;
+	for (i = 0; i < dir->nr; i++)
+		free_ref_entry(dir->entries[i]);
+	free(dir->entries);
+	dir->entries = NULL;
+	dir->nr = dir->alloc = dir->sorted = 0;
+}
 
-		while (p) {
-			merge_count++;
+/* The directory of a REF_DIR entry, read from disk if necessary. */
+static struct ref_dir *get_ref_dir(struct ref_entry *entry)
+{
+	struct ref_dir *dir = &entry->u.subdir;
 
-			while (psize < k && q->next) {
-				q = q->next;
-				psize++;
-			}
-			qsize = k;
-
-			while ((psize > 0) || (qsize > 0 && q)) {
-				if (qsize == 0 || !q) {
-					e = p;
-					p = p->next;
-					psize--;
-				} else if (psize == 0) {
-					e = q;
-					q = q->next;
-					qsize--;
-				} else {
-					cmp = strcmp(q->name, p->name);
-					if (cmp < 0) {
-						e = q;
-						q = q->next;
-						qsize--;
-					} else if (cmp > 0) {
-						e = p;
-						p = p->next;
-						psize--;
-					} else {
-						if (hashcmp(q->sha1, p->sha1))
-							die("Duplicated ref, and SHA1s don't match: %s",
-							    q->name);
-						warning("Duplicated ref: %s", q->name);
-						e = q;
-						q = q->next;
-						qsize--;
-						free(e);
-						e = p;
-						p = p->next;
-						psize--;
-					}
-				}
+	if (entry->flag & REF_INCOMPLETE) {
+		read_loose_refs(entry->name, dir);
+		entry->flag &= ~REF_INCOMPLETE;
+	}
+	return dir;
+}
 
-				e->next = NULL;
+static void add_entry_to_dir(struct ref_dir *dir, struct ref_entry *entry)
+{
+	ALLOC_GROW(dir->entries, dir->nr + 1, dir->alloc);
+	dir->entries[dir->nr++] = entry;
+	/* packed-refs is sorted, so appending usually keeps it in order */
+	if (dir->sorted == dir->nr - 1 &&
+	    (dir->nr == 1 ||
+	     strcmp(dir->entries[dir->nr - 2]->name, entry->name) < 0))
+		dir->sorted = dir->nr;
+}
 
-				if (l)
-					l->next = e;
-				if (!new_list)
-					new_list = e;
-				l = e;
-			}
+static int ref_entry_cmp(const void *a, const void *b)
+{
+	struct ref_entry *one = *(struct ref_entry **)a;
+	struct ref_entry *two = *(struct ref_entry **)b;
+	return strcmp(one->name, two->name);
+}
 
-			p = q;
-		};
+static void sort_ref_dir(struct ref_dir *dir)
+{
+	int i, j;
 
-		k = k * 2;
-	} while ((last_merge_count != merge_count) || (last_merge_count != 1));
+	if (dir->sorted == dir->nr)
+		return;
 
-	return new_list;
+	qsort(dir->entries, dir->nr, sizeof(*dir->entries), ref_entry_cmp);
+
+	/* Remove any duplicates */
+	for (i = 0, j = 0; j < dir->nr; j++) {
+		struct ref_entry *entry = dir->entries[j];
+		if (i && !strcmp(dir->entries[i - 1]->name, entry->name)) {
+			struct ref_entry *prev = dir->entries[i - 1];
+			if ((prev->flag | entry->flag) & REF_DIR ||
+			    hashcmp(prev->u.value.sha1, entry->u.value.sha1))
+				die("Duplicated ref, and SHA1s don't match: %s",
+				    entry->name);
+			warning("Duplicated ref: %s", entry->name);
+			free_ref_entry(entry);
+			continue;
+		}
+		dir->entries[i++] = entry;
+	}
+	dir->nr = dir->sorted = i;
 }
 
 /*
- * Future: need to be in "struct repository"
- * when doing a full libification.
+ * Return the index of the entry named by the first "len" bytes of
+ * "name" in "dir", or -1 if there is none.
  */
-static struct cached_refs {
-	char did_loose;
-	char did_packed;
-	struct ref_list *loose;
-	struct ref_list *packed;
-} cached_refs, submodule_refs;
-static struct ref_list *current_ref;
-
-static struct ref_list *extra_refs;
+static int search_ref_dir(struct ref_dir *dir, const char *name, int len)
+{
+	int lo = 0, hi;
+
+	sort_ref_dir(dir);
+	hi = dir->nr;
+	while (lo < hi) {
+		int mi = lo + (hi - lo) / 2;
+		const char *ename = dir->entries[mi]->name;
+		int cmp = strncmp(ename, name, len);
+		if (!cmp)
+			cmp = ename[len] ? 1 : 0;
+		if (!cmp)
+			return mi;
+		if (cmp > 0)
+			hi = mi;
+		else
+			lo = mi + 1;
+	}
+	return -1;
+}
 
-static void free_ref_list(struct ref_list *list)
+/*
+ * Return the directory that holds (or would hold) "refname", going
+ * down from "dir" one path component at a time.  Missing directories
+ * are created if "mkdir" is set; otherwise NULL is returned for them.
+ */
+static struct ref_dir *find_containing_dir(struct ref_dir *dir,
+					   const char *refname, int mkdir)
 {
-	struct ref_list *next;
-	for ( ; list; list = next) {
-		next = list->next;
-		free(list);
+	const char *slash;
+
+	for (slash = strchr(refname, '/'); slash; slash = strchr(slash + 1, '/')) {
+		int len = slash - refname + 1;
+		int pos = search_ref_dir(dir, refname, len);
+		struct ref_entry *entry;
+
+		if (pos >= 0) {
+			entry = dir->entries[pos];
+			if (!(entry->flag & REF_DIR))
+				return NULL;
+		} else {
+			if (!mkdir)
+				return NULL;
+			entry = create_dir_entry(dir->ref_cache, refname, len, 0);
+			add_entry_to_dir(dir, entry);
+		}
+		dir = get_ref_dir(entry);
 	}
+	return dir;
+}
+
+/* Find the ref "refname" under "dir", or return NULL. */
+static struct ref_entry *find_ref(struct ref_dir *dir, const char *refname)
+{
+	int pos;
+
+	dir = find_containing_dir(dir, refname, 0);
+	if (!dir)
+		return NULL;
+	pos = search_ref_dir(dir, refname, strlen(refname));
+	if (pos < 0 || dir->entries[pos]->flag & REF_DIR)
+		return NULL;
+	return dir->entries[pos];
+}
+
+static void add_ref(struct ref_dir *dir, struct ref_entry *entry)
+{
+	dir = find_containing_dir(dir, entry->name, 1);
+	if (!dir)
+		die("'%s' is both a ref and a directory of refs", entry->name);
+	add_entry_to_dir(dir, entry);
+}
+
+static const char *parse_ref_line(char *line, unsigned char *sha1)
+{
+	/*
+	 * 42: the answer to everything.
+	 *
+	 * In this case, it happens to be the answer to
+	 *  40 (length of sha1 hex representation)
+	 *  +1 (space in between hex and name)
+	 *  +1 (newline at the end of the line)
+	 */
+	int len = strlen(line) - 42;
+
+	if (len <= 0)
+		return NULL;
+	if (get_sha1_hex(line, sha1) < 0)
+		return NULL;
+	if (!isspace(line[40]))
+		return NULL;
+	line += 41;
+	if (isspace(*line))
+		return NULL;
+	if (line[len] != '\n')
+		return NULL;
+	line[len] = 0;
+
+	return line;
 }
 
 static void invalidate_cached_refs(void)
 {
-	struct cached_refs *ca = &cached_refs;
+	struct ref_cache *ca = &cached_refs;
 
-	if (ca->did_loose && ca->loose)
-		free_ref_list(ca->loose);
-	if (ca->did_packed && ca->packed)
-		free_ref_list(ca->packed);
+	free_ref_entry(ca->loose);
+	free_ref_entry(ca->packed);
 	ca->loose = ca->packed = NULL;
-	ca->did_loose = ca->did_packed = 0;
 }
 
-static void read_packed_refs(FILE *f, struct cached_refs *cached_refs)
+static void read_packed_refs(FILE *f, struct ref_dir *dir)
 {
-	struct ref_list *list = NULL;
-	struct ref_list *last = NULL;
+	struct ref_entry *last = NULL;
 	char refline[PATH_MAX];
 	int flag = REF_ISPACKED;
 
@@ -205,7 +306,8 @@ static void read_packed_refs(FILE *f, struct cached_refs *cached_refs)
 
 		name = parse_ref_line(refline, sha1);
 		if (name) {
-			list = add_ref(name, sha1, flag, list, &last);
+			last = create_ref_entry(name, sha1, flag);
+			add_ref(dir, last);
 			continue;
 		}
 		if (last &&
@@ -213,113 +315,122 @@ static void read_packed_refs(FILE *f, struct cached_refs *cached_refs)
 		    strlen(refline) == 42 &&
 		    refline[41] == '\n' &&
 		    !get_sha1_hex(refline + 1, sha1))
-			hashcpy(last->peeled, sha1);
+			hashcpy(last->u.value.peeled, sha1);
 	}
-	cached_refs->packed = sort_ref_list(list);
 }
 
 void add_extra_ref(const char *name, const unsigned char *sha1, int flag)
 {
-	extra_refs = add_ref(name, sha1, flag, extra_refs, NULL);
+	add_entry_to_dir(&extra_refs, create_ref_entry(name, sha1, flag));
 }
 
 void clear_extra_refs(void)
 {
-	free_ref_list(extra_refs);
-	extra_refs = NULL;
+	clear_ref_dir(&extra_refs);
 }
 
-static struct ref_list *get_packed_refs(const char *submodule)
+static struct ref_cache *get_ref_cache(const char *submodule)
 {
-	const char *packed_refs_file;
-	struct cached_refs *refs;
+	struct ref_cache *refs;
 
-	if (submodule) {
-		packed_refs_file = git_path_submodule(submodule, "packed-refs");
-		refs = &submodule_refs;
-		free_ref_list(refs->packed);
-	} else {
-		packed_refs_file = git_path("packed-refs");
-		refs = &cached_refs;
-	}
+	if (!submodule)
+		return &cached_refs;
 
-	if (!refs->did_packed || submodule) {
-		FILE *f = fopen(packed_refs_file, "r");
-		refs->packed = NULL;
+	/* Submodule refs are not cached; start afresh every time. */
+	refs = &submodule_refs;
+	free_ref_entry(refs->loose);
+	free_ref_entry(refs->packed);
+	refs->loose = refs->packed = NULL;
+	free(refs->submodule);
+	refs->submodule = xstrdup(submodule);
+	return refs;
+}
+
+static struct ref_dir *get_packed_refs(struct ref_cache *refs)
+{
+	if (!refs->packed) {
+		const char *packed_refs_file;
+		FILE *f;
+
+		if (refs->submodule)
+			packed_refs_file = git_path_submodule(refs->submodule,
+							      "packed-refs");
+		else
+			packed_refs_file = git_path("packed-refs");
+		refs->packed = create_dir_entry(refs, "", 0, 0);
+		f = fopen(packed_refs_file, "r");
 		if (f) {
-			read_packed_refs(f, refs);
+			read_packed_refs(f, &refs->packed->u.subdir);
 			fclose(f);
 		}
-		refs->did_packed = 1;
 	}
-	return refs->packed;
+	return get_ref_dir(refs->packed);
 }
 
-static struct ref_list *get_ref_dir(const char *submodule, const char *base,
-				    struct ref_list *list)
+/*
+ * Read the loose refs directly in "dirname" (e.g. "refs/heads/") into
+ * "dir".  Subdirectories are only noted, to be read when needed.
+ */
+static void read_loose_refs(const char *dirname, struct ref_dir *dir)
 {
-	DIR *dir;
+	const char *submodule = dir->ref_cache->submodule;
+	struct strbuf ref = STRBUF_INIT;
 	const char *path;
+	DIR *d;
+	struct dirent *de;
+	int dirnamelen;
 
 	if (submodule)
-		path = git_path_submodule(submodule, "%s", base);
+		path = git_path_submodule(submodule, "%s", dirname);
 	else
-		path = git_path("%s", base);
+		path = git_path("%s", dirname);
 
+	d = opendir(path);
+	if (!d)
+		return;
 
-	dir = opendir(path);
+	strbuf_addstr(&ref, dirname);
+	dirnamelen = ref.len;
 
-	if (dir) {
-		struct dirent *de;
-		int baselen = strlen(base);
-		char *ref = xmalloc(baselen + 257);
-
-		memcpy(ref, base, baselen);
-		if (baselen && base[baselen-1] != '/')
-			ref[baselen++] = '/';
-
-		while ((de = readdir(dir)) != NULL) {
-			unsigned char sha1[20];
-			struct stat st;
-			int flag;
-			int namelen;
-			const char *refdir;
+	while ((de = readdir(d)) != NULL) {
+		unsigned char sha1[20];
+		struct stat st;
+		int flag;
+		const char *refdir;
 
-			if (de->d_name[0] == '.')
-				continue;
-			namelen = strlen(de->d_name);
-			if (namelen > 255)
-				continue;
-			if (has_extension(de->d_name, ".lock"))
-				continue;
-			memcpy(ref + baselen, de->d_name, namelen+1);
-			refdir = submodule
-				? git_path_submodule(submodule, "%s", ref)
-				: git_path("%s", ref);
-			if (stat(refdir, &st) < 0)
-				continue;
-			if (S_ISDIR(st.st_mode)) {
-				list = get_ref_dir(submodule, ref, list);
-				continue;
+		if (de->d_name[0] == '.')
+			continue;
+		if (has_extension(de->d_name, ".lock"))
+			continue;
+		strbuf_setlen(&ref, dirnamelen);
+		strbuf_addstr(&ref, de->d_name);
+		refdir = submodule
+			? git_path_submodule(submodule, "%s", ref.buf)
+			: git_path("%s", ref.buf);
+		if (stat(refdir, &st) < 0)
+			continue;
+		if (S_ISDIR(st.st_mode)) {
+			strbuf_addch(&ref, '/');
+			add_entry_to_dir(dir, create_dir_entry(dir->ref_cache,
+							       ref.buf, ref.len, 1));
+			continue;
+		}
+		if (submodule) {
+			hashclr(sha1);
+			flag = 0;
+			if (resolve_gitlink_ref(submodule, ref.buf, sha1) < 0) {
+				hashclr(sha1);
+				flag |= REF_BROKEN;
 			}
-			if (submodule) {
+		} else
+			if (!resolve_ref(ref.buf, sha1, 1, &flag)) {
 				hashclr(sha1);
-				flag = 0;
-				if (resolve_gitlink_ref(submodule, ref, sha1) < 0) {
-					hashclr(sha1);
-					flag |= REF_BROKEN;
-				}
-			} else
-				if (!resolve_ref(ref, sha1, 1, &flag)) {
-					hashclr(sha1);
-					flag |= REF_BROKEN;
-				}
-			list = add_ref(ref, sha1, flag, list, NULL);
-		}
-		free(ref);
-		closedir(dir);
+				flag |= REF_BROKEN;
+			}
+		add_entry_to_dir(dir, create_ref_entry(ref.buf, sha1, flag));
 	}
-	return sort_ref_list(list);
+	strbuf_release(&ref);
+	closedir(d);
 }
 
 struct warn_if_dangling_data {
@@ -356,19 +467,15 @@ void warn_dangling_symref(FILE *fp, const char *msg_fmt, const char *refname)
 	for_each_rawref(warn_if_dangling_symref, &data);
 }
 
-static struct ref_list *get_loose_refs(const char *submodule)
+static struct ref_dir *get_loose_refs(struct ref_cache *refs)
 {
-	if (submodule) {
-		free_ref_list(submodule_refs.loose);
-		submodule_refs.loose = get_ref_dir(submodule, "refs", NULL);
-		return submodule_refs.loose;
+	if (!refs->loose) {
+		/* Only "refs/" is read, and only when it is looked into */
+		refs->loose = create_dir_entry(refs, "", 0, 0);
+		add_entry_to_dir(&refs->loose->u.subdir,
+				 create_dir_entry(refs, "refs/", 5, 1));
 	}
-
-	if (!cached_refs.did_loose) {
-		cached_refs.loose = get_ref_dir(NULL, "refs", NULL);
-		cached_refs.did_loose = 1;
-	}
-	return cached_refs.loose;
+	return get_ref_dir(refs->loose);
 }
 
 /* We allow "recursive" symbolic refs. Only within reason, though */
@@ -378,27 +485,24 @@ static struct ref_list *get_loose_refs(const char *submodule)
 static int resolve_gitlink_packed_ref(char *name, int pathlen, const char *refname, unsigned char *result)
 {
 	FILE *f;
-	struct cached_refs refs;
-	struct ref_list *ref;
+	struct ref_dir refs;
+	struct ref_entry *ref;
 	int retval;
 
 	strcpy(name + pathlen, "packed-refs");
 	f = fopen(name, "r");
 	if (!f)
 		return -1;
+	memset(&refs, 0, sizeof(refs));
 	read_packed_refs(f, &refs);
 	fclose(f);
-	ref = refs.packed;
+	ref = find_ref(&refs, refname);
 	retval = -1;
-	while (ref) {
-		if (!strcmp(ref->name, refname)) {
-			retval = 0;
-			memcpy(result, ref->sha1, 20);
-			break;
-		}
-		ref = ref->next;
+	if (ref) {
+		retval = 0;
+		memcpy(result, ref->u.value.sha1, 20);
 	}
-	free_ref_list(refs.packed);
+	clear_ref_dir(&refs);
 	return retval;
 }
 
@@ -499,15 +603,13 @@ const char *resolve_ref(const char *ref, unsigned char *sha1, int reading, int *
 		git_snpath(path, sizeof(path), "%s", ref);
 		/* Special case: non-existing file. */
 		if (lstat(path, &st) < 0) {
-			struct ref_list *list = get_packed_refs(NULL);
-			while (list) {
-				if (!strcmp(ref, list->name)) {
-					hashcpy(sha1, list->sha1);
-					if (flag)
-						*flag |= REF_ISPACKED;
-					return ref;
-				}
-				list = list->next;
+			struct ref_entry *entry;
+			entry = find_ref(get_packed_refs(&cached_refs), ref);
+			if (entry) {
+				hashcpy(sha1, entry->u.value.sha1);
+				if (flag)
+					*flag |= REF_ISPACKED;
+				return ref;
 			}
 			if (reading || errno != ENOENT)
 				return NULL;
@@ -582,7 +684,7 @@ int read_ref(const char *ref, unsigned char *sha1)
 
 #define DO_FOR_EACH_INCLUDE_BROKEN 01
 static int do_one_ref(const char *base, each_ref_fn fn, int trim,
-		      int flags, void *cb_data, struct ref_list *entry)
+		      int flags, void *cb_data, struct ref_entry *entry)
 {
 	if (prefixcmp(entry->name, base))
 		return 0;
@@ -590,13 +692,13 @@ static int do_one_ref(const char *base, each_ref_fn fn, int trim,
 	if (!(flags & DO_FOR_EACH_INCLUDE_BROKEN)) {
 		if (entry->flag & REF_BROKEN)
 			return 0; /* ignore dangling symref */
-		if (!has_sha1_file(entry->sha1)) {
+		if (!has_sha1_file(entry->u.value.sha1)) {
 			error("%s does not point to a valid object!", entry->name);
 			return 0;
 		}
 	}
 	current_ref = entry;
-	return fn(entry->name + trim, entry->sha1, entry->flag, cb_data);
+	return fn(entry->name + trim, entry->u.value.sha1, entry->flag, cb_data);
 }
 
 static int filter_refs(const char *ref, const unsigned char *sha, int flags,
@@ -617,10 +719,10 @@ int peel_ref(const char *ref, unsigned char *sha1)
 	if (current_ref && (current_ref->name == ref
 		|| !strcmp(current_ref->name, ref))) {
 		if (current_ref->flag & REF_KNOWS_PEELED) {
-			hashcpy(sha1, current_ref->peeled);
+			hashcpy(sha1, current_ref->u.value.peeled);
 			return 0;
 		}
-		hashcpy(base, current_ref->sha1);
+		hashcpy(base, current_ref->u.value.sha1);
 		goto fallback;
 	}
 
@@ -628,19 +730,14 @@ int peel_ref(const char *ref, unsigned char *sha1)
 		return -1;
 
 	if ((flag & REF_ISPACKED)) {
-		struct ref_list *list = get_packed_refs(NULL);
+		struct ref_entry *entry;
 
-		while (list) {
-			if (!strcmp(list->name, ref)) {
-				if (list->flag & REF_KNOWS_PEELED) {
-					hashcpy(sha1, list->peeled);
-					return 0;
-				}
-				/* older pack-refs did not leave peeled ones */
-				break;
-			}
-			list = list->next;
+		entry = find_ref(get_packed_refs(&cached_refs), ref);
+		if (entry && entry->flag & REF_KNOWS_PEELED) {
+			hashcpy(sha1, entry->u.value.peeled);
+			return 0;
 		}
+		/* older pack-refs did not leave peeled ones */
 	}
 
 fallback:
@@ -655,44 +752,117 @@ fallback:
 	return -1;
 }
 
-static int do_for_each_ref(const char *submodule, const char *base, each_ref_fn fn,
-			   int trim, int flags, void *cb_data)
+static int do_for_each_ref_in_dir(struct ref_dir *dir, const char *base,
+				  each_ref_fn fn, int trim, int flags,
+				  void *cb_data)
 {
-	int retval = 0;
-	struct ref_list *packed = get_packed_refs(submodule);
-	struct ref_list *loose = get_loose_refs(submodule);
+	int i, retval = 0;
 
-	struct ref_list *extra;
+	sort_ref_dir(dir);
+	for (i = 0; i < dir->nr && !retval; i++) {
+		struct ref_entry *entry = dir->entries[i];
+		if (entry->flag & REF_DIR)
+			retval = do_for_each_ref_in_dir(get_ref_dir(entry), base,
+							fn, trim, flags, cb_data);
+		else
+			retval = do_one_ref(base, fn, trim, flags, cb_data, entry);
+	}
+	return retval;
+}
+
+/*
+ * Walk the packed and the loose refs of one directory together, in
+ * order; a loose ref hides the packed ref of the same name.
+ */
+static int do_for_each_ref_in_dirs(struct ref_dir *packed,
+				   struct ref_dir *loose, const char *base,
+				   each_ref_fn fn, int trim, int flags,
+				   void *cb_data)
+{
+	int i = 0, j = 0, retval = 0;
 
-	for (extra = extra_refs; extra; extra = extra->next)
-		retval = do_one_ref(base, fn, trim, flags, cb_data, extra);
+	sort_ref_dir(packed);
+	sort_ref_dir(loose);
+	while (!retval && i < packed->nr && j < loose->nr) {
+		struct ref_entry *p = packed->entries[i];
+		struct ref_entry *l = loose->entries[j];
+		int cmp = strcmp(p->name, l->name);
 
-	while (packed && loose) {
-		struct ref_list *entry;
-		int cmp = strcmp(packed->name, loose->name);
 		if (!cmp) {
-			packed = packed->next;
+			i++;
+			j++;
+			if ((p->flag & REF_DIR) && (l->flag & REF_DIR))
+				retval = do_for_each_ref_in_dirs(get_ref_dir(p),
+						get_ref_dir(l), base,
+						fn, trim, flags, cb_data);
+			else if (l->flag & REF_DIR)
+				retval = do_for_each_ref_in_dir(get_ref_dir(l),
+						base, fn, trim, flags, cb_data);
+			else
+				retval = do_one_ref(base, fn, trim, flags,
+						    cb_data, l);
 			continue;
 		}
 		if (cmp > 0) {
-			entry = loose;
-			loose = loose->next;
+			p = l;
+			j++;
 		} else {
-			entry = packed;
-			packed = packed->next;
+			i++;
 		}
-		retval = do_one_ref(base, fn, trim, flags, cb_data, entry);
-		if (retval)
-			goto end_each;
+		if (p->flag & REF_DIR)
+			retval = do_for_each_ref_in_dir(get_ref_dir(p), base,
+							fn, trim, flags, cb_data);
+		else
+			retval = do_one_ref(base, fn, trim, flags, cb_data, p);
 	}
-
-	for (packed = packed ? packed : loose; packed; packed = packed->next) {
-		retval = do_one_ref(base, fn, trim, flags, cb_data, packed);
-		if (retval)
-			goto end_each;
+	for (; !retval && i < packed->nr; i++) {
+		struct ref_entry *p = packed->entries[i];
+		if (p->flag & REF_DIR)
+			retval = do_for_each_ref_in_dir(get_ref_dir(p), base,
+							fn, trim, flags, cb_data);
+		else
+			retval = do_one_ref(base, fn, trim, flags, cb_data, p);
+	}
+	for (; !retval && j < loose->nr; j++) {
+		struct ref_entry *l = loose->entries[j];
+		if (l->flag & REF_DIR)
+			retval = do_for_each_ref_in_dir(get_ref_dir(l), base,
+							fn, trim, flags, cb_data);
+		else
+			retval = do_one_ref(base, fn, trim, flags, cb_data, l);
 	}
+	return retval;
+}
+
+static int do_for_each_ref(const char *submodule, const char *base, each_ref_fn fn,
+			   int trim, int flags, void *cb_data)
+{
+	int i, retval = 0;
+	struct ref_cache *refs = get_ref_cache(submodule);
+	struct ref_dir *packed = get_packed_refs(refs);
+	struct ref_dir *loose = get_loose_refs(refs);
+
+	for (i = 0; i < extra_refs.nr; i++)
+		retval = do_one_ref(base, fn, trim, flags, cb_data,
+				    extra_refs.entries[i]);
+
+	/*
+	 * Only look into the directory holding the refs that start
+	 * with "base", e.g. "refs/tags/" for "refs/tags/" or
+	 * "refs/tags/v1", so that its siblings are never read.
+	 */
+	packed = find_containing_dir(packed, base, 0);
+	loose = find_containing_dir(loose, base, 0);
+	if (packed && loose)
+		retval = do_for_each_ref_in_dirs(packed, loose, base,
+						 fn, trim, flags, cb_data);
+	else if (packed)
+		retval = do_for_each_ref_in_dir(packed, base,
+						fn, trim, flags, cb_data);
+	else if (loose)
+		retval = do_for_each_ref_in_dir(loose, base,
+						fn, trim, flags, cb_data);
 
-end_each:
 	current_ref = NULL;
 	return retval;
 }
@@ -1002,27 +1172,61 @@ static int remove_empty_directories(const char *file)
 	return result;
 }
 
+/* Find the first ref under "dir" other than "skip", or NULL. */
+static struct ref_entry *first_ref_in_dir(struct ref_dir *dir, const char *skip)
+{
+	int i;
+
+	sort_ref_dir(dir);
+	for (i = 0; i < dir->nr; i++) {
+		struct ref_entry *entry = dir->entries[i];
+		if (entry->flag & REF_DIR) {
+			entry = first_ref_in_dir(get_ref_dir(entry), skip);
+			if (entry)
+				return entry;
+		} else if (!skip || strcmp(skip, entry->name))
+			return entry;
+	}
+	return NULL;
+}
+
+/*
+ * "ref" (e.g. 'foo/bar') cannot be created if 'foo' is a ref, or if
+ * there are refs under 'foo/bar/', not counting "oldref".
+ */
 static int is_refname_available(const char *ref, const char *oldref,
-				struct ref_list *list, int quiet)
-{
-	int namlen = strlen(ref); /* e.g. 'foo/bar' */
-	while (list) {
-		/* list->name could be 'foo' or 'foo/bar/baz' */
-		if (!oldref || strcmp(oldref, list->name)) {
-			int len = strlen(list->name);
-			int cmplen = (namlen < len) ? namlen : len;
-			const char *lead = (namlen < len) ? list->name : ref;
-			if (!strncmp(ref, list->name, cmplen) &&
-			    lead[cmplen] == '/') {
-				if (!quiet)
-					error("'%s' exists; cannot create '%s'",
-					      list->name, ref);
-				return 0;
-			}
-		}
-		list = list->next;
+				struct ref_dir *dir, int quiet)
+{
+	struct strbuf dirname = STRBUF_INIT;
+	struct ref_entry *entry = NULL;
+	const char *slash;
+	int pos;
+
+	for (slash = strchr(ref, '/'); slash; slash = strchr(slash + 1, '/')) {
+		char *prefix = xmemdupz(ref, slash - ref);
+		entry = find_ref(dir, prefix);
+		free(prefix);
+		if (entry && (!oldref || strcmp(oldref, entry->name)))
+			goto conflict;
+		entry = NULL;
 	}
-	return 1;
+
+	dir = find_containing_dir(dir, ref, 0);
+	if (!dir)
+		return 1;
+	strbuf_addf(&dirname, "%s/", ref);
+	pos = search_ref_dir(dir, dirname.buf, dirname.len);
+	strbuf_release(&dirname);
+	if (pos < 0)
+		return 1;
+	entry = first_ref_in_dir(get_ref_dir(dir->entries[pos]), oldref);
+	if (!entry)
+		return 1;
+
+conflict:
+	if (!quiet)
+		error("'%s' exists; cannot create '%s'", entry->name, ref);
+	return 0;
 }
 
 static struct ref_lock *lock_ref_sha1_basic(const char *ref, const unsigned char *old_sha1, int flags, int *type_p)
@@ -1068,7 +1272,7 @@ static struct ref_lock *lock_ref_sha1_basic(const char *ref, const unsigned char
 	 * name is a proper prefix of our refname.
 	 */
 	if (missing &&
-	     !is_refname_available(ref, NULL, get_packed_refs(NULL), 0)) {
+	     !is_refname_available(ref, NULL, get_packed_refs(&cached_refs), 0)) {
 		last_errno = ENOTDIR;
 		goto error_return;
 	}
@@ -1125,40 +1329,45 @@ struct ref_lock *lock_any_ref_for_update(const char *ref, const unsigned char *o
 
 static struct lock_file packlock;
 
+struct repack_without_ref_data {
+	int fd;
+	const char *refname;
+};
+
+static int repack_ref_fn(const char *refname, const unsigned char *sha1,
+			 int flags, void *cb_data)
+{
+	struct repack_without_ref_data *data = cb_data;
+	char line[PATH_MAX + 100];
+	int len;
+
+	if (!strcmp(refname, data->refname))
+		return 0;
+	len = snprintf(line, sizeof(line), "%s %s\n",
+		       sha1_to_hex(sha1), refname);
+	/* this should not happen but just being defensive */
+	if (len > sizeof(line))
+		die("too long a refname '%s'", refname);
+	write_or_die(data->fd, line, len);
+	return 0;
+}
+
 static int repack_without_ref(const char *refname)
 {
-	struct ref_list *list, *packed_ref_list;
-	int fd;
-	int found = 0;
+	struct ref_dir *packed = get_packed_refs(&cached_refs);
+	struct repack_without_ref_data data;
 
-	packed_ref_list = get_packed_refs(NULL);
-	for (list = packed_ref_list; list; list = list->next) {
-		if (!strcmp(refname, list->name)) {
-			found = 1;
-			break;
-		}
-	}
-	if (!found)
+	if (!find_ref(packed, refname))
 		return 0;
-	fd = hold_lock_file_for_update(&packlock, git_path("packed-refs"), 0);
-	if (fd < 0) {
+	data.refname = refname;
+	data.fd = hold_lock_file_for_update(&packlock, git_path("packed-refs"), 0);
+	if (data.fd < 0) {
 		unable_to_lock_error(git_path("packed-refs"), errno);
 		return error("cannot delete '%s' from packed refs", refname);
 	}
-
-	for (list = packed_ref_list; list; list = list->next) {
-		char line[PATH_MAX + 100];
-		int len;
-
-		if (!strcmp(refname, list->name))
-			continue;
-		len = snprintf(line, sizeof(line), "%s %s\n",
-			       sha1_to_hex(list->sha1), list->name);
-		/* this should not happen but just being defensive */
-		if (len > sizeof(line))
-			die("too long a refname '%s'", list->name);
-		write_or_die(fd, line, len);
-	}
+	do_for_each_ref_in_dir(packed, "", repack_ref_fn, 0,
+			       DO_FOR_EACH_INCLUDE_BROKEN, &data);
+	current_ref = NULL;
 	return commit_lock_file(&packlock);
 }
 
@@ -1229,10 +1438,10 @@ int rename_ref(const char *oldref, const char *newref, const char *logmsg)
 	if (!symref)
 		return error("refname %s not found", oldref);
 
-	if (!is_refname_available(newref, oldref, get_packed_refs(NULL), 0))
+	if (!is_refname_available(newref, oldref, get_packed_refs(&cached_refs), 0))
 		return 1;
 
-	if (!is_refname_available(newref, oldref, get_loose_refs(NULL), 0))
+	if (!is_refname_available(newref, oldref, get_loose_refs(&cached_refs), 0))
 		return 1;
 
 	lock = lock_ref_sha1_basic(renamed_ref, NULL, 0, NULL);
@@ -2036,6 +2036,7 @@ static int commit_match(struct commit *commit, struct rev_info *opt)
 {
 	if (!opt->grep_filter.pattern_list && !opt->grep_filter.header_list)
 		return 1;
+	load_commit_buffer(commit);
 	return grep_buffer(&opt->grep_filter,
 			   NULL, /* we say nothing, not even filename */
 			   commit->buffer, strlen(commit->buffer));
@@ -2305,12 +2306,16 @@ struct commit *get_revision(struct rev_info *revs)
 		revs->reverse_output_stage = 1;
 	}
 
-	if (revs->reverse_output_stage)
-		return pop_commit(&revs->commits);
-
-	c = get_revision_internal(revs);
-	if (c && revs->graph)
-		graph_update(revs->graph, c);
+	if (revs->reverse_output_stage) {
+		c = pop_commit(&revs->commits);
+	} else {
+		c = get_revision_internal(revs);
+		if (c && revs->graph)
+			graph_update(revs->graph, c);
+	}
+	/* commits parsed from the commit-graph come without a buffer */
+	if (c && save_commit_buffer)
+		load_commit_buffer(c);
 	return c;
 }
 
@@ -18,6 +18,8 @@
 #include "refs.h"
 #include "pack-revindex.h"
 #include "sha1-lookup.h"
+#include "midx.h"
+#include "thread-utils.h"
 
 #ifndef O_NOATIME
 #if defined(__linux__) && (defined(__i386__) || defined(__PPC__))
@@ -586,6 +588,112 @@ int open_pack_index(struct packed_git *p)
 	return ret;
 }
 
+static int open_pack_sizes(struct packed_git *p)
+{
+	const struct pack_sizes_header *hdr;
+	char *sizes_name;
+	struct stat st;
+	size_t size;
+	void *map;
+	uint32_t nr_large;
+	int fd;
+
+	if (p->sizes_checked)
+		return p->sizes_data ? 0 : -1;
+	p->sizes_checked = 1;
+	if (open_pack_index(p))
+		return -1;
+
+	sizes_name = xstrdup(p->pack_name);
+	strcpy(sizes_name + strlen(sizes_name) - strlen(".pack"), ".sizes");
+	fd = git_open_noatime(sizes_name);
+	free(sizes_name);
+	if (fd < 0)
+		return -1;
+	if (fstat(fd, &st) || st.st_size < sizeof(*hdr) + 20) {
+		close(fd);
+		return -1;
+	}
+	size = xsize_t(st.st_size);
+	map = xmmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	hdr = map;
+	nr_large = ntohl(hdr->nr_large);
+	if (ntohl(hdr->signature) != PACK_SIZES_SIGNATURE ||
+	    ntohl(hdr->version) != PACK_SIZES_VERSION) {
+		warning("ignoring sizes file of unknown format for %s",
+			p->pack_name);
+		goto fail;
+	}
+	if (ntohl(hdr->nr_objects) != p->num_objects ||
+	    hashcmp(hdr->checksum,
+		    (const unsigned char *)p->index_data + p->index_size - 40)) {
+		warning("ignoring stale sizes file for %s", p->pack_name);
+		goto fail;
+	}
+	if (nr_large > p->num_objects ||
+	    size != sizeof(*hdr) + p->num_objects * 5 +
+		    (size_t)nr_large * 8 + 20) {
+		warning("ignoring corrupt sizes file for %s", p->pack_name);
+		goto fail;
+	}
+	p->sizes_data = map;
+	p->sizes_size = size;
+	return 0;
+
+fail:
+	munmap(map, size);
+	return -1;
+}
+
+static int find_pack_entry_pos(const unsigned char *sha1,
+			       struct packed_git *p);
+
+/*
+ * Look up the type and size of object "sha1" in the sizes file of
+ * pack "p", if it has one.  Returns the type, or -1 if the pack has
+ * no usable sizes file.
+ */
+int packed_object_size(struct packed_git *p, const unsigned char *sha1,
+		       unsigned long *sizep)
+{
+	const struct pack_sizes_header *hdr;
+	const unsigned char *base;
+	uint32_t size, nr_large;
+	int pos, type;
+
+	if (open_pack_sizes(p))
+		return -1;
+	pos = find_pack_entry_pos(sha1, p);
+	if (pos < 0)
+		return -1;
+
+	hdr = p->sizes_data;
+	nr_large = ntohl(hdr->nr_large);
+	base = (const unsigned char *)p->sizes_data + sizeof(*hdr);
+	type = base[p->num_objects * 4 + nr_large * 8 + pos];
+	if (type < OBJ_COMMIT || type > OBJ_BLOB)
+		return -1;
+	if (!sizep)
+		return type;
+
+	size = ntohl(*((uint32_t *)(base + pos * 4)));
+	if (!(size & 0x80000000)) {
+		*sizep = size;
+	} else {
+		const uint32_t *large;
+
+		size &= 0x7fffffff;
+		if (size >= nr_large)
+			return -1;
+		large = (const uint32_t *)(base + p->num_objects * 4 + size * 8);
+		*sizep = xsize_t(((uint64_t)ntohl(large[0]) << 32) |
+				 ntohl(large[1]));
+	}
+	return type;
+}
+
 static void scan_windows(struct packed_git *p,
 	struct packed_git **lru_p,
 	struct pack_window **lru_w,
@@ -688,6 +796,12 @@ void close_pack_index(struct packed_git *p)
 		munmap((void *)p->index_data, p->index_size);
 		p->index_data = NULL;
 	}
+	if (p->sizes_data) {
+		munmap((void *)p->sizes_data, p->sizes_size);
+		p->sizes_data = NULL;
+	}
+	p->sizes_checked = 0;
+	free_pack_revindex(p);
 }
 
 /*
@@ -707,6 +821,8 @@ void free_pack_by_name(const char *pack_name)
 	while (*pp) {
 		p = *pp;
 		if (strcmp(pack_name, p->pack_name) == 0) {
+			if (p->multi_pack_index)
+				close_multi_pack_index();
 			clear_delta_base_cache();
 			close_pack_windows(p);
 			if (p->pack_fd != -1) {
@@ -996,6 +1112,9 @@ static void prepare_packed_git_one(char *objdir, int local)
 	DIR *dir;
 	struct dirent *de;
 
+	if (local)
+		prepare_multi_pack_index(objdir);
+
 	sprintf(path, "%s/pack", objdir);
 	len = strlen(path);
 	dir = opendir(path);
@@ -1107,9 +1226,28 @@ void prepare_packed_git(void)
 	prepare_packed_git_run_once = 1;
 }
 
+/*
+ * The number of packed objects, counting the ones in several packs
+ * more than once unless a multi-pack-index covers them.
+ */
+unsigned long approximate_object_count(void)
+{
+	struct packed_git *p;
+	unsigned long count = 0;
+
+	prepare_packed_git();
+	if (multi_pack_index)
+		count = multi_pack_index->num_objects;
+	for (p = packed_git; p; p = p->next) {
+		if (p->multi_pack_index || open_pack_index(p))
+			continue;
+		count += p->num_objects;
+	}
+	return count;
+}
+
 void reprepare_packed_git(void)
 {
-	discard_revindex();
 	prepare_packed_git_run_once = 0;
 	prepare_packed_git();
 }
@@ -1505,6 +1643,7 @@ static off_t get_delta_base(struct packed_git *p,
 
 /* forward declaration for a mutually recursive function */
 static int packed_object_info(struct packed_git *p, off_t offset,
+			      const unsigned char *sha1,
 			      unsigned long *sizep, int *rtype);
 
 static int packed_delta_info(struct packed_git *p,
@@ -1519,14 +1658,13 @@ static int packed_delta_info(struct packed_git *p,
 	base_offset = get_delta_base(p, w_curs, &curpos, type, obj_offset);
 	if (!base_offset)
 		return OBJ_BAD;
-	type = packed_object_info(p, base_offset, NULL, NULL);
+	type = packed_object_info(p, base_offset, NULL, NULL, NULL);
 	if (type <= OBJ_NONE) {
-		struct revindex_entry *revidx;
 		const unsigned char *base_sha1;
-		revidx = find_pack_revindex(p, base_offset);
-		if (!revidx)
+		int pos = find_pack_revindex(p, base_offset);
+		if (pos < 0)
 			return OBJ_BAD;
-		base_sha1 = nth_packed_object_sha1(p, revidx->nr);
+		base_sha1 = nth_packed_object_sha1(p, pack_pos_to_index(p, pos));
 		mark_bad_packed_object(p, base_sha1);
 		type = sha1_object_info(base_sha1, NULL);
 		if (type <= OBJ_NONE)
@@ -1573,13 +1711,19 @@ int unpack_object_header(struct packed_git *p,
 	return type;
 }
 
+/*
+ * "sha1" names the object at "obj_offset" if the caller knows it; it
+ * is needed to look the object up in the sizes file of the pack.
+ */
 static int packed_object_info(struct packed_git *p, off_t obj_offset,
+			      const unsigned char *sha1,
 			      unsigned long *sizep, int *rtype)
 {
 	struct pack_window *w_curs = NULL;
 	unsigned long size;
 	off_t curpos = obj_offset;
 	enum object_type type;
+	int final_type;
 
 	type = unpack_object_header(p, &w_curs, &curpos, &size);
 	if (rtype)
@@ -1588,6 +1732,15 @@ static int packed_object_info(struct packed_git *p, off_t obj_offset,
 	switch (type) {
 	case OBJ_OFS_DELTA:
 	case OBJ_REF_DELTA:
+		/*
+		 * A sizes file spares us walking the delta chain and
+		 * inflating the delta to learn the final type and size.
+		 */
+		final_type = sha1 ? packed_object_size(p, sha1, sizep) : -1;
+		if (final_type > 0) {
+			type = final_type;
+			break;
+		}
 		type = packed_delta_info(p, &w_curs, curpos,
 					 type, obj_offset, sizep);
 		break;
@@ -1639,117 +1792,230 @@ static void *unpack_compressed_entry(struct packed_git *p,
 	return buffer;
 }
 
-#define MAX_DELTA_CACHE (256)
-
 static size_t delta_base_cached;
+static unsigned long delta_base_nr;
 
+/*
+ * The cached bases are kept in a chained hash table keyed by pack and
+ * offset, so that two hot bases never push each other out merely
+ * because they hash to the same slot; only the byte and entry limits
+ * decide what is evicted, least recently used first.  Blobs are less
+ * likely to be needed again than trees and commits, so they live in
+ * their own list and are evicted before anything else.
+ */
 static struct delta_base_cache_lru_list {
 	struct delta_base_cache_lru_list *prev;
 	struct delta_base_cache_lru_list *next;
-} delta_base_cache_lru = { &delta_base_cache_lru, &delta_base_cache_lru };
+} delta_base_cache_lru[2] = {
+	{ &delta_base_cache_lru[0], &delta_base_cache_lru[0] },
+	{ &delta_base_cache_lru[1], &delta_base_cache_lru[1] },
+};
+
+#define DELTA_BASE_LRU(type) (&delta_base_cache_lru[(type) != OBJ_BLOB])
 
 static struct delta_base_cache_entry {
 	struct delta_base_cache_lru_list lru;
+	struct delta_base_cache_entry *next;
 	void *data;
 	struct packed_git *p;
 	off_t base_offset;
 	unsigned long size;
 	enum object_type type;
-} delta_base_cache[MAX_DELTA_CACHE];
+} **delta_base_cache;
+static unsigned int delta_base_cache_size;
 
-static unsigned long pack_entry_hash(struct packed_git *p, off_t base_offset)
+static struct delta_base_cache_stats {
+	unsigned long hits;
+	unsigned long misses;
+	unsigned long evictions;
+	size_t peak;
+} delta_base_cache_stats;
+
+static unsigned int pack_entry_hash(struct packed_git *p, off_t base_offset)
 {
 	unsigned long hash;
 
 	hash = (unsigned long)p + (unsigned long)base_offset;
 	hash += (hash >> 8) + (hash >> 16);
-	return hash % MAX_DELTA_CACHE;
+	return hash & (delta_base_cache_size - 1);
+}
+
+static struct delta_base_cache_entry **find_delta_base_cache(struct packed_git *p,
+							      off_t base_offset)
+{
+	struct delta_base_cache_entry **pos;
+
+	if (!delta_base_cache)
+		return NULL;
+	pos = &delta_base_cache[pack_entry_hash(p, base_offset)];
+	for (; *pos; pos = &(*pos)->next)
+		if ((*pos)->p == p && (*pos)->base_offset == base_offset)
+			return pos;
+	return NULL;
 }
 
 static int in_delta_base_cache(struct packed_git *p, off_t base_offset)
 {
-	unsigned long hash = pack_entry_hash(p, base_offset);
-	struct delta_base_cache_entry *ent = delta_base_cache + hash;
-	return (ent->data && ent->p == p && ent->base_offset == base_offset);
+	return !!find_delta_base_cache(p, base_offset);
+}
+
+static void lru_unlink(struct delta_base_cache_lru_list *lru)
+{
+	lru->next->prev = lru->prev;
+	lru->prev->next = lru->next;
+}
+
+static void lru_append(struct delta_base_cache_lru_list *head,
+		       struct delta_base_cache_lru_list *lru)
+{
+	lru->next = head;
+	lru->prev = head->prev;
+	head->prev->next = lru;
+	head->prev = lru;
+}
+
+static void detach_delta_base_cache(struct delta_base_cache_entry **pos)
+{
+	struct delta_base_cache_entry *ent = *pos;
+
+	*pos = ent->next;
+	lru_unlink(&ent->lru);
+	delta_base_cached -= ent->size;
+	delta_base_nr--;
 }
 
 static void *cache_or_unpack_entry(struct packed_git *p, off_t base_offset,
 	unsigned long *base_size, enum object_type *type, int keep_cache)
 {
 	void *ret;
-	unsigned long hash = pack_entry_hash(p, base_offset);
-	struct delta_base_cache_entry *ent = delta_base_cache + hash;
+	struct delta_base_cache_entry **pos, *ent;
 
-	ret = ent->data;
-	if (!ret || ent->p != p || ent->base_offset != base_offset)
+	pos = find_delta_base_cache(p, base_offset);
+	if (!pos) {
+		delta_base_cache_stats.misses++;
 		return unpack_entry(p, base_offset, type, base_size);
+	}
+	delta_base_cache_stats.hits++;
 
+	ent = *pos;
+	*type = ent->type;
+	*base_size = ent->size;
 	if (!keep_cache) {
-		ent->data = NULL;
-		ent->lru.next->prev = ent->lru.prev;
-		ent->lru.prev->next = ent->lru.next;
-		delta_base_cached -= ent->size;
+		detach_delta_base_cache(pos);
+		ret = ent->data;
+		free(ent);
 	} else {
 		ret = xmemdupz(ent->data, ent->size);
+		/* move it to the most recently used end */
+		lru_unlink(&ent->lru);
+		lru_append(DELTA_BASE_LRU(ent->type), &ent->lru);
 	}
-	*type = ent->type;
-	*base_size = ent->size;
 	return ret;
 }
 
-static inline void release_delta_base_cache(struct delta_base_cache_entry *ent)
+static void release_delta_base_cache(struct delta_base_cache_entry *ent)
 {
-	if (ent->data) {
-		free(ent->data);
-		ent->data = NULL;
-		ent->lru.next->prev = ent->lru.prev;
-		ent->lru.prev->next = ent->lru.next;
-		delta_base_cached -= ent->size;
-	}
+	struct delta_base_cache_entry **pos;
+
+	pos = &delta_base_cache[pack_entry_hash(ent->p, ent->base_offset)];
+	while (*pos != ent)
+		pos = &(*pos)->next;
+	detach_delta_base_cache(pos);
+	free(ent->data);
+	free(ent);
 }
 
 void clear_delta_base_cache(void)
 {
-	unsigned long p;
-	for (p = 0; p < MAX_DELTA_CACHE; p++)
-		release_delta_base_cache(&delta_base_cache[p]);
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(delta_base_cache_lru); i++) {
+		struct delta_base_cache_lru_list *head = &delta_base_cache_lru[i];
+		while (head->next != head)
+			release_delta_base_cache((void *)head->next);
+	}
+}
+
+static void grow_delta_base_cache(void)
+{
+	struct delta_base_cache_lru_list *head, *lru;
+	unsigned int i;
+
+	free(delta_base_cache);
+	delta_base_cache_size = delta_base_cache_size ? delta_base_cache_size * 2 : 256;
+	delta_base_cache = xcalloc(delta_base_cache_size, sizeof(*delta_base_cache));
+	for (head = delta_base_cache_lru;
+	     head < delta_base_cache_lru + ARRAY_SIZE(delta_base_cache_lru);
+	     head++) {
+		for (lru = head->next; lru != head; lru = lru->next) {
+			struct delta_base_cache_entry *ent = (void *)lru;
+			i = pack_entry_hash(ent->p, ent->base_offset);
+			ent->next = delta_base_cache[i];
+			delta_base_cache[i] = ent;
+		}
+	}
+}
+
+static int delta_base_cache_full(void)
+{
+	return delta_base_cached > delta_base_cache_limit ||
+		(delta_base_cache_entries &&
+		 delta_base_nr >= delta_base_cache_entries);
+}
+
+static void trace_delta_base_cache_stats(void)
+{
+	struct strbuf buf = STRBUF_INIT;
+
+	strbuf_addf(&buf, "delta base cache: hits %lu, misses %lu, "
+		    "evictions %lu, peak %lu bytes\n",
+		    delta_base_cache_stats.hits,
+		    delta_base_cache_stats.misses,
+		    delta_base_cache_stats.evictions,
+		    (unsigned long)delta_base_cache_stats.peak);
+	trace_strbuf("GIT_TRACE_DELTA_BASE_CACHE", &buf);
+	strbuf_release(&buf);
 }
 
 static void add_delta_base_cache(struct packed_git *p, off_t base_offset,
 	void *base, unsigned long base_size, enum object_type type)
 {
-	unsigned long hash = pack_entry_hash(p, base_offset);
-	struct delta_base_cache_entry *ent = delta_base_cache + hash;
-	struct delta_base_cache_lru_list *lru;
+	struct delta_base_cache_entry *ent, **pos;
+	struct delta_base_cache_lru_list *head;
 
-	release_delta_base_cache(ent);
+	if (!delta_base_cache && trace_want("GIT_TRACE_DELTA_BASE_CACHE"))
+		atexit(trace_delta_base_cache_stats);
+
+	pos = find_delta_base_cache(p, base_offset);
+	if (pos)
+		release_delta_base_cache(*pos);
 	delta_base_cached += base_size;
 
-	for (lru = delta_base_cache_lru.next;
-	     delta_base_cached > delta_base_cache_limit
-	     && lru != &delta_base_cache_lru;
-	     lru = lru->next) {
-		struct delta_base_cache_entry *f = (void *)lru;
-		if (f->type == OBJ_BLOB)
-			release_delta_base_cache(f);
-	}
-	for (lru = delta_base_cache_lru.next;
-	     delta_base_cached > delta_base_cache_limit
-	     && lru != &delta_base_cache_lru;
-	     lru = lru->next) {
-		struct delta_base_cache_entry *f = (void *)lru;
-		release_delta_base_cache(f);
+	for (head = delta_base_cache_lru;
+	     head < delta_base_cache_lru + ARRAY_SIZE(delta_base_cache_lru);
+	     head++) {
+		while (delta_base_cache_full() && head->next != head) {
+			release_delta_base_cache((void *)head->next);
+			delta_base_cache_stats.evictions++;
+		}
 	}
 
+	if (delta_base_nr >= delta_base_cache_size / 2)
+		grow_delta_base_cache();
+
+	ent = xmalloc(sizeof(*ent));
 	ent->p = p;
 	ent->base_offset = base_offset;
 	ent->type = type;
 	ent->data = base;
 	ent->size = base_size;
-	ent->lru.next = &delta_base_cache_lru;
-	ent->lru.prev = delta_base_cache_lru.prev;
-	delta_base_cache_lru.prev->next = &ent->lru;
-	delta_base_cache_lru.prev = &ent->lru;
+	pos = &delta_base_cache[pack_entry_hash(p, base_offset)];
+	ent->next = *pos;
+	*pos = ent;
+	delta_base_nr++;
+	lru_append(DELTA_BASE_LRU(type), &ent->lru);
+	if (delta_base_cache_stats.peak < delta_base_cached)
+		delta_base_cache_stats.peak = delta_base_cached;
 }
 
 static void *read_object(const unsigned char *sha1, enum object_type *type,
@@ -1783,12 +2049,11 @@ static void *unpack_delta_entry(struct packed_git *p,
 		 * This is costly but should happen only in the presence
 		 * of a corrupted pack, and is better than failing outright.
 		 */
-		struct revindex_entry *revidx;
 		const unsigned char *base_sha1;
-		revidx = find_pack_revindex(p, base_offset);
-		if (!revidx)
+		int pos = find_pack_revindex(p, base_offset);
+		if (pos < 0)
 			return NULL;
-		base_sha1 = nth_packed_object_sha1(p, revidx->nr);
+		base_sha1 = nth_packed_object_sha1(p, pack_pos_to_index(p, pos));
 		error("failed to read delta base object %s"
 		      " at offset %"PRIuMAX" from %s",
 		      sha1_to_hex(base_sha1), (uintmax_t)base_offset,
@@ -1848,11 +2113,11 @@ void *unpack_entry(struct packed_git *p, off_t obj_offset,
 		write_pack_access_log(p, obj_offset);
 
 	if (do_check_packed_object_crc && p->index_version > 1) {
-		struct revindex_entry *revidx = find_pack_revindex(p, obj_offset);
-		unsigned long len = revidx[1].offset - obj_offset;
-		if (check_pack_crc(p, &w_curs, obj_offset, len, revidx->nr)) {
-			const unsigned char *sha1 =
-				nth_packed_object_sha1(p, revidx->nr);
+		int pos = find_pack_revindex(p, obj_offset);
+		unsigned long len = pack_pos_to_offset(p, pos + 1) - obj_offset;
+		uint32_t nr = pack_pos_to_index(p, pos);
+		if (check_pack_crc(p, &w_curs, obj_offset, len, nr)) {
+			const unsigned char *sha1 = nth_packed_object_sha1(p, nr);
 			error("bad packed object CRC for %s",
 			      sha1_to_hex(sha1));
 			mark_bad_packed_object(p, sha1);
@@ -1921,8 +2186,12 @@ off_t nth_packed_object_offset(const struct packed_git *p, uint32_t n)
 	}
 }
 
-off_t find_pack_entry_one(const unsigned char *sha1,
-				  struct packed_git *p)
+/*
+ * Return the position of "sha1" in the index of pack "p", or -1 if
+ * the pack does not have it.
+ */
+static int find_pack_entry_pos(const unsigned char *sha1,
+			       struct packed_git *p)
 {
 	const uint32_t *level1_ofs = p->index_data;
 	const unsigned char *index = p->index_data;
@@ -1935,7 +2204,7 @@ off_t find_pack_entry_one(const unsigned char *sha1,
 
 	if (!index) {
 		if (open_pack_index(p))
-			return 0;
+			return -1;
 		level1_ofs = p->index_data;
 		index = p->index_data;
 	}
@@ -1960,11 +2229,8 @@ off_t find_pack_entry_one(const unsigned char *sha1,
 	if (use_lookup < 0)
 		use_lookup = !!getenv("GIT_USE_LOOKUP");
 	if (use_lookup) {
-		int pos = sha1_entry_pos(index, stride, 0,
-					 lo, hi, p->num_objects, sha1);
-		if (pos < 0)
-			return 0;
-		return nth_packed_object_offset(p, pos);
+		return sha1_entry_pos(index, stride, 0,
+				      lo, hi, p->num_objects, sha1);
 	}
 
 	do {
@@ -1975,13 +2241,23 @@ off_t find_pack_entry_one(const unsigned char *sha1,
 			printf("lo %u hi %u rg %u mi %u\n",
 			       lo, hi, hi - lo, mi);
 		if (!cmp)
-			return nth_packed_object_offset(p, mi);
+			return mi;
 		if (cmp > 0)
 			hi = mi;
 		else
 			lo = mi+1;
 	} while (lo < hi);
-	return 0;
+	return -1;
+}
+
+off_t find_pack_entry_one(const unsigned char *sha1,
+				  struct packed_git *p)
+{
+	int pos = find_pack_entry_pos(sha1, p);
+
+	if (pos < 0)
+		return 0;
+	return nth_packed_object_offset(p, pos);
 }
 
 static int is_pack_valid(struct packed_git *p)
@@ -2005,24 +2281,50 @@ static int is_pack_valid(struct packed_git *p)
 	return !open_packed_git(p);
 }
 
+static int is_bad_packed_object(struct packed_git *p, const unsigned char *sha1)
+{
+	unsigned i;
+
+	for (i = 0; i < p->num_bad_objects; i++)
+		if (!hashcmp(sha1, p->bad_object_sha1 + 20 * i))
+			return 1;
+	return 0;
+}
+
 static int find_pack_entry(const unsigned char *sha1, struct pack_entry *e)
 {
 	static struct packed_git *last_found = (void *)1;
 	struct packed_git *p;
 	off_t offset;
+	int skip_midx = 0;
 
 	prepare_packed_git();
 	if (!packed_git)
 		return 0;
+
+	/*
+	 * The multi-pack-index answers for all the packs it covers with
+	 * one lookup.  If it names a pack we cannot use for this object,
+	 * fall back to searching every pack below.
+	 */
+	if (multi_pack_index) {
+		if (!find_multi_pack_index_entry(sha1, &p, &offset))
+			skip_midx = 1;
+		else if (!is_bad_packed_object(p, sha1) && is_pack_valid(p)) {
+			e->offset = offset;
+			e->p = p;
+			hashcpy(e->sha1, sha1);
+			return 1;
+		}
+	}
+
 	p = (last_found == (void *)1) ? packed_git : last_found;
 
 	do {
-		if (p->num_bad_objects) {
-			unsigned i;
-			for (i = 0; i < p->num_bad_objects; i++)
-				if (!hashcmp(sha1, p->bad_object_sha1 + 20 * i))
-					goto next;
-		}
+		if (skip_midx && p->multi_pack_index)
+			goto next;
+		if (p->num_bad_objects && is_bad_packed_object(p, sha1))
+			goto next;
 
 		offset = find_pack_entry_one(sha1, p);
 		if (offset) {
@@ -2121,7 +2423,7 @@ int sha1_object_info_extended(const unsigned char *sha1, struct object_info *oi)
 			return status;
 	}
 
-	status = packed_object_info(e.p, e.offset, oi->sizep, &rtype);
+	status = packed_object_info(e.p, e.offset, sha1, oi->sizep, &rtype);
 	if (status < 0) {
 		mark_bad_packed_object(e.p, sha1);
 		status = sha1_object_info_extended(sha1, oi);
@@ -2262,6 +2564,462 @@ void *read_sha1_file_extended(const unsigned char *sha1,
 	return NULL;
 }
 
+/*
+ * Batched object reads.
+ *
+ * The objects of a batch are visited sorted by pack and offset, so
+ * that each pack is read front to back, and the kernel is asked to
+ * read ahead the parts of the packs holding them.  Undeltified packed
+ * objects are inflated by a few threads reading the pack through a
+ * descriptor of their own, while this thread reads the others (deltas,
+ * loose objects, and anything the threads failed on) with
+ * read_sha1_file().
+ *
+ * Objects of big_file_threshold or more, and those that come after the
+ * batch has read BATCH_READ_MEMORY bytes, are left to the caller.
+ */
+#define BATCH_READ_MEMORY (32 * 1024 * 1024)
+#define BATCH_READ_THREADS 4
+
+/* the pread() emulation is not thread-safe */
+#if !defined(NO_PTHREADS) && !defined(NO_PREAD)
+#define THREADED_BATCH_READ
+#endif
+
+struct batch_entry {
+	struct object_read_request *req;
+	const unsigned char *sha1;	/* after replacement */
+	struct packed_git *p;
+	off_t offset;
+
+	/* where an undeltified object is inflated from */
+	int fd;
+	off_t data_offset;
+	unsigned long data_len;
+};
+
+static int batch_entry_cmp(const void *a_, const void *b_)
+{
+	const struct batch_entry *a = *(const struct batch_entry **)a_;
+	const struct batch_entry *b = *(const struct batch_entry **)b_;
+
+	if (a->p != b->p)
+		return (uintptr_t)a->p < (uintptr_t)b->p ? -1 : 1;
+	return (a->offset < b->offset) ? -1 : (a->offset != b->offset);
+}
+
+/*
+ * Ask for the data of the objects of "p" among sorted[0..nr) to be
+ * read ahead, merging the ranges that are close to each other.
+ */
+static void prefetch_batch(int fd, struct packed_git *p,
+			   struct batch_entry **sorted, int nr)
+{
+#ifdef POSIX_FADV_WILLNEED
+	off_t start = 0, end = 0;
+	int i;
+
+	for (i = 0; i < nr; i++) {
+		int pos = find_revindex_position(p, sorted[i]->offset);
+		off_t next;
+
+		if (pos < 0)
+			continue;
+		next = pack_pos_to_offset(p, pos + 1);
+		if (end && sorted[i]->offset <= end + 65536) {
+			end = next;
+			continue;
+		}
+		if (end)
+			posix_fadvise(fd, start, end - start,
+				      POSIX_FADV_WILLNEED);
+		start = sorted[i]->offset;
+		end = next;
+	}
+	if (end)
+		posix_fadvise(fd, start, end - start, POSIX_FADV_WILLNEED);
+#endif
+}
+
+/*
+ * Decide whether "e" can be inflated by a thread, and fill in its
+ * request and where to inflate it from if so.
+ */
+static int prepare_batch_inflate(struct batch_entry *e, int fd,
+				 unsigned long *budget)
+{
+	struct pack_window *w_curs = NULL;
+	off_t curpos = e->offset;
+	unsigned long size;
+	int type, pos;
+
+	if (fd < 0 || do_check_packed_object_crc)
+		return 0;
+	type = unpack_object_header(e->p, &w_curs, &curpos, &size);
+	unuse_pack(&w_curs);
+	if (type < OBJ_COMMIT || type > OBJ_BLOB)
+		return 0;
+	if (size >= big_file_threshold || size > *budget)
+		return 0;
+	pos = find_revindex_position(e->p, e->offset);
+	if (pos < 0)
+		return 0;
+
+	e->req->type = type;
+	e->req->size = size;
+	e->fd = fd;
+	e->data_offset = curpos;
+	e->data_len = pack_pos_to_offset(e->p, pos + 1) - curpos;
+	*budget -= size;
+	return 1;
+}
+
+/*
+ * Inflate "len" bytes of compressed pack data into a buffer of "size"
+ * bytes; returns NULL if they do not inflate to exactly that.  This
+ * does not touch any global state, and is safe to call from threads.
+ */
+static void *inflate_pack_data(const unsigned char *in, unsigned long len,
+			       unsigned long size)
+{
+	unsigned char *out;
+	git_zstream stream;
+	int st;
+
+	out = xmallocz(size);
+	memset(&stream, 0, sizeof(stream));
+	stream.next_in = (unsigned char *)in;
+	stream.avail_in = len;
+	stream.next_out = out;
+	stream.avail_out = size + 1;
+	git_inflate_init(&stream);
+	st = git_inflate(&stream, Z_FINISH);
+	git_inflate_end(&stream);
+	if (st != Z_STREAM_END || stream.total_out != size) {
+		free(out);
+		return NULL;
+	}
+	return out;
+}
+
+/* Inflate a job prepared above; leaves req->buf NULL on failure */
+static void batch_inflate(struct batch_entry *e)
+{
+	unsigned char *in;
+	unsigned long done = 0;
+
+	in = xmalloc(e->data_len);
+	while (done < e->data_len) {
+		ssize_t n = pread(e->fd, in + done, e->data_len - done,
+				  e->data_offset + done);
+		if (n <= 0) {
+			free(in);
+			return;
+		}
+		done += n;
+	}
+	e->req->buf = inflate_pack_data(in, e->data_len, e->req->size);
+	free(in);
+}
+
+#ifdef THREADED_BATCH_READ
+struct batch_inflate_state {
+	struct batch_entry **jobs;
+	int nr, next;
+	pthread_mutex_t mutex;
+};
+
+static void *batch_inflate_thread(void *data)
+{
+	struct batch_inflate_state *s = data;
+
+	for (;;) {
+		int i;
+
+		pthread_mutex_lock(&s->mutex);
+		i = s->next++;
+		pthread_mutex_unlock(&s->mutex);
+		if (i >= s->nr)
+			break;
+		batch_inflate(s->jobs[i]);
+	}
+	return NULL;
+}
+#endif
+
+/* Read an object the threads did not, if it fits in the budget */
+static void batch_read_one(struct batch_entry *e, int want_contents,
+			   unsigned long *budget)
+{
+	struct object_read_request *req = e->req;
+
+	req->type = sha1_object_info(e->sha1, &req->size);
+	if (!want_contents || req->type <= 0)
+		return;
+	if (req->size >= big_file_threshold || req->size > *budget)
+		return;
+	req->buf = read_sha1_file(req->sha1, &req->type, &req->size);
+	*budget -= req->size;
+}
+
+void read_object_batch(struct object_read_request *req, int nr,
+		       int want_contents)
+{
+	struct batch_entry *entries, **sorted, **jobs, **rest;
+	unsigned long budget = BATCH_READ_MEMORY;
+	int i, j, nr_jobs = 0, nr_rest = 0, nr_threads = 0;
+#ifdef THREADED_BATCH_READ
+	struct batch_inflate_state state;
+	pthread_t threads[BATCH_READ_THREADS];
+	try_to_free_t old_try_to_free_routine = NULL;
+#endif
+
+	entries = xcalloc(nr, sizeof(*entries));
+	sorted = xmalloc(nr * sizeof(*sorted));
+	for (i = 0; i < nr; i++) {
+		struct batch_entry *e = &entries[i];
+		struct pack_entry pe;
+
+		e->req = &req[i];
+		e->sha1 = want_contents ? lookup_replace_object(req[i].sha1)
+					: req[i].sha1;
+		e->fd = -1;
+		req[i].buf = NULL;
+		if (!find_cached_object(e->sha1) && find_pack_entry(e->sha1, &pe)) {
+			e->p = pe.p;
+			e->offset = pe.offset;
+		}
+		sorted[i] = e;
+	}
+	qsort(sorted, nr, sizeof(*sorted), batch_entry_cmp);
+
+	jobs = xmalloc(nr * sizeof(*jobs));
+	rest = xmalloc(nr * sizeof(*rest));
+	for (i = 0; i < nr; i = j) {
+		struct packed_git *p = sorted[i]->p;
+		int fd = -1;
+
+		for (j = i + 1; j < nr && sorted[j]->p == p; j++)
+			; /* nothing */
+		if (p && !load_pack_revindex(p)) {
+			fd = git_open_noatime(p->pack_name);
+			if (fd >= 0)
+				prefetch_batch(fd, p, sorted + i, j - i);
+		}
+		for (; i < j; i++) {
+			if (want_contents && p &&
+			    prepare_batch_inflate(sorted[i], fd, &budget))
+				jobs[nr_jobs++] = sorted[i];
+			else
+				rest[nr_rest++] = sorted[i];
+		}
+		if (fd >= 0 && (!nr_jobs || jobs[nr_jobs - 1]->fd != fd))
+			close(fd);
+	}
+
+#ifdef THREADED_BATCH_READ
+	if (nr_jobs > 1) {
+		nr_threads = online_cpus();
+		if (nr_threads > BATCH_READ_THREADS)
+			nr_threads = BATCH_READ_THREADS;
+		if (nr_threads > nr_jobs / 2)
+			nr_threads = nr_jobs / 2;
+	}
+	if (nr_threads > 1) {
+		/* a thread running out of memory must not touch the pack windows */
+		old_try_to_free_routine = set_try_to_free_routine(NULL);
+		state.jobs = jobs;
+		state.nr = nr_jobs;
+		state.next = 0;
+		pthread_mutex_init(&state.mutex, NULL);
+		for (i = 0; i < nr_threads; i++)
+			if (pthread_create(&threads[i], NULL,
+					   batch_inflate_thread, &state))
+				die("unable to create thread");
+	} else
+		nr_threads = 0;
+#endif
+	if (!nr_threads)
+		for (i = 0; i < nr_jobs; i++)
+			batch_inflate(jobs[i]);
+
+	for (i = 0; i < nr_rest; i++)
+		batch_read_one(rest[i], want_contents, &budget);
+
+#ifdef THREADED_BATCH_READ
+	if (nr_threads) {
+		for (i = 0; i < nr_threads; i++)
+			pthread_join(threads[i], NULL);
+		pthread_mutex_destroy(&state.mutex);
+		set_try_to_free_routine(old_try_to_free_routine);
+	}
+#endif
+
+	for (i = 0; i < nr_jobs; i++) {
+		if (i + 1 == nr_jobs || jobs[i + 1]->fd != jobs[i]->fd)
+			close(jobs[i]->fd);
+		if (!jobs[i]->req->buf) {
+			budget += jobs[i]->req->size;
+			batch_read_one(jobs[i], want_contents, &budget);
+		}
+	}
+
+	free(rest);
+	free(jobs);
+	free(sorted);
+	free(entries);
+}
+
+/*
+ * Copy the compressed data of the packed object whose data starts at
+ * "curpos" and inflates to "size" bytes.  Where the next object starts
+ * is only looked up when the reverse index of the pack is loaded
+ * already, as building it would cost more than the read; otherwise
+ * this copies as much as zlib can need for "size" bytes, and inflating
+ * stops at the end of the stream.
+ */
+static unsigned char *copy_pack_data(struct packed_git *p, off_t obj_offset,
+				     off_t curpos, unsigned long size,
+				     unsigned long *len)
+{
+	struct pack_window *w_curs = NULL;
+	unsigned char *data;
+	unsigned long done = 0;
+
+	if (p->revindex || p->revindex_map) {
+		int pos = find_revindex_position(p, obj_offset);
+		if (pos < 0)
+			return NULL;
+		*len = pack_pos_to_offset(p, pos + 1) - curpos;
+	} else {
+		/* compressBound() of zlib */
+		*len = size + (size >> 12) + (size >> 14) + (size >> 25) + 13;
+		if (*len > p->pack_size - 20 - curpos)
+			*len = p->pack_size - 20 - curpos;
+	}
+	data = xmalloc(*len);
+	while (done < *len) {
+		unsigned long avail;
+		unsigned char *in = use_pack(p, &w_curs, curpos + done, &avail);
+		if (avail > *len - done)
+			avail = *len - done;
+		memcpy(data + done, in, avail);
+		done += avail;
+	}
+	unuse_pack(&w_curs);
+	return data;
+}
+
+static int prepare_packed_read(struct packed_git *p, off_t obj_offset,
+			       struct prepared_object *po)
+{
+	struct pack_window *w_curs = NULL;
+	off_t curpos = obj_offset, base_offset;
+	enum object_type type;
+	unsigned long size;
+	void *base;
+
+	if (in_delta_base_cache(p, obj_offset)) {
+		po->data = cache_or_unpack_entry(p, obj_offset, &po->size,
+						 &po->type, 1);
+		return 0;
+	}
+
+	type = unpack_object_header(p, &w_curs, &curpos, &size);
+	switch (type) {
+	case OBJ_OFS_DELTA:
+	case OBJ_REF_DELTA:
+		base_offset = get_delta_base(p, &w_curs, &curpos, type,
+					     obj_offset);
+		unuse_pack(&w_curs);
+		if (!base_offset)
+			return -1;
+		base = cache_or_unpack_entry(p, base_offset, &po->base_size,
+					     &po->type, 0);
+		if (!base)
+			return -1;
+		/* keep the base cached for the other deltas against it */
+		po->base = xmemdupz(base, po->base_size);
+		add_delta_base_cache(p, base_offset, base, po->base_size,
+				     po->type);
+		break;
+	case OBJ_COMMIT:
+	case OBJ_TREE:
+	case OBJ_BLOB:
+	case OBJ_TAG:
+		unuse_pack(&w_curs);
+		po->type = type;
+		break;
+	default:
+		unuse_pack(&w_curs);
+		return -1;
+	}
+
+	po->zdata = copy_pack_data(p, obj_offset, curpos, size, &po->zsize);
+	if (!po->zdata) {
+		free(po->base);
+		po->base = NULL;
+		return -1;
+	}
+	po->size = size;
+	return 0;
+}
+
+int prepare_object_read(const unsigned char *sha1, struct prepared_object *po)
+{
+	const unsigned char *repl = lookup_replace_object(sha1);
+	struct pack_entry e;
+
+	memset(po, 0, sizeof(*po));
+	hashcpy(po->sha1, repl);
+	if (!do_check_packed_object_crc && !log_pack_access &&
+	    !find_cached_object(repl)) {
+		if (find_pack_entry(repl, &e)) {
+			if (!prepare_packed_read(e.p, e.offset, po))
+				return 0;
+		} else {
+			po->map = map_sha1_file(repl, &po->mapsize);
+			if (po->map)
+				return 0;
+		}
+	}
+
+	/* anything unusual is read the usual way */
+	memset(po, 0, sizeof(*po));
+	po->data = read_sha1_file(sha1, &po->type, &po->size);
+	return po->data ? 0 : -1;
+}
+
+void *finish_object_read(struct prepared_object *po,
+			 enum object_type *type, unsigned long *size)
+{
+	void *data;
+
+	if (po->data) {
+		data = po->data;
+		*type = po->type;
+		*size = po->size;
+	} else if (po->map) {
+		data = unpack_sha1_file(po->map, po->mapsize, type, size,
+					po->sha1);
+		munmap(po->map, po->mapsize);
+	} else {
+		data = inflate_pack_data(po->zdata, po->zsize, po->size);
+		free(po->zdata);
+		*type = po->type;
+		*size = po->size;
+		if (data && po->base) {
+			void *delta = data;
+			data = patch_delta(po->base, po->base_size,
+					   delta, po->size, size);
+			free(delta);
+		}
+		free(po->base);
+	}
+	memset(po, 0, sizeof(*po));
+	return data;
+}
+
 void *read_object_with_reference(const unsigned char *sha1,
 				 const char *required_type_name,
 				 unsigned long *size,
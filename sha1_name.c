@@ -6,6 +6,7 @@
 #include "tree-walk.h"
 #include "refs.h"
 #include "remote.h"
+#include "midx.h"
 
 static int get_sha1_oneline(const char *, unsigned char *, struct commit_list *);
 
@@ -71,6 +72,67 @@ static int match_sha(unsigned len, const unsigned char *a, const unsigned char *
 	return 1;
 }
 
+typedef const unsigned char *(*nth_sha1_fn)(void *, uint32_t);
+
+static const unsigned char *nth_pack_sha1(void *p, uint32_t n)
+{
+	return nth_packed_object_sha1(p, n);
+}
+
+static const unsigned char *nth_midx_sha1(void *m, uint32_t n)
+{
+	return nth_multi_pack_index_sha1(m, n);
+}
+
+/*
+ * Look for "match" in a sorted table of "num" object names; "found"
+ * counts distinct candidates and is set to 2 once it is ambiguous.
+ */
+static void find_short_object_in_table(int len, const unsigned char *match,
+				       nth_sha1_fn nth, void *table, uint32_t num,
+				       const unsigned char **found_sha1, int *found)
+{
+	uint32_t first = 0, last = num;
+
+	while (first < last) {
+		uint32_t mid = (first + last) / 2;
+		const unsigned char *now;
+		int cmp;
+
+		now = nth(table, mid);
+		cmp = hashcmp(match, now);
+		if (!cmp) {
+			first = mid;
+			break;
+		}
+		if (cmp > 0) {
+			first = mid+1;
+			continue;
+		}
+		last = mid;
+	}
+	if (first < num) {
+		const unsigned char *now, *next;
+		now = nth(table, first);
+		if (match_sha(len, match, now)) {
+			next = nth(table, first+1);
+			if (!next|| !match_sha(len, match, next)) {
+				/* unique within this table */
+				if (!*found) {
+					*found_sha1 = now;
+					(*found)++;
+				}
+				else if (hashcmp(*found_sha1, now))
+					*found = 2;
+			}
+			else {
+				/* not even unique within this table */
+				*found = 2;
+			}
+		}
+	}
+}
+
 static int find_short_packed_object(int len, const unsigned char *match, unsigned char *sha1)
 {
 	struct packed_git *p;
@@ -78,52 +140,17 @@ static int find_short_packed_object(int len, const unsigned char *match, unsigne
 	int found = 0;
 
 	prepare_packed_git();
+	if (multi_pack_index)
+		find_short_object_in_table(len, match, nth_midx_sha1,
+					   multi_pack_index,
+					   multi_pack_index->num_objects,
+					   &found_sha1, &found);
 	for (p = packed_git; p && found < 2; p = p->next) {
-		uint32_t num, last;
-		uint32_t first = 0;
+		if (p->multi_pack_index)
+			continue;
 		open_pack_index(p);
-		num = p->num_objects;
-		last = num;
-		while (first < last) {
-			uint32_t mid = (first + last) / 2;
-			const unsigned char *now;
-			int cmp;
-
-			now = nth_packed_object_sha1(p, mid);
-			cmp = hashcmp(match, now);
-			if (!cmp) {
-				first = mid;
-				break;
-			}
-			if (cmp > 0) {
-				first = mid+1;
-				continue;
-			}
-			last = mid;
-		}
-		if (first < num) {
-			const unsigned char *now, *next;
-		       now = nth_packed_object_sha1(p, first);
-			if (match_sha(len, match, now)) {
-				next = nth_packed_object_sha1(p, first+1);
-			       if (!next|| !match_sha(len, match, next)) {
-					/* unique within this pack */
-					if (!found) {
-						found_sha1 = now;
-						found++;
-					}
-					else if (hashcmp(found_sha1, now)) {
-						found = 2;
-						break;
-					}
-				}
-				else {
-					/* not even unique within this pack */
-					found = 2;
-					break;
-				}
-			}
-		}
+		find_short_object_in_table(len, match, nth_pack_sha1, p,
+					   p->num_objects, &found_sha1, &found);
 	}
 	if (found == 1)
 		hashcpy(sha1, found_sha1);
@@ -0,0 +1,264 @@
+#include "cache.h"
+#include "split-index.h"
+#include "varint.h"
+
+static void discard_split_index_base(struct split_index *si)
+{
+	if (!si->base)
+		return;
+	discard_index(si->base);
+	free(si->base->cache);
+	free(si->base);
+	si->base = NULL;
+}
+
+struct split_index *init_split_index(struct index_state *istate)
+{
+	if (!istate->split_index) {
+		istate->split_index = xcalloc(1, sizeof(*istate->split_index));
+		istate->split_index->refcount = 1;
+	}
+	return istate->split_index;
+}
+
+void release_split_index(struct index_state *istate)
+{
+	struct split_index *si = istate->split_index;
+
+	if (!si)
+		return;
+	istate->split_index = NULL;
+	if (--si->refcount)
+		return;
+	discard_split_index_base(si);
+	free(si->delete_pos);
+	free(si);
+}
+
+/*
+ * The "link" extension is the name of the shared index, followed by
+ * the number of deleted entries and their positions in the shared
+ * index, each as the difference from the previous one.
+ */
+int read_link_extension(struct index_state *istate,
+			const void *data_, unsigned long sz)
+{
+	const unsigned char *data = data_, *end = data + sz;
+	struct split_index *si;
+	uint32_t i, nr, pos = 0;
+
+	if (sz < 21)
+		return error("corrupt link extension (too short)");
+	si = init_split_index(istate);
+	hashcpy(si->base_sha1, data);
+	data += 20;
+	nr = decode_varint(&data);
+	si->delete_nr = 0;
+	for (i = 0; i < nr; i++) {
+		if (end <= data)
+			return error("corrupt link extension (too short)");
+		pos += decode_varint(&data);
+		ALLOC_GROW(si->delete_pos, si->delete_nr + 1, si->delete_alloc);
+		si->delete_pos[si->delete_nr++] = pos;
+	}
+	if (data != end)
+		return error("corrupt link extension (garbage at the end)");
+	return 0;
+}
+
+void write_link_extension(struct strbuf *sb, struct index_state *istate)
+{
+	struct split_index *si = istate->split_index;
+	unsigned char varint[16];
+	uint32_t i, prev = 0;
+
+	strbuf_add(sb, si->base_sha1, 20);
+	strbuf_add(sb, varint, encode_varint(si->delete_nr, varint));
+	for (i = 0; i < si->delete_nr; i++) {
+		strbuf_add(sb, varint,
+			   encode_varint(si->delete_pos[i] - prev, varint));
+		prev = si->delete_pos[i];
+	}
+}
+
+static int compare_ce(const struct cache_entry *a, const struct cache_entry *b)
+{
+	return cache_name_compare(a->name, a->ce_flags, b->name, b->ce_flags);
+}
+
+void merge_base_index(struct index_state *istate)
+{
+	struct split_index *si = istate->split_index;
+	struct index_state *base;
+	const char *base_path;
+	struct cache_entry **cache;
+	char *alloc;
+	size_t size = 0;
+	unsigned int i, j, d, nr;
+
+	base = xcalloc(1, sizeof(*base));
+	base_path = git_path("sharedindex.%s", sha1_to_hex(si->base_sha1));
+	if (read_index_from(base, base_path) < 0 || !base->initialized)
+		die("broken index, expect %s to exist", base_path);
+	if (hashcmp(base->sha1, si->base_sha1))
+		die("broken index, expect %s in %s, got %s",
+		    sha1_to_hex(si->base_sha1), base_path,
+		    sha1_to_hex(base->sha1));
+	si->base = base;
+
+	for (d = 0; d < si->delete_nr; d++)
+		if (base->cache_nr <= si->delete_pos[d] ||
+		    (d && si->delete_pos[d] <= si->delete_pos[d - 1]))
+			die("corrupt link extension: bad position %u",
+			    si->delete_pos[d]);
+
+	/*
+	 * The entries of the base are kept as they are on disk, so that
+	 * the next write can tell what changed; the index gets copies.
+	 */
+	nr = istate->cache_nr + base->cache_nr - si->delete_nr;
+	for (i = 0; i < istate->cache_nr; i++)
+		size += ce_size(istate->cache[i]);
+	for (i = d = 0; i < base->cache_nr; i++) {
+		if (d < si->delete_nr && si->delete_pos[d] == i) {
+			d++;
+			continue;
+		}
+		size += ce_size(base->cache[i]);
+	}
+
+	cache = xcalloc(alloc_nr(nr), sizeof(*cache));
+	alloc = xmalloc(size);
+	size = 0;
+	for (i = j = d = nr = 0; i < istate->cache_nr || j < base->cache_nr; ) {
+		struct cache_entry *ce;
+		int cmp;
+
+		if (j < base->cache_nr && d < si->delete_nr &&
+		    si->delete_pos[d] == j) {
+			d++;
+			j++;
+			continue;
+		}
+		if (j == base->cache_nr)
+			cmp = -1;
+		else if (i == istate->cache_nr)
+			cmp = 1;
+		else
+			cmp = compare_ce(istate->cache[i], base->cache[j]);
+		if (!cmp)
+			die("corrupt index: %s is also in the shared index",
+			    istate->cache[i]->name);
+		ce = (cmp < 0) ? istate->cache[i++] : base->cache[j++];
+
+		cache[nr] = (struct cache_entry *)(alloc + size);
+		memcpy(cache[nr], ce, ce_size(ce));
+		size += ce_size(ce);
+		nr++;
+	}
+
+	free(istate->cache);
+	free(istate->alloc);
+	istate->cache = cache;
+	istate->cache_nr = nr;
+	istate->cache_alloc = alloc_nr(nr);
+	istate->alloc = alloc;
+
+	si->delete_nr = 0;
+}
+
+/* Does "ce" still look on disk the way "base" does? */
+static int ce_same_as_base(const struct cache_entry *ce,
+			   const struct cache_entry *base)
+{
+	unsigned int ondisk_flags = CE_NAMEMASK | CE_STAGEMASK | CE_VALID |
+		CE_EXTENDED_FLAGS;
+
+	return !memcmp(&ce->ce_ctime, &base->ce_ctime,
+		       offsetof(struct cache_entry, ce_flags) -
+		       offsetof(struct cache_entry, ce_ctime)) &&
+		(ce->ce_flags & ondisk_flags) == (base->ce_flags & ondisk_flags) &&
+		!hashcmp(ce->sha1, base->sha1);
+}
+
+unsigned int prepare_split_index(struct index_state *istate,
+				 struct cache_entry ***changed)
+{
+	struct split_index *si = istate->split_index;
+	struct index_state *base = si->base;
+	struct cache_entry **out = NULL;
+	unsigned int i, j, nr = 0, alloc = 0;
+
+	si->delete_nr = 0;
+	for (i = j = 0; i < istate->cache_nr || j < base->cache_nr; ) {
+		struct cache_entry *ce = NULL;
+		int cmp;
+
+		if (i < istate->cache_nr) {
+			ce = istate->cache[i];
+			if (ce->ce_flags & CE_REMOVE) {
+				i++;
+				continue;
+			}
+		}
+		if (j == base->cache_nr)
+			cmp = -1;
+		else if (!ce)
+			cmp = 1;
+		else
+			cmp = compare_ce(ce, base->cache[j]);
+
+		if (!cmp && ce_same_as_base(ce, base->cache[j])) {
+			i++;
+			j++;
+			continue;
+		}
+		if (cmp <= 0) {
+			ALLOC_GROW(out, nr + 1, alloc);
+			out[nr++] = ce;
+			i++;
+		}
+		if (cmp >= 0) {
+			ALLOC_GROW(si->delete_pos, si->delete_nr + 1,
+				   si->delete_alloc);
+			si->delete_pos[si->delete_nr++] = j;
+			j++;
+		}
+	}
+	*changed = out;
+	return nr;
+}
+
+void set_split_index_base(struct index_state *istate, const unsigned char *sha1)
+{
+	struct split_index *si = istate->split_index;
+	struct index_state *base;
+	size_t size = 0;
+	char *alloc;
+	unsigned int i;
+
+	discard_split_index_base(si);
+	base = xcalloc(1, sizeof(*base));
+	base->version = istate->version;
+	for (i = 0; i < istate->cache_nr; i++)
+		if (!(istate->cache[i]->ce_flags & CE_REMOVE))
+			size += ce_size(istate->cache[i]);
+	base->cache = xcalloc(alloc_nr(istate->cache_nr), sizeof(*base->cache));
+	base->cache_alloc = alloc_nr(istate->cache_nr);
+	base->alloc = alloc = xmalloc(size ? size : 1);
+	size = 0;
+	for (i = 0; i < istate->cache_nr; i++) {
+		struct cache_entry *ce = istate->cache[i];
+
+		if (ce->ce_flags & CE_REMOVE)
+			continue;
+		base->cache[base->cache_nr] = (struct cache_entry *)(alloc + size);
+		memcpy(base->cache[base->cache_nr++], ce, ce_size(ce));
+		size += ce_size(ce);
+	}
+	base->initialized = 1;
+	hashcpy(base->sha1, sha1);
+	hashcpy(si->base_sha1, sha1);
+	si->base = base;
+	si->delete_nr = 0;
+}
@@ -0,0 +1,54 @@
+#ifndef SPLIT_INDEX_H
+#define SPLIT_INDEX_H
+
+/*
+ * A split index keeps most of its entries in a shared index file,
+ * "$GIT_DIR/sharedindex.<sha1>", that is rarely rewritten.  The index
+ * file itself only holds the entries that are new or differ from the
+ * shared index, and a "link" extension naming the shared index and
+ * the positions of its entries that are gone or replaced.
+ */
+struct split_index {
+	unsigned char base_sha1[20];
+	/* the shared index as it is on disk; NULL until there is one */
+	struct index_state *base;
+	/* positions in "base" that are deleted, only while reading */
+	uint32_t *delete_pos;
+	unsigned int delete_nr, delete_alloc;
+	unsigned int refcount;
+};
+
+/* Return the split_index of "istate", creating an empty one if needed. */
+extern struct split_index *init_split_index(struct index_state *istate);
+
+/* Drop the reference "istate" holds to its split_index, if any. */
+extern void release_split_index(struct index_state *istate);
+
+extern int read_link_extension(struct index_state *istate,
+			       const void *data, unsigned long sz);
+extern void write_link_extension(struct strbuf *sb, struct index_state *istate);
+
+/*
+ * Read the shared index that the "link" extension of "istate" names
+ * and merge its entries with the ones read from the index file.
+ */
+extern void merge_base_index(struct index_state *istate);
+
+/*
+ * Work out which entries of "istate" have to go into the index file
+ * when it is written against its current shared index: fill "changed"
+ * with them and remember the positions of the shared entries that are
+ * deleted or replaced.  Returns the number of entries in "changed",
+ * which the caller frees.
+ */
+extern unsigned int prepare_split_index(struct index_state *istate,
+					struct cache_entry ***changed);
+
+/*
+ * Make a private copy of the entries of "istate" to serve as the
+ * shared index "sha1" it was just written to.
+ */
+extern void set_split_index_base(struct index_state *istate,
+				 const unsigned char *sha1);
+
+#endif
@@ -241,4 +241,53 @@ test_expect_success "--batch-check with multiple sha1s gives correct format" '
     "$(echo_without_newline "$batch_check_input" | git cat-file --batch-check)"
 '
 
+test_expect_success 'setup objects in a pack and loose' '
+	for i in 1 2 3 4 5 6 7 8 9 10
+	do
+		test-genrandom "$i" $((i * 1000)) >file$i &&
+		git add file$i &&
+		test_tick &&
+		git commit -q -m "$i" || return 1
+	done &&
+	git repack -adq &&
+	echo loose >file1 &&
+	git add file1 &&
+	test_tick &&
+	git commit -q -m loose &&
+	git rev-list --objects --all | cut -d" " -f1 >objects &&
+	echo deadbeef >>objects &&
+	sort -r objects >objects.sorted &&
+	cat objects.sorted objects.sorted >many
+'
+
+test_expect_success '--batch-check with many objects' '
+	while read sha1
+	do
+		if type=$(git cat-file -t $sha1 2>/dev/null)
+		then
+			echo "$sha1 $type $(git cat-file -s $sha1)"
+		else
+			echo "$sha1 missing"
+		fi || return 1
+	done <many >expect &&
+	git cat-file --batch-check <many >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success '--batch with many objects' '
+	while read sha1
+	do
+		if type=$(git cat-file -t $sha1 2>/dev/null)
+		then
+			echo "$sha1 $type $(git cat-file -s $sha1)" &&
+			git cat-file $type $sha1 &&
+			echo
+		else
+			echo "$sha1 missing"
+		fi || return 1
+	done <many >expect &&
+	git cat-file --batch <many >actual &&
+	test_cmp expect actual
+'
+
 test_done
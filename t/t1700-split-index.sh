@@ -0,0 +1,136 @@
+#!/bin/sh
+
+test_description='split index mode tests'
+
+. ./test-lib.sh
+
+shared_indexes () {
+	ls .git/sharedindex.* 2>/dev/null | wc -l
+}
+
+test_expect_success 'setup' '
+	for i in 0 1 2 3 4 5 6 7 8 9
+	do
+		for j in 0 1 2 3 4
+		do
+			echo $i$j >file$j$i || return 1
+		done
+	done &&
+	mkdir dir &&
+	echo d >dir/one &&
+	echo e >dir/two &&
+	git add . &&
+	git commit -q -m initial &&
+	git ls-files -s >ls-files.orig
+'
+
+test_expect_success 'enable split index' '
+	git update-index --split-index &&
+	test $(shared_indexes) = 1 &&
+	base=$(ls .git/sharedindex.* | sed "s/.*sharedindex\.//") &&
+	test "$(test-index-version <.git/sharedindex.$base)" = 2 &&
+	git ls-files -s >actual &&
+	test_cmp ls-files.orig actual &&
+	test $(wc -c <.git/index) -lt $(wc -c <.git/sharedindex.$base)
+'
+
+test_expect_success 'small changes only rewrite the index' '
+	echo changed >file03 &&
+	git add file03 &&
+	echo new >dir/new &&
+	git add dir/new &&
+	git rm -q file05 &&
+	test $(shared_indexes) = 1 &&
+	git ls-files >actual &&
+	test_line_count = 52 actual &&
+	git diff-files --exit-code &&
+	git diff --cached --name-status >actual &&
+	printf "A\tdir/new\nM\tfile03\nD\tfile05\n" >expect &&
+	test_cmp expect actual
+'
+
+test_expect_success 'commit and reset keep the split index' '
+	git commit -q -m second &&
+	git ls-files -s >ls-files.second &&
+	git reset -q --hard HEAD^ &&
+	git ls-files -s >actual &&
+	test_cmp ls-files.orig actual &&
+	git reset -q --hard HEAD@{1} &&
+	git ls-files -s >actual &&
+	test_cmp ls-files.second actual &&
+	test $(shared_indexes) = 1 &&
+	git diff-files --exit-code
+'
+
+test_expect_success 'many changes write a new shared index' '
+	for i in 10 11 12 13 14 15
+	do
+		echo more >file$i || return 1
+	done &&
+	git add file1? &&
+	test $(shared_indexes) = 2 &&
+	git diff-files --exit-code &&
+	git diff --cached --name-only >actual &&
+	test_line_count = 6 actual
+'
+
+test_expect_success 'disable split index' '
+	git ls-files -s >expect &&
+	git update-index --no-split-index &&
+	git ls-files -s >actual &&
+	test_cmp expect actual &&
+	rm .git/sharedindex.* &&
+	git ls-files -s >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'core.splitIndex' '
+	git config core.splitIndex true &&
+	echo more >file08 &&
+	git add file08 &&
+	test $(shared_indexes) = 1 &&
+	git config core.splitIndex false &&
+	echo more >file09 &&
+	git add file09 &&
+	rm .git/sharedindex.* &&
+	git diff-files --exit-code &&
+	git config --unset core.splitIndex
+'
+
+test_expect_success 'split index with version 4' '
+	git update-index --index-version 4 --split-index &&
+	test "$(test-index-version <.git/index)" = 4 &&
+	echo again >file08 &&
+	git add file08 &&
+	git ls-files -s >actual &&
+	git diff-files --exit-code &&
+	git update-index --no-split-index --index-version 2 &&
+	git ls-files -s >expect &&
+	test_cmp expect actual
+'
+
+test_expect_success 'reading an index keeps its shared index' '
+	git update-index --no-split-index &&
+	rm -f .git/sharedindex.* &&
+	git update-index --split-index &&
+	git ls-files -s >expect &&
+	base=$(ls .git/sharedindex.*) &&
+	test-chmtime =-1296000 $base &&
+	git ls-files >/dev/null &&
+	GIT_INDEX_FILE=.git/other-index \
+		git update-index --add --split-index file08 &&
+	test $(shared_indexes) = 2 &&
+	test -f $base &&
+	git ls-files -s >actual &&
+	test_cmp expect actual &&
+	rm .git/other-index
+'
+
+test_expect_success 'a missing shared index is an error' '
+	git update-index --split-index &&
+	rm .git/sharedindex.* &&
+	test_must_fail git ls-files 2>err &&
+	grep "sharedindex" err
+'
+
+test_done
@@ -0,0 +1,88 @@
+#!/bin/sh
+
+test_description='index file format version 4
+
+Version 4 stores each path name relative to the one before it.
+'
+
+. ./test-lib.sh
+
+test_expect_success 'setup' '
+	mkdir -p dir/sub other &&
+	for f in a b dir/c dir/sub/d dir/sub/dd dir/sub/ddd dir/sub/e other/f
+	do
+		echo $f >$f || return 1
+	done &&
+	git add . &&
+	git commit -q -m initial &&
+	git ls-files -s >expect &&
+	test "$(test-index-version <.git/index)" = 2
+'
+
+test_expect_success 'update-index --index-version 4' '
+	git update-index --index-version 4 &&
+	test "$(test-index-version <.git/index)" = 4 &&
+	git ls-files -s >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'version 4 is kept when the index is rewritten' '
+	echo changed >dir/sub/dd &&
+	mkdir dir/new &&
+	echo new >dir/new/g &&
+	git add dir &&
+	git rm -q dir/sub/ddd &&
+	test "$(test-index-version <.git/index)" = 4 &&
+	git ls-files -s >actual &&
+	git reset -q --hard &&
+	test "$(test-index-version <.git/index)" = 4 &&
+	git ls-files -s >actual &&
+	test_cmp expect actual &&
+	git diff-files --exit-code
+'
+
+test_expect_success 'extended flags in version 4' '
+	>intent &&
+	git add -N intent &&
+	git update-index --skip-worktree dir/c &&
+	test "$(test-index-version <.git/index)" = 4 &&
+	git ls-files -t >actual &&
+	grep "^S dir/c\$" actual &&
+	grep "^H intent\$" actual &&
+	git update-index --no-skip-worktree dir/c &&
+	git rm -q --cached intent
+'
+
+test_expect_success 'path names longer than the flags can hold' '
+	blob=$(git rev-parse HEAD:a) &&
+	long=$(printf "%02100d" 0) &&
+	git update-index --add --cacheinfo 100644 $blob $long/a/$long &&
+	git update-index --add --cacheinfo 100644 $blob $long/b/$long &&
+	git ls-files >actual &&
+	grep "^$long/a/$long\$" actual &&
+	grep "^$long/b/$long\$" actual &&
+	git rm -q --cached $long/a/$long $long/b/$long
+'
+
+test_expect_success 'back to version 2' '
+	git update-index --index-version 2 &&
+	test "$(test-index-version <.git/index)" = 2 &&
+	git ls-files -s >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'index.version applies to new index files' '
+	rm .git/index &&
+	git -c index.version=4 read-tree HEAD &&
+	test "$(test-index-version <.git/index)" = 4 &&
+	git ls-files -s >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'unsupported versions are rejected' '
+	test_must_fail git update-index --index-version 1 &&
+	test_must_fail git update-index --index-version 5 &&
+	test "$(test-index-version <.git/index)" = 4
+'
+
+test_done
@@ -118,4 +118,19 @@ test_expect_success 'pack, prune and repack' '
 	test_cmp all-of-them again
 '
 
+test_expect_success 'packed and loose refs are listed together in order' '
+	git branch r/a &&
+	git branch r-a &&
+	git pack-refs --all --prune &&
+	git branch r/b &&
+	git branch r0 &&
+	git branch r/x/c &&
+	git show-ref >actual &&
+	sort -k 2 actual >expect &&
+	test_cmp expect actual &&
+	git show-ref --heads >actual &&
+	grep " refs/heads/" expect >expect.heads &&
+	test_cmp expect.heads actual
+'
+
 test_done
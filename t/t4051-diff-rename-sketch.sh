@@ -0,0 +1,61 @@
+#!/bin/sh
+
+test_description='inexact rename detection over the rename limit'
+. ./test-lib.sh
+
+make_file () {
+	for i in 1 2 3 4 5 6 7 8 9 10
+	do
+		echo "$1 line $i"
+	done
+}
+
+test_expect_success 'setup' '
+	mkdir a &&
+	for n in 1 2 3 4 5 6
+	do
+		make_file $n >a/file$n || return 1
+	done &&
+	git add a &&
+	test_tick &&
+	git commit -m initial &&
+	git mv a b &&
+	for n in 1 2 3 4 5 6
+	do
+		echo "edited $n" >>b/file$n || return 1
+	done &&
+	git add b &&
+	test_tick &&
+	git commit -m moved &&
+	cat >expect <<-\EOF
+	R091	a/file1	b/file1
+	R091	a/file2	b/file2
+	R091	a/file3	b/file3
+	R091	a/file4	b/file4
+	R091	a/file5	b/file5
+	R091	a/file6	b/file6
+	EOF
+'
+
+test_expect_success 'renames are found under the limit' '
+	git diff -M --name-status HEAD^ HEAD >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'rename detection is skipped over the limit' '
+	git diff -M -l2 --name-status HEAD^ HEAD >actual &&
+	! grep ^R actual
+'
+
+test_expect_success 'diff.renameSketch finds renames over the limit' '
+	git -c diff.renameSketch=true diff -M -l3 --name-status HEAD^ HEAD >actual 2>err &&
+	test_cmp expect actual &&
+	! grep "rename detection was skipped" err
+'
+
+test_expect_success 'diff.renameSketch still honors the limit' '
+	git -c diff.renameSketch=true diff -M -l2 --name-status HEAD^ HEAD >actual &&
+	! grep ^R actual
+'
+
+test_done
@@ -179,6 +179,32 @@ test_expect_success \
     } >current &&
     test_cmp expect current'
 
+test_expect_success \
+    'use packed deltified objects with a tiny delta base cache' \
+    'GIT_OBJECT_DIRECTORY=.git2/objects &&
+     export GIT_OBJECT_DIRECTORY && {
+	 git -c core.deltaBaseCacheEntries=1 diff-tree --root -p $commit &&
+	 while read object
+	 do
+	    t=`git cat-file -t $object` &&
+	    git -c core.deltaBaseCacheLimit=1 cat-file $t $object || return 1
+	 done <obj-list
+    } >current &&
+    test_cmp expect current'
+
+test_expect_success \
+    'GIT_TRACE_DELTA_BASE_CACHE reports cache statistics' \
+    'GIT_OBJECT_DIRECTORY=.git2/objects &&
+     export GIT_OBJECT_DIRECTORY &&
+     while read object
+     do
+	 t=`git cat-file -t $object` &&
+	 GIT_TRACE_DELTA_BASE_CACHE="$TRASH/trace" \
+	     git cat-file $t $object >/dev/null || return 1
+     done <obj-list &&
+     grep "^delta base cache: hits [0-9]*, misses [0-9]*, evictions 0," \
+	 "$TRASH/trace"'
+
 unset GIT_OBJECT_DIRECTORY
 
 test_expect_success 'survive missing objects/pack directory' '
@@ -396,6 +422,43 @@ test_expect_success 'verify resulting packs' '
 	git verify-pack test-11-*.pack
 '
 
+test_expect_success 'setup a pack of more objects than one thread checks' '
+	mkdir threads &&
+	(
+		cd threads &&
+		git init &&
+		awk "BEGIN {
+			for (i = 0; i < 3000; i++) {
+				f = \"blob-\" i;
+				for (j = 0; j < 40; j++)
+					print \"line \" j \" of every blob\" >f;
+				print \"blob number \" i >f;
+				close(f);
+			}
+		}" &&
+		ls blob-* | git hash-object -w --stdin-paths >../thread-objects &&
+		git pack-objects .git/objects/pack/pack <../thread-objects &&
+		git prune-packed &&
+		rm -f blob-*
+	) &&
+	test $(wc -l <thread-objects) = 3000
+'
+
+test_expect_success 'checking objects on threads gives the same pack' '
+	(
+		cd threads &&
+		one=$(git pack-objects --window=0 --threads=1 \
+			../thread-1 <../thread-objects) &&
+		four=$(git pack-objects --window=0 --threads=4 \
+			../thread-4 <../thread-objects) &&
+		test $one = $four &&
+		cmp ../thread-1-$one.pack ../thread-4-$four.pack &&
+		cmp ../thread-1-$one.idx ../thread-4-$four.idx &&
+		git verify-pack -v ../thread-4-$four.pack >verify &&
+		grep "chain length = 1:" verify
+	)
+'
+
 #
 # WARNING!
 #
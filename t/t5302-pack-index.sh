@@ -65,6 +65,17 @@ test_expect_success \
     'cmp "test-1-${pack1}.idx" "1.idx" &&
      cmp "test-2-${pack2}.idx" "2.idx"'
 
+test_expect_success 'index-pack with several threads' '
+	git index-pack --threads=4 --index-version=2 -o 4.idx "test-1-${pack1}.pack" &&
+	cmp "test-2-${pack2}.idx" 4.idx
+'
+
+test_expect_success 'index-pack --stdin --strict with several threads' '
+	git index-pack --threads=4 --strict --stdin stdin.pack \
+		<"test-1-${pack1}.pack" &&
+	cmp "test-2-${pack2}.idx" stdin.idx
+'
+
 test_expect_success 'index-pack --verify on index version 1' '
 	git index-pack --verify "test-1-${pack1}.pack"
 '
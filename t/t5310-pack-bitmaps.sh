@@ -0,0 +1,221 @@
+#!/bin/sh
+
+test_description='exercise basic bitmap functionality'
+. ./test-lib.sh
+
+test_expect_success 'setup repo with moderate-sized history' '
+	for i in 1 2 3 4 5 6 7 8 9 10
+	do
+		echo $i >file-$i &&
+		mkdir -p dir-$i &&
+		echo "content $i" >dir-$i/file &&
+		git add file-$i dir-$i &&
+		test_tick &&
+		git commit -m "commit $i" || return 1
+	done &&
+	git branch other HEAD~4 &&
+	git checkout other &&
+	echo other >other &&
+	git add other &&
+	test_tick &&
+	git commit -m other &&
+	git tag -a -m "a tag" annotated &&
+	git checkout master
+'
+
+test_expect_success 'full repack creates bitmaps' '
+	git repack -adb &&
+	ls .git/objects/pack/ | grep bitmap >output &&
+	test_line_count = 1 output
+'
+
+test_expect_success 'rev-list --use-bitmap-index matches a plain walk' '
+	git rev-list --objects --all | cut -c1-40 | sort >expect &&
+	git rev-list --objects --all --use-bitmap-index | sort >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'rev-list --use-bitmap-index with negative revisions' '
+	git rev-list --objects master ^other | cut -c1-40 | sort >expect &&
+	git rev-list --objects --use-bitmap-index master ^other |
+		sort >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'pack-objects --revs produces the same objects' '
+	printf "master\n^other\n" |
+	git pack-objects --revs --stdout --no-use-bitmap-index >plain.pack &&
+	printf "master\n^other\n" |
+	git pack-objects --revs --stdout >bitmap.pack &&
+	git index-pack -o plain.idx plain.pack &&
+	git index-pack -o bitmap.idx bitmap.pack &&
+	git show-index <plain.idx | cut -d" " -f2 | sort >expect &&
+	git show-index <bitmap.idx | cut -d" " -f2 | sort >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'objects outside the bitmapped pack fall back to a walk' '
+	echo new >new-file &&
+	git add new-file &&
+	test_tick &&
+	git commit -m "loose commit" &&
+	git rev-list --objects --all | cut -c1-40 | sort >expect &&
+	git rev-list --objects --all --use-bitmap-index |
+		cut -c1-40 | sort >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'clone from bitmapped repository' '
+	git repack -adb &&
+	git clone --no-local --bare . clone.git &&
+	git rev-list --objects --all | cut -c1-40 | sort >expect &&
+	git --git-dir=clone.git rev-list --objects --all |
+		cut -c1-40 | sort >actual &&
+	test_cmp expect actual &&
+	git --git-dir=clone.git fsck
+'
+
+test_expect_success 'packing everything copies the bitmapped pack' '
+	git pack-objects --revs --all --stdout --delta-base-offset \
+		</dev/null >all.pack &&
+	cmp .git/objects/pack/pack-*.pack all.pack &&
+	git pack-objects --revs --all --stdout --delta-base-offset \
+		--include-tag </dev/null >all-tags.pack &&
+	cmp all.pack all-tags.pack
+'
+
+test_expect_success 'packs made without OFS_DELTA are complete' '
+	git pack-objects --revs --all --stdout </dev/null >ref-delta.pack &&
+	git index-pack --strict -o ref-delta.idx ref-delta.pack &&
+	git rev-list --objects --all | cut -c1-40 | sort >expect &&
+	git show-index <ref-delta.idx | cut -d" " -f2 | sort >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'incremental repack does not write bitmaps' '
+	echo more >>new-file &&
+	git commit -a -m "more" &&
+	git repack -d &&
+	ls .git/objects/pack/ | grep bitmap >output &&
+	test_line_count = 1 output
+'
+
+test_expect_success 'repack.writebitmaps enables bitmaps' '
+	git config repack.writebitmaps true &&
+	git repack -ad &&
+	ls .git/objects/pack/ | grep bitmap >output &&
+	test_line_count = 1 output &&
+	git rev-list --objects --all | cut -c1-40 | sort >expect &&
+	git rev-list --objects --all --use-bitmap-index | sort >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'setup files that only delta against their own history' '
+	git init names &&
+	(
+		cd names &&
+		for i in 1 2 3 4 5 6 7 8 9 10
+		do
+			test-genrandom file-$i 2000 >file-$i || return 1
+		done &&
+		git add . &&
+		test_tick &&
+		git commit -m base &&
+		for j in 1 2 3
+		do
+			for i in 1 2 3 4 5 6 7 8 9 10
+			do
+				echo "change $j" >>file-$i || return 1
+			done &&
+			test_tick &&
+			git commit -a -m "change $j" || return 1
+		done &&
+		git repack -adb --depth=1
+	)
+'
+
+test_expect_success 'objects from bitmaps are grouped by name for deltas' '
+	(
+		cd names &&
+		printf "HEAD~1\n^HEAD~3\n" |
+		git pack-objects --revs --window=3 --no-use-bitmap-index \
+			../names-plain >plain &&
+		printf "HEAD~1\n^HEAD~3\n" |
+		git pack-objects --revs --window=3 ../names-bitmap >bitmap &&
+		git verify-pack -v ../names-plain-$(cat plain).pack |
+		grep "^[0-9a-f]\{40\} blob .* [0-9a-f]\{40\}\$" |
+		awk "{ print \$1, \$NF }" | sort >expect &&
+		git verify-pack -v ../names-bitmap-$(cat bitmap).pack |
+		grep "^[0-9a-f]\{40\} blob .* [0-9a-f]\{40\}\$" |
+		awk "{ print \$1, \$NF }" | sort >actual &&
+		test_line_count = 10 expect &&
+		test_cmp expect actual
+	)
+'
+
+test_expect_success 'thin packs make deltas against what the other side has' '
+	(
+		cd names &&
+		for i in 1 2 3 4 5 6 7 8 9 10
+		do
+			head -c 1000 file-$i >tmp &&
+			mv tmp file-$i || return 1
+		done &&
+		test_tick &&
+		git commit -a -m shrink &&
+		git repack -adb &&
+		printf "HEAD\n^HEAD~1\n" |
+		git pack-objects --revs --thin --stdout \
+			--no-use-bitmap-index >../thin-plain.pack &&
+		printf "HEAD\n^HEAD~1\n" |
+		git pack-objects --revs --thin --stdout >../thin-bitmap.pack
+	) &&
+	test $(wc -c <thin-plain.pack) -lt 5000 &&
+	cmp thin-plain.pack thin-bitmap.pack
+'
+
+test_expect_success 'a corrupt bitmap index is not used' '
+	(
+		cd names &&
+		bitmap=$(ls .git/objects/pack/*.bitmap) &&
+		chmod u+w $bitmap &&
+		size=$(wc -c <$bitmap) &&
+		printf "\377\377\377\377" |
+		dd of=$bitmap bs=1 seek=$(($size - 100)) conv=notrunc 2>/dev/null &&
+		git rev-list --objects --all | cut -c1-40 | sort >expect &&
+		git rev-list --objects --all --use-bitmap-index 2>err |
+			cut -c1-40 | sort >actual &&
+		test_cmp expect actual &&
+		grep "corrupt bitmap index" err
+	)
+'
+
+test_expect_success 'setup a bitmapped repository with an alternate' '
+	git init alt-base &&
+	(cd alt-base && test_commit base-one && test_commit base-two) &&
+	git clone -q --shared alt-base alt-user &&
+	(
+		cd alt-user &&
+		test_commit user-one &&
+		git repack -adb &&
+		ls .git/objects/pack/*.bitmap
+	)
+'
+
+test_expect_success '--local leaves out the objects of the alternate' '
+	(
+		cd alt-user &&
+		git pack-objects --revs --all --stdout --delta-base-offset \
+			--local --no-use-bitmap-index </dev/null >plain.pack &&
+		git index-pack -o plain.idx plain.pack &&
+		git pack-objects --revs --all --stdout --delta-base-offset \
+			--local </dev/null >bitmap.pack &&
+		git index-pack -o bitmap.idx bitmap.pack &&
+		git show-index <plain.idx | cut -d" " -f2 | sort >expect &&
+		git show-index <bitmap.idx | cut -d" " -f2 | sort >actual &&
+		test_line_count = 3 expect &&
+		test_cmp expect actual
+	)
+'
+
+test_done
@@ -0,0 +1,130 @@
+#!/bin/sh
+
+test_description='commit-graph file'
+. ./test-lib.sh
+
+graph=.git/objects/info/commit-graph
+
+# run a command with and without the commit-graph and compare the output
+graph_cmp () {
+	git -c core.commitgraph=false "$@" >expect &&
+	git "$@" >actual &&
+	test_cmp expect actual
+}
+
+test_expect_success 'setup history with merges' '
+	for i in 1 2 3 4 5
+	do
+		test_commit "base-$i" || return 1
+	done &&
+	git branch side1 base-2 &&
+	git branch side2 base-3 &&
+	git branch side3 base-3 &&
+	git checkout side1 &&
+	test_commit one-1 &&
+	test_commit one-2 &&
+	git checkout side2 &&
+	test_commit two-1 &&
+	git checkout side3 &&
+	test_commit three-1 &&
+	git checkout master &&
+	test_tick &&
+	git merge -m octopus side1 side2 side3 &&
+	git tag octopus &&
+	test_commit after-merge
+'
+
+test_expect_success 'write commit-graph' '
+	git commit-graph write &&
+	test -f $graph &&
+	git commit-graph verify
+'
+
+test_expect_success 'log --graph matches' '
+	graph_cmp log --graph --oneline --all
+'
+
+test_expect_success 'rev-list --topo-order --parents matches' '
+	graph_cmp rev-list --topo-order --parents --all &&
+	graph_cmp rev-list --date-order --parents master ^side2
+'
+
+test_expect_success 'merge-base matches' '
+	graph_cmp merge-base --all side1 side2 &&
+	graph_cmp merge-base --octopus side1 side2 side3 &&
+	graph_cmp merge-base master side3
+'
+
+test_expect_success '--contains matches' '
+	graph_cmp branch --contains base-3 &&
+	graph_cmp branch --contains one-1 &&
+	graph_cmp tag --contains two-1 &&
+	graph_cmp tag --contains base-1
+'
+
+test_expect_success 'commits newer than the commit-graph are walked too' '
+	test_commit newer &&
+	git checkout -b newer-side side1 &&
+	test_commit newer-side &&
+	git checkout master &&
+	graph_cmp log --graph --oneline --all &&
+	graph_cmp branch --contains base-2 &&
+	graph_cmp tag --contains one-2 &&
+	graph_cmp merge-base newer-side master
+'
+
+test_expect_success 'gc.writeCommitGraph rewrites the commit-graph' '
+	git -c gc.writecommitgraph=true gc &&
+	git commit-graph verify &&
+	graph_cmp log --graph --oneline --all
+'
+
+test_expect_success 'grafts disable the commit-graph' '
+	echo "$(git rev-parse base-4) $(git rev-parse base-1)" >.git/info/grafts &&
+	git rev-list base-5 >actual &&
+	test_line_count = 3 actual &&
+	test_must_fail git commit-graph write &&
+	rm .git/info/grafts
+'
+
+test_expect_success 'verify notices a corrupt commit-graph' '
+	cp $graph graph.bak &&
+	chmod u+w $graph &&
+	printf "\377\377\377\377" |
+	dd of=$graph bs=1 seek=1060 conv=notrunc 2>/dev/null &&
+	test_must_fail git commit-graph verify &&
+	mv graph.bak $graph
+'
+
+test_expect_success 'commit messages are read for commits in the commit-graph' '
+	git commit-graph write &&
+	graph_cmp fast-export master &&
+	git checkout -b reset-side master &&
+	git reset --hard octopus~1 >actual &&
+	echo "HEAD is now at $(git rev-parse --short base-5) base-5" >expect &&
+	test_cmp expect actual &&
+	git cherry-pick one-2~1 &&
+	git log -1 --format=%s >actual &&
+	echo one-1 >expect &&
+	test_cmp expect actual &&
+	git checkout master
+'
+
+test_expect_success 'parents are read from the commit-graph' '
+	git init loose &&
+	(
+		cd loose &&
+		test_commit A &&
+		test_commit B &&
+		test_commit C &&
+		git commit-graph write &&
+		git rev-list HEAD >expect &&
+		obj=$(git rev-parse B | sed "s|^..|&/|") &&
+		rm -f .git/objects/$obj &&
+		git rev-list HEAD >actual &&
+		test_cmp expect actual &&
+		test_must_fail git -c core.commitgraph=false rev-list HEAD
+	)
+'
+
+test_done
@@ -0,0 +1,82 @@
+#!/bin/sh
+
+test_description='multi-pack-index file'
+. ./test-lib.sh
+
+midx=.git/objects/pack/multi-pack-index
+
+# run a command with and without the multi-pack-index and compare the output
+midx_cmp () {
+	cat >input &&
+	git -c core.multipackindex=false "$@" <input >expect &&
+	git "$@" <input >actual &&
+	test_cmp expect actual
+}
+
+test_expect_success 'setup several packs' '
+	for i in 1 2 3 4 5
+	do
+		test_commit "commit-$i" &&
+		git repack -d -q || return 1
+	done &&
+	ls .git/objects/pack/*.pack >packs &&
+	test_line_count = 5 packs
+'
+
+test_expect_success 'write multi-pack-index' '
+	git multi-pack-index write &&
+	test -f $midx &&
+	git multi-pack-index verify
+'
+
+test_expect_success 'objects are found through the multi-pack-index' '
+	git rev-list --objects --all | cut -c1-40 >objects &&
+	midx_cmp cat-file --batch-check <objects &&
+	midx_cmp rev-list --objects --all </dev/null &&
+	midx_cmp log -p --all </dev/null
+'
+
+test_expect_success 'abbreviated names are resolved' '
+	short=$(git rev-parse --short=7 commit-3) &&
+	git rev-parse commit-3 >expect &&
+	git rev-parse $short >actual &&
+	test_cmp expect actual &&
+	midx_cmp log --abbrev-commit --oneline --all </dev/null
+'
+
+test_expect_success 'packs newer than the multi-pack-index are searched too' '
+	test_commit newer &&
+	git repack -d -q &&
+	git rev-parse newer:newer.t >blob &&
+	midx_cmp cat-file --batch-check <blob &&
+	midx_cmp rev-list --objects --all </dev/null
+'
+
+test_expect_success 'a missing pack disables the multi-pack-index' '
+	pack=$(ls .git/objects/pack/*.pack | head -n 1) &&
+	mv $pack pack.bak &&
+	git multi-pack-index verify >/dev/null 2>&1
+	status=$? &&
+	mv pack.bak $pack &&
+	test $status != 0 &&
+	git repack -a -d -q &&
+	git fsck
+'
+
+test_expect_success 'repack rewrites the multi-pack-index' '
+	test -f $midx &&
+	git multi-pack-index verify &&
+	midx_cmp rev-list --objects --all </dev/null
+'
+
+test_expect_success 'verify notices a corrupt multi-pack-index' '
+	cp $midx midx.bak &&
+	chmod u+w $midx &&
+	size=$(wc -c <$midx) &&
+	printf "\377\377\377\377" |
+	dd of=$midx bs=1 seek=$(($size - 30)) conv=notrunc 2>/dev/null &&
+	test_must_fail git multi-pack-index verify &&
+	mv midx.bak $midx
+'
+
+test_done
@@ -0,0 +1,117 @@
+#!/bin/sh
+
+test_description='pack-objects delta islands'
+. ./test-lib.sh
+
+# is $1 stored as a delta against $2 in the (only) pack?
+is_delta_base () {
+	git verify-pack -v .git/objects/pack/pack-*.idx >verify &&
+	grep "^$1 .* $2\$" verify
+}
+
+test_expect_success 'setup two forks sharing content' '
+	test-genrandom one 8192 >one &&
+	test-genrandom two 8192 >two &&
+	cp one data &&
+	git add data &&
+	test_tick &&
+	git commit -m one &&
+	one=$(git rev-parse HEAD:data) &&
+	git update-ref refs/virtual/1/heads/master HEAD &&
+	git checkout -q --orphan fork2 &&
+	cat one two >data &&
+	git add data &&
+	test_tick &&
+	git commit -m two &&
+	two=$(git rev-parse HEAD:data) &&
+	git update-ref refs/virtual/2/heads/master HEAD &&
+	git checkout -q HEAD^0 &&
+	git update-ref -d refs/heads/master &&
+	git update-ref -d refs/heads/fork2
+'
+
+test_expect_success 'without islands, the forks share a delta' '
+	git repack -adfq &&
+	is_delta_base $one $two
+'
+
+test_expect_success 'island regex with capture groups separates the forks' '
+	git config pack.island "refs/virtual/([0-9]+)/heads/" &&
+	git repack -adfiq &&
+	! is_delta_base $one $two &&
+	! is_delta_base $two $one
+'
+
+test_expect_success 'existing deltas across islands are not reused' '
+	git repack -adfq &&
+	is_delta_base $one $two &&
+	git repack -adiq &&
+	! is_delta_base $one $two
+'
+
+test_expect_success 'island regex without capture groups is one island' '
+	git config pack.island "refs/virtual/" &&
+	git repack -adfiq &&
+	is_delta_base $one $two
+'
+
+test_expect_success 'an object may use a base reachable from all its islands' '
+	git config pack.island "refs/virtual/([0-9]+)/heads/" &&
+	git update-ref refs/virtual/1/heads/also $(git rev-parse refs/virtual/2/heads/master) &&
+	git repack -adfiq &&
+	is_delta_base $one $two
+'
+
+test_expect_success 'the last matching regex wins' '
+	git update-ref -d refs/virtual/1/heads/also &&
+	git config --add pack.island "refs/virtual/[0-9]+/heads/" &&
+	git repack -adfiq &&
+	is_delta_base $one $two
+'
+
+test_expect_success 'setup a tree found at different depths' '
+	git init nested &&
+	(
+		cd nested &&
+		mkdir -p x/y/sub &&
+		cp ../one x/y/sub/data &&
+		git add x &&
+		test_tick &&
+		git commit -m deep &&
+		git update-ref refs/virtual/2/heads/master HEAD &&
+		git checkout -q --orphan shallow &&
+		git mv x/y/sub sub &&
+		cat ../one ../two >big &&
+		git add big &&
+		test_tick &&
+		git commit -m shallow &&
+		git update-ref refs/virtual/1/heads/master HEAD &&
+		git checkout -q HEAD^0 &&
+		git update-ref -d refs/heads/master &&
+		git update-ref -d refs/heads/shallow &&
+		git config pack.island "refs/virtual/([0-9]+)/heads/"
+	)
+'
+
+test_expect_success 'a tree gets the islands of all the paths it is at' '
+	(
+		cd nested &&
+		git repack -adfq &&
+		is_delta_base $one $(git rev-parse HEAD:big) &&
+		git repack -adfiq &&
+		! is_delta_base $one $(git rev-parse HEAD:big)
+	)
+'
+
+test_expect_success 'packs made with islands are complete' '
+	git config --unset-all pack.island &&
+	git config --add pack.island "refs/virtual/([0-9]+)/heads/" &&
+	git repack -adfiq &&
+	git fsck --full &&
+	git rev-list --objects --all >expect &&
+	git verify-pack -v .git/objects/pack/pack-*.idx |
+	grep -c "^[0-9a-f]\{40\} " >count &&
+	test $(cat count) = $(wc -l <expect)
+'
+
+test_done
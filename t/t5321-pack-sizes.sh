@@ -0,0 +1,76 @@
+#!/bin/sh
+
+test_description='pack sizes files'
+. ./test-lib.sh
+
+test_expect_success 'setup' '
+	test-genrandom base 4096 >file &&
+	git add file &&
+	test_tick &&
+	git commit -m 0 &&
+	for i in 1 2 3 4 5 6 7 8
+	do
+		echo $i >>file &&
+		git add file &&
+		test_tick &&
+		git commit -m $i || return 1
+	done &&
+	git rev-list --objects --all | cut -c1-40 >objects
+'
+
+test_expect_success 'repack writes a sizes file' '
+	git -c pack.writeSizes=true repack -adq &&
+	test_path_is_file .git/objects/pack/pack-*.sizes
+'
+
+test_expect_success 'object info is the same with or without it' '
+	git cat-file --batch-check <objects >with &&
+	mv .git/objects/pack/pack-*.sizes sizes &&
+	git cat-file --batch-check <objects >without &&
+	mv sizes $(ls .git/objects/pack/pack-*.pack | sed "s/pack\$/sizes/") &&
+	test_cmp without with
+'
+
+test_expect_success 'index-pack writes the same sizes file' '
+	cp .git/objects/pack/pack-*.pack copy.pack &&
+	git -c pack.writeSizes=true index-pack copy.pack &&
+	cmp .git/objects/pack/pack-*.sizes copy.sizes
+'
+
+test_expect_success 'sizes of deltas are taken from the sizes file' '
+	git verify-pack -v .git/objects/pack/pack-*.idx |
+	grep "^[0-9a-f]\{40\} " |
+	sort |
+	awk "NF == 7 { print NR - 1, \$1; exit }" >delta &&
+	read pos obj <delta &&
+	sizes=$(ls .git/objects/pack/pack-*.sizes) &&
+	cp "$sizes" sizes.orig &&
+	chmod +w "$sizes" &&
+	printf "\\000\\000\\000\\007" |
+	dd of="$sizes" bs=1 seek=$((36 + 4 * $pos)) conv=notrunc &&
+	test "$(git cat-file -s $obj)" = 7 &&
+	cp sizes.orig "$sizes"
+'
+
+test_expect_success 'a stale sizes file is ignored' '
+	echo 9 >>file &&
+	git add file &&
+	test_tick &&
+	git commit -m 9 &&
+	git rev-list --objects --all | cut -c1-40 >objects &&
+	git repack -adq &&
+	git cat-file --batch-check <objects >expect &&
+	cp sizes.orig $(ls .git/objects/pack/pack-*.pack | sed "s/pack\$/sizes/") &&
+	git cat-file --batch-check <objects >actual 2>err &&
+	grep "stale sizes file" err &&
+	test_cmp expect actual
+'
+
+test_expect_success 'repack -d removes redundant sizes files' '
+	git -c pack.writeSizes=true repack -adq &&
+	test $(ls .git/objects/pack/*.sizes | wc -l) = 1 &&
+	git repack -adfq &&
+	test $(ls .git/objects/pack/*.sizes 2>/dev/null | wc -l) = 0
+'
+
+test_done
@@ -0,0 +1,73 @@
+#!/bin/sh
+
+test_description='on-disk reverse indexes'
+. ./test-lib.sh
+
+rev_file () {
+	ls .git/objects/pack/pack-*.pack | sed "s/pack\$/rev/"
+}
+
+test_expect_success 'setup' '
+	test-genrandom base 4096 >file &&
+	git add file &&
+	test_tick &&
+	git commit -m 0 &&
+	for i in 1 2 3 4 5 6 7 8
+	do
+		echo $i >>file &&
+		git add file &&
+		test_tick &&
+		git commit -m $i || return 1
+	done &&
+	git repack -adbq &&
+	git pack-objects --all --stdout </dev/null >expect.pack &&
+	git rev-list --use-bitmap-index --objects --all >expect.objects
+'
+
+test_expect_success 'repack writes a reverse index' '
+	git -c pack.writeReverseIndex=true repack -adbq &&
+	test_path_is_file $(rev_file)
+'
+
+test_expect_success 'index-pack writes the same reverse index' '
+	cp .git/objects/pack/pack-*.pack copy.pack &&
+	git -c pack.writeReverseIndex=true index-pack copy.pack &&
+	cmp $(rev_file) copy.rev
+'
+
+test_expect_success 'packing gives the same result with a reverse index' '
+	git pack-objects --all --stdout </dev/null >actual.pack 2>err &&
+	test_cmp expect.pack actual.pack &&
+	! grep "reverse index" err &&
+	git rev-list --use-bitmap-index --objects --all >actual.objects &&
+	test_cmp expect.objects actual.objects
+'
+
+test_expect_success 'a reverse index of the wrong size is ignored' '
+	rev=$(rev_file) &&
+	mv "$rev" rev.orig &&
+	head -c 20 rev.orig >"$rev" &&
+	git pack-objects --all --stdout </dev/null >actual.pack 2>err &&
+	grep "reverse index of the wrong size" err &&
+	test_cmp expect.pack actual.pack &&
+	mv rev.orig "$rev"
+'
+
+test_expect_success 'a stale reverse index is ignored' '
+	cp $(rev_file) stale.rev &&
+	git -c pack.compression=1 repack -adbFq &&
+	git pack-objects --all --stdout </dev/null >expect.pack &&
+	cp stale.rev $(rev_file) &&
+	git pack-objects --all --stdout </dev/null >actual.pack 2>err &&
+	grep "stale reverse index" err &&
+	test_cmp expect.pack actual.pack
+'
+
+test_expect_success 'repack -d removes redundant reverse indexes' '
+	git -c pack.writeReverseIndex=true repack -adq &&
+	test $(ls .git/objects/pack/*.rev | wc -l) = 1 &&
+	git repack -adfq &&
+	test $(ls .git/objects/pack/*.rev 2>/dev/null | wc -l) = 0
+'
+
+test_done
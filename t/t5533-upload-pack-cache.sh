@@ -0,0 +1,108 @@
+#!/bin/sh
+
+test_description='upload-pack pack cache'
+. ./test-lib.sh
+
+cached_packs () {
+	ls server/.git/pack-cache/*.pack 2>/dev/null | wc -l
+}
+
+test_expect_success 'setup' '
+	git init server &&
+	(
+		cd server &&
+		test_commit one &&
+		test_commit two &&
+		git config uploadpack.packCache pack-cache
+	)
+'
+
+test_expect_success 'first clone stores the pack' '
+	git clone --progress "file://$TRASH_DIRECTORY/server" first 2>err &&
+	! grep "cached pack" err &&
+	test $(cached_packs) = 1 &&
+	(cd first && git fsck --full)
+'
+
+test_expect_success 'identical request is served from the cache' '
+	git clone --progress "file://$TRASH_DIRECTORY/server" second 2>err &&
+	grep "Sending a cached pack" err &&
+	test $(cached_packs) = 1 &&
+	(cd second && git fsck --full) &&
+	test "$(git --git-dir=first/.git rev-parse HEAD)" = \
+		"$(git --git-dir=second/.git rev-parse HEAD)"
+'
+
+test_expect_success 'a fetch with haves gets its own entry' '
+	(cd server && test_commit three) &&
+	(
+		cd first &&
+		git fetch --progress 2>err &&
+		! grep "cached pack" err &&
+		git fsck --full
+	) &&
+	(
+		cd second &&
+		git fetch --progress 2>err &&
+		grep "Sending a cached pack" err &&
+		git fsck --full &&
+		test "$(git rev-parse origin/master)" = \
+			"$(git --git-dir=../server/.git rev-parse master)"
+	)
+'
+
+test_expect_success 'entries made for older refs are dropped' '
+	git clone "file://$TRASH_DIRECTORY/server" third &&
+	test $(cached_packs) = 2 &&
+	(cd server && test_commit four) &&
+	git clone "file://$TRASH_DIRECTORY/server" fourth &&
+	test $(cached_packs) = 1
+'
+
+test_expect_success 'shallow requests are cached separately' '
+	(cd server && git tag -l | xargs git tag -d) &&
+	git clone --progress --depth=1 "file://$TRASH_DIRECTORY/server" shallow1 2>err &&
+	! grep "cached pack" err &&
+	git clone --progress --depth=1 "file://$TRASH_DIRECTORY/server" shallow2 2>err &&
+	grep "Sending a cached pack" err &&
+	test -f shallow2/.git/shallow &&
+	(cd shallow2 && test_must_fail git rev-parse HEAD~3 && git fsck) &&
+	git clone --progress "file://$TRASH_DIRECTORY/server" full 2>err &&
+	! grep "cached pack" err &&
+	(cd full && git rev-parse HEAD~3)
+'
+
+test_expect_success 'the cache is kept within its size limit' '
+	git --git-dir=server/.git config uploadpack.packCacheLimit 1 &&
+	(cd server && test_commit five) &&
+	git clone "file://$TRASH_DIRECTORY/server" limited &&
+	test $(cached_packs) = 0 &&
+	(cd limited && git fsck --full)
+'
+
+test_expect_success 'repositories can share a cache directory' '
+	git --git-dir=server/.git config --unset uploadpack.packCacheLimit &&
+	git init other &&
+	(cd other && test_commit other) &&
+	for repo in server other
+	do
+		git --git-dir=$repo/.git config uploadpack.packCache \
+			"$TRASH_DIRECTORY/shared-cache" || return 1
+	done &&
+	git clone "file://$TRASH_DIRECTORY/server" shared1 &&
+	git clone "file://$TRASH_DIRECTORY/other" shared2 &&
+	test $(ls shared-cache/*.pack | wc -l) = 2 &&
+	git clone --progress "file://$TRASH_DIRECTORY/server" shared3 2>err &&
+	grep "Sending a cached pack" err &&
+	(cd shared3 && git fsck --full) &&
+	(cd server && test_commit six) &&
+	git clone "file://$TRASH_DIRECTORY/server" shared4 &&
+	test $(ls shared-cache/*.pack | wc -l) = 2 &&
+	git clone --progress "file://$TRASH_DIRECTORY/other" shared5 2>err &&
+	grep "Sending a cached pack" err &&
+	(cd shared5 && git fsck --full) &&
+	test "$(git --git-dir=shared5/.git rev-parse HEAD)" = \
+		"$(git --git-dir=other/.git rev-parse HEAD)"
+'
+
+test_done
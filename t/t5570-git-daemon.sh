@@ -0,0 +1,100 @@
+#!/bin/sh
+
+test_description='git daemon serving from a pool of workers'
+. ./test-lib.sh
+
+if test -z "$GIT_TEST_GIT_DAEMON"
+then
+	skip_all="git daemon testing disabled (define GIT_TEST_GIT_DAEMON to enable)"
+	test_done
+fi
+
+if test_have_prereq MINGW
+then
+	skip_all='skipping test, git daemon --workers is not supported'
+	test_done
+fi
+
+LIB_GIT_DAEMON_PORT=${LIB_GIT_DAEMON_PORT-'5570'}
+GIT_DAEMON_URL=git://127.0.0.1:$LIB_GIT_DAEMON_PORT
+
+start_git_daemon () {
+	trap 'code=$?; stop_git_daemon; (exit $code); die' EXIT
+
+	# not "git daemon", which would leave the daemon behind when killed
+	"$GIT_EXEC_PATH/git-daemon" --listen=127.0.0.1 \
+		--port="$LIB_GIT_DAEMON_PORT" --reuseaddr --verbose \
+		--export-all --base-path="$TRASH_DIRECTORY" "$@" \
+		>/dev/null 2>"$TRASH_DIRECTORY/daemon.log" &
+	GIT_DAEMON_PID=$!
+
+	# the workers are started once the daemon listens
+	for i in 1 2 3 4 5 6 7 8 9 10
+	do
+		test $(grep -c "Worker started" "$TRASH_DIRECTORY/daemon.log") -ge 2 &&
+		return
+		sleep 1
+	done
+	stop_git_daemon
+	skip_all='skipping test, git daemon failed to start'
+	test_done
+}
+
+stop_git_daemon () {
+	trap 'die' EXIT
+	kill "$GIT_DAEMON_PID" 2>/dev/null
+	wait "$GIT_DAEMON_PID" 2>/dev/null
+}
+
+test_expect_success 'setup repository' '
+	echo content >file &&
+	git add file &&
+	test_tick &&
+	git commit -m one &&
+	echo more >>file &&
+	test_tick &&
+	git commit -a -m two &&
+	git clone --bare . repo.git
+'
+
+start_git_daemon --workers=2
+
+test_expect_success 'clone from a daemon with workers' '
+	git clone "$GIT_DAEMON_URL/repo.git" clone &&
+	git rev-parse master >expect &&
+	git --git-dir=clone/.git rev-parse origin/master >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'more clients than workers are all served' '
+	for i in 1 2 3 4 5 6
+	do
+		git clone -q "$GIT_DAEMON_URL/repo.git" clone-$i &
+		eval "pid_$i=\$!"
+	done &&
+	for i in 1 2 3 4 5 6
+	do
+		eval "wait \$pid_$i" &&
+		git --git-dir=clone-$i/.git rev-parse origin/master >actual &&
+		test_cmp expect actual || return 1
+	done
+'
+
+test_expect_success 'a worker that dies is replaced' '
+	pid=$(sed -n "s/.*\[\([0-9]*\)\] Worker started$/\1/p" daemon.log |
+	      head -n 1) &&
+	test -n "$pid" &&
+	kill -9 $pid &&
+	for i in 1 2 3 4 5 6 7 8 9 10
+	do
+		grep "\[$pid\] Worker exited" daemon.log >/dev/null && break
+		sleep 1
+	done &&
+	git clone "$GIT_DAEMON_URL/repo.git" clone-after-kill &&
+	git --git-dir=clone-after-kill/.git rev-parse origin/master >actual &&
+	test_cmp expect actual &&
+	test $(grep -c "Worker started" daemon.log) -ge 3
+'
+
+stop_git_daemon
+test_done
@@ -0,0 +1,137 @@
+#!/bin/sh
+
+test_description='git status with the untracked cache'
+
+. ./test-lib.sh
+
+check_status () {
+	git ls-files -o --exclude-standard --directory --no-empty-directory |
+	sed "s/^/?? /" >../expect &&
+	rm -f ../trace &&
+	GIT_TRACE_UNTRACKED_STATS="$TRASH_DIRECTORY/trace" \
+	git status --porcelain >../status &&
+	grep "^??" ../status >../actual &&
+	test_cmp ../expect ../actual
+}
+
+opened () {
+	sed -n "s/^opendir: //p" ../trace
+}
+
+test_expect_success 'setup' '
+	git init repo &&
+	cd repo &&
+	mkdir done dtwo dthree dfour &&
+	echo one >done/one &&
+	echo two >dtwo/two &&
+	echo three >dthree/three &&
+	echo "*.o" >.gitignore &&
+	git add done/one dtwo/two .gitignore &&
+	git commit -q -m initial &&
+	: >done/untracked &&
+	: >dthree/untracked.o &&
+	: >dfour/untracked &&
+	git update-index --untracked-cache &&
+	# a directory changed in the second "git status" starts in is
+	# not trusted, so push the times of what we touch into the past
+	test-chmtime =-100 . done dtwo dthree dfour .gitignore
+'
+
+test_expect_success 'first status fills the cache' '
+	check_status &&
+	test $(opened) = 5 &&
+	check_status &&
+	test $(opened) = 0
+'
+
+test_expect_success 'new untracked file' '
+	: >dtwo/new &&
+	test-chmtime =-90 dtwo &&
+	check_status &&
+	test $(opened) = 1 &&
+	grep "?? dtwo/new" ../actual &&
+	check_status &&
+	test $(opened) = 0
+'
+
+test_expect_success 'removed untracked file' '
+	rm dfour/untracked &&
+	test-chmtime =-80 dfour &&
+	check_status &&
+	! grep dfour ../actual
+'
+
+test_expect_success 'changed .gitignore' '
+	echo untracked >>.gitignore &&
+	git add .gitignore &&
+	test-chmtime =-70 .gitignore &&
+	check_status &&
+	grep "gitignore invalidation: 1" ../trace &&
+	! grep "done/untracked" ../actual &&
+	check_status &&
+	test $(opened) = 0
+'
+
+test_expect_success 'file removed from the index' '
+	git rm -q --cached done/one &&
+	check_status &&
+	test $(opened) = 1 &&
+	grep "?? done/" ../actual &&
+	git add done/one &&
+	check_status
+'
+
+test_expect_success 'show all untracked files' '
+	git ls-files -o --exclude-standard >../expect &&
+	sed "s/^/?? /" <../expect >../expect.all &&
+	git status --porcelain -uall >../status &&
+	grep "^??" ../status >../actual &&
+	test_cmp ../expect.all ../actual &&
+	check_status
+'
+
+test_expect_success 'switching branches' '
+	git checkout -q -b side &&
+	mkdir dside &&
+	echo side >dside/file &&
+	: >dside/extra &&
+	git add dside/file &&
+	git commit -q -m side &&
+	test-chmtime =-60 . dside &&
+	check_status &&
+	git checkout -q master &&
+	check_status &&
+	grep "?? dside/" ../actual &&
+	git checkout -q side &&
+	check_status &&
+	grep "?? dside/extra" ../actual &&
+	git checkout -q master
+'
+
+test_expect_success 'status with a pathspec does not use the cache' '
+	rm -f ../trace &&
+	GIT_TRACE_UNTRACKED_STATS="$TRASH_DIRECTORY/trace" \
+	git status --porcelain dtwo >../actual &&
+	! test -s ../trace &&
+	grep "?? dtwo/new" ../actual
+'
+
+test_expect_success 'core.untrackedCache=false removes the cache' '
+	git config core.untrackedCache false &&
+	git update-index --untracked-cache 2>../err &&
+	grep "core.untrackedCache is set to false" ../err &&
+	check_status &&
+	! test -s ../trace
+'
+
+test_expect_success 'core.untrackedCache=true adds the cache' '
+	git config core.untrackedCache true &&
+	check_status &&
+	test -s ../trace &&
+	git config --unset core.untrackedCache &&
+	git update-index --no-untracked-cache &&
+	check_status &&
+	! test -s ../trace
+'
+
+test_done
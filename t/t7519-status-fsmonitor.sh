@@ -0,0 +1,137 @@
+#!/bin/sh
+
+test_description='git status with a file system monitor'
+
+. ./test-lib.sh
+
+# The stand-in monitor reports whatever is listed in "changed", one
+# path per line, and fails if "hook-fails" exists.
+test_expect_success 'setup' '
+	cat >fsmonitor-hook <<-EOF &&
+	#!$SHELL_PATH
+	echo "\$*" >"$TRASH_DIRECTORY/hook-args"
+	test -f "$TRASH_DIRECTORY/hook-fails" && exit 1
+	test -f "$TRASH_DIRECTORY/changed" || exit 0
+	tr "\\\\n" "\\\\000" <"$TRASH_DIRECTORY/changed"
+	EOF
+	chmod +x fsmonitor-hook &&
+	git init repo &&
+	cd repo &&
+	mkdir dir1 dir2 &&
+	for f in one two dir1/one dir1/two dir2/one
+	do
+		echo $f >$f || return 1
+	done &&
+	git add . &&
+	git commit -q -m initial &&
+	git config core.fsmonitor "\"$TRASH_DIRECTORY/fsmonitor-hook\""
+'
+
+test_expect_success 'first status checks everything' '
+	echo changed >one &&
+	git status --porcelain >../actual &&
+	echo " M one" >../expect &&
+	test_cmp ../expect ../actual &&
+	test_path_is_missing ../hook-args
+'
+
+test_expect_success 'monitor is asked what changed since the last time' '
+	git status --porcelain >../actual &&
+	test_cmp ../expect ../actual &&
+	test "$(cut -d" " -f1 <../hook-args)" = 1 &&
+	test "$(cut -d" " -f2 <../hook-args)" -gt 0
+'
+
+test_expect_success 'changes the monitor does not report are not seen' '
+	echo changed >dir1/one &&
+	git status --porcelain >../actual &&
+	test_cmp ../expect ../actual
+'
+
+test_expect_success 'reported changes are seen' '
+	echo dir1/one >../changed &&
+	git status --porcelain >../actual &&
+	cat >../expect <<-\EOF &&
+	 M dir1/one
+	 M one
+	EOF
+	test_cmp ../expect ../actual
+'
+
+test_expect_success 'a reported directory covers everything below it' '
+	rm ../changed &&
+	echo changed >dir2/one &&
+	git status --porcelain >../actual &&
+	test_cmp ../expect ../actual &&
+	echo dir2 >../changed &&
+	git status --porcelain >../actual &&
+	cat >../expect <<-\EOF &&
+	 M dir1/one
+	 M dir2/one
+	 M one
+	EOF
+	test_cmp ../expect ../actual
+'
+
+test_expect_success 'everything is checked when the monitor fails' '
+	rm ../changed &&
+	echo changed >two &&
+	: >../hook-fails &&
+	git status --porcelain >../actual &&
+	cat >../expect <<-\EOF &&
+	 M dir1/one
+	 M dir2/one
+	 M one
+	 M two
+	EOF
+	test_cmp ../expect ../actual &&
+	rm ../hook-fails
+'
+
+test_expect_success 'with preloading' '
+	git reset -q --hard &&
+	git -c core.preloadindex=true status --porcelain >../actual &&
+	: >../expect &&
+	test_cmp ../expect ../actual &&
+	echo changed >dir1/two &&
+	git -c core.preloadindex=true status --porcelain >../actual &&
+	test_cmp ../expect ../actual &&
+	echo dir1/two >../changed &&
+	git -c core.preloadindex=true status --porcelain >../actual &&
+	echo " M dir1/two" >../expect &&
+	test_cmp ../expect ../actual &&
+	rm ../changed &&
+	git reset -q --hard
+'
+
+test_expect_success 'untracked cache only reads reported directories' '
+	git update-index --untracked-cache &&
+	# directories changed in the same second are not cached
+	test-chmtime =-60 . dir1 dir2 &&
+	git status --porcelain >../actual &&
+	: >../expect &&
+	test_cmp ../expect ../actual &&
+	: >dir1/new &&
+	git status --porcelain >../actual &&
+	test_cmp ../expect ../actual &&
+	echo dir1/new >../changed &&
+	git status --porcelain >../actual &&
+	echo "?? dir1/new" >../expect &&
+	test_cmp ../expect ../actual
+'
+
+test_expect_success 'unsetting core.fsmonitor checks everything again' '
+	rm ../changed &&
+	echo changed >dir2/one &&
+	git status --porcelain >../actual &&
+	test_cmp ../expect ../actual &&
+	git config --unset core.fsmonitor &&
+	git status --porcelain >../actual &&
+	cat >../expect <<-\EOF &&
+	 M dir2/one
+	?? dir1/new
+	EOF
+	test_cmp ../expect ../actual
+'
+
+test_done
@@ -0,0 +1,151 @@
+#!/bin/sh
+
+test_description='git repack --geometric works correctly'
+
+. ./test-lib.sh
+
+packdir=.git/objects/pack
+
+objects_in_packs () {
+	for idx in $packdir/*.idx
+	do
+		git show-index <$idx | cut -d" " -f2 || return 1
+	done | sort
+}
+
+test_expect_success '--geometric with no packs packs loose objects' '
+	git init loose &&
+	(
+		cd loose &&
+		test_commit loose &&
+		git repack --geometric=2 -d -q &&
+		ls .git/objects/pack/*.pack >packs &&
+		test_line_count = 1 packs &&
+		git count-objects >count &&
+		grep "^0 objects" count
+	)
+'
+
+test_expect_success 'setup a large pack' '
+	for i in 1 2 3 4 5 6 7 8 9 10
+	do
+		test_commit "large-$i" || return 1
+	done &&
+	git repack -d -q &&
+	ls $packdir/*.pack >large &&
+	test_line_count = 1 large
+'
+
+test_expect_success 'packs in a geometric progression are left alone' '
+	test_commit small-1 &&
+	git repack -d -q &&
+	ls $packdir/*.pack >before &&
+	git repack --geometric=2 -d -q &&
+	ls $packdir/*.pack >after &&
+	test_cmp before after
+'
+
+test_expect_success 'small packs are combined without touching the large one' '
+	test_commit small-2 &&
+	git repack -d -q &&
+	test_commit small-3 &&
+	git repack -d -q &&
+	objects_in_packs >expect &&
+	git repack --geometric=2 -d -q &&
+	ls $packdir/*.pack >packs &&
+	test_line_count = 2 packs &&
+	test -f $(cat large) &&
+	objects_in_packs >actual &&
+	test_cmp expect actual &&
+	git fsck
+'
+
+test_expect_success 'the combined pack absorbs packs it outgrows' '
+	for i in 1 2 3 4 5 6 7 8 9 10 11 12
+	do
+		test_commit "more-$i" || return 1
+	done &&
+	objects_in_packs >expect &&
+	git rev-list --objects --all | cut -c1-40 | sort >>expect &&
+	sort -u expect >expect.sorted &&
+	git repack --geometric=2 -d -q &&
+	ls $packdir/*.pack >packs &&
+	test_line_count = 1 packs &&
+	objects_in_packs >actual &&
+	test_cmp expect.sorted actual
+'
+
+test_expect_success '.keep packs are not combined' '
+	test_commit kept &&
+	git repack -d -q &&
+	ls -t $packdir/*.pack | head -n 1 >kept &&
+	touch $(sed "s/\.pack$/.keep/" kept) &&
+	test_commit after-kept &&
+	git repack --geometric=2 -d -q &&
+	test -f $(cat kept) &&
+	git fsck
+'
+
+test_expect_success 'pack-objects --stdin-packs leaves out excluded packs' '
+	git init stdin-packs &&
+	(
+		cd stdin-packs &&
+		test_commit A &&
+		git repack -d -q &&
+		A=$(basename $(ls .git/objects/pack/*.pack)) &&
+		test_commit B &&
+		git repack -d -q &&
+		B=$(basename $(ls .git/objects/pack/*.pack | grep -v $A)) &&
+		test_commit C &&
+		{
+			echo $B &&
+			echo "^$A"
+		} >in &&
+		pack=$(git pack-objects --stdin-packs --unpacked out <in) &&
+		git show-index <out-$pack.idx | cut -d" " -f2 | sort >actual &&
+		git rev-list --objects A..C | cut -c1-40 | sort >expect &&
+		test_cmp expect actual
+	)
+'
+
+test_expect_success 'pack-objects --stdin-packs names objects for deltas' '
+	git init stdin-names &&
+	(
+		cd stdin-names &&
+		for i in 1 2 3 4 5 6 7 8 9 10
+		do
+			test-genrandom file-$i 2000 >file-$i || return 1
+		done &&
+		git add . &&
+		test_tick &&
+		git commit -m base &&
+		git repack -d -q &&
+		for j in 1 2 3
+		do
+			for i in 1 2 3 4 5 6 7 8 9 10
+			do
+				echo "change $j" >>file-$i || return 1
+			done &&
+			test_tick &&
+			git commit -a -m "change $j" &&
+			git repack -d -q || return 1
+		done &&
+		ls .git/objects/pack/*.pack | sed "s,.*/,," >in &&
+		test_line_count = 4 in &&
+		pack=$(git pack-objects --stdin-packs --window=3 out <in) &&
+		git verify-pack -v out-$pack.idx |
+		grep -c "^[0-9a-f]\{40\} blob .* [0-9a-f]\{40\}\$" >count &&
+		test $(cat count) = 30
+	)
+'
+
+test_expect_success 'pack-objects --stdin-packs only takes --unpacked' '
+	(
+		cd stdin-packs &&
+		test_must_fail git pack-objects --stdin-packs --revs out <in &&
+		test_must_fail git pack-objects --stdin-packs --all out <in &&
+		test_must_fail git pack-objects --stdin-packs --thin --stdout <in
+	)
+'
+
+test_done
@@ -825,4 +825,99 @@ test_expect_success 'mimic ack-grep --group' '
 	test_cmp expected actual
 '
 
+cat >expected <<EOF
+file:foo mmap bar
+file:foo_mmap bar
+file:foo_mmap bar mmap
+file:foo mmap bar_mmap
+file:foo_mmap bar mmap baz
+EOF
+
+test_expect_success 'grep with a quantified character' '
+	git grep -e "fooo*[ _]m" file >actual &&
+	test_cmp expected actual &&
+	git grep -E -e "fo(o|x)[ _]mx?map" file >actual &&
+	test_cmp expected actual &&
+	git grep -e "foo[ _]mma\{1,2\}p" file >actual &&
+	test_cmp expected actual
+'
+
+test_expect_success 'grep with alternation outside a group' '
+	git grep -E -e "nothing|mmap" file >actual &&
+	test_cmp expected actual &&
+	git grep -e "nothing\|mmap" file >actual &&
+	test_cmp expected actual
+'
+
+cat >expected <<EOF
+hello_world:Hello world
+hello_world:HeLLo world
+EOF
+
+test_expect_success 'grep -i with a regexp' '
+	git grep -i -e "hello w.r" hello_world >actual &&
+	test_cmp expected actual
+'
+
+cat >expected <<EOF
+ab:a+b*c
+EOF
+
+test_expect_success 'grep with escaped special characters' '
+	git grep -e "a+b\*c" ab >actual &&
+	test_cmp expected actual &&
+	git grep -E -e "a\+b\*c" ab >actual &&
+	test_cmp expected actual
+'
+
+test_expect_success 'grep --threads produces the output of a single thread' '
+	git grep -n -C1 -e o HEAD >expected &&
+	git grep --threads=1 -n -C1 -e o HEAD >actual &&
+	test_cmp expected actual &&
+	git grep --threads=5 -n -C1 -e o HEAD >actual &&
+	test_cmp expected actual &&
+	git -c grep.threads=3 grep -n -C1 -e o HEAD >actual &&
+	test_cmp expected actual
+'
+
+test_expect_success 'setup history of packed deltas' '
+	git init packed &&
+	(
+		cd packed &&
+		for i in 0 1 2 3 4 5 6 7 8 9 10 11 12 13 14 15 16 17 18 19
+		do
+			for j in 0 1 2 3 4 5 6 7 8 9
+			do
+				echo "revision $i line $j with some words in it"
+			done >>file &&
+			git add file &&
+			test_tick &&
+			git commit -q -m $i || return 1
+		done &&
+		git rev-list --reverse HEAD >revs
+	)
+'
+
+for ofs in true false
+do
+	test_expect_success "grep --threads reads deltas (deltaBaseOffset=$ofs)" '
+		(
+			cd packed &&
+			git -c repack.useDeltaBaseOffset=$ofs \
+				repack -a -d -f -q --depth=5 --window=20 &&
+			test_path_is_missing .git/objects/$(git rev-parse HEAD:file | sed "s|..|&/|") &&
+			git grep --threads=1 -n -e "line [37]" $(cat revs) >expected &&
+			git grep --threads=4 -n -e "line [37]" $(cat revs) >actual &&
+			test_cmp expected actual &&
+			git grep --threads=4 -c -e words $(cat revs) >actual &&
+			test $(wc -l <actual) = 20
+		)
+	'
+done
+
+test_expect_success 'grep rejects a negative number of threads' '
+	test_must_fail git grep --threads=-1 -e o HEAD &&
+	test_must_fail git -c grep.threads=-2 grep -e o HEAD
+'
+
 test_done
@@ -0,0 +1,100 @@
+#!/bin/sh
+
+test_description='git grep with a trigram index'
+. ./test-lib.sh
+
+gidx=.git/objects/info/grep-index
+
+# run grep with and without the grep index and compare the output
+gidx_cmp () {
+	test_might_fail git -c grep.useindex=false grep "$@" >expect &&
+	test_might_fail git grep "$@" >actual &&
+	test_cmp expect actual
+}
+
+test_expect_success 'setup' '
+	printf "%s\n" "int main(void)" "{" "	return Hello(42);" "}" >main.c &&
+	printf "%s\n" "static int hello(int x)" "{" "	return x;" "}" >hello.c &&
+	printf "%s\n" "nothing to see here" >README &&
+	git add . &&
+	test_tick &&
+	git commit -m initial &&
+	git repack -a -d -q
+'
+
+test_expect_success 'write the grep index' '
+	git grep-index write &&
+	test -f $gidx
+'
+
+for pattern in "-e return" "-e Hello" "-i -e hello" "-F -e return" "-F -i -e HELLO" \
+	"-e ret.*x" "-e nowhere" "-w -e int" "-e see --or -e main" \
+	"-e int --and -e hello" "-e int --and --not -e hello" \
+	"-v -e return" "-L -e hello" "-c -e x"
+do
+	test_expect_success "grep $pattern matches" "
+		gidx_cmp $pattern HEAD &&
+		gidx_cmp --cached $pattern
+	"
+done
+
+test_expect_success 'blobs missing from the index are searched' '
+	echo "return of the index" >new.c &&
+	git add new.c &&
+	test_tick &&
+	git commit -m new &&
+	gidx_cmp -e "of the" HEAD &&
+	gidx_cmp -e return HEAD
+'
+
+test_expect_success 'repack adds new blobs to the index' '
+	cp $gidx old-index &&
+	git repack -d -q &&
+	! cmp old-index $gidx &&
+	gidx_cmp -e "of the" HEAD &&
+	gidx_cmp -e return HEAD~1
+'
+
+test_expect_success 'an incremental and a full index agree' '
+	git grep -e "of the" HEAD >expect &&
+	git grep-index write --full &&
+	git grep -e "of the" HEAD >actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'blobs the index rules out are not read' '
+	git init skip &&
+	(
+		cd skip &&
+		echo "return 0;" >match.c &&
+		echo "zzzz" >other &&
+		git add . &&
+		test_tick &&
+		git commit -m skip &&
+		git repack -a -d -q &&
+		git grep-index write &&
+		blob=$(git rev-parse HEAD:other) &&
+		pack=$(ls .git/objects/pack/pack-*.pack) &&
+		offset=$(git verify-pack -v ${pack%.pack}.idx |
+			 sed -n "s/^$blob blob *[0-9]* [0-9]* \([0-9]*\)$/\1/p") &&
+		test -n "$offset" &&
+		chmod u+w $pack &&
+		printf "\377\377" |
+		dd of=$pack bs=1 seek=$(($offset + 1)) conv=notrunc 2>/dev/null &&
+		test_must_fail git cat-file blob $blob &&
+		test_must_fail git -c grep.useindex=false grep -e return HEAD &&
+		git grep -e return HEAD >actual 2>err &&
+		echo "HEAD:match.c:return 0;" >expect &&
+		test_cmp expect actual &&
+		test ! -s err
+	)
+'
+
+test_expect_success 'a corrupt index is ignored' '
+	printf "GIDX" >$gidx &&
+	git grep -e return HEAD >actual 2>err &&
+	test_line_count = 3 actual &&
+	grep "grep index" err
+'
+
+test_done
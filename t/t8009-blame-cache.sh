@@ -0,0 +1,109 @@
+#!/bin/sh
+
+test_description='git blame with the blame cache'
+. ./test-lib.sh
+
+# run blame with and without the cache and compare the output
+cache_cmp () {
+	git blame "$@" >expect &&
+	git -c blame.cache=true blame "$@" >actual &&
+	test_cmp expect actual
+}
+
+# the commit and original line of each final line of incremental output
+incremental_lines () {
+	awk 'NF == 4 && length($1) == 40 && $4 ~ /^[0-9]+$/ {
+		for (i = 0; i < $4; i++)
+			print $3 + i, $1, $2 + i
+	}' | sort -n
+}
+
+test_expect_success 'setup' '
+	for i in 1 2 3 4 5 6 7 8 9 10
+	do
+		echo "line $i"
+	done >file &&
+	git add file &&
+	test_tick &&
+	git commit -m initial &&
+	for i in 2 5 8
+	do
+		sed -e "s/^line $i\$/change $i/" file >file.new &&
+		mv file.new file &&
+		test_tick &&
+		git commit -a -m "change $i" || return 1
+	done &&
+	git mv file renamed &&
+	test_tick &&
+	git commit -m rename &&
+	git checkout -b side HEAD~2 &&
+	echo "side line" >>file &&
+	test_tick &&
+	git commit -a -m side &&
+	git checkout master &&
+	test_tick &&
+	git merge -m merge side &&
+	sed -e "s/^line 1\$/   line 1/" renamed >renamed.new &&
+	mv renamed.new renamed &&
+	test_tick &&
+	git commit -a -m whitespace &&
+	echo last >>renamed &&
+	test_tick &&
+	git commit -a -m last
+'
+
+test_expect_success 'blame writes the cache' '
+	git -c blame.cache=true blame HEAD~3 -- renamed >/dev/null &&
+	git rev-parse --verify refs/notes/blame-cache
+'
+
+for args in "" "-p" "--line-porcelain" "-n -f" "--root" "-w" "-L 3,7"
+do
+	test_expect_success "blame $args matches with the cache" "
+		cache_cmp $args HEAD -- renamed
+	"
+done
+
+test_expect_success 'incremental blame matches with the cache' '
+	git blame --incremental HEAD -- renamed |
+	incremental_lines >expect &&
+	git -c blame.cache=true blame --incremental HEAD -- renamed |
+	incremental_lines >actual &&
+	test_line_count = 12 actual &&
+	test_cmp expect actual
+'
+
+test_expect_success 'blaming a cached commit looks at no history' '
+	git -c blame.cache=true blame HEAD -- renamed >/dev/null &&
+	git -c blame.cache=true blame --show-stats HEAD -- renamed >stats &&
+	grep "^num commits: 0\$" stats
+'
+
+test_expect_success 'blaming the work tree uses the cache' '
+	echo uncommitted >>renamed &&
+	cache_cmp renamed &&
+	git checkout renamed
+'
+
+test_expect_success 'the cache is not used with a range' '
+	cache_cmp HEAD~2..HEAD -- renamed &&
+	cache_cmp -M HEAD -- renamed
+'
+
+test_expect_success 'a corrupt cache entry is ignored' '
+	git notes --ref=blame-cache list |
+	while read note object
+	do
+		printf "0 1 0 garbage" >garbage &&
+		git notes --ref=blame-cache add -f -F garbage $object ||
+		return 1
+	done &&
+	tree=$(git rev-parse refs/notes/blame-cache^{tree}) &&
+	commit=$(echo "blame cache v1" | git commit-tree $tree) &&
+	git update-ref refs/notes/blame-cache $commit &&
+	git -c blame.cache=true blame --show-stats HEAD -- renamed >stats &&
+	! grep "^num commits: 0\$" stats &&
+	cache_cmp HEAD -- renamed
+'
+
+test_done
@@ -44,6 +44,21 @@ static int debug_fd;
 static int advertise_refs;
 static int stateless_rpc;
 
+/*
+ * The pack cache keeps the packs we sent, named after the state of our
+ * refs and what the client asked for, so that the next client asking
+ * for the same thing gets the same bytes without running pack-objects.
+ */
+static const char *pack_cache_dir;
+static unsigned long pack_cache_limit = 256 * 1024 * 1024;
+static git_SHA_CTX refs_ctx;
+static struct strbuf shallow_request = STRBUF_INIT;
+static char pack_cache_repo[41];
+static char pack_cache_refs[41];
+static char pack_cache_name[PATH_MAX];
+static char pack_cache_tmp[PATH_MAX];
+static int pack_cache_fd = -1;
+
 static void reset_timeout(void)
 {
 	alarm(timeout);
@@ -71,6 +86,207 @@ static ssize_t send_client_data(int fd, const char *data, ssize_t sz)
 	return safe_write(fd, data, sz);
 }
 
+static int sha1_hex_cmp(const void *a, const void *b)
+{
+	return strcmp(*(const char **)a, *(const char **)b);
+}
+
+static void pack_cache_add_objects(git_SHA_CTX *ctx, const char *what,
+				   struct object_array *objs)
+{
+	const char **hex = xmalloc(objs->nr * sizeof(*hex));
+	int i;
+
+	for (i = 0; i < objs->nr; i++)
+		hex[i] = xstrdup(sha1_to_hex(objs->objects[i].item->sha1));
+	qsort(hex, objs->nr, sizeof(*hex), sha1_hex_cmp);
+	for (i = 0; i < objs->nr; i++) {
+		git_SHA1_Update(ctx, what, strlen(what));
+		git_SHA1_Update(ctx, hex[i], 41);
+		free((char *)hex[i]);
+	}
+	free(hex);
+}
+
+/*
+ * Work out the name of the cached pack for this request, and open it
+ * if we have it.  Returns the file descriptor, or -1 if there is no
+ * such entry (or another upload-pack pruned it just now).  The name
+ * starts with a hash of the path of our repository, as several may
+ * share one cache directory, then a hash of our refs, so that the
+ * entries made before the refs moved can be told apart and dropped.
+ */
+static int find_cached_pack(int create_full_pack)
+{
+	const char *repo = real_path(get_git_dir());
+	git_SHA_CTX ctx;
+	unsigned char sha1[20];
+	char flags[64];
+
+	git_SHA1_Init(&ctx);
+	git_SHA1_Update(&ctx, repo, strlen(repo));
+	git_SHA1_Final(sha1, &ctx);
+	memcpy(pack_cache_repo, sha1_to_hex(sha1), 41);
+
+	git_SHA1_Final(sha1, &refs_ctx);
+	memcpy(pack_cache_refs, sha1_to_hex(sha1), 41);
+
+	git_SHA1_Init(&ctx);
+	git_SHA1_Update(&ctx, pack_cache_repo, 41);
+	snprintf(flags, sizeof(flags), "full %d thin %d ofs %d tag %d\n",
+		 create_full_pack, use_thin_pack, use_ofs_delta,
+		 use_include_tag);
+	git_SHA1_Update(&ctx, flags, strlen(flags));
+	pack_cache_add_objects(&ctx, "want ", &want_obj);
+	pack_cache_add_objects(&ctx, "have ", &have_obj);
+	git_SHA1_Update(&ctx, shallow_request.buf, shallow_request.len);
+	git_SHA1_Final(sha1, &ctx);
+
+	snprintf(pack_cache_name, sizeof(pack_cache_name), "%s/%s-%s-%s.pack",
+		 pack_cache_dir, pack_cache_repo, pack_cache_refs,
+		 sha1_to_hex(sha1));
+	return open(pack_cache_name, O_RDONLY);
+}
+
+static void send_cached_pack(int fd)
+{
+	static const char msg[] = "Sending a cached pack.\n";
+	char data[LARGE_PACKET_MAX - 5]; /* a full side-band-64k packet */
+	ssize_t sz;
+
+	if (!no_progress)
+		send_client_data(2, msg, strlen(msg));
+	while ((sz = xread(fd, data, sizeof(data))) > 0) {
+		reset_timeout();
+		if (send_client_data(1, data, sz) < 0)
+			die("git upload-pack: unable to send the cached pack");
+	}
+	if (sz < 0)
+		die_errno("git upload-pack: unable to read '%s'", pack_cache_name);
+	close(fd);
+	/* the mtime tells which entries were used last */
+	utime(pack_cache_name, NULL);
+	if (use_sideband)
+		packet_flush(1);
+}
+
+static void start_cached_pack(void)
+{
+	if (mkdir(pack_cache_dir, 0777) && errno != EEXIST)
+		return;
+	snprintf(pack_cache_tmp, sizeof(pack_cache_tmp),
+		 "%s/tmp_pack_XXXXXX", pack_cache_dir);
+	pack_cache_fd = git_mkstemp_mode(pack_cache_tmp, 0444);
+}
+
+static void write_cached_pack(const char *data, ssize_t sz)
+{
+	if (pack_cache_fd < 0)
+		return;
+	if (write_in_full(pack_cache_fd, data, sz) < 0) {
+		close(pack_cache_fd);
+		unlink(pack_cache_tmp);
+		pack_cache_fd = -1;
+	}
+}
+
+static void abort_cached_pack(void)
+{
+	if (pack_cache_fd < 0)
+		return;
+	close(pack_cache_fd);
+	unlink(pack_cache_tmp);
+	pack_cache_fd = -1;
+}
+
+struct cached_pack {
+	char *path;
+	off_t size;
+	time_t mtime;
+};
+
+static int cached_pack_cmp(const void *a_, const void *b_)
+{
+	const struct cached_pack *a = a_, *b = b_;
+
+	if (a->mtime != b->mtime)
+		return a->mtime < b->mtime ? -1 : 1;
+	return strcmp(a->path, b->path);
+}
+
+/*
+ * Drop the packs made for refs of ours we no longer have, then the
+ * least recently used ones until the cache fits in its limit.  The
+ * packs of other repositories sharing the directory only go by the
+ * limit; we cannot tell whether their refs have moved.
+ */
+static int stale_cached_pack(const char *name)
+{
+	return !prefixcmp(name, pack_cache_repo) &&
+		name[40] == '-' &&
+		prefixcmp(name + 41, pack_cache_refs);
+}
+
+static void prune_pack_cache(void)
+{
+	struct cached_pack *packs = NULL;
+	int nr = 0, alloc = 0, i;
+	unsigned long total = 0;
+	struct dirent *de;
+	DIR *dir;
+
+	dir = opendir(pack_cache_dir);
+	if (!dir)
+		return;
+	while ((de = readdir(dir)) != NULL) {
+		struct strbuf path = STRBUF_INIT;
+		struct stat st;
+
+		if (!prefixcmp(de->d_name, "tmp_pack_")) {
+			/* left behind by an upload-pack that was killed */
+			strbuf_addf(&path, "%s/%s", pack_cache_dir, de->d_name);
+			if (!lstat(path.buf, &st) &&
+			    st.st_mtime + 24 * 3600 < time(NULL))
+				unlink(path.buf);
+			strbuf_release(&path);
+			continue;
+		}
+		if (!has_extension(de->d_name, ".pack"))
+			continue;
+		strbuf_addf(&path, "%s/%s", pack_cache_dir, de->d_name);
+		if (stale_cached_pack(de->d_name) || lstat(path.buf, &st)) {
+			unlink(path.buf);
+			strbuf_release(&path);
+			continue;
+		}
+		ALLOC_GROW(packs, nr + 1, alloc);
+		packs[nr].path = strbuf_detach(&path, NULL);
+		packs[nr].size = st.st_size;
+		packs[nr].mtime = st.st_mtime;
+		total += st.st_size;
+		nr++;
+	}
+	closedir(dir);
+
+	qsort(packs, nr, sizeof(*packs), cached_pack_cmp);
+	for (i = 0; i < nr; i++) {
+		if (total > pack_cache_limit && !unlink(packs[i].path))
+			total -= packs[i].size;
+		free(packs[i].path);
+	}
+	free(packs);
+}
+
+static void finish_cached_pack(void)
+{
+	if (pack_cache_fd < 0)
+		return;
+	if (close(pack_cache_fd) || rename(pack_cache_tmp, pack_cache_name))
+		unlink(pack_cache_tmp);
+	pack_cache_fd = -1;
+	prune_pack_cache();
+}
+
 static FILE *pack_pipe = NULL;
 static void show_commit(struct commit *commit, void *data)
 {
@@ -150,7 +366,8 @@ static void create_pack_file(void)
 	struct async rev_list;
 	struct child_process pack_objects;
 	int create_full_pack = (nr_our_refs == want_obj.nr && !have_obj.nr);
-	char data[8193], progress[128];
+	/* a full side-band-64k packet, and the byte we hold back */
+	char data[LARGE_PACKET_MAX - 4], progress[128];
 	char abort_msg[] = "aborting due to possible repository "
 		"corruption on the remote side.";
 	int buffered = -1;
@@ -158,6 +375,15 @@ static void create_pack_file(void)
 	const char *argv[10];
 	int arg = 0;
 
+	if (pack_cache_dir) {
+		int fd = find_cached_pack(create_full_pack);
+		if (fd >= 0) {
+			send_cached_pack(fd);
+			return;
+		}
+		start_cached_pack();
+	}
+
 	argv[arg++] = "pack-objects";
 	if (!shallow_nr) {
 		argv[arg++] = "--revs";
@@ -300,6 +526,7 @@ static void create_pack_file(void)
 			sz = send_client_data(1, data, sz);
 			if (sz < 0)
 				goto fail;
+			write_cached_pack(data, sz);
 		}
 	}
 
@@ -316,13 +543,16 @@ static void create_pack_file(void)
 		sz = send_client_data(1, data, 1);
 		if (sz < 0)
 			goto fail;
+		write_cached_pack(data, 1);
 		fprintf(stderr, "flushed.\n");
 	}
+	finish_cached_pack();
 	if (use_sideband)
 		packet_flush(1);
 	return;
 
  fail:
+	abort_cached_pack();
 	send_client_data(3, abort_msg, sizeof(abort_msg));
 	die("git upload-pack: %s", abort_msg);
 }
@@ -614,6 +844,7 @@ static void receive_needs(void)
 				die("did not find object for %s", line);
 			object->flags |= CLIENT_SHALLOW;
 			add_object_array(object, NULL, &shallows);
+			strbuf_addf(&shallow_request, "%s\n", line);
 			continue;
 		}
 		if (!prefixcmp(line, "deepen ")) {
@@ -621,6 +852,7 @@ static void receive_needs(void)
 			depth = strtol(line + 7, &end, 0);
 			if (end == line + 7 || depth <= 0)
 				die("Invalid deepen: %s", line);
+			strbuf_addf(&shallow_request, "%s\n", line);
 			continue;
 		}
 		if (prefixcmp(line, "want ") ||
@@ -737,6 +969,8 @@ static int send_ref(const char *refname, const unsigned char *sha1, int flag, vo
 	if (!o)
 		die("git upload-pack: cannot find object %s:", sha1_to_hex(sha1));
 
+	git_SHA1_Update(&refs_ctx, refname, strlen(refname) + 1);
+	git_SHA1_Update(&refs_ctx, sha1, 20);
 	if (capabilities)
 		packet_write(1, "%s %s%c%s%s\n", sha1_to_hex(sha1), refname_nons,
 			     0, capabilities,
@@ -761,6 +995,8 @@ static int mark_our_ref(const char *refname, const unsigned char *sha1, int flag
 	struct object *o = parse_object(sha1);
 	if (!o)
 		die("git upload-pack: cannot find object %s:", sha1_to_hex(sha1));
+	git_SHA1_Update(&refs_ctx, refname, strlen(refname) + 1);
+	git_SHA1_Update(&refs_ctx, sha1, 20);
 	if (!(o->flags & OUR_REF)) {
 		o->flags |= OUR_REF;
 		nr_our_refs++;
@@ -768,8 +1004,20 @@ static int mark_our_ref(const char *refname, const unsigned char *sha1, int flag
 	return 0;
 }
 
+static int upload_pack_config(const char *var, const char *value, void *cb)
+{
+	if (!strcmp(var, "uploadpack.packcache"))
+		return git_config_pathname(&pack_cache_dir, var, value);
+	if (!strcmp(var, "uploadpack.packcachelimit")) {
+		pack_cache_limit = git_config_ulong(var, value);
+		return 0;
+	}
+	return git_default_config(var, value, cb);
+}
+
 static void upload_pack(void)
 {
+	git_SHA1_Init(&refs_ctx);
 	if (advertise_refs || !stateless_rpc) {
 		reset_timeout();
 		head_ref_namespaced(send_ref, NULL);
@@ -840,6 +1088,7 @@ int main(int argc, char **argv)
 		die("attempt to fetch/clone from a shallow repository");
 	if (getenv("GIT_DEBUG_SEND_PACK"))
 		debug_fd = atoi(getenv("GIT_DEBUG_SEND_PACK"));
+	git_config(upload_pack_config, NULL);
 	upload_pack();
 	return 0;
 }
@@ -0,0 +1,27 @@
+#ifndef VARINT_H
+#define VARINT_H
+
+#include "git-compat-util.h"
+
+/*
+ * Variable-length integers, seven bits per byte with the high bit set
+ * on every byte but the last, most significant group first.  As with
+ * the offsets of OFS_DELTA objects in a pack, one is added to the
+ * value at each continuation so that every number has exactly one
+ * encoding.
+ */
+
+/*
+ * Store "value" in "buf", which must have room for 16 bytes, and
+ * return the number of bytes used.  "buf" may be NULL to only
+ * compute the length.
+ */
+extern int encode_varint(uintmax_t value, unsigned char *buf);
+
+/*
+ * Read a number starting at "*bufp" and advance "*bufp" past it.
+ * Returns 0 and leaves "*bufp" alone if the number does not fit.
+ */
+extern uintmax_t decode_varint(const unsigned char **bufp);
+
+#endif /* VARINT_H */
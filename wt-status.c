@@ -469,6 +469,8 @@ static void wt_status_collect_untracked(struct wt_status *s)
 		dir.flags |=
 			DIR_SHOW_OTHER_DIRECTORIES | DIR_HIDE_EMPTY_DIRECTORIES;
 	setup_standard_excludes(&dir);
+	tweak_untracked_cache(&the_index);
+	dir.untracked = the_index.untracked;
 
 	fill_directory(&dir, s->pathspec);
 	for (i = 0; i < dir.nr; i++) {